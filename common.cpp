@@ -1,8 +1,798 @@
 #include "common.hpp"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
 #include <functional>
+#include <sstream>
+#include <climits>
+#include <cmath>
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <malloc.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Linux 5.1以降 (古いglibcのヘッダーには定義がない)
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE 0x0010
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 namespace {
   std::function<VOID(INT32)> sigintHandler;
+
+  // アロケーション統計
+  struct AllocationStats {
+    // 置き換え前のメモリアロケーター
+    memAlloc previousMemAlloc;
+    memAlignAlloc previousMemAlignAlloc;
+    memCalloc previousMemCalloc;
+    memRealloc previousMemRealloc;
+    memFree previousMemFree;
+
+    // 開始フラグ
+    BOOL isEnabled;
+
+    // サブシステムごとの集計
+    AllocationCounter tags[ALLOCATION_TAG_COUNT];
+
+    // セッションごとの集計
+    AllocationSessionSlot sessions[ALLOCATION_SESSION_SLOTS + 1];
+
+    // 解放済みのセッションに割り当てられたまま使用中のバイト数
+    volatile SIZE_T closedSessionBytes;
+
+    // 全体の使用中のバイト数と前回の出力以降の最大値
+    volatile SIZE_T inUseBytes;
+    volatile SIZE_T peakInUseBytes;
+
+    // 前回出力した時刻
+    UINT64 lastReportTime;
+  };
+
+  AllocationStats allocationStats;
+
+  // 呼び出し元のスレッドのアロケーションの割り当て
+  thread_local AllocationTag currentAllocationTag = ALLOCATION_TAG_OTHER;
+  thread_local UINT32 currentAllocationSessionSlot = 0;
+
+  /**
+   * @brief セッションのスロットをロックする (保持するのは数命令のため待機は譲るのみ)
+   */
+  VOID lockAllocationSessionSlot(AllocationSessionSlot& sessionSlot)
+  {
+    while (ATOMIC_EXCHANGE_BOOL(&sessionSlot.isLocked, TRUE)) {
+      sched_yield();
+    }
+  }
+
+  /**
+   * @brief セッションのスロットのロックを解除する
+   */
+  VOID unlockAllocationSessionSlot(AllocationSessionSlot& sessionSlot)
+  {
+    ATOMIC_STORE_BOOL(&sessionSlot.isLocked, FALSE);
+  }
+
+  /**
+   * @brief アロケーションを集計する
+   */
+  VOID trackAllocation(AllocationHeader* pHeader, SIZE_T size)
+  {
+    auto sessionSlot = currentAllocationSessionSlot;
+    SIZE_T inUseBytes, peakInUseBytes;
+
+    // ヘッダー
+    pHeader->size = size;
+    pHeader->tag = currentAllocationTag;
+    pHeader->sessionSlot = static_cast<UINT16>(sessionSlot);
+    pHeader->generation = 0;
+
+    // サブシステムとセッション (世代の取得と加算はスロットの解放と不可分にする)
+    ATOMIC_ADD(&allocationStats.tags[pHeader->tag].inUseBytes, size);
+    ATOMIC_ADD(&allocationStats.tags[pHeader->tag].allocatedBytes, size);
+    ATOMIC_INCREMENT(&allocationStats.tags[pHeader->tag].allocationCount);
+    if (sessionSlot != 0) {
+      auto& slot = allocationStats.sessions[sessionSlot];
+      lockAllocationSessionSlot(slot);
+      pHeader->generation = static_cast<UINT32>(slot.generation);
+      slot.inUseBytes += size;
+      unlockAllocationSessionSlot(slot);
+    }
+
+    // 全体と最大値
+    inUseBytes = ATOMIC_ADD(&allocationStats.inUseBytes, size) + size;
+    peakInUseBytes = ATOMIC_LOAD(&allocationStats.peakInUseBytes);
+    while (inUseBytes > peakInUseBytes && !ATOMIC_COMPARE_EXCHANGE(&allocationStats.peakInUseBytes, &peakInUseBytes, inUseBytes)) {
+    }
+  }
+
+  /**
+   * @brief アロケーションの解放を集計する
+   */
+  VOID untrackAllocation(const AllocationHeader& header)
+  {
+    auto& sessionSlot = allocationStats.sessions[header.sessionSlot];
+
+    ATOMIC_SUBTRACT(&allocationStats.tags[header.tag].inUseBytes, header.size);
+    if (header.sessionSlot != 0) {
+      // 確保したセッションが解放済みの場合は解放済みのセッションとして集計
+      // (解放済みの場合はスロットの解放時に加算済みのため、ロック中に判定すれば負にならない)
+      lockAllocationSessionSlot(sessionSlot);
+      if (static_cast<UINT32>(sessionSlot.generation) == header.generation) {
+        sessionSlot.inUseBytes -= header.size;
+      } else {
+        ATOMIC_SUBTRACT(&allocationStats.closedSessionBytes, header.size);
+      }
+      unlockAllocationSessionSlot(sessionSlot);
+    }
+    ATOMIC_SUBTRACT(&allocationStats.inUseBytes, header.size);
+  }
+
+  // 非同期ロガーのスレッドごとのリングバッファ (書き込みは所有するスレッド、読み出しはロガースレッドのみ)
+  struct AsyncLogRing {
+    // データ (ringSizeバイト)
+    std::vector<BYTE> buffer;
+
+    // 書き込み位置と読み出し位置 (単調増加し、バッファサイズで折り返して使用する)
+    volatile SIZE_T head;
+    volatile SIZE_T tail;
+
+    // 所有するスレッドが終了したか
+    volatile ATOMIC_BOOL isAbandoned;
+
+    // 書き込んだログ、容量不足で破棄したログ、レート制限で抑制したログの数
+    volatile SIZE_T capturedCount;
+    volatile SIZE_T droppedCount;
+    volatile SIZE_T suppressedCount;
+
+    // 破棄を警告済みの数 (ロガースレッドのみ使用)
+    SIZE_T reportedDroppedCount;
+
+    // 所有するスレッドのID
+    INT32 tid;
+  };
+
+  // リングバッファに書き込むログのヘッダー (タグ、フォーマット文字列、引数が続く)
+  struct AsyncLogRecordHeader {
+    UINT32 size;
+    UINT32 level;
+    UINT64 time;
+    UINT32 tagLen;
+    UINT32 fmtLen;
+  };
+
+  // 呼び出し箇所 (フォーマット文字列) ごとの出力回数
+  struct AsyncLogRate {
+    UINT64 windowStart;
+    UINT32 count;
+    UINT32 suppressed;
+  };
+
+  // スレッドごとの状態 (スレッドの終了時にリングバッファを破棄可能にする)
+  struct AsyncLogThread {
+    std::shared_ptr<AsyncLogRing> pRing;
+    std::unordered_map<const CHAR*, AsyncLogRate> rates;
+    std::vector<BYTE> record;
+
+    ~AsyncLogThread()
+    {
+      if (pRing) {
+        ATOMIC_STORE_BOOL(&pRing->isAbandoned, TRUE);
+      }
+    }
+  };
+
+  // 非同期ロガー
+  struct AsyncLogger {
+    // 開始フラグ
+    BOOL isEnabled;
+
+    // 置き換え前のログ出力関数
+    logPrintFunc previousLogPrint;
+
+    // 呼び出し箇所ごとに1秒間に出力するログの上限
+    UINT32 rateLimit;
+
+    // スレッドごとのリングバッファのサイズ (バイト、2のべき乗)
+    SIZE_T ringSize;
+
+    // リングバッファの一覧 (lockで保護する)
+    MUTEX lock;
+    std::vector<std::shared_ptr<AsyncLogRing>> rings;
+
+    // ロガースレッドを起床する条件変数と未出力のログがあるか (lockと組み合わせて使用する)
+    CVAR cvar;
+    volatile ATOMIC_BOOL hasPendingLogs;
+
+    // 終了処理中フラグと書き込み中のスレッド数 (終了処理は書き込み中のスレッドがなくなってからロックを解放する)
+    volatile ATOMIC_BOOL isStopping;
+    volatile SIZE_T activeWriters;
+
+    // 破棄したリングバッファのカウンタの合計 (lockで保護する)
+    SIZE_T retiredCapturedCount;
+    SIZE_T retiredDroppedCount;
+    SIZE_T retiredSuppressedCount;
+
+    // 前回のメトリクス出力時のカウンタの合計
+    SIZE_T lastCapturedCount;
+    SIZE_T lastDroppedCount;
+    SIZE_T lastSuppressedCount;
+
+    // ロガースレッド
+    TID threadId;
+    volatile ATOMIC_BOOL isTerminated;
+  };
+
+  AsyncLogger asyncLogger;
+  thread_local AsyncLogThread asyncLogThread;
+
+  // ログレベルの表示名 (LOG_LEVEL_*の順)
+  const CHAR* const logLevelNames[] = {
+    "", "VERBOSE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL", "SILENT", "PROFILE",
+  };
+
+  // フォーマット文字列の変換指定
+  struct LogFormatSpec {
+    // 先頭の'%'と変換指定子の次の位置
+    const CHAR* pBegin;
+    const CHAR* pEnd;
+
+    // 変換指定子 ('\0'の場合は解釈できない)
+    CHAR conversion;
+
+    // 長さ修飾子 ('H'はhh、'q'はll、'\0'はなし)
+    CHAR lengthModifier;
+
+    // '*'で指定した幅と精度の数、精度 (指定しない場合は-1、'*'の場合は-2)
+    UINT32 starCount;
+    INT32 precision;
+  };
+
+  /**
+   * @brief 次の変換指定を取得する
+   */
+  BOOL nextLogFormatSpec(const CHAR*& pCursor, LogFormatSpec& spec)
+  {
+    auto p = strchr(pCursor, '%');
+
+    if (!p) {
+      return FALSE;
+    }
+
+    spec.pBegin = p++;
+    spec.lengthModifier = '\0';
+    spec.starCount = 0;
+    spec.precision = -1;
+
+    // フラグと幅
+    while (*p != '\0' && strchr("-+ #0'", *p)) {
+      p++;
+    }
+    if (*p == '*') {
+      spec.starCount++;
+      p++;
+    }
+    while (isdigit(*p)) {
+      p++;
+    }
+
+    // 精度
+    if (*p == '.') {
+      p++;
+      if (*p == '*') {
+        spec.starCount++;
+        spec.precision = -2;
+        p++;
+      } else {
+        spec.precision = 0;
+        while (isdigit(*p)) {
+          spec.precision = spec.precision * 10 + (*p++ - '0');
+        }
+      }
+    }
+
+    // 長さ修飾子
+    if (*p == 'h' || *p == 'l') {
+      spec.lengthModifier = p[1] == *p ? (*p == 'h' ? 'H' : 'q') : *p;
+      p += p[1] == *p ? 2 : 1;
+    } else if (*p != '\0' && strchr("Lzjt", *p)) {
+      spec.lengthModifier = *p++;
+    }
+
+    // 変換指定子
+    spec.conversion = *p != '\0' && strchr("diouxXcsfFeEgGaApn%", *p) ? *p : '\0';
+    spec.pEnd = *p != '\0' ? p + 1 : p;
+    pCursor = spec.pEnd;
+
+    return TRUE;
+  }
+
+  /**
+   * @brief リングバッファの指定位置からコピーする (折り返しを考慮する)
+   */
+  VOID copyFromAsyncLogRing(const AsyncLogRing& ring, SIZE_T position, PVOID pData, SIZE_T size)
+  {
+    auto offset = position & (ring.buffer.size() - 1);
+    auto first = MIN(size, ring.buffer.size() - offset);
+
+    MEMCPY(pData, ring.buffer.data() + offset, first);
+    MEMCPY(reinterpret_cast<PBYTE>(pData) + first, ring.buffer.data(), size - first);
+  }
+
+  /**
+   * @brief ログをリングバッファに書き込む (空きがない場合は破棄する)
+   */
+  BOOL writeAsyncLogRing(AsyncLogRing& ring, const std::vector<BYTE>& record)
+  {
+    auto head = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+    auto tail = __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE);
+    auto offset = head & (ring.buffer.size() - 1);
+    auto first = MIN(record.size(), ring.buffer.size() - offset);
+
+    if (ring.buffer.size() - (head - tail) < record.size()) {
+      return FALSE;
+    }
+
+    MEMCPY(ring.buffer.data() + offset, record.data(), first);
+    MEMCPY(ring.buffer.data(), record.data() + first, record.size() - first);
+    __atomic_store_n(&ring.head, head + record.size(), __ATOMIC_RELEASE);
+
+    return TRUE;
+  }
+
+  /**
+   * @brief リングバッファからログを1件読み出す
+   */
+  BOOL readAsyncLogRing(AsyncLogRing& ring, std::vector<BYTE>& record)
+  {
+    auto tail = __atomic_load_n(&ring.tail, __ATOMIC_RELAXED);
+    auto head = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+    UINT32 size;
+
+    if (head == tail) {
+      return FALSE;
+    }
+
+    copyFromAsyncLogRing(ring, tail, &size, SIZEOF(size));
+    record.resize(size);
+    copyFromAsyncLogRing(ring, tail, record.data(), size);
+    __atomic_store_n(&ring.tail, tail + size, __ATOMIC_RELEASE);
+
+    return TRUE;
+  }
+
+  /**
+   * @brief 呼び出し元のスレッドのリングバッファを作成して登録する
+   */
+  std::shared_ptr<AsyncLogRing> registerAsyncLogRing()
+  {
+    auto pRing = std::make_shared<AsyncLogRing>();
+
+    pRing->buffer.resize(asyncLogger.ringSize);
+    pRing->tid = static_cast<INT32>(syscall(SYS_gettid));
+
+    MUTEX_LOCK(asyncLogger.lock);
+    asyncLogger.rings.push_back(pRing);
+    MUTEX_UNLOCK(asyncLogger.lock);
+
+    return pRing;
+  }
+
+  /**
+   * @brief ロガースレッドを起床する (未出力のログがない状態から書き込んだ場合のみ条件変数を通知する)
+   */
+  VOID wakeAsyncLogger()
+  {
+    if (ATOMIC_LOAD_BOOL(&asyncLogger.hasPendingLogs) || ATOMIC_EXCHANGE_BOOL(&asyncLogger.hasPendingLogs, TRUE)) {
+      return;
+    }
+
+    MUTEX_LOCK(asyncLogger.lock);
+    CVAR_SIGNAL(asyncLogger.cvar);
+    MUTEX_UNLOCK(asyncLogger.lock);
+  }
+
+  /**
+   * @brief 引数を整形せずにリングバッファに書き込む
+   *
+   * 整数、浮動小数点数、ポインターは値を、文字列は内容をコピーし、整形はロガースレッドで行う。
+   */
+  VOID captureLogRecord(AsyncLogThread& thread, UINT32 level, const CHAR* pTag, const CHAR* pFmt, va_list args)
+  {
+    auto& record = thread.record;
+    AsyncLogRecordHeader header;
+    LogFormatSpec spec;
+    const CHAR* pCursor = pFmt;
+    const CHAR* pString;
+    INT32 star = 0;
+    UINT32 length;
+    UINT64 value;
+    DOUBLE doubleValue;
+    long double longDoubleValue;
+
+    auto append = [&record](const VOID* pData, SIZE_T size) {
+      record.insert(record.end(), reinterpret_cast<const BYTE*>(pData), reinterpret_cast<const BYTE*>(pData) + size);
+    };
+
+    // ヘッダー、タグ、フォーマット文字列
+    header.level = level;
+    header.time = GETTIME();
+    header.tagLen = static_cast<UINT32>(STRLEN(pTag));
+    header.fmtLen = static_cast<UINT32>(STRLEN(pFmt));
+    record.resize(SIZEOF(header));
+    append(pTag, header.tagLen);
+    append(pFmt, header.fmtLen);
+
+    // 引数 (解釈できない変換指定以降は文字列として出力する)
+    while (nextLogFormatSpec(pCursor, spec) && spec.conversion != '\0') {
+      for (UINT32 i = 0; i < spec.starCount; i++) {
+        star = va_arg(args, INT32);
+        value = static_cast<UINT64>(static_cast<INT64>(star));
+        append(&value, SIZEOF(value));
+      }
+
+      switch (spec.conversion) {
+        case 'd':
+        case 'i':
+          switch (spec.lengthModifier) {
+            case 'l': value = static_cast<UINT64>(va_arg(args, long)); break;
+            case 'q': value = static_cast<UINT64>(va_arg(args, long long)); break;
+            case 'z': value = static_cast<UINT64>(va_arg(args, ssize_t)); break;
+            case 'j': value = static_cast<UINT64>(va_arg(args, intmax_t)); break;
+            case 't': value = static_cast<UINT64>(va_arg(args, ptrdiff_t)); break;
+            default: value = static_cast<UINT64>(static_cast<INT64>(va_arg(args, INT32))); break;
+          }
+          append(&value, SIZEOF(value));
+          break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'c':
+          switch (spec.lengthModifier) {
+            case 'l': value = va_arg(args, unsigned long); break;
+            case 'q': value = va_arg(args, unsigned long long); break;
+            case 'z': value = va_arg(args, size_t); break;
+            case 'j': value = va_arg(args, uintmax_t); break;
+            case 't': value = static_cast<UINT64>(va_arg(args, ptrdiff_t)); break;
+            default: value = va_arg(args, UINT32); break;
+          }
+          append(&value, SIZEOF(value));
+          break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+          if (spec.lengthModifier == 'L') {
+            longDoubleValue = va_arg(args, long double);
+            append(&longDoubleValue, SIZEOF(longDoubleValue));
+          } else {
+            doubleValue = va_arg(args, DOUBLE);
+            append(&doubleValue, SIZEOF(doubleValue));
+          }
+          break;
+        case 's':
+          // 精度を指定した場合はNULで終端されていない場合がある
+          pString = va_arg(args, const CHAR*);
+          pString = pString ? pString : "(null)";
+          length = static_cast<UINT32>(spec.precision == -1 ? STRNLEN(pString, ASYNC_LOG_MAX_STRING_LEN)
+                                                            : STRNLEN(pString, MIN(static_cast<UINT32>(spec.precision == -2 ? MAX(star, 0) : spec.precision), ASYNC_LOG_MAX_STRING_LEN)));
+          append(&length, SIZEOF(length));
+          append(pString, length);
+          break;
+        case 'p':
+          value = reinterpret_cast<UINT64>(va_arg(args, PVOID));
+          append(&value, SIZEOF(value));
+          break;
+        case 'n':
+          // 書き込み先は無視する
+          va_arg(args, PVOID);
+          break;
+        default:
+          break;
+      }
+    }
+
+    // サイズを確定してリングバッファに書き込む
+    header.size = static_cast<UINT32>(record.size());
+    MEMCPY(record.data(), &header, SIZEOF(header));
+    if (record.size() <= thread.pRing->buffer.size() && writeAsyncLogRing(*thread.pRing, record)) {
+      ATOMIC_INCREMENT(&thread.pRing->capturedCount);
+      wakeAsyncLogger();
+    } else {
+      ATOMIC_INCREMENT(&thread.pRing->droppedCount);
+    }
+  }
+
+  /**
+   * @brief 引数を整形せずにリングバッファに書き込む (可変長引数)
+   */
+  VOID captureLog(AsyncLogThread& thread, UINT32 level, const CHAR* pTag, const CHAR* pFmt, ...)
+  {
+    va_list args;
+
+    va_start(args, pFmt);
+    captureLogRecord(thread, level, pTag, pFmt, args);
+    va_end(args);
+  }
+
+  /**
+   * @brief リングバッファから読み出したログを整形する
+   */
+  std::string formatLogRecord(const std::vector<BYTE>& record)
+  {
+    AsyncLogRecordHeader header;
+    LogFormatSpec spec;
+    std::string tag, fmt, message, specString;
+    const BYTE *pArgs, *pArgsEnd;
+    const CHAR *pCursor, *pLiteral;
+    INT32 stars[2] = {0, 0};
+    UINT32 length;
+    UINT64 value;
+    DOUBLE doubleValue;
+    long double longDoubleValue;
+    time_t seconds;
+    struct tm utc;
+    CHAR timestamp[32], prefix[64];
+
+    MEMCPY(&header, record.data(), SIZEOF(header));
+    tag.assign(reinterpret_cast<const CHAR*>(record.data()) + SIZEOF(header), header.tagLen);
+    fmt.assign(reinterpret_cast<const CHAR*>(record.data()) + SIZEOF(header) + header.tagLen, header.fmtLen);
+    pArgs = record.data() + SIZEOF(header) + header.tagLen + header.fmtLen;
+    pArgsEnd = record.data() + record.size();
+
+    // 引数を読み出す (足りない場合は0)
+    auto read = [&pArgs, pArgsEnd](PVOID pValue, SIZE_T size) {
+      auto available = MIN(size, static_cast<SIZE_T>(pArgsEnd - pArgs));
+      MEMSET(pValue, 0x00, size);
+      MEMCPY(pValue, pArgs, available);
+      pArgs += available;
+    };
+
+    // 変換指定ごとに整形する
+    auto appendFormatted = [&message, &specString, &spec, &stars](auto argument) {
+      auto format = [&](PCHAR pBuffer, SIZE_T size) {
+        switch (spec.starCount) {
+          case 0: return snprintf(pBuffer, size, specString.c_str(), argument);
+          case 1: return snprintf(pBuffer, size, specString.c_str(), stars[0], argument);
+          default: return snprintf(pBuffer, size, specString.c_str(), stars[0], stars[1], argument);
+        }
+      };
+      auto formattedLength = format(nullptr, 0);
+      auto offset = message.size();
+
+      if (formattedLength > 0) {
+        message.resize(offset + static_cast<SIZE_T>(formattedLength) + 1);
+        format(&message[offset], static_cast<SIZE_T>(formattedLength) + 1);
+        message.resize(offset + static_cast<SIZE_T>(formattedLength));
+      }
+    };
+
+    pCursor = pLiteral = fmt.c_str();
+    while (nextLogFormatSpec(pCursor, spec) && spec.conversion != '\0') {
+      message.append(pLiteral, spec.pBegin - pLiteral);
+      pLiteral = spec.pEnd;
+      specString.assign(spec.pBegin, spec.pEnd - spec.pBegin);
+
+      for (UINT32 i = 0; i < spec.starCount && i < 2; i++) {
+        read(&value, SIZEOF(value));
+        stars[i] = static_cast<INT32>(static_cast<INT64>(value));
+      }
+
+      switch (spec.conversion) {
+        case '%':
+          message += '%';
+          break;
+        case 'd':
+        case 'i':
+          read(&value, SIZEOF(value));
+          switch (spec.lengthModifier) {
+            case 'l': appendFormatted(static_cast<long>(value)); break;
+            case 'q': appendFormatted(static_cast<long long>(value)); break;
+            case 'z': appendFormatted(static_cast<ssize_t>(value)); break;
+            case 'j': appendFormatted(static_cast<intmax_t>(value)); break;
+            case 't': appendFormatted(static_cast<ptrdiff_t>(value)); break;
+            default: appendFormatted(static_cast<INT32>(value)); break;
+          }
+          break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'c':
+          read(&value, SIZEOF(value));
+          switch (spec.lengthModifier) {
+            case 'l': appendFormatted(static_cast<unsigned long>(value)); break;
+            case 'q': appendFormatted(static_cast<unsigned long long>(value)); break;
+            case 'z': appendFormatted(static_cast<size_t>(value)); break;
+            case 'j': appendFormatted(static_cast<uintmax_t>(value)); break;
+            case 't': appendFormatted(static_cast<ptrdiff_t>(value)); break;
+            default: appendFormatted(static_cast<UINT32>(value)); break;
+          }
+          break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+          if (spec.lengthModifier == 'L') {
+            read(&longDoubleValue, SIZEOF(longDoubleValue));
+            appendFormatted(longDoubleValue);
+          } else {
+            read(&doubleValue, SIZEOF(doubleValue));
+            appendFormatted(doubleValue);
+          }
+          break;
+        case 's':
+          read(&length, SIZEOF(length));
+          length = MIN(length, static_cast<UINT32>(pArgsEnd - pArgs));
+          appendFormatted(std::string(reinterpret_cast<const CHAR*>(pArgs), length).c_str());
+          pArgs += length;
+          break;
+        case 'p':
+          read(&value, SIZEOF(value));
+          appendFormatted(reinterpret_cast<PVOID>(value));
+          break;
+        default:
+          break;
+      }
+    }
+    message.append(pLiteral);
+
+    // 時刻 (UTC)、ログレベル、タグを付加する
+    seconds = static_cast<time_t>(header.time / HUNDREDS_OF_NANOS_IN_A_SECOND);
+    gmtime_r(&seconds, &utc);
+    strftime(timestamp, SIZEOF(timestamp), "%Y-%m-%d %H:%M:%S", &utc);
+    snprintf(prefix,
+             SIZEOF(prefix),
+             "%s.%03u %-7s ",
+             timestamp,
+             static_cast<UINT32>(header.time % HUNDREDS_OF_NANOS_IN_A_SECOND / HUNDREDS_OF_NANOS_IN_A_MILLISECOND),
+             header.level < ARRAY_SIZE(logLevelNames) ? logLevelNames[header.level] : "");
+
+    return prefix + tag + ": " + message + "\n";
+  }
+
+  // プリセットの設定値
+  struct PresetValue {
+    const CHAR* pPreset;
+    const CHAR* pName;
+    const CHAR* pValue;
+  };
+
+  const PresetValue presetValues[] = {
+    // 低遅延: キューを浅くしてバッファリングによる遅延を抑える
+    {"low-latency",  VIDEO_QUEUE_SIZE_ENV_VAR, "2"},
+    {"low-latency",  AUDIO_QUEUE_SIZE_ENV_VAR, "4"},
+    {"low-latency",  AUDIO_PROFILE_ENV_VAR,    "lowlatency"},
+    // 低CPU: 解像度とフレームレートを下げてエンコード負荷を抑える
+    {"low-cpu",      VIDEO_WIDTH_ENV_VAR,      "320"},
+    {"low-cpu",      VIDEO_HEIGHT_ENV_VAR,     "240"},
+    {"low-cpu",      VIDEO_FRAMERATE_ENV_VAR,  "15"},
+    {"low-cpu",      VIDEO_BITRATE_ENV_VAR,    "300000"},
+    {"low-cpu",      CLOCK_OVERLAY_ENV_VAR,    "0"},
+    // 高画質: レベル3.1の上限 (1280x720@30) で送信する
+    {"high-quality", VIDEO_WIDTH_ENV_VAR,      "1280"},
+    {"high-quality", VIDEO_HEIGHT_ENV_VAR,     "720"},
+    {"high-quality", VIDEO_FRAMERATE_ENV_VAR,  "30"},
+    {"high-quality", VIDEO_BITRATE_ENV_VAR,    "2500000"},
+    {"high-quality", AUDIO_BITRATE_ENV_VAR,    "96000"},
+  };
+
+  // スレッドの役割ごとの名前と環境変数 (ThreadRoleの順)
+  struct ThreadRoleSetting {
+    const CHAR* pName;
+    const CHAR* pCpusEnvVar;
+    const CHAR* pSchedEnvVar;
+  };
+
+  const ThreadRoleSetting threadRoleSettings[THREAD_ROLE_COUNT] = {
+    {"capture",   CAPTURE_CPUS_ENV_VAR,   CAPTURE_SCHED_ENV_VAR},
+    {"encode",    ENCODE_CPUS_ENV_VAR,    ENCODE_SCHED_ENV_VAR},
+    {"fanout",    FANOUT_CPUS_ENV_VAR,    FANOUT_SCHED_ENV_VAR},
+    {"signaling", SIGNALING_CPUS_ENV_VAR, SIGNALING_SCHED_ENV_VAR},
+    {"record",    RECORD_CPUS_ENV_VAR,    RECORD_SCHED_ENV_VAR},
+  };
+
+  // ソフトウェアエンコーダーを含むH.264エンコーダーの候補 (優先順)
+  const CHAR* const videoEncoderCandidates[] = {
+    "v4l2h264enc",
+    "x264enc",
+    "openh264enc",
+  };
+
+  // 映像コーデックごとの名前、SDKのコーデック、SDPのエンコーディング名、エンコーダーの候補 (VideoCodecTypeの順、H.264のエンコーダーは別に選択する)
+  struct VideoCodecSetting {
+    const CHAR* pName;
+    RTC_CODEC rtcCodec;
+    const CHAR* pEncodingName;
+    const CHAR* pEncoders[2];
+  };
+
+  const VideoCodecSetting videoCodecSettings[VIDEO_CODEC_TYPE_COUNT] = {
+    {"h264", VIDEO_CODEC,    "H264", {nullptr,       nullptr}},
+    {"h265", RTC_CODEC_H265, "H265", {"v4l2h265enc", "x265enc"}},
+    {"vp8",  RTC_CODEC_VP8,  "VP8",  {"vp8enc",      nullptr}},
+  };
+
+  // 解像度とフレームレートの段 (設定に対する割合、パーセント、先頭が設定どおり)
+  struct VideoScalingLevel {
+    UINT32 sizePercent;
+    UINT32 frameratePercent;
+  };
+
+  const VideoScalingLevel videoScalingLevels[] = {
+    {100, 100},
+    {75,  100},
+    {50,  100},
+    {50,  50},
+    {25,  50},
+  };
+
+  /**
+   * @brief H.264エンコーダーのベンチマーク結果を比較する
+   *
+   * リアルタイムでエンコードできる候補を優先し、エンコード遅延が小さい方を選ぶ。
+   * 遅延の差が1ms未満の場合はCPU時間が少ない方を選ぶ。
+   */
+  BOOL isBetterVideoEncoder(const VideoEncoderProbeResult& a, const VideoEncoderProbeResult& b, UINT64 frameInterval)
+  {
+    auto aRealtime = a.wallTimePerFrame <= frameInterval;
+    auto bRealtime = b.wallTimePerFrame <= frameInterval;
+
+    if (aRealtime != bRealtime) {
+      return aRealtime;
+    }
+
+    if (a.meanLatency + HUNDREDS_OF_NANOS_IN_A_MILLISECOND < b.meanLatency ||
+        b.meanLatency + HUNDREDS_OF_NANOS_IN_A_MILLISECOND < a.meanLatency) {
+      return a.meanLatency < b.meanLatency;
+    }
+
+    return a.cpuTimePerFrame < b.cpuTimePerFrame;
+  }
+
+  // レイテンシ計測用SEIのUUID ("kvs-latency-sei1"、0x00を含まない)
+  const BYTE latencySeiUuid[] = {
+    0x6b, 0x76, 0x73, 0x2d, 0x6c, 0x61, 0x74, 0x65, 0x6e, 0x63, 0x79, 0x2d, 0x73, 0x65, 0x69, 0x31,
+  };
+
+  // レイテンシ計測用SEIのペイロード長
+  constexpr UINT32 latencySeiPayloadLen = SIZEOF(latencySeiUuid) + LATENCY_SEI_TIMESTAMP_LEN * LATENCY_SEI_TIMESTAMP_COUNT;
+
+  /**
+   * @brief 次のNALユニットのヘッダ位置を探す
+   */
+  UINT32 findNextNalStart(PBYTE pData, UINT32 size, UINT32 offset)
+  {
+    for (auto i = offset; i + 3 <= size; i++) {
+      if (pData[i] == 0x00 && pData[i + 1] == 0x00 && pData[i + 2] == 0x01) {
+        return i + 3;
+      }
+    }
+
+    return size;
+  }
 }
 
 // ============================================================================
@@ -51,6 +841,33 @@ VOID setSigintHandler(PKvsWebrtcConfig pKvsWebrtcConfig)
   });
 }
 
+/**
+ * @brief ホストの全チャネルを中断するSIGINTハンドラを設定する
+ */
+VOID setSigintHandler(PKvsWebrtcHost pKvsWebrtcHost)
+{
+  // SIGINTハンドラ
+  sigintHandler = [pKvsWebrtcHost](INT32 sigNum) {
+    UNUSED_PARAM(sigNum);
+
+    if (pKvsWebrtcHost) {
+      // 中断フラグをON
+      // (チャネルへの反映はメインループで行う)
+      ATOMIC_STORE_BOOL(&pKvsWebrtcHost->isInterrupted, TRUE);
+
+      // ブロックを解除
+      if (IS_VALID_CVAR_VALUE(pKvsWebrtcHost->cvar)) {
+        CVAR_BROADCAST(pKvsWebrtcHost->cvar);
+      }
+    }
+  };
+
+  // SIGINTハンドラを設定
+  signal(SIGINT, [](INT32 sigNum) {
+    sigintHandler(sigNum);
+  });
+}
+
 /**
  * @brief CA証明書のパスを取得する
  */
@@ -66,272 +883,297 @@ CleanUp:
   return retStatus;
 }
 
-// ============================================================================
-// KvsWebrtcConfig 管理
-// ============================================================================
-
 /**
- * @brief KVS WebRTCの設定を作成する
+ * @brief 設定ファイルとプリセットを読み込む
+ *
+ * 優先順位は 環境変数 > 設定ファイル > プリセット > デフォルト値 とする。
+ * いずれも未設定の環境変数として反映するため、設定値は環境変数と同じ方法で参照できる。
  */
-STATUS createKvsWebrtcConfig(PCHAR pChannelName, UINT32 logLevel, std::unique_ptr<KvsWebrtcConfig>& pKvsWebrtcConfig)
+STATUS loadSettings()
 {
   auto retStatus = STATUS_SUCCESS;
 
-  // KVS WebRTCの設定を初期化
-  pKvsWebrtcConfig = std::make_unique<KvsWebrtcConfig>();
+  // 設定ファイル
+  if (GETENV(CONFIG_FILE_ENV_VAR)) {
+    CHK_STATUS(loadConfigFile(GETENV(CONFIG_FILE_ENV_VAR)));
+  }
 
-  // 接続フラグ
-  ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->isConnected, FALSE);
+  // プリセット
+  if (GETENV(PRESET_ENV_VAR)) {
+    CHK_STATUS(applyPreset(GETENV(PRESET_ENV_VAR)));
+  }
 
-  // 中断フラグ
-  ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->isInterrupted, FALSE);
+CleanUp:
 
-  // 終了フラグ
-  ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->isTerminated, FALSE);
+  return retStatus;
+}
 
-  // 設定オブジェクト保護用ミューテックス
-  pKvsWebrtcConfig->kvsWebrtcConfigObjLock = MUTEX_CREATE(TRUE);
+/**
+ * @brief 設定ファイルを読み込む
+ *
+ * 1行に1つ「名前=値」の形式で記述する。空行と「#」で始まる行は無視する。
+ */
+STATUS loadConfigFile(PCHAR pPath)
+{
+  auto retStatus = STATUS_SUCCESS;
+  std::ifstream file;
+  std::string line, name, value;
+  size_t pos;
+
+  // 設定ファイルを開く
+  file.open(pPath);
+  CHK_ERR(file.is_open(), STATUS_OPEN_FILE_FAILED, "設定ファイル「%s」を開けません。", pPath);
+
+  while (std::getline(file, line)) {
+    // 空行とコメントを無視
+    if (line.empty() || line[0] == '#' || (pos = line.find('=')) == std::string::npos) {
+      continue;
+    }
 
-  // シグナリングメッセージ送信用ミューテックス
-  pKvsWebrtcConfig->signalingSendMessageLock = MUTEX_CREATE(FALSE);
+    // 前後の空白を除去
+    name = line.substr(0, pos);
+    value = line.substr(pos + 1);
+    name.erase(name.find_last_not_of(" \t\r") + 1);
+    name.erase(0, name.find_first_not_of(" \t"));
+    value.erase(value.find_last_not_of(" \t\r") + 1);
+    value.erase(0, value.find_first_not_of(" \t"));
 
-  // 条件変数
-  pKvsWebrtcConfig->cvar = CVAR_CREATE();
+    // 環境変数で設定されていない場合のみ反映
+    setenv(name.c_str(), value.c_str(), 0);
+  }
 
-  // シグナリングクライアント再作成フラグ
-  ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->recreateSignalingClient, FALSE);
+CleanUp:
 
-  // ICEサーバーの数
-  pKvsWebrtcConfig->iceUriCount = 0;
+  return retStatus;
+}
 
-  // 送信用パイプライン
-  pKvsWebrtcConfig->sendPipeline = nullptr;
+/**
+ * @brief プリセットを適用する
+ */
+STATUS applyPreset(PCHAR pPreset)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto isFound = FALSE;
 
-  // 受信用パイプライン
-  pKvsWebrtcConfig->recvPipeline = nullptr;
+  for (auto&& presetValue : presetValues) {
+    if (STRCMPI(presetValue.pPreset, pPreset) == 0) {
+      // 環境変数と設定ファイルで設定されていない場合のみ反映
+      setenv(presetValue.pName, presetValue.pValue, 0);
+      isFound = TRUE;
+    }
+  }
 
-  // CA証明書のパスを取得
-  CHK_STATUS(getCaCertPath(pKvsWebrtcConfig->pCaCertPath));
+  CHK_ERR(isFound, STATUS_INVALID_ARG, "プリセット「%s」は存在しません。", pPreset);
 
-  // 認証情報プロバイダーを作成
-  CHK_STATUS(createCredentialProvider(pKvsWebrtcConfig->pCaCertPath, pKvsWebrtcConfig->pCredentialProvider));
+CleanUp:
 
-  // クライアント情報を初期化
-  CHK_STATUS(initClientInfo(logLevel, pKvsWebrtcConfig->clientInfo));
+  return retStatus;
+}
 
-  // チャネル情報を初期化
-  CHK_STATUS(initChannelInfo(pChannelName,
-                             pKvsWebrtcConfig->pCaCertPath,
-                             GETENV(DEFAULT_REGION_ENV_VAR),
-                             pKvsWebrtcConfig->channelInfo));
+/**
+ * @brief 環境変数から真偽値を取得する
+ */
+BOOL getEnvBool(const CHAR* pName, BOOL defaultValue)
+{
+  PCHAR pValue;
 
-  // コールバックを初期化
-  CHK_STATUS(initCallbacks(reinterpret_cast<UINT64>(pKvsWebrtcConfig.get()), pKvsWebrtcConfig->callbacks));
+  if (!(pValue = GETENV(pName)) || pValue[0] == '\0') {
+    return defaultValue;
+  }
 
-  // シグナリングクライアントに関するメトリクス初期化
-  CHK_STATUS(initMetrics(pKvsWebrtcConfig->metrics));
+  return STRCMPI(pValue, "0") != 0 && STRCMPI(pValue, "false") != 0 && STRCMPI(pValue, "off") != 0;
+}
 
-CleanUp:
+/**
+ * @brief 環境変数から整数値を取得する
+ */
+UINT32 getEnvUint32(const CHAR* pName, UINT32 defaultValue)
+{
+  PCHAR pValue;
+  UINT32 value;
 
-  if (STATUS_FAILED(retStatus)) {
-    freeKvsWebrtcConfig(pKvsWebrtcConfig);
+  if (!(pValue = GETENV(pName)) || STATUS_FAILED(STRTOUI32(pValue, NULL, 10, &value))) {
+    return defaultValue;
   }
 
-  return retStatus;
+  return value;
 }
 
 /**
- * @brief KVS WebRTCの設定を解放する
+ * @brief チャネルの環境変数を取得する (「名前_チャネル番号」を優先する)
+ *
+ * チャネル番号は1から始まる (例: 2番目のチャネルのデバイスはKVS_WEBRTC_VIDEO_DEVICE_2)。
  */
-STATUS freeKvsWebrtcConfig(std::unique_ptr<KvsWebrtcConfig>& pKvsWebrtcConfig)
+PCHAR getChannelEnv(PKvsWebrtcConfig pKvsWebrtcConfig, const CHAR* pName)
 {
-  ENTERS();
-  auto retStatus = STATUS_SUCCESS;
+  PCHAR pValue;
 
-  // NULLチェック
-  CHK(pKvsWebrtcConfig, retStatus);
-
-  // 設定オブジェクト保護用ミューテックスを解放
-  if (IS_VALID_MUTEX_VALUE(pKvsWebrtcConfig->kvsWebrtcConfigObjLock)) {
-    MUTEX_FREE(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  if ((pValue = GETENV((std::string(pName) + "_" + std::to_string(pKvsWebrtcConfig->channelIndex + 1)).c_str()))) {
+    return pValue;
   }
 
-  // シグナリングメッセージ送信用ミューテックスを解放
-  if (IS_VALID_MUTEX_VALUE(pKvsWebrtcConfig->signalingSendMessageLock)) {
-    MUTEX_FREE(pKvsWebrtcConfig->signalingSendMessageLock);
-  }
-
-  // 条件変数を解放
-  if (IS_VALID_CVAR_VALUE(pKvsWebrtcConfig->cvar)) {
-    CVAR_FREE(pKvsWebrtcConfig->cvar);
-  }
+  return GETENV(pName);
+}
 
-  // GStreamerパイプラインを解放
-  freeGstPipelines(pKvsWebrtcConfig.get());
+/**
+ * @brief チャネルの環境変数から真偽値を取得する
+ */
+BOOL getChannelEnvBool(PKvsWebrtcConfig pKvsWebrtcConfig, const CHAR* pName, BOOL defaultValue)
+{
+  PCHAR pValue;
 
-  // ストリーミングセッションを解放
-  for (auto&& value : pKvsWebrtcConfig->streamingSessions) {
-    freeKvsWebrtcStreamingSession(value.second);
+  if (!(pValue = getChannelEnv(pKvsWebrtcConfig, pName)) || pValue[0] == '\0') {
+    return defaultValue;
   }
 
-  // ストリーミングセッションをクリア
-  pKvsWebrtcConfig->streamingSessions.clear();
-
-  // 認証情報プロバイダーを解放
-  freeIotCredentialProvider(&pKvsWebrtcConfig->pCredentialProvider);
+  return STRCMPI(pValue, "0") != 0 && STRCMPI(pValue, "false") != 0 && STRCMPI(pValue, "off") != 0;
+}
 
-  // KVS WebRTCの設定を解放
-  pKvsWebrtcConfig.reset();
+/**
+ * @brief チャネルの環境変数から整数値を取得する
+ */
+UINT32 getChannelEnvUint32(PKvsWebrtcConfig pKvsWebrtcConfig, const CHAR* pName, UINT32 defaultValue)
+{
+  PCHAR pValue;
+  UINT32 value;
 
-CleanUp:
+  if (!(pValue = getChannelEnv(pKvsWebrtcConfig, pName)) || STATUS_FAILED(STRTOUI32(pValue, NULL, 10, &value))) {
+    return defaultValue;
+  }
 
-  LEAVES();
-  return retStatus;
+  return value;
 }
 
 // ============================================================================
-// KvsWebrtcStreamingSession 管理
+// レイテンシ計測
 // ============================================================================
 
 /**
- * @brief ストリーミングセッションを作成する
+ * @brief レイテンシ統計を初期化する
  */
-STATUS createKvsWebrtcStreamingSession(PKvsWebrtcConfig pKvsWebrtcConfig, PCHAR pPeerClientId, std::unique_ptr<KvsWebrtcStreamingSession>& pStreamingSession)
+STATUS initLatencyStats(LatencyStats& latencyStats, UINT32 capacity)
 {
   auto retStatus = STATUS_SUCCESS;
-  RtcMediaStreamTrack videoTrack;
-  RtcMediaStreamTrack audioTrack;
-  RtcRtpTransceiverInit videoRtpTransceiverInit;
-  RtcRtpTransceiverInit audioRtpTransceiverInit;
-
-  // 映像と音声のトラックを初期化
-  MEMSET(&videoTrack, 0x00, SIZEOF(RtcMediaStreamTrack));
-  MEMSET(&audioTrack, 0x00, SIZEOF(RtcMediaStreamTrack));
-
-  // ストリーミングセッションを初期化
-  pStreamingSession = std::make_unique<KvsWebrtcStreamingSession>();
-
-  // KVS WebRTCの設定
-  pStreamingSession->pKvsWebrtcConfig = pKvsWebrtcConfig;
-
-  // クライアントID
-  STRCPY(pStreamingSession->peerClientId, pPeerClientId);
 
-  // 終了フラグ
-  ATOMIC_STORE_BOOL(&pStreamingSession->isTerminated, FALSE);
-
-  // ICE候補収集完了フラグ
-  ATOMIC_STORE_BOOL(&pStreamingSession->candidateGatheringDone, FALSE);
-
-  // Trickle ICEフラグ (handleOfferで設定される)
-  pStreamingSession->remoteCanTrickleIce = FALSE;
+  // 保護用ミューテックス
+  latencyStats.lock = MUTEX_CREATE(FALSE);
 
-  // フレームインデックス
-  pStreamingSession->frameIndex = 0;
-
-  // ピア接続を初期化
-  CHK_STATUS(initPeerConnection(pKvsWebrtcConfig, pStreamingSession->pPeerConnection));
+  // サンプル
+  latencyStats.samples.assign(capacity, 0);
 
-  // ICE Candidateを受信した際のコールバックを設定
-  CHK_STATUS(peerConnectionOnIceCandidate(pStreamingSession->pPeerConnection,
-                                          reinterpret_cast<UINT64>(pStreamingSession.get()),
-                                          onIceCandidateHandler));
+  // サンプル数
+  latencyStats.count = 0;
 
-  // ピア接続の状態が変化した際のコールバックを設定
-  CHK_STATUS(peerConnectionOnConnectionStateChange(pStreamingSession->pPeerConnection,
-                                                   reinterpret_cast<UINT64>(pStreamingSession.get()),
-                                                   onConnectionStateChanged));
+CleanUp:
 
-  // サポートされるコーデックを追加
-  CHK_STATUS(addSupportedCodec(pStreamingSession->pPeerConnection, VIDEO_CODEC));
-  CHK_STATUS(addSupportedCodec(pStreamingSession->pPeerConnection, AUDIO_CODEC));
+  return retStatus;
+}
 
-  // トラックの種類
-  videoTrack.kind = MEDIA_STREAM_TRACK_KIND_VIDEO;
-  audioTrack.kind = MEDIA_STREAM_TRACK_KIND_AUDIO;
+/**
+ * @brief レイテンシ統計を解放する
+ */
+STATUS freeLatencyStats(LatencyStats& latencyStats)
+{
+  auto retStatus = STATUS_SUCCESS;
 
-  // トラックのコーデック
-  videoTrack.codec = VIDEO_CODEC;
-  audioTrack.codec = AUDIO_CODEC;
+  // 保護用ミューテックスを解放
+  if (IS_VALID_MUTEX_VALUE(latencyStats.lock)) {
+    MUTEX_FREE(latencyStats.lock);
+    latencyStats.lock = INVALID_MUTEX_VALUE;
+  }
 
-  // トランシーバーの方向
-  videoRtpTransceiverInit.direction = RTC_RTP_TRANSCEIVER_DIRECTION_SENDONLY;
-  audioRtpTransceiverInit.direction = RTC_RTP_TRANSCEIVER_DIRECTION_SENDRECV;
+  // サンプルを解放
+  latencyStats.samples.clear();
 
-  // トラックのストリームID
-  STRCPY(videoTrack.streamId, VIDEO_STREAM_ID);
-  STRCPY(audioTrack.streamId, AUDIO_STREAM_ID);
+CleanUp:
 
-  // トラックのID
-  STRCPY(videoTrack.trackId, VIDEO_TRACK_ID);
-  STRCPY(audioTrack.trackId, AUDIO_TRACK_ID);
+  return retStatus;
+}
 
-  // トランシーバーを追加
-  CHK_STATUS(addTransceiver(pStreamingSession->pPeerConnection, &videoTrack, &videoRtpTransceiverInit, &pStreamingSession->pVideoRtcRtpTransceiver));
-  CHK_STATUS(addTransceiver(pStreamingSession->pPeerConnection, &audioTrack, &audioRtpTransceiverInit, &pStreamingSession->pAudioRtcRtpTransceiver));
+/**
+ * @brief レイテンシのサンプルを追加する
+ */
+VOID addLatencySample(LatencyStats& latencyStats, UINT64 latency)
+{
+  // 初期化されていない場合は無視
+  if (!IS_VALID_MUTEX_VALUE(latencyStats.lock) || latencyStats.samples.empty()) {
+    return;
+  }
 
-CleanUp:
+  MUTEX_LOCK(latencyStats.lock);
 
-  if (STATUS_FAILED(retStatus)) {
-    freeKvsWebrtcStreamingSession(pStreamingSession);
-  }
+  // リングバッファに追加
+  latencyStats.samples[latencyStats.count % latencyStats.samples.size()] = latency;
+  latencyStats.count++;
 
-  return retStatus;
+  MUTEX_UNLOCK(latencyStats.lock);
 }
 
 /**
- * @brief ストリーミングセッションを解放する
+ * @brief レイテンシの分布を出力してリセットする
  */
-STATUS freeKvsWebrtcStreamingSession(std::unique_ptr<KvsWebrtcStreamingSession>& pStreamingSession)
+VOID logLatencyStats(const CHAR* pName, LatencyStats& latencyStats)
 {
-  auto retStatus = STATUS_SUCCESS;
-
-  // NULLチェック
-  CHK(pStreamingSession, retStatus);
+  std::vector<UINT64> samples;
+  UINT64 count;
 
-  // ピア接続を解放
-  CHK_LOG_ERR(closePeerConnection(pStreamingSession->pPeerConnection));
-  CHK_LOG_ERR(freePeerConnection(&pStreamingSession->pPeerConnection));
+  // 初期化されていない場合は無視
+  if (!IS_VALID_MUTEX_VALUE(latencyStats.lock) || latencyStats.samples.empty()) {
+    return;
+  }
 
-  // ストリーミングセッションを解放
-  pStreamingSession.reset();
+  // サンプルを取り出してリセット
+  MUTEX_LOCK(latencyStats.lock);
+  count = latencyStats.count;
+  samples.assign(latencyStats.samples.begin(),
+                 latencyStats.samples.begin() + static_cast<std::ptrdiff_t>(MIN(count, static_cast<UINT64>(latencyStats.samples.size()))));
+  latencyStats.count = 0;
+  MUTEX_UNLOCK(latencyStats.lock);
+
+  // サンプルがない場合は出力しない
+  if (samples.empty()) {
+    return;
+  }
 
-CleanUp:
+  // パーセンタイルを求めるためにソート
+  std::sort(samples.begin(), samples.end());
 
-  CHK_LOG_ERR(retStatus);
+  auto percentile = [&samples](DOUBLE p) {
+    return static_cast<DOUBLE>(samples[static_cast<size_t>(p * static_cast<DOUBLE>(samples.size() - 1))]) / HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+  };
 
-  return retStatus;
+  // ログを出力
+  DLOGP("%s: count: %" PRIu64 ", min: %.2f ms, p50: %.2f ms, p90: %.2f ms, p99: %.2f ms, max: %.2f ms",
+        pName,
+        count,
+        percentile(0.0),
+        percentile(0.5),
+        percentile(0.9),
+        percentile(0.99),
+        percentile(1.0));
 }
 
-// ============================================================================
-// 初期化
-// ============================================================================
-
 /**
- * @brief 認証情報プロバイダーを作成する
+ * @brief メディアクロックを初期化する
  */
-STATUS createCredentialProvider(PCHAR pCaCertPath, PAwsCredentialProvider& pCredentialProvider)
+STATUS initMediaClock(MediaClock& mediaClock)
 {
   auto retStatus = STATUS_SUCCESS;
-  PCHAR pIotCoreCredentialEndPoint;
-  PCHAR pIotCoreCert;
-  PCHAR pIotCorePrivateKey;
-  PCHAR pIotCoreRoleAlias;
-  PCHAR pIotCoreThingName;
 
-  // 認証情報プロバイダー
-  CHK_ERR(pIotCoreCredentialEndPoint = GETENV(IOT_CORE_CREDENTIAL_ENDPOINT), STATUS_INVALID_OPERATION, "環境変数「%s」は必須です。", IOT_CORE_CREDENTIAL_ENDPOINT);
-  CHK_ERR(pIotCoreCert               = GETENV(IOT_CORE_CERT),                STATUS_INVALID_OPERATION, "環境変数「%s」は必須です。", IOT_CORE_CERT);
-  CHK_ERR(pIotCorePrivateKey         = GETENV(IOT_CORE_PRIVATE_KEY),         STATUS_INVALID_OPERATION, "環境変数「%s」は必須です。", IOT_CORE_PRIVATE_KEY);
-  CHK_ERR(pIotCoreRoleAlias          = GETENV(IOT_CORE_ROLE_ALIAS),          STATUS_INVALID_OPERATION, "環境変数「%s」は必須です。", IOT_CORE_ROLE_ALIAS);
-  CHK_ERR(pIotCoreThingName          = GETENV(IOT_CORE_THING_NAME),          STATUS_INVALID_OPERATION, "環境変数「%s」は必須です。", IOT_CORE_THING_NAME);
-  CHK_STATUS(createLwsIotCredentialProvider(pIotCoreCredentialEndPoint,
-                                            pIotCoreCert,
-                                            pIotCorePrivateKey,
-                                            pCaCertPath,
-                                            pIotCoreRoleAlias,
-                                            pIotCoreThingName,
-                                            &pCredentialProvider));
+  // 保護用ミューテックス
+  mediaClock.lock = MUTEX_CREATE(FALSE);
+
+  // オフセット
+  mediaClock.initialized = FALSE;
+  mediaClock.offset = 0;
+  for (UINT32 i = 0; i < MEDIA_CLOCK_TRACK_COUNT; i++) {
+    mediaClock.trackOffsets[i] = 0;
+    mediaClock.trackInitialized[i] = FALSE;
+    mediaClock.lastTimestamps[i] = 0;
+  }
+
+  // ジッタ
+  CHK_STATUS(initLatencyStats(mediaClock.jitter, LATENCY_STATS_CAPACITY));
 
 CleanUp:
 
@@ -339,26 +1181,20 @@ CleanUp:
 }
 
 /**
- * @brief クライアント情報を初期化する
+ * @brief メディアクロックを解放する
  */
-STATUS initClientInfo(UINT32 logLevel, SignalingClientInfo& clientInfo)
+STATUS freeMediaClock(MediaClock& mediaClock)
 {
   auto retStatus = STATUS_SUCCESS;
 
-  // クライアント情報のバージョン
-  clientInfo.version = SIGNALING_CLIENT_INFO_CURRENT_VERSION;
-
-  // クライアントID
-  STRCPY(clientInfo.clientId, CLIENT_ID);
-
-  // ログレベル
-  clientInfo.loggingLevel = logLevel;
-
-  // キャッシュファイルのパス
-  clientInfo.cacheFilePath = NULL;
+  // 保護用ミューテックスを解放
+  if (IS_VALID_MUTEX_VALUE(mediaClock.lock)) {
+    MUTEX_FREE(mediaClock.lock);
+    mediaClock.lock = INVALID_MUTEX_VALUE;
+  }
 
-  // 再作成の試行回数
-  clientInfo.signalingClientCreationMaxRetryAttempts = CREATE_SIGNALING_CLIENT_RETRY_ATTEMPTS_SENTINEL_VALUE;
+  // ジッタを解放
+  freeLatencyStats(mediaClock.jitter);
 
 CleanUp:
 
@@ -366,56 +1202,126 @@ CleanUp:
 }
 
 /**
- * @brief チャネル情報を初期化する
+ * @brief PTSと到着時刻からセッションクロックのタイムスタンプを求める
+ *
+ * ビデオとオーディオは同じパイプラインのランニングタイムをPTSに持つため、
+ * 共通のオフセットを加えてセッションクロック (GETTIMEの単調な時刻) に写像する。
+ * 到着時刻とPTSの差は経路やスケジューラのジッタで遅れる方向にのみ揺らぐため、
+ * オフセットは差が小さくなったら即座に追従し、大きくなった場合はクロックのずれとしてゆっくり追従する。
  */
-STATUS initChannelInfo(PCHAR pChannelName, PCHAR pCaCertPath, PCHAR pRegion, ChannelInfo& channelInfo)
+UINT64 getMediaClockTimestamp(MediaClock& mediaClock, MediaClockTrack track, UINT64 pts, UINT64 arrivalTime)
 {
-  auto retStatus = STATUS_SUCCESS;
-
-  // チャネル情報のバージョン
-  channelInfo.version = CHANNEL_INFO_CURRENT_VERSION;
-
-  // チャネル名
-  channelInfo.pChannelName = pChannelName;
+  auto difference = static_cast<INT64>(arrivalTime) - static_cast<INT64>(pts);
+  UINT64 timestamp;
 
-  // リージョン
-  channelInfo.pRegion = pRegion ? pRegion : const_cast<PCHAR>(DEFAULT_AWS_REGION);
+  // 初期化されていない場合は到着時刻
+  if (!IS_VALID_MUTEX_VALUE(mediaClock.lock) || track >= MEDIA_CLOCK_TRACK_COUNT) {
+    return arrivalTime;
+  }
 
-  // KMSキーID
-  channelInfo.pKmsKeyId = NULL;
+  MUTEX_LOCK(mediaClock.lock);
 
-  // ストリームに紐付くタグの数
-  channelInfo.tagCount = 0;
+  // オフセットを更新 (初回とPTSの不連続時は再同期)
+  if (!mediaClock.initialized || ABS(difference - mediaClock.offset) > MEDIA_CLOCK_RESYNC_THRESHOLD) {
+    if (mediaClock.initialized) {
+      DLOGW("Media clock resynchronized: offset changed by %" PRId64 " ms",
+            (difference - mediaClock.offset) / HUNDREDS_OF_NANOS_IN_A_MILLISECOND);
+    }
+    mediaClock.offset = difference;
+    mediaClock.initialized = TRUE;
+  } else if (difference < mediaClock.offset) {
+    mediaClock.offset = difference;
+  } else {
+    mediaClock.offset += (difference - mediaClock.offset) / MEDIA_CLOCK_DRIFT_SMOOTHING;
+  }
 
-  // ストリームに紐付くタグ
-  channelInfo.pTags = NULL;
+  // トラックごとの差を平滑化 (A/Vオフセット計測用)
+  if (!mediaClock.trackInitialized[track]) {
+    mediaClock.trackOffsets[track] = difference;
+    mediaClock.trackInitialized[track] = TRUE;
+  } else {
+    mediaClock.trackOffsets[track] += (difference - mediaClock.trackOffsets[track]) / MEDIA_CLOCK_TRACK_SMOOTHING;
+  }
 
-  // チャネルタイプ
-  channelInfo.channelType = SIGNALING_CHANNEL_TYPE_SINGLE_MASTER;
+  // トラックごとに単調増加させる
+  timestamp = static_cast<UINT64>(static_cast<INT64>(pts) + mediaClock.offset);
+  if (timestamp <= mediaClock.lastTimestamps[track]) {
+    timestamp = mediaClock.lastTimestamps[track] + 1;
+  }
+  mediaClock.lastTimestamps[track] = timestamp;
 
-  // チャネルロールタイプ
-  channelInfo.channelRoleType = SIGNALING_CHANNEL_ROLE_TYPE_MASTER;
+  MUTEX_UNLOCK(mediaClock.lock);
 
-  // キャッシュポリシー
-  channelInfo.cachingPolicy = SIGNALING_API_CALL_CACHE_TYPE_FILE;
+  // ジッタを記録
+  addLatencySample(mediaClock.jitter, static_cast<UINT64>(MAX(static_cast<INT64>(arrivalTime) - static_cast<INT64>(timestamp), 0)));
 
-  // キャッシュ期間
-  channelInfo.cachingPeriod = SIGNALING_API_CALL_CACHE_TTL_SENTINEL_VALUE;
+  return timestamp;
+}
 
-  // ICEサーバーの構成情報を非同期で取得する
-  channelInfo.asyncIceServerConfig = TRUE;
+/**
+ * @brief メディアクロックのA/Vオフセットとジッタを出力する
+ */
+VOID logMediaClockStats(MediaClock& mediaClock)
+{
+  INT64 avOffset = 0;
+  BOOL hasAvOffset;
 
-  // エラーの発生時に再試行する
-  channelInfo.retry = TRUE;
+  // 初期化されていない場合は無視
+  if (!IS_VALID_MUTEX_VALUE(mediaClock.lock)) {
+    return;
+  }
 
-  // 再接続する
-  channelInfo.reconnect = TRUE;
+  // オーディオの到着遅れからビデオの到着遅れを引いたA/Vオフセット
+  MUTEX_LOCK(mediaClock.lock);
+  hasAvOffset = mediaClock.trackInitialized[MEDIA_CLOCK_TRACK_VIDEO] && mediaClock.trackInitialized[MEDIA_CLOCK_TRACK_AUDIO];
+  if (hasAvOffset) {
+    avOffset = mediaClock.trackOffsets[MEDIA_CLOCK_TRACK_AUDIO] - mediaClock.trackOffsets[MEDIA_CLOCK_TRACK_VIDEO];
+  }
+  MUTEX_UNLOCK(mediaClock.lock);
 
-  // CA証明書のパス
-  channelInfo.pCertPath = pCaCertPath;
+  // ログを出力
+  if (hasAvOffset) {
+    DLOGP("avOffset: %.2f ms", static_cast<DOUBLE>(avOffset) / HUNDREDS_OF_NANOS_IN_A_MILLISECOND);
+  }
+  logLatencyStats("timestampJitter", mediaClock.jitter);
+}
 
-  // メッセージのTTL (60ns)
-  channelInfo.messageTtl = 0;
+/**
+ * @brief フレームペーサーを初期化して送信スレッドを開始する
+ *
+ * writeFrameはフレーム単位でRTPパケットを送出するため、フレームを分割せず
+ * トークンバケットで次のフレームの送出を遅らせることでキーフレーム後のバーストを分散する。
+ * 上りは全セッションで共有されるため、バケットもセッション間で共有する。
+ */
+STATUS initFramePacer(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto& framePacer = pKvsWebrtcConfig->framePacer;
+
+  // 設定
+  framePacer.threadId = INVALID_TID_VALUE;
+  framePacer.rate = static_cast<DOUBLE>(getEnvUint32(PACING_RATE_ENV_VAR, DEFAULT_PACING_RATE)) / 8;
+  framePacer.burst = static_cast<DOUBLE>(getEnvUint32(PACING_BURST_ENV_VAR, DEFAULT_PACING_BURST));
+  framePacer.maxDelay = getEnvUint32(PACING_MAX_DELAY_ENV_VAR, DEFAULT_PACING_MAX_DELAY_MS) * HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+  framePacer.tokens = framePacer.burst;
+  framePacer.lastRefillTime = GETTIME();
+  ATOMIC_STORE_BOOL(&framePacer.isTerminated, FALSE);
+
+  // レートが設定されていない場合は無効
+  pKvsWebrtcConfig->pacingEnabled = framePacer.rate > 0;
+  CHK(pKvsWebrtcConfig->pacingEnabled, retStatus);
+
+  // 同期オブジェクトとメトリクス
+  framePacer.lock = MUTEX_CREATE(FALSE);
+  framePacer.cvar = CVAR_CREATE();
+  CHK_STATUS(initLatencyStats(framePacer.delay, LATENCY_STATS_CAPACITY));
+
+  // 送信スレッドを開始
+  CHK_STATUS(THREAD_CREATE(&framePacer.threadId, framePacerRoutine, reinterpret_cast<PVOID>(pKvsWebrtcConfig)));
+  DLOGI("Frame pacing enabled: rate: %.0f bytes/s, burst: %.0f bytes, max delay: %" PRIu64 " ms",
+        framePacer.rate,
+        framePacer.burst,
+        framePacer.maxDelay / HUNDREDS_OF_NANOS_IN_A_MILLISECOND);
 
 CleanUp:
 
@@ -423,26 +1329,37 @@ CleanUp:
 }
 
 /**
- * @brief コールバックを初期化する
+ * @brief フレームペーサーの送信スレッドを停止して解放する
  */
-STATUS initCallbacks(UINT64 customData, SignalingClientCallbacks& callbacks)
+STATUS freeFramePacer(PKvsWebrtcConfig pKvsWebrtcConfig)
 {
   auto retStatus = STATUS_SUCCESS;
 
-  // コールバックのバージョン
-  callbacks.version = SIGNALING_CLIENT_CALLBACKS_CURRENT_VERSION;
-
-  // カスタムデータ
-  callbacks.customData = customData;
+  // NULLチェック
+  CHK(pKvsWebrtcConfig, STATUS_NULL_ARG);
 
-  // メッセージの受信時
-  callbacks.messageReceivedFn = onSignalingMessageReceived;
+  // 初期化されていない場合は何もしない
+  CHK(IS_VALID_MUTEX_VALUE(pKvsWebrtcConfig->framePacer.lock), retStatus);
+
+  // 送信スレッドを停止
+  MUTEX_LOCK(pKvsWebrtcConfig->framePacer.lock);
+  ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->framePacer.isTerminated, TRUE);
+  CVAR_BROADCAST(pKvsWebrtcConfig->framePacer.cvar);
+  MUTEX_UNLOCK(pKvsWebrtcConfig->framePacer.lock);
+  if (IS_VALID_TID_VALUE(pKvsWebrtcConfig->framePacer.threadId)) {
+    THREAD_JOIN(pKvsWebrtcConfig->framePacer.threadId, nullptr);
+    pKvsWebrtcConfig->framePacer.threadId = INVALID_TID_VALUE;
+  }
 
-  // クライアント状態の変化時
-  callbacks.stateChangeFn = onSignalingClientStateChanged;
+  // 送信待ちのフレームを破棄
+  pKvsWebrtcConfig->framePacer.frames.clear();
 
-  // エラーの発生時
-  callbacks.errorReportFn = onSignalingClientError;
+  // 同期オブジェクトとメトリクスを解放
+  CVAR_FREE(pKvsWebrtcConfig->framePacer.cvar);
+  MUTEX_FREE(pKvsWebrtcConfig->framePacer.lock);
+  pKvsWebrtcConfig->framePacer.lock = INVALID_MUTEX_VALUE;
+  freeLatencyStats(pKvsWebrtcConfig->framePacer.delay);
+  pKvsWebrtcConfig->pacingEnabled = FALSE;
 
 CleanUp:
 
@@ -450,399 +1367,532 @@ CleanUp:
 }
 
 /**
- * @brief メトリクスを初期化する
+ * @brief フレームをペーシングのキューに追加する
  */
-STATUS initMetrics(SignalingClientMetrics& metrics)
+VOID enqueuePacedFrame(PKvsWebrtcConfig pKvsWebrtcConfig,
+                       PKvsWebrtcStreamingSession pStreamingSession,
+                       Frame& frame,
+                       const std::shared_ptr<std::vector<BYTE>>& pData)
 {
-  auto retStatus = STATUS_SUCCESS;
+  auto& framePacer = pKvsWebrtcConfig->framePacer;
 
-  // シグナリングクライアントに関するメトリクスのバージョン
-  metrics.version = SIGNALING_CLIENT_METRICS_CURRENT_VERSION;
+  MUTEX_LOCK(framePacer.lock);
 
-CleanUp:
+  // 停止している場合は破棄
+  if (!ATOMIC_LOAD_BOOL(&framePacer.isTerminated)) {
+    framePacer.frames.push_back({pStreamingSession->peerClientId, frame, pData, GETTIME()});
+    CVAR_SIGNAL(framePacer.cvar);
+  }
 
-  return retStatus;
+  MUTEX_UNLOCK(framePacer.lock);
 }
 
 /**
- * @brief ピア接続を初期化する
+ * @brief フレームペーサーの送信スレッド
  */
-STATUS initPeerConnection(PKvsWebrtcConfig pKvsWebrtcConfig, PRtcPeerConnection& pPeerConnection)
+PVOID framePacerRoutine(PVOID arg)
 {
-  ENTERS();
-  auto retStatus = STATUS_SUCCESS;
-  RtcConfiguration configuration;
-  UINT32 i, j, iceConfigCount, uriCount = 0;
-  PIceConfigInfo pIceConfigInfo;
+  auto pKvsWebrtcConfig = reinterpret_cast<PKvsWebrtcConfig>(arg);
+  auto& framePacer = pKvsWebrtcConfig->framePacer;
+  auto waited = TRUE;
+  PacedFrame pacedFrame;
+  UINT64 now, queuedTime;
+
+  // 配信スレッドとして配置
+  applyThreadPolicy(pKvsWebrtcConfig->pKvsWebrtcHost, THREAD_ROLE_FANOUT);
+
+  MUTEX_LOCK(framePacer.lock);
+
+  while (!ATOMIC_LOAD_BOOL(&framePacer.isTerminated)) {
+    // キューが空の場合は追加されるまで待機
+    if (framePacer.frames.empty()) {
+      CVAR_WAIT(framePacer.cvar, framePacer.lock, INFINITE_TIME_VALUE);
+      waited = TRUE;
+      continue;
+    }
 
-  // ピア接続の設定を初期化
-  MEMSET(&configuration, 0x00, SIZEOF(RtcConfiguration));
-
-  // ネットワークインターフェースを制限するためのフィルター関数
-  configuration.kvsRtcConfiguration.iceSetInterfaceFilterFunc = NULL;
-
-  // ICEモード
-  configuration.iceTransportPolicy = ICE_TRANSPORT_POLICY_ALL;
+    // 経過時間分のトークンを補充
+    now = GETTIME();
+    framePacer.tokens = MIN(framePacer.burst,
+                            framePacer.tokens + static_cast<DOUBLE>(now - framePacer.lastRefillTime) * framePacer.rate / HUNDREDS_OF_NANOS_IN_A_SECOND);
+    framePacer.lastRefillTime = now;
+
+    // トークンが不足している場合は補充されるか遅延の上限に達するまで待機
+    queuedTime = now - framePacer.frames.front().enqueueTime;
+    if (framePacer.tokens < 0 && queuedTime < framePacer.maxDelay) {
+      CVAR_WAIT(framePacer.cvar,
+                framePacer.lock,
+                MIN(static_cast<UINT64>(-framePacer.tokens * HUNDREDS_OF_NANOS_IN_A_SECOND / framePacer.rate) + 1, framePacer.maxDelay - queuedTime));
+      waited = TRUE;
+      continue;
+    }
 
-  // STUNサーバーのエンドポイント
-  SNPRINTF(configuration.iceServers[0].urls,
-           MAX_ICE_CONFIG_URI_LEN,
-           KINESIS_VIDEO_STUN_URL,
-           pKvsWebrtcConfig->channelInfo.pRegion,
-           KINESIS_VIDEO_STUN_URL_POSTFIX);
+    // 先頭のフレームを取り出してトークンを消費 (大きなフレームは負になり次のフレームを待たせる)
+    pacedFrame = std::move(framePacer.frames.front());
+    framePacer.frames.pop_front();
+    if (framePacer.tokens < 0) {
+      framePacer.forcedCount++;
+    }
+    framePacer.tokens -= pacedFrame.frame.size;
+
+    // メトリクスを記録
+    framePacer.frameCount++;
+    framePacer.byteCount += pacedFrame.frame.size;
+    framePacer.burstBytes = (waited ? 0 : framePacer.burstBytes) + pacedFrame.frame.size;
+    framePacer.maxBurstBytes = MAX(framePacer.maxBurstBytes, framePacer.burstBytes);
+    waited = FALSE;
+    addLatencySample(framePacer.delay, queuedTime);
+
+    // ロックを解除して送信
+    MUTEX_UNLOCK(framePacer.lock);
+    writePacedFrame(pKvsWebrtcConfig, pacedFrame);
+    pacedFrame.pData.reset();
+    MUTEX_LOCK(framePacer.lock);
+  }
 
-  // TURNサーバーの設定
-  CHK_STATUS(signalingClientGetIceConfigInfoCount(pKvsWebrtcConfig->signalingHandle, &iceConfigCount));
+  MUTEX_UNLOCK(framePacer.lock);
 
-  // TURNサーバーを1つだけ使用 (候補収集の遅延を最適化)
-  for (uriCount = 0, i = 0; i < 1 && i < iceConfigCount; i++) {
-    CHK_STATUS(signalingClientGetIceConfigInfo(pKvsWebrtcConfig->signalingHandle, i, &pIceConfigInfo));
+  releaseThreadPolicy(pKvsWebrtcConfig->pKvsWebrtcHost);
 
-    for (j = 0; j < pIceConfigInfo->uriCount; j++) {
-      CHECK(uriCount < MAX_ICE_SERVERS_COUNT);
+  return nullptr;
+}
 
-      DLOGD("TURN server %d urls: %s", j + 1, pIceConfigInfo->uris[j]);
+/**
+ * @brief ペーシングしたフレームを送信する
+ */
+VOID writePacedFrame(PKvsWebrtcConfig pKvsWebrtcConfig, PacedFrame& pacedFrame)
+{
+  STATUS status;
+  UINT64 writeStartTime;
 
-      STRNCPY(configuration.iceServers[uriCount + 1].urls, pIceConfigInfo->uris[j], MAX_ICE_CONFIG_URI_LEN);
-      STRNCPY(configuration.iceServers[uriCount + 1].credential, pIceConfigInfo->password, MAX_ICE_CONFIG_CREDENTIAL_LEN);
-      STRNCPY(configuration.iceServers[uriCount + 1].username, pIceConfigInfo->userName, MAX_ICE_CONFIG_USER_NAME_LEN);
+  MUTEX_LOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
 
-      uriCount++;
+  // 待機中に終了したセッションには送信しない
+  auto it = pKvsWebrtcConfig->streamingSessions.find(pacedFrame.peerClientId);
+  if (it != pKvsWebrtcConfig->streamingSessions.end() && it->second && !ATOMIC_LOAD_BOOL(&it->second->isTerminated)) {
+    AllocationScope allocationScope(ALLOCATION_TAG_PEER_CONNECTION, it->second->allocationSlot);
+    pacedFrame.frame.index = static_cast<UINT32>(ATOMIC_INCREMENT(&it->second->frameIndex));
+    pacedFrame.frame.frameData = pacedFrame.pData->data();
+
+    // フレームを送信 (パケット化と暗号化にかかった時間をセッションごとに集計)
+    writeStartTime = GETTIME();
+    status = writeFrame(it->second->pVideoRtcRtpTransceiver, &pacedFrame.frame);
+    ATOMIC_ADD(&it->second->writeTime, GETTIME() - writeStartTime);
+    ATOMIC_INCREMENT(&it->second->writtenFrames);
+    if (STATUS_FAILED(status) && status != STATUS_SRTP_NOT_READY_YET) {
+      DLOGV("writeFrame failed: 0x%08x", status);
+    } else if (STATUS_SUCCEEDED(status)) {
+      ATOMIC_INCREMENT(&pKvsWebrtcConfig->sentFrameCount);
+      ATOMIC_ADD(&pKvsWebrtcConfig->sentByteCount, pacedFrame.frame.size);
     }
   }
 
-  // ICEサーバーの数を保存
-  pKvsWebrtcConfig->iceUriCount = uriCount + 1;
-
-  // ピア接続を作成
-  CHK_STATUS(createPeerConnection(&configuration, &pPeerConnection));
-
-CleanUp:
-
-  LEAVES();
-  return retStatus;
+  MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
 }
 
-// ============================================================================
-// シグナリング
-// ============================================================================
-
 /**
- * @brief シグナリングクライアントを初期化する
+ * @brief フレームペーサーのメトリクスを出力してリセットする
  */
-STATUS initSignaling(PKvsWebrtcConfig pKvsWebrtcConfig)
+VOID logFramePacerStats(FramePacer& framePacer)
 {
-  auto retStatus = STATUS_SUCCESS;
+  UINT64 frameCount, byteCount, forcedCount, maxBurstBytes;
+  size_t queued;
 
-  // シグナリングクライアントを作成
-  CHK_STATUS(createSignalingClientSync(&pKvsWebrtcConfig->clientInfo,
-                                       &pKvsWebrtcConfig->channelInfo,
-                                       &pKvsWebrtcConfig->callbacks,
-                                       pKvsWebrtcConfig->pCredentialProvider,
-                                       &pKvsWebrtcConfig->signalingHandle));
+  // 初期化されていない場合は無視
+  if (!IS_VALID_MUTEX_VALUE(framePacer.lock)) {
+    return;
+  }
 
-  // シグナリングクライアントの接続に必要な情報を取得
-  CHK_STATUS(signalingClientFetchSync(pKvsWebrtcConfig->signalingHandle));
+  // カウンタを取り出してリセット
+  MUTEX_LOCK(framePacer.lock);
+  frameCount = framePacer.frameCount;
+  byteCount = framePacer.byteCount;
+  forcedCount = framePacer.forcedCount;
+  maxBurstBytes = framePacer.maxBurstBytes;
+  queued = framePacer.frames.size();
+  framePacer.frameCount = 0;
+  framePacer.byteCount = 0;
+  framePacer.forcedCount = 0;
+  framePacer.maxBurstBytes = 0;
+  MUTEX_UNLOCK(framePacer.lock);
 
-  // シグナリングクライアントを接続
-  CHK_STATUS(signalingClientConnectSync(pKvsWebrtcConfig->signalingHandle));
+  // ログを出力
+  DLOGP("framePacer: frames: %" PRIu64 ", bytes: %" PRIu64 ", forced: %" PRIu64 ", maxBurst: %" PRIu64 " bytes, queued: %zu",
+        frameCount,
+        byteCount,
+        forcedCount,
+        maxBurstBytes,
+        queued);
+  logLatencyStats("pacingDelay", framePacer.delay);
+}
 
-  // シグナリングクライアントに関するメトリクスを取得
-  CHK_STATUS(signalingClientGetMetrics(pKvsWebrtcConfig->signalingHandle, &pKvsWebrtcConfig->metrics));
+/**
+ * @brief レイテンシ計測用SEIを作成する
+ *
+ * user_data_unregistered (payloadType=5) のSEI NALユニットをAnnex-B形式で作成する。
+ * タイムスタンプは1バイトあたり7ビットで最上位ビットを立てて格納するため、
+ * ペイロードに0x00が現れずエミュレーション防止バイトを考慮せずに書き換えられる。
+ */
+VOID buildLatencySei(UINT64 captureTime, std::vector<BYTE>& sei)
+{
+  // スタートコード、NALヘッダ (nal_unit_type=6)、payloadType、payloadSize
+  sei.assign({0x00, 0x00, 0x00, 0x01, 0x06, 0x05, static_cast<BYTE>(latencySeiPayloadLen)});
 
-  // ログを出力
-  DLOGP(     "getTokenCallTime: %" PRIu64 " ms", pKvsWebrtcConfig->metrics.signalingClientStats.getTokenCallTime);
-  DLOGP(     "describeCallTime: %" PRIu64 " ms", pKvsWebrtcConfig->metrics.signalingClientStats.describeCallTime);
-  DLOGP("describeMediaCallTime: %" PRIu64 " ms", pKvsWebrtcConfig->metrics.signalingClientStats.describeMediaCallTime);
-  DLOGP(       "createCallTime: %" PRIu64 " ms", pKvsWebrtcConfig->metrics.signalingClientStats.createCallTime);
-  DLOGP(  "getEndpointCallTime: %" PRIu64 " ms", pKvsWebrtcConfig->metrics.signalingClientStats.getEndpointCallTime);
-  DLOGP( "getIceConfigCallTime: %" PRIu64 " ms", pKvsWebrtcConfig->metrics.signalingClientStats.getIceConfigCallTime);
-  DLOGP(      "connectCallTime: %" PRIu64 " ms", pKvsWebrtcConfig->metrics.signalingClientStats.connectCallTime);
-  DLOGP(  "joinSessionCallTime: %" PRIu64 " ms", pKvsWebrtcConfig->metrics.signalingClientStats.joinSessionCallTime);
-  DLOGP(     "createClientTime: %" PRIu64 " ms", pKvsWebrtcConfig->metrics.signalingClientStats.createClientTime);
-  DLOGP(      "fetchClientTime: %" PRIu64 " ms", pKvsWebrtcConfig->metrics.signalingClientStats.fetchClientTime);
-  DLOGP(    "connectClientTime: %" PRIu64 " ms", pKvsWebrtcConfig->metrics.signalingClientStats.connectClientTime);
+  // UUID
+  sei.insert(sei.end(), latencySeiUuid, latencySeiUuid + SIZEOF(latencySeiUuid));
 
-CleanUp:
+  // タイムスタンプ
+  sei.resize(sei.size() + LATENCY_SEI_TIMESTAMP_LEN * LATENCY_SEI_TIMESTAMP_COUNT);
+  auto pTimestamps = sei.data() + sei.size() - LATENCY_SEI_TIMESTAMP_LEN * LATENCY_SEI_TIMESTAMP_COUNT;
+  setLatencySeiTimestamp(pTimestamps, LATENCY_SEI_TIMESTAMP_CAPTURE, captureTime);
+  setLatencySeiTimestamp(pTimestamps, LATENCY_SEI_TIMESTAMP_APPSINK, 0);
+  setLatencySeiTimestamp(pTimestamps, LATENCY_SEI_TIMESTAMP_WRITE, 0);
 
-  return retStatus;
+  // rbsp_trailing_bits
+  sei.push_back(0x80);
 }
 
 /**
- * @brief シグナリングクライアントを解放する
+ * @brief アクセスユニットからレイテンシ計測用SEIのタイムスタンプ領域を探す
  */
-STATUS deinitSignaling(PKvsWebrtcConfig pKvsWebrtcConfig)
+PBYTE findLatencySei(PBYTE pData, UINT32 size)
 {
-  auto retStatus = STATUS_SUCCESS;
-
-  // NULLチェック
-  CHK(pKvsWebrtcConfig, retStatus);
+  UINT32 pos, type;
 
-  // 終了フラグをON
-  ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->isTerminated, TRUE);
+  for (pos = findNextNalStart(pData, size, 0); pos < size; pos = findNextNalStart(pData, size, pos)) {
+    type = pData[pos] & 0x1F;
 
-  // シグナリングクライアントを解放
-  CHK_STATUS(freeSignalingClient(&pKvsWebrtcConfig->signalingHandle));
+    // SEIはVCL NALユニットより前にしか存在しない
+    if (type >= 1 && type <= 5) {
+      break;
+    }
 
-CleanUp:
+    // 自身が埋め込んだSEIか確認
+    if (type == 6 &&
+        pos + 3 + latencySeiPayloadLen <= size &&
+        pData[pos + 1] == 0x05 &&
+        pData[pos + 2] == latencySeiPayloadLen &&
+        MEMCMP(pData + pos + 3, latencySeiUuid, SIZEOF(latencySeiUuid)) == 0) {
+      return pData + pos + 3 + SIZEOF(latencySeiUuid);
+    }
+  }
 
-  return retStatus;
+  return nullptr;
 }
 
 /**
- * @brief シグナリングのメインループ
+ * @brief アクセスユニットから最初のVCL NALユニットの位置を探す
  */
-STATUS loopSignaling(PKvsWebrtcConfig pKvsWebrtcConfig)
+UINT32 findH264VclOffset(PBYTE pData, UINT32 size)
 {
-  ENTERS();
-  auto retStatus = STATUS_SUCCESS;
-  auto isConfigObjLocked = FALSE;
+  UINT32 pos, type;
 
-  // メインループ
-  while (!ATOMIC_LOAD_BOOL(&pKvsWebrtcConfig->isInterrupted)) {
-    // ロックを開始
-    MUTEX_LOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
-    isConfigObjLocked = TRUE;
+  for (pos = findNextNalStart(pData, size, 0); pos < size; pos = findNextNalStart(pData, size, pos)) {
+    type = pData[pos] & 0x1F;
 
-    // 終了したストリーミングセッションを解放
-    for (auto&& value : pKvsWebrtcConfig->streamingSessions) {
-      if (ATOMIC_LOAD_BOOL(&value.second->isTerminated)) {
-        CHK_STATUS(freeKvsWebrtcStreamingSession(value.second));
-      }
+    if (type >= 1 && type <= 5) {
+      // スタートコードの先頭を返す (4バイトのスタートコードにも対応)
+      return (pos >= 4 && pData[pos - 4] == 0x00) ? pos - 4 : pos - 3;
     }
+  }
 
-    // 解放したストリーミングセッションをマップから削除
-    std::erase_if(pKvsWebrtcConfig->streamingSessions, [](auto&& value) {
-      return !value.second;
-    });
+  return 0;
+}
 
-    // シグナリングクライアントの再作成が必要か確認
-    if (ATOMIC_LOAD_BOOL(&pKvsWebrtcConfig->recreateSignalingClient)) {
-      // シグナリングクライアントを再作成
-      DLOGI("Recreating signaling client");
-      CHK_STATUS(freeSignalingClient(&pKvsWebrtcConfig->signalingHandle));
-      CHK_STATUS(createSignalingClientSync(&pKvsWebrtcConfig->clientInfo,
-                                           &pKvsWebrtcConfig->channelInfo,
-                                           &pKvsWebrtcConfig->callbacks,
-                                           pKvsWebrtcConfig->pCredentialProvider,
-                                           &pKvsWebrtcConfig->signalingHandle));
-      CHK_STATUS(signalingClientFetchSync(pKvsWebrtcConfig->signalingHandle));
-      CHK_STATUS(signalingClientConnectSync(pKvsWebrtcConfig->signalingHandle));
-      ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->recreateSignalingClient, FALSE);
-    }
-
-    // 5秒間スリープ
-    CVAR_WAIT(pKvsWebrtcConfig->cvar, pKvsWebrtcConfig->kvsWebrtcConfigObjLock, (5 * HUNDREDS_OF_NANOS_IN_A_SECOND));
-
-    // ロックを解除
-    MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
-    isConfigObjLocked = FALSE;
+/**
+ * @brief レイテンシ計測用SEIのタイムスタンプを取得する
+ */
+UINT64 getLatencySeiTimestamp(PBYTE pTimestamps, LatencySeiTimestamp index)
+{
+  auto pTimestamp = pTimestamps + index * LATENCY_SEI_TIMESTAMP_LEN;
+  UINT64 value = 0;
+
+  for (UINT32 i = 0; i < LATENCY_SEI_TIMESTAMP_LEN; i++) {
+    value = (value << 7) | (pTimestamp[i] & 0x7F);
   }
 
-CleanUp:
+  return value;
+}
 
-  CHK_LOG_ERR(retStatus);
+/**
+ * @brief レイテンシ計測用SEIのタイムスタンプを設定する
+ */
+VOID setLatencySeiTimestamp(PBYTE pTimestamps, LatencySeiTimestamp index, UINT64 value)
+{
+  auto pTimestamp = pTimestamps + index * LATENCY_SEI_TIMESTAMP_LEN;
 
-  if (isConfigObjLocked) {
-    MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  for (INT32 i = LATENCY_SEI_TIMESTAMP_LEN - 1; i >= 0; i--) {
+    pTimestamp[i] = static_cast<BYTE>(0x80 | (value & 0x7F));
+    value >>= 7;
   }
-
-  LEAVES();
-  return retStatus;
 }
 
 // ============================================================================
-// WebRTCセッション処理
+// KvsWebrtcHost 管理
 // ============================================================================
 
 /**
- * @brief SDPオファーを処理する
+ * @brief チャネル間で共有するリソースを作成する
+ *
+ * 認証情報プロバイダーとスレッドプールを全チャネルで共有し、
+ * チャネルごとに認証情報の更新やスレッドが重複しないようにする。
  */
-STATUS handleOffer(PKvsWebrtcConfig pKvsWebrtcConfig, PKvsWebrtcStreamingSession pStreamingSession, SignalingMessage& signalingMessage)
+STATUS createKvsWebrtcHost(std::unique_ptr<KvsWebrtcHost>& pKvsWebrtcHost)
 {
-  UNUSED_PARAM(pKvsWebrtcConfig);
   auto retStatus = STATUS_SUCCESS;
-  RtcSessionDescriptionInit sessionDescriptionInit;
-  NullableBool canTrickle;
 
-  // セッション情報を初期化
-  MEMSET(&sessionDescriptionInit, 0x00, SIZEOF(RtcSessionDescriptionInit));
+  // ホストを初期化
+  pKvsWebrtcHost = std::make_unique<KvsWebrtcHost>();
 
-  // セッション情報を取得
-  CHK_STATUS(deserializeSessionDescriptionInit(signalingMessage.payload,
-                                               signalingMessage.payloadLen,
-                                               &sessionDescriptionInit));
+  // 中断フラグ
+  ATOMIC_STORE_BOOL(&pKvsWebrtcHost->isInterrupted, FALSE);
+
+  // 保護用ミューテックスと条件変数
+  pKvsWebrtcHost->lock = MUTEX_CREATE(FALSE);
+  pKvsWebrtcHost->cvar = CVAR_CREATE();
+  pKvsWebrtcHost->threadLock = MUTEX_CREATE(FALSE);
+  pKvsWebrtcHost->reaperThreadId = INVALID_TID_VALUE;
+
+  // シグナリングメッセージとSDPのバッファプール
+  CHK_STATUS(initBufferPool(pKvsWebrtcHost->signalingMessagePool, SIZEOF(SignalingMessage), SIGNALING_MESSAGE_POOL_MAX_FREE));
+  CHK_STATUS(initBufferPool(pKvsWebrtcHost->sessionDescriptionPool, SIZEOF(RtcSessionDescriptionInit), SESSION_DESCRIPTION_POOL_MAX_FREE));
+
+  // データチャネルのメッセージの送信用バッファプールと疎通確認の間隔
+  CHK_STATUS(initBufferPool(pKvsWebrtcHost->dataChannelMessagePool, DATA_CHANNEL_MAX_MESSAGE_SIZE, DATA_CHANNEL_MESSAGE_POOL_MAX_FREE));
+  pKvsWebrtcHost->dataChannelPingInterval =
+    static_cast<UINT64>(getEnvUint32(DATA_CHANNEL_PING_INTERVAL_ENV_VAR, DEFAULT_DATA_CHANNEL_PING_INTERVAL_MS)) * HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+
+  // 定期処理の間隔 (5秒、音声の適応制御とデータチャネルの疎通確認の間隔の方が短い場合はその間隔)
+  pKvsWebrtcHost->serviceInterval = MIN(static_cast<UINT64>(5 * HUNDREDS_OF_NANOS_IN_A_SECOND), static_cast<UINT64>(AUDIO_ADAPT_INTERVAL));
+  if (pKvsWebrtcHost->dataChannelPingInterval != 0) {
+    pKvsWebrtcHost->serviceInterval = MIN(pKvsWebrtcHost->serviceInterval, pKvsWebrtcHost->dataChannelPingInterval);
+  }
 
-  // リモートのピア接続を設定
-  CHK_STATUS(setRemoteDescription(pStreamingSession->pPeerConnection, &sessionDescriptionInit));
+  // スレッドの配置 (以降に作成するSDKのスレッドはメインスレッドの配置を継承する)
+  CHK_STATUS(initThreadPolicies(pKvsWebrtcHost.get()));
+  applyThreadPolicy(pKvsWebrtcHost.get(), THREAD_ROLE_SIGNALING);
 
-  // リモートがTrickle ICEをサポートしているか確認
-  canTrickle = canTrickleIceCandidates(pStreamingSession->pPeerConnection);
+  // 終了したセッションを解放するスレッドを開始
+  CHK_STATUS(startSessionReaper(pKvsWebrtcHost.get()));
 
-  // setRemoteDescription後はNULLにならない
-  CHECK(!NULLABLE_CHECK_EMPTY(canTrickle));
-  pStreamingSession->remoteCanTrickleIce = canTrickle.value;
+  // CA証明書のパスを取得
+  CHK_STATUS(getCaCertPath(pKvsWebrtcHost->pCaCertPath));
 
-  // ローカルのピア接続を設定
-  CHK_STATUS(setLocalDescription(pStreamingSession->pPeerConnection, &pStreamingSession->answerSessionDescriptionInit));
+  // 認証情報プロバイダーを作成
+  CHK_STATUS(createCredentialProvider(pKvsWebrtcHost->pCaCertPath, pKvsWebrtcHost->pCredentialProvider));
 
-  // Trickle ICEをサポートしている場合は即座にアンサーを送信
-  // サポートしていない場合はICE候補収集完了後に送信 (onIceCandidateHandlerで処理)
-  if (pStreamingSession->remoteCanTrickleIce) {
-    // SDPアンサーを作成
-    CHK_STATUS(createAnswer(pStreamingSession->pPeerConnection, &pStreamingSession->answerSessionDescriptionInit));
+  // スレッドプールを作成
+  CHK_STATUS(threadpoolCreate(&pKvsWebrtcHost->pThreadpool, HOST_THREADPOOL_MIN_THREADS, HOST_THREADPOOL_MAX_THREADS));
 
-    // SDPアンサーを送信
-    CHK_STATUS(sendAnswer(pStreamingSession));
-  }
+  // メトリクスの出力間隔
+  pKvsWebrtcHost->metricsInterval = getEnvUint32(METRICS_INTERVAL_ENV_VAR, DEFAULT_METRICS_INTERVAL_SECONDS) * HUNDREDS_OF_NANOS_IN_A_SECOND;
+  pKvsWebrtcHost->lastMetricsTime = GETTIME();
+  pKvsWebrtcHost->lastCpuTime = getProcessCpuTime();
+
+  // アドミッション制御の予算
+  pKvsWebrtcHost->maxCpuPercent = getEnvUint32(MAX_CPU_ENV_VAR, DEFAULT_MAX_CPU_PERCENT);
+  pKvsWebrtcHost->maxEgressBitrate = getEnvUint32(MAX_EGRESS_BITRATE_ENV_VAR, DEFAULT_MAX_EGRESS_BITRATE);
+  pKvsWebrtcHost->maxResidentBytes = static_cast<UINT64>(getEnvUint32(MAX_RSS_ENV_VAR, DEFAULT_MAX_RSS_MB)) * 1024 * 1024;
+  pKvsWebrtcHost->lastLoadTime = GETTIME();
+  getSystemCpuTicks(pKvsWebrtcHost->lastCpuTotalTicks, pKvsWebrtcHost->lastCpuIdleTicks);
 
 CleanUp:
 
-  CHK_LOG_ERR(retStatus);
+  if (STATUS_FAILED(retStatus)) {
+    freeKvsWebrtcHost(pKvsWebrtcHost);
+  }
 
   return retStatus;
 }
 
 /**
- * @brief SDPアンサーを送信する
+ * @brief チャネル間で共有するリソースとチャネルを解放する
  */
-STATUS sendAnswer(PKvsWebrtcStreamingSession pStreamingSession)
+STATUS freeKvsWebrtcHost(std::unique_ptr<KvsWebrtcHost>& pKvsWebrtcHost)
 {
   auto retStatus = STATUS_SUCCESS;
-  auto pKvsWebrtcConfig = pStreamingSession->pKvsWebrtcConfig;
-  auto isLocked = FALSE;
-  UINT32 signalingMessageLen = MAX_SIGNALING_MESSAGE_LEN;
-  SignalingMessage signalingMessage;
 
-  // SDPアンサーをシリアライズ
-  CHK_STATUS(serializeSessionDescriptionInit(&pStreamingSession->answerSessionDescriptionInit,
-                                             signalingMessage.payload,
-                                             &signalingMessageLen));
+  // NULLチェック
+  CHK(pKvsWebrtcHost, retStatus);
 
-  // シグナリングメッセージのバージョン
-  signalingMessage.version = SIGNALING_MESSAGE_CURRENT_VERSION;
+  // スレッドプールを解放 (実行中のタスクの完了を待つ)
+  if (pKvsWebrtcHost->pThreadpool) {
+    threadpoolFree(pKvsWebrtcHost->pThreadpool);
+    pKvsWebrtcHost->pThreadpool = nullptr;
+  }
 
-  // シグナリングメッセージのタイプ
-  signalingMessage.messageType = SIGNALING_MESSAGE_TYPE_ANSWER;
+  // 解放待ちのセッションを解放してスレッドを停止 (セッションはチャネルを参照するためチャネルより先に解放する)
+  stopSessionReaper(pKvsWebrtcHost.get());
 
-  // クライアントID
-  STRNCPY(signalingMessage.peerClientId, pStreamingSession->peerClientId, MAX_SIGNALING_CLIENT_ID_LEN);
+  // チャネルを解放
+  for (auto&& pKvsWebrtcConfig : pKvsWebrtcHost->channels) {
+    freeKvsWebrtcConfig(pKvsWebrtcConfig);
+  }
+  pKvsWebrtcHost->channels.clear();
 
-  // ペイロードの長さ
-  signalingMessage.payloadLen = STRLEN(signalingMessage.payload);
+  // バッファプールを解放 (全セッションの解放後)
+  freeBufferPool(pKvsWebrtcHost->signalingMessagePool);
+  freeBufferPool(pKvsWebrtcHost->sessionDescriptionPool);
+  freeBufferPool(pKvsWebrtcHost->dataChannelMessagePool);
 
-  // 関連付けID
-  SNPRINTF(signalingMessage.correlationId, MAX_CORRELATION_ID_LEN, "%llu", GETTIME());
+  // 認証情報プロバイダーを解放
+  if (pKvsWebrtcHost->pCredentialProvider) {
+    freeIotCredentialProvider(&pKvsWebrtcHost->pCredentialProvider);
+  }
 
-  // ロックを開始
-  MUTEX_LOCK(pKvsWebrtcConfig->signalingSendMessageLock);
-  isLocked = TRUE;
+  // 保護用ミューテックスと条件変数を解放
+  if (IS_VALID_CVAR_VALUE(pKvsWebrtcHost->cvar)) {
+    CVAR_FREE(pKvsWebrtcHost->cvar);
+  }
+  if (IS_VALID_MUTEX_VALUE(pKvsWebrtcHost->lock)) {
+    MUTEX_FREE(pKvsWebrtcHost->lock);
+  }
+  if (IS_VALID_MUTEX_VALUE(pKvsWebrtcHost->threadLock)) {
+    MUTEX_FREE(pKvsWebrtcHost->threadLock);
+  }
 
-  // シグナリングメッセージを送信
-  CHK_STATUS(signalingClientSendMessageSync(pKvsWebrtcConfig->signalingHandle, &signalingMessage));
+  // ホストを解放
+  pKvsWebrtcHost.reset();
 
 CleanUp:
 
-  // ロックを解除
-  if (isLocked) {
-    MUTEX_UNLOCK(pKvsWebrtcConfig->signalingSendMessageLock);
-  }
-
-  CHK_LOG_ERR(retStatus);
-
   return retStatus;
 }
 
 /**
- * @brief ICE候補を送信する
+ * @brief 全チャネルのメインループ
  */
-STATUS sendIceCandidate(PKvsWebrtcStreamingSession pStreamingSession, PCHAR candidateJson)
+STATUS loopKvsWebrtcHost(PKvsWebrtcHost pKvsWebrtcHost)
 {
+  ENTERS();
   auto retStatus = STATUS_SUCCESS;
-  auto pKvsWebrtcConfig = pStreamingSession->pKvsWebrtcConfig;
-  auto isLocked = FALSE;
-  SignalingMessage signalingMessage;
 
   // NULLチェック
-  CHK(pStreamingSession && candidateJson, STATUS_NULL_ARG);
-
-  // シグナリングメッセージのバージョン
-  signalingMessage.version = SIGNALING_MESSAGE_CURRENT_VERSION;
+  CHK(pKvsWebrtcHost, STATUS_NULL_ARG);
 
-  // シグナリングメッセージのタイプ
-  signalingMessage.messageType = SIGNALING_MESSAGE_TYPE_ICE_CANDIDATE;
-
-  // クライアントID
-  STRNCPY(signalingMessage.peerClientId, pStreamingSession->peerClientId, MAX_SIGNALING_CLIENT_ID_LEN);
+  // メインループ
+  while (!ATOMIC_LOAD_BOOL(&pKvsWebrtcHost->isInterrupted)) {
+    // チャネルごとの処理
+    for (auto&& pKvsWebrtcConfig : pKvsWebrtcHost->channels) {
+      CHK_STATUS(serviceSignaling(pKvsWebrtcConfig.get()));
+    }
 
-  // ペイロード
-  signalingMessage.payloadLen = static_cast<UINT32>(STRNLEN(candidateJson, MAX_SIGNALING_MESSAGE_LEN));
-  STRNCPY(signalingMessage.payload, candidateJson, signalingMessage.payloadLen);
+    // アドミッション制御に使用する負荷を更新
+    updateHostLoad(pKvsWebrtcHost);
 
-  // 関連付けID
-  signalingMessage.correlationId[0] = '\0';
+    // メトリクスを出力
+    if (pKvsWebrtcHost->metricsInterval != 0 && GETTIME() - pKvsWebrtcHost->lastMetricsTime >= pKvsWebrtcHost->metricsInterval) {
+      reportKvsWebrtcHostMetrics(pKvsWebrtcHost);
+    }
 
-  // ロックを開始
-  MUTEX_LOCK(pKvsWebrtcConfig->signalingSendMessageLock);
-  isLocked = TRUE;
+    // 定期処理の間隔だけスリープ
+    // (セッションの状態が変化した場合は起床し、待機前に変化していた場合は待機しない)
+    MUTEX_LOCK(pKvsWebrtcHost->lock);
+    if (!pKvsWebrtcHost->hasPendingWork) {
+      CVAR_WAIT(pKvsWebrtcHost->cvar, pKvsWebrtcHost->lock, pKvsWebrtcHost->serviceInterval);
+    }
+    pKvsWebrtcHost->hasPendingWork = FALSE;
+    MUTEX_UNLOCK(pKvsWebrtcHost->lock);
+  }
 
-  // シグナリングメッセージを送信
-  CHK_STATUS(signalingClientSendMessageSync(pKvsWebrtcConfig->signalingHandle, &signalingMessage));
+  // ホストの中断を全チャネルに反映
+  for (auto&& pKvsWebrtcConfig : pKvsWebrtcHost->channels) {
+    ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->isInterrupted, TRUE);
+    if (IS_VALID_CVAR_VALUE(pKvsWebrtcConfig->cvar)) {
+      CVAR_BROADCAST(pKvsWebrtcConfig->cvar);
+    }
+  }
 
 CleanUp:
 
-  // ロックを解除
-  if (isLocked) {
-    MUTEX_UNLOCK(pKvsWebrtcConfig->signalingSendMessageLock);
-  }
-
   CHK_LOG_ERR(retStatus);
 
+  LEAVES();
   return retStatus;
 }
 
 /**
- * @brief リモートからのICE候補を処理する
+ * @brief ホストのメトリクスを出力する
  */
-STATUS handleRemoteCandidate(PKvsWebrtcStreamingSession pStreamingSession, SignalingMessage& signalingMessage)
+VOID reportKvsWebrtcHostMetrics(PKvsWebrtcHost pKvsWebrtcHost)
 {
-  auto retStatus = STATUS_SUCCESS;
-  RtcIceCandidateInit iceCandidate;
-
-  // NULLチェック
-  CHK(pStreamingSession, STATUS_NULL_ARG);
-
-  // ICE候補をデシリアライズ
-  CHK_STATUS(deserializeRtcIceCandidateInit(signalingMessage.payload, signalingMessage.payloadLen, &iceCandidate));
-
-  // ICE候補を追加
-  CHK_STATUS(addIceCandidate(pStreamingSession->pPeerConnection, iceCandidate.candidate));
-
-CleanUp:
+  auto now = GETTIME();
+  auto cpuTime = getProcessCpuTime();
+
+  // プロセス全体のCPU使用率と常駐メモリ
+  DLOGP("host: channels: %zu, cpu: %.1f %%, rss: %" PRIu64 " KiB",
+        pKvsWebrtcHost->channels.size(),
+        now > pKvsWebrtcHost->lastMetricsTime ? static_cast<DOUBLE>(cpuTime - pKvsWebrtcHost->lastCpuTime) / static_cast<DOUBLE>(now - pKvsWebrtcHost->lastMetricsTime) * 100.0 : 0.0,
+        getProcessResidentBytes() / 1024);
+
+  // アドミッション制御に使用する直近の負荷
+  MUTEX_LOCK(pKvsWebrtcHost->lock);
+  DLOGP("host load: systemCpu: %.1f %%, egress: %" PRIu64 " bps",
+        pKvsWebrtcHost->cpuBusyPercent,
+        pKvsWebrtcHost->egressBitrate);
+  MUTEX_UNLOCK(pKvsWebrtcHost->lock);
+
+  pKvsWebrtcHost->lastMetricsTime = now;
+  pKvsWebrtcHost->lastCpuTime = cpuTime;
+
+  // サブシステムごとのアロケーション
+  logAllocationStats();
+
+  // シグナリングメッセージとSDPのバッファプール
+  logBufferPoolStats("signalingMessagePool", pKvsWebrtcHost->signalingMessagePool);
+  logBufferPoolStats("sessionDescriptionPool", pKvsWebrtcHost->sessionDescriptionPool);
+  logBufferPoolStats("dataChannelMessagePool", pKvsWebrtcHost->dataChannelMessagePool);
+
+  // 役割ごとの実行待ち時間
+  logThreadRoleStats(pKvsWebrtcHost);
+
+  // 非同期ロガー
+  logAsyncLoggerStats();
+
+  // セッションの解放 (解放待ちの数、解放に要した時間、切断から解放が完了するまでの時間)
+  MUTEX_LOCK(pKvsWebrtcHost->reaperLock);
+  DLOGP("host reaper: pending: %zu, reaped: %zu",
+        pKvsWebrtcHost->reaperQueue.size(),
+        ATOMIC_EXCHANGE(&pKvsWebrtcHost->reapedSessions, 0));
+  MUTEX_UNLOCK(pKvsWebrtcHost->reaperLock);
+  logLatencyStats("teardown", pKvsWebrtcHost->teardownLatency);
+  logLatencyStats("linger", pKvsWebrtcHost->lingerLatency);
+}
 
-  CHK_LOG_ERR(retStatus);
+/**
+ * @brief ホストのメインループを起床する
+ *
+ * 待機の直前に呼び出された場合も取りこぼさないように、ロックを保持してフラグを立ててから通知する。
+ */
+VOID wakeKvsWebrtcHost(PKvsWebrtcHost pKvsWebrtcHost)
+{
+  if (!IS_VALID_MUTEX_VALUE(pKvsWebrtcHost->lock) || !IS_VALID_CVAR_VALUE(pKvsWebrtcHost->cvar)) {
+    return;
+  }
 
-  return retStatus;
+  MUTEX_LOCK(pKvsWebrtcHost->lock);
+  pKvsWebrtcHost->hasPendingWork = TRUE;
+  CVAR_BROADCAST(pKvsWebrtcHost->cvar);
+  MUTEX_UNLOCK(pKvsWebrtcHost->lock);
 }
 
-// ============================================================================
-// コールバック
-// ============================================================================
-
 /**
- * @brief シグナリングクライアントの状態が変化した際のコールバック
+ * @brief 終了したセッションを解放するスレッドを開始する
  */
-STATUS onSignalingClientStateChanged(UINT64 customData, SIGNALING_CLIENT_STATE state)
+STATUS startSessionReaper(PKvsWebrtcHost pKvsWebrtcHost)
 {
-  UNUSED_PARAM(customData);
   auto retStatus = STATUS_SUCCESS;
-  PCHAR pStateStr;
 
-  // 状態を表す文字列を取得
-  CHK_STATUS(signalingClientGetStateString(state, &pStateStr));
+  // 同期オブジェクトとメトリクス
+  pKvsWebrtcHost->reaperLock = MUTEX_CREATE(FALSE);
+  pKvsWebrtcHost->reaperCvar = CVAR_CREATE();
+  pKvsWebrtcHost->sessionStatsLock = MUTEX_CREATE(FALSE);
+  pKvsWebrtcHost->reaperTerminated = FALSE;
+  CHK_STATUS(initLatencyStats(pKvsWebrtcHost->teardownLatency, RECONNECT_STATS_CAPACITY));
+  CHK_STATUS(initLatencyStats(pKvsWebrtcHost->lingerLatency, RECONNECT_STATS_CAPACITY));
 
-  // ログを出力
-  DLOGV("state: %d (%s)", state, pStateStr);
+  // スレッドを開始
+  CHK_STATUS(THREAD_CREATE(&pKvsWebrtcHost->reaperThreadId, sessionReaperRoutine, reinterpret_cast<PVOID>(pKvsWebrtcHost)));
 
 CleanUp:
 
@@ -850,306 +1900,4319 @@ CleanUp:
 }
 
 /**
- * @brief シグナリングメッセージを受信した際のコールバック
+ * @brief 終了したセッションを解放するスレッドを停止する (解放待ちのセッションはすべて解放する)
  */
-STATUS onSignalingMessageReceived(UINT64 customData, PReceivedSignalingMessage pReceivedSignalingMessage)
+VOID stopSessionReaper(PKvsWebrtcHost pKvsWebrtcHost)
 {
-  auto retStatus = STATUS_SUCCESS;
-  auto pKvsWebrtcConfig = reinterpret_cast<PKvsWebrtcConfig>(customData);
-  std::unique_ptr<KvsWebrtcStreamingSession> pStreamingSession;
-  auto isConfigObjLocked = FALSE;
-  PCHAR pPeerClientId;
+  // 初期化されていない場合は何もしない
+  if (!IS_VALID_MUTEX_VALUE(pKvsWebrtcHost->reaperLock)) {
+    return;
+  }
 
-  // ロックを開始
-  MUTEX_LOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
-  isConfigObjLocked = TRUE;
+  // スレッドを停止 (停止前に解放待ちのセッションを解放する)
+  MUTEX_LOCK(pKvsWebrtcHost->reaperLock);
+  pKvsWebrtcHost->reaperTerminated = TRUE;
+  CVAR_BROADCAST(pKvsWebrtcHost->reaperCvar);
+  MUTEX_UNLOCK(pKvsWebrtcHost->reaperLock);
+  if (IS_VALID_TID_VALUE(pKvsWebrtcHost->reaperThreadId)) {
+    THREAD_JOIN(pKvsWebrtcHost->reaperThreadId, nullptr);
+    pKvsWebrtcHost->reaperThreadId = INVALID_TID_VALUE;
+  }
 
-  // ログを出力
-  DLOGV("messageType: %d, correlationId: %s, peerClientId: %s, payloadLen: %d, payload: %s, statusCode: %d, errorType: %s, description: %s",
-        pReceivedSignalingMessage->signalingMessage.messageType,
-        pReceivedSignalingMessage->signalingMessage.correlationId,
-        pReceivedSignalingMessage->signalingMessage.peerClientId,
-        pReceivedSignalingMessage->signalingMessage.payloadLen,
-        pReceivedSignalingMessage->signalingMessage.payload,
-        pReceivedSignalingMessage->statusCode,
-        pReceivedSignalingMessage->errorType,
-        pReceivedSignalingMessage->description);
+  // スレッドを開始できなかった場合に残ったセッションを解放
+  for (auto&& pStreamingSession : pKvsWebrtcHost->reaperQueue) {
+    freeKvsWebrtcStreamingSession(pStreamingSession);
+  }
+  pKvsWebrtcHost->reaperQueue.clear();
+
+  // 同期オブジェクトとメトリクスを解放
+  CVAR_FREE(pKvsWebrtcHost->reaperCvar);
+  MUTEX_FREE(pKvsWebrtcHost->sessionStatsLock);
+  MUTEX_FREE(pKvsWebrtcHost->reaperLock);
+  pKvsWebrtcHost->reaperLock = INVALID_MUTEX_VALUE;
+  freeLatencyStats(pKvsWebrtcHost->teardownLatency);
+  freeLatencyStats(pKvsWebrtcHost->lingerLatency);
+}
 
-  // クライアントID
-  pPeerClientId = pReceivedSignalingMessage->signalingMessage.peerClientId;
+/**
+ * @brief 終了したセッションを解放待ちのキューに追加する
+ *
+ * 呼び出し元はセッションをファンアウトの対象 (streamingSessions) から外しておくこと。
+ * ピア接続の解放は時間がかかるため、設定オブジェクトのロックを保持せずにスレッドで行う。
+ */
+VOID reapStreamingSession(PKvsWebrtcHost pKvsWebrtcHost, std::unique_ptr<KvsWebrtcStreamingSession>&& pStreamingSession)
+{
+  // NULLチェック
+  if (!pStreamingSession) {
+    return;
+  }
 
-  // メッセージタイプ別の処理
-  switch (pReceivedSignalingMessage->signalingMessage.messageType) {
-    case SIGNALING_MESSAGE_TYPE_OFFER:
-      // ストリーミングセッションの存在チェック
-      CHK_ERR(!pKvsWebrtcConfig->streamingSessions.contains(pPeerClientId),
-              STATUS_INVALID_OPERATION,
-              "すでにクライアントID「%s」のピア接続は存在します。",
-              pPeerClientId);
+  pStreamingSession->unlinkTime = GETTIME();
 
-      // ストリーミングセッションを作成
-      CHK_STATUS(createKvsWebrtcStreamingSession(pKvsWebrtcConfig, pPeerClientId, pStreamingSession));
+  // スレッドが動作していない場合はその場で解放
+  if (!IS_VALID_TID_VALUE(pKvsWebrtcHost->reaperThreadId)) {
+    freeKvsWebrtcStreamingSession(pStreamingSession);
+    return;
+  }
 
-      // SDPオファーを処理
-      CHK_STATUS(handleOffer(pKvsWebrtcConfig, pStreamingSession.get(), pReceivedSignalingMessage->signalingMessage));
+  MUTEX_LOCK(pKvsWebrtcHost->reaperLock);
+  pKvsWebrtcHost->reaperQueue.push_back(std::move(pStreamingSession));
+  CVAR_SIGNAL(pKvsWebrtcHost->reaperCvar);
+  MUTEX_UNLOCK(pKvsWebrtcHost->reaperLock);
+}
 
-      // ストリーミングセッションを保存
-      pKvsWebrtcConfig->streamingSessions.emplace(pPeerClientId, std::move(pStreamingSession));
-      break;
-    case SIGNALING_MESSAGE_TYPE_ICE_CANDIDATE:
-      // ストリーミングセッションの存在チェック
-      CHK_ERR(pKvsWebrtcConfig->streamingSessions.contains(pPeerClientId),
-              STATUS_INVALID_OPERATION,
-              "クライアントID「%s」のピア接続が見つかりません。",
-              pPeerClientId);
+/**
+ * @brief 終了したセッションを解放するスレッド
+ */
+PVOID sessionReaperRoutine(PVOID arg)
+{
+  auto pKvsWebrtcHost = reinterpret_cast<PKvsWebrtcHost>(arg);
+  std::vector<std::unique_ptr<KvsWebrtcStreamingSession>> streamingSessions;
+  auto isTerminated = FALSE;
+  UINT64 startTime, lingerStartTime, now;
+
+  // シグナリングスレッドとして配置
+  applyThreadPolicy(pKvsWebrtcHost, THREAD_ROLE_SIGNALING);
+
+  while (!isTerminated) {
+    // 解放待ちのセッションが追加されるまで待機
+    MUTEX_LOCK(pKvsWebrtcHost->reaperLock);
+    while (!pKvsWebrtcHost->reaperTerminated && pKvsWebrtcHost->reaperQueue.empty()) {
+      CVAR_WAIT(pKvsWebrtcHost->reaperCvar, pKvsWebrtcHost->reaperLock, INFINITE_TIME_VALUE);
+    }
+    streamingSessions.swap(pKvsWebrtcHost->reaperQueue);
+    isTerminated = pKvsWebrtcHost->reaperTerminated;
+    MUTEX_UNLOCK(pKvsWebrtcHost->reaperLock);
+
+    // ロックの外で統計を取得中の場合は完了を待つ (取得対象から外れたセッションも参照されている可能性がある)
+    MUTEX_LOCK(pKvsWebrtcHost->sessionStatsLock);
+    MUTEX_UNLOCK(pKvsWebrtcHost->sessionStatsLock);
+
+    // ロックを保持せずに解放
+    for (auto&& pStreamingSession : streamingSessions) {
+      lingerStartTime = getDisconnectTime(pStreamingSession.get());
+      lingerStartTime = lingerStartTime != 0 ? lingerStartTime : pStreamingSession->unlinkTime;
+      startTime = GETTIME();
+      freeKvsWebrtcStreamingSession(pStreamingSession);
+      now = GETTIME();
+
+      // メトリクスを記録
+      addLatencySample(pKvsWebrtcHost->teardownLatency, now - startTime);
+      addLatencySample(pKvsWebrtcHost->lingerLatency, now - lingerStartTime);
+      ATOMIC_INCREMENT(&pKvsWebrtcHost->reapedSessions);
+    }
+    streamingSessions.clear();
+  }
 
-      // リモートからのICE候補を処理
-      CHK_STATUS(handleRemoteCandidate(pKvsWebrtcConfig->streamingSessions[pPeerClientId].get(),
-                                       pReceivedSignalingMessage->signalingMessage));
-      break;
-    default:
-      break;
+  releaseThreadPolicy(pKvsWebrtcHost);
+
+  return nullptr;
+}
+
+/**
+ * @brief プロセスのCPU時間 (100ナノ秒単位) を取得する
+ */
+UINT64 getProcessCpuTime()
+{
+  struct rusage usage;
+
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
   }
 
-  // ロックを解除
-  MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
-  isConfigObjLocked = FALSE;
+  return (static_cast<UINT64>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * HUNDREDS_OF_NANOS_IN_A_SECOND) +
+         (static_cast<UINT64>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * HUNDREDS_OF_NANOS_IN_A_MICROSECOND);
+}
 
-CleanUp:
+/**
+ * @brief プロセスの常駐メモリ (バイト) を取得する
+ */
+UINT64 getProcessResidentBytes()
+{
+  std::ifstream statm("/proc/self/statm");
+  UINT64 pages = 0, residentPages = 0;
 
-  CHK_LOG_ERR(retStatus);
+  statm >> pages >> residentPages;
 
-  if (isConfigObjLocked) {
-    MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  return residentPages * static_cast<UINT64>(sysconf(_SC_PAGESIZE));
+}
+
+// ============================================================================
+// アドミッション制御
+// ============================================================================
+
+/**
+ * @brief チャネルのアドミッション制御の設定を初期化する
+ */
+STATUS initAdmissionControl(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto retStatus = STATUS_SUCCESS;
+  PCHAR pPolicy = getChannelEnv(pKvsWebrtcConfig, ADMISSION_POLICY_ENV_VAR);
+
+  // セッション数の上限
+  pKvsWebrtcConfig->maxSessions = getChannelEnvUint32(pKvsWebrtcConfig, MAX_SESSIONS_ENV_VAR, DEFAULT_MAX_SESSIONS);
+
+  // 予算を超えた場合の動作
+  if (!pPolicy || STRCMPI(pPolicy, "reject") == 0) {
+    pKvsWebrtcConfig->admissionPolicy = ADMISSION_POLICY_REJECT;
+  } else if (STRCMPI(pPolicy, "evict-idle") == 0) {
+    pKvsWebrtcConfig->admissionPolicy = ADMISSION_POLICY_EVICT_IDLE;
+  } else if (STRCMPI(pPolicy, "evict-oldest") == 0) {
+    pKvsWebrtcConfig->admissionPolicy = ADMISSION_POLICY_EVICT_OLDEST;
+  } else {
+    CHK_ERR(FALSE, STATUS_INVALID_ARG, "環境変数「%s」の値「%s」は不正です。", ADMISSION_POLICY_ENV_VAR, pPolicy);
   }
 
+  // アイドルとみなすまでの時間
+  pKvsWebrtcConfig->sessionIdleTimeout =
+    getChannelEnvUint32(pKvsWebrtcConfig, SESSION_IDLE_TIMEOUT_ENV_VAR, DEFAULT_SESSION_IDLE_TIMEOUT_SECONDS) * HUNDREDS_OF_NANOS_IN_A_SECOND;
+
+CleanUp:
+
   return retStatus;
 }
 
 /**
- * @brief ICE Candidateを受信した際のコールバック
+ * @brief ホストの負荷 (CPU使用率、送信ビットレート、常駐メモリ) を更新する
+ *
+ * 送信ビットレートはセッションごとのoutbound-rtpの統計 (bytesSent) の増分から求める。
  */
-VOID onIceCandidateHandler(UINT64 customData, PCHAR candidateJson)
+VOID updateHostLoad(PKvsWebrtcHost pKvsWebrtcHost)
 {
-  auto retStatus = STATUS_SUCCESS;
-  auto pStreamingSession = reinterpret_cast<PKvsWebrtcStreamingSession>(customData);
+  auto now = GETTIME();
+  auto elapsed = now - pKvsWebrtcHost->lastLoadTime;
+  std::vector<std::pair<PKvsWebrtcStreamingSession, UINT64>> streamingSessions;
+  UINT64 cpuTotalTicks = 0, cpuIdleTicks = 0, egressBitrate = 0;
+  DOUBLE cpuBusyPercent = 0;
+
+  // 計測間隔が短すぎる場合は更新しない
+  if (elapsed < HUNDREDS_OF_NANOS_IN_A_SECOND) {
+    return;
+  }
 
-  // NULLチェック
-  CHK(pStreamingSession, STATUS_NULL_ARG);
+  // システム全体のCPU使用率
+  if (getSystemCpuTicks(cpuTotalTicks, cpuIdleTicks) && cpuTotalTicks > pKvsWebrtcHost->lastCpuTotalTicks) {
+    cpuBusyPercent = 100.0 -
+      static_cast<DOUBLE>(cpuIdleTicks - pKvsWebrtcHost->lastCpuIdleTicks) / static_cast<DOUBLE>(cpuTotalTicks - pKvsWebrtcHost->lastCpuTotalTicks) * 100.0;
+  }
 
-  if (candidateJson == NULL) {
-    // ログを出力
-    DLOGD("ICE candidate gathering done");
+  // セッションごとの送信ビットレート
+  // (統計の取得はピア接続のロックを取るため、設定オブジェクトのロックの外で行い、解放スレッドを待たせる)
+  MUTEX_LOCK(pKvsWebrtcHost->sessionStatsLock);
+  for (auto&& pKvsWebrtcConfig : pKvsWebrtcHost->channels) {
+    // 計測するセッションを取得
+    streamingSessions.clear();
+    MUTEX_LOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+    for (auto&& value : pKvsWebrtcConfig->streamingSessions) {
+      if (value.second && !ATOMIC_LOAD_BOOL(&value.second->isTerminated)) {
+        streamingSessions.emplace_back(value.second.get(), 0);
+      }
+    }
+    MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
 
-    // ICE候補収集完了
-    ATOMIC_STORE_BOOL(&pStreamingSession->candidateGatheringDone, TRUE);
+    // ロックの外で送信バイト数を取得
+    for (auto&& [pStreamingSession, bytesSent] : streamingSessions) {
+      bytesSent = getStreamingSessionBytesSent(pStreamingSession);
+    }
 
-    // Trickle ICEをサポートしていない場合はここでアンサーを送信
-    if (!pStreamingSession->remoteCanTrickleIce) {
-      CHK_STATUS(createAnswer(pStreamingSession->pPeerConnection, &pStreamingSession->answerSessionDescriptionInit));
-      CHK_STATUS(sendAnswer(pStreamingSession));
+    // 結果を書き戻す
+    MUTEX_LOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+    for (auto&& [pStreamingSession, bytesSent] : streamingSessions) {
+      pStreamingSession->egressBitrate = bytesSent > pStreamingSession->lastBytesSent
+        ? (bytesSent - pStreamingSession->lastBytesSent) * 8 * HUNDREDS_OF_NANOS_IN_A_SECOND / elapsed
+        : 0;
+      pStreamingSession->lastBytesSent = bytesSent;
+      egressBitrate += pStreamingSession->egressBitrate;
     }
-  } else if (pStreamingSession->remoteCanTrickleIce) {
-    // ログを出力
-    DLOGV("candidate: %s", candidateJson);
+    MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  }
+  MUTEX_UNLOCK(pKvsWebrtcHost->sessionStatsLock);
+
+  // 負荷を更新
+  MUTEX_LOCK(pKvsWebrtcHost->lock);
+  pKvsWebrtcHost->cpuBusyPercent = cpuBusyPercent;
+  pKvsWebrtcHost->egressBitrate = egressBitrate;
+  pKvsWebrtcHost->residentBytes = getProcessResidentBytes();
+  pKvsWebrtcHost->lastLoadTime = now;
+  pKvsWebrtcHost->lastCpuTotalTicks = cpuTotalTicks;
+  pKvsWebrtcHost->lastCpuIdleTicks = cpuIdleTicks;
+  MUTEX_UNLOCK(pKvsWebrtcHost->lock);
+}
 
-    // Trickle ICEをサポートしている場合はICE候補を送信
-    CHK_STATUS(sendIceCandidate(pStreamingSession, candidateJson));
+/**
+ * @brief システム全体のCPU時間とアイドル時間 (クロックティック) を取得する
+ */
+BOOL getSystemCpuTicks(UINT64& totalTicks, UINT64& idleTicks)
+{
+  std::ifstream stat("/proc/stat");
+  std::string label;
+  UINT64 ticks;
+
+  // 1行目の「cpu user nice system idle iowait irq softirq steal ...」
+  if (!(stat >> label) || label != "cpu") {
+    return FALSE;
   }
 
-CleanUp:
+  totalTicks = 0;
+  idleTicks = 0;
+  for (UINT32 i = 0; i < 8 && stat >> ticks; i++) {
+    totalTicks += ticks;
+    // idleとiowait
+    if (i == 3 || i == 4) {
+      idleTicks += ticks;
+    }
+  }
 
-  CHK_LOG_ERR(retStatus);
+  return totalTicks > 0;
 }
 
 /**
- * @brief ピア接続の状態が変化した際のコールバック
+ * @brief ストリーミングセッションが送信したバイト数を統計から取得する
  */
-VOID onConnectionStateChanged(UINT64 customData, RTC_PEER_CONNECTION_STATE state)
+UINT64 getStreamingSessionBytesSent(PKvsWebrtcStreamingSession pStreamingSession)
 {
-  auto retStatus = STATUS_SUCCESS;
-  auto pStreamingSession = reinterpret_cast<PKvsWebrtcStreamingSession>(customData);
-  auto pKvsWebrtcConfig = pStreamingSession->pKvsWebrtcConfig;
+  PRtcRtpTransceiver transceivers[] = {pStreamingSession->pVideoRtcRtpTransceiver, pStreamingSession->pAudioRtcRtpTransceiver};
+  RtcStats rtcStats;
+  UINT64 bytesSent = 0;
+
+  for (auto pTransceiver : transceivers) {
+    MEMSET(&rtcStats, 0x00, SIZEOF(RtcStats));
+    rtcStats.requestedTypeOfStats = RTC_STATS_TYPE_OUTBOUND_RTP;
+    if (pTransceiver && STATUS_SUCCEEDED(rtcPeerConnectionGetMetrics(pStreamingSession->pPeerConnection, pTransceiver, &rtcStats))) {
+      bytesSent += rtcStats.rtcStatsObject.outboundRtpStreamStats.sent.bytesSent;
+    }
+  }
 
-  // ログを出力
-  DLOGI("state: %u", state);
+  return bytesSent;
+}
 
-  // 状態別の処理
-  switch (state) {
-    case RTC_PEER_CONNECTION_STATE_CONNECTED:
-      // 接続フラグをON
-      ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->isConnected, TRUE);
+/**
+ * @brief 新しいオファーを受け入れるか判定する
+ *
+ * セッション数、システムのCPU使用率、送信ビットレート (1セッション分を加算した見込み)、
+ * 常駐メモリの順に予算を確認し、超える場合は設定に応じてセッションを切断して受け入れるか拒否する。
+ * 設定オブジェクトのロックを保持して呼び出すこと。
+ */
+AdmissionResult admitStreamingSession(PKvsWebrtcConfig pKvsWebrtcConfig, PCHAR pPeerClientId)
+{
+  auto pKvsWebrtcHost = pKvsWebrtcConfig->pKvsWebrtcHost;
+  auto result = ADMISSION_RESULT_ADMITTED;
+  PKvsWebrtcStreamingSession pEvictedSession;
+  UINT32 activeSessions = 0, connectedSessions = 0;
+  UINT64 sessionBitrate = 0;
 
-      // ブロックを解除
-      if (IS_VALID_CVAR_VALUE(pKvsWebrtcConfig->cvar)) {
-        CVAR_BROADCAST(pKvsWebrtcConfig->cvar);
-      }
-      break;
-    case RTC_PEER_CONNECTION_STATE_FAILED:
-    case RTC_PEER_CONNECTION_STATE_CLOSED:
-    case RTC_PEER_CONNECTION_STATE_DISCONNECTED:
-      // 終了フラグをON
-      ATOMIC_STORE_BOOL(&pStreamingSession->isTerminated, TRUE);
-    default:
-      // 接続フラグをOFF
-      ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->isConnected, FALSE);
+  // 終了していないセッション数と接続済みセッションの送信ビットレート
+  for (auto&& value : pKvsWebrtcConfig->streamingSessions) {
+    if (!value.second || ATOMIC_LOAD_BOOL(&value.second->isTerminated)) {
+      continue;
+    }
+    activeSessions++;
+    if (ATOMIC_LOAD_BOOL(&value.second->isConnected) && value.second->egressBitrate > 0) {
+      connectedSessions++;
+      sessionBitrate += value.second->egressBitrate;
+    }
+  }
 
-      // ブロックを解除
-      if (IS_VALID_CVAR_VALUE(pKvsWebrtcConfig->cvar)) {
-        CVAR_BROADCAST(pKvsWebrtcConfig->cvar);
-      }
-      break;
+  // 1セッションあたりの送信ビットレートの見込み (接続済みセッションがない場合は設定値)
+  sessionBitrate = connectedSessions > 0 ? sessionBitrate / connectedSessions
+                                         : static_cast<UINT64>(pKvsWebrtcConfig->videoBitrate) + pKvsWebrtcConfig->audioBitrate;
+
+  // 予算を確認
+  MUTEX_LOCK(pKvsWebrtcHost->lock);
+  if (pKvsWebrtcConfig->maxSessions != 0 && activeSessions >= pKvsWebrtcConfig->maxSessions) {
+    result = ADMISSION_RESULT_REJECTED_SESSIONS;
+  } else if (pKvsWebrtcHost->maxCpuPercent != 0 && pKvsWebrtcHost->cpuBusyPercent >= pKvsWebrtcHost->maxCpuPercent) {
+    result = ADMISSION_RESULT_REJECTED_CPU;
+  } else if (pKvsWebrtcHost->maxEgressBitrate != 0 && pKvsWebrtcHost->egressBitrate + sessionBitrate > pKvsWebrtcHost->maxEgressBitrate) {
+    result = ADMISSION_RESULT_REJECTED_EGRESS;
+  } else if (pKvsWebrtcHost->maxResidentBytes != 0 && pKvsWebrtcHost->residentBytes >= pKvsWebrtcHost->maxResidentBytes) {
+    result = ADMISSION_RESULT_REJECTED_MEMORY;
+  }
+  MUTEX_UNLOCK(pKvsWebrtcHost->lock);
+
+  // 予算を超える場合はセッションを切断して受け入れる (メインループで解放する)
+  if (result != ADMISSION_RESULT_ADMITTED && pKvsWebrtcConfig->admissionPolicy != ADMISSION_POLICY_REJECT &&
+      (pEvictedSession = selectEvictionCandidate(pKvsWebrtcConfig))) {
+    DLOGI("Evicting session %s to admit %s", pEvictedSession->peerClientId, pPeerClientId);
+    ATOMIC_STORE_BOOL(&pEvictedSession->isTerminated, TRUE);
+    wakeKvsWebrtcHost(pKvsWebrtcHost);
+    result = ADMISSION_RESULT_EVICTED;
   }
 
-CleanUp:
+  // 拒否したクライアントのICE候補は無視する
+  if (result != ADMISSION_RESULT_ADMITTED && result != ADMISSION_RESULT_EVICTED) {
+    pKvsWebrtcConfig->rejectedPeers[pPeerClientId] = GETTIME();
+  }
 
-  CHK_LOG_ERR(retStatus);
+  ATOMIC_INCREMENT(&pKvsWebrtcConfig->admissionCounts[result]);
+
+  return result;
 }
 
 /**
- * @brief シグナリングクライアントでエラーが発生した際のコールバック
+ * @brief 切断するセッションを選択する
+ *
+ * アイドルのセッション (接続できないままタイムアウトしたもの、または接続後に送信が止まっているもの) のうち
+ * 最も古いものを優先し、ない場合はevict-oldestの場合のみ最も古いセッションを選択する。
  */
-STATUS onSignalingClientError(UINT64 customData, STATUS status, PCHAR message, UINT32 messageLen)
+PKvsWebrtcStreamingSession selectEvictionCandidate(PKvsWebrtcConfig pKvsWebrtcConfig)
 {
-  auto retStatus = STATUS_SUCCESS;
-  auto pKvsWebrtcConfig = reinterpret_cast<PKvsWebrtcConfig>(customData);
+  auto now = GETTIME();
+  PKvsWebrtcStreamingSession pIdleSession = nullptr, pOldestSession = nullptr;
+  BOOL isIdle;
 
-  // ログを出力
-  DLOGW("status: 0x%08x, message: %s, messageLen: %d", status, message, messageLen);
+  for (auto&& value : pKvsWebrtcConfig->streamingSessions) {
+    auto pStreamingSession = value.second.get();
+    if (!pStreamingSession || ATOMIC_LOAD_BOOL(&pStreamingSession->isTerminated)) {
+      continue;
+    }
 
-  // 特定のエラーの場合はシグナリングクライアントを再作成
-  if (status == STATUS_SIGNALING_ICE_CONFIG_REFRESH_FAILED ||
-      status == STATUS_SIGNALING_RECONNECT_FAILED) {
-    ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->recreateSignalingClient, TRUE);
-    CVAR_BROADCAST(pKvsWebrtcConfig->cvar);
+    // アイドルか判定
+    isIdle = now - pStreamingSession->createTime >= pKvsWebrtcConfig->sessionIdleTimeout &&
+      (!ATOMIC_LOAD_BOOL(&pStreamingSession->isConnected) || pStreamingSession->egressBitrate == 0);
+
+    if (isIdle && (!pIdleSession || pStreamingSession->createTime < pIdleSession->createTime)) {
+      pIdleSession = pStreamingSession;
+    }
+    if (!pOldestSession || pStreamingSession->createTime < pOldestSession->createTime) {
+      pOldestSession = pStreamingSession;
+    }
   }
 
-CleanUp:
+  if (pIdleSession) {
+    return pIdleSession;
+  }
 
-  return retStatus;
+  return pKvsWebrtcConfig->admissionPolicy == ADMISSION_POLICY_EVICT_OLDEST ? pOldestSession : nullptr;
+}
+
+/**
+ * @brief アドミッション制御のメトリクスを出力する
+ */
+VOID logAdmissionStats(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto& counts = pKvsWebrtcConfig->admissionCounts;
+
+  DLOGP("channel %s: admission: admitted: %zu, evicted: %zu, rejected sessions: %zu, cpu: %zu, egress: %zu, memory: %zu",
+        pKvsWebrtcConfig->channelInfo.pChannelName,
+        ATOMIC_EXCHANGE(&counts[ADMISSION_RESULT_ADMITTED], 0),
+        ATOMIC_EXCHANGE(&counts[ADMISSION_RESULT_EVICTED], 0),
+        ATOMIC_EXCHANGE(&counts[ADMISSION_RESULT_REJECTED_SESSIONS], 0),
+        ATOMIC_EXCHANGE(&counts[ADMISSION_RESULT_REJECTED_CPU], 0),
+        ATOMIC_EXCHANGE(&counts[ADMISSION_RESULT_REJECTED_EGRESS], 0),
+        ATOMIC_EXCHANGE(&counts[ADMISSION_RESULT_REJECTED_MEMORY], 0));
 }
 
 // ============================================================================
-// GStreamer
+// アロケーション統計
 // ============================================================================
 
 /**
- * @brief GStreamerパイプラインを作成する
+ * @brief スコープの間、呼び出し元のスレッドのアロケーションをサブシステムとセッションに割り当てる
  */
-STATUS createGstPipelines(PKvsWebrtcConfig pKvsWebrtcConfig)
+AllocationScope::AllocationScope(AllocationTag tag, UINT32 sessionSlot)
+  : previousTag(currentAllocationTag), previousSessionSlot(currentAllocationSessionSlot)
 {
-  auto retStatus = STATUS_SUCCESS;
-  GError* sendError = nullptr;
-  GError* recvError = nullptr;
-  GstElement* appsinkVideo = nullptr;
-  GstElement* appsinkAudio = nullptr;
+  currentAllocationTag = tag;
+  currentAllocationSessionSlot = sessionSlot != 0 ? sessionSlot : previousSessionSlot;
+}
 
-  // NULLチェック
-  CHK(pKvsWebrtcConfig, STATUS_NULL_ARG);
+/**
+ * @brief スコープ開始前の割り当てに戻す
+ */
+AllocationScope::~AllocationScope()
+{
+  currentAllocationTag = previousTag;
+  currentAllocationSessionSlot = previousSessionSlot;
+}
 
-  // 送信用パイプラインを作成
-  pKvsWebrtcConfig->sendPipeline = gst_parse_launch(
-    "rtpbin name=rtpbin "
-    // Video
-    "v4l2src ! "
-    "queue "
-    "  max-size-buffers=240 "
-    "  leaky=downstream ! "
-    "videoconvert ! "
-    "videoscale ! "
-    "videorate ! "
-    "video/x-raw,width=640,height=480,framerate=30/1 ! "
-    "clockoverlay "
-    "  time-format=\"%Y-%m-%d %H:%M:%S\" "
-    "  halignment=right "
-    "  valignment=top ! "
-    "v4l2h264enc extra-controls=\"encode,h264_profile=0,h264_level=30;\" ! "
-    "video/x-h264,stream-format=byte-stream,alignment=au,level=(string)3 ! "
-    "h264parse config-interval=-1 ! "
-    "rtph264pay ! "
-    "rtpbin.send_rtp_sink_0 "
-    "rtpbin.send_rtp_src_0 ! "
-    "udpsink "
-    "  host=225.0.0.37 "
-    "  port=50000 "
-    "  multicast-iface=lo "
-    "  ttl-mc=0 "
-    "  bind-address=127.0.0.1 "
-    "  async=false "
-    "  sync=true "
-    "rtpbin.send_rtcp_src_0 ! "
-    "udpsink "
-    "  host=225.0.0.37 "
-    "  port=50001 "
-    "  multicast-iface=lo "
-    "  ttl-mc=0 "
-    "  bind-address=127.0.0.1 "
-    "  async=false "
-    "  sync=false "
-    // Audio
-    "alsasrc device=plughw:CARD=WEBCAM,DEV=0 ! "
-    "queue "
-    "  max-size-buffers=400 "
-    "  leaky=downstream ! "
-    "audioconvert ! "
-    "audioresample ! "
-    "opusenc ! "
-    "audio/x-opus,rate=48000,channels=2 ! "
-    "rtpopuspay ! "
-    "rtpbin.send_rtp_sink_1 "
-    "rtpbin.send_rtp_src_1 ! "
-    "udpsink "
-    "  host=225.0.0.37 "
-    "  port=50002 "
-    "  multicast-iface=lo "
-    "  ttl-mc=0 "
-    "  bind-address=127.0.0.1 "
-    "  async=false "
-    "  sync=true "
-    "rtpbin.send_rtcp_src_1 ! "
-    "udpsink "
-    "  host=225.0.0.37 "
-    "  port=50003 "
-    "  multicast-iface=lo "
-    "  ttl-mc=0 "
-    "  bind-address=127.0.0.1 "
-    "  async=false "
-    "  sync=false",
-    &sendError);
+/**
+ * @brief アロケーション統計を開始する (SDKのメモリアロケーターを置き換える)
+ *
+ * MEMALLOCなどのグローバルなアロケーターを、サイズと割り当て先をヘッダーに記録するものに置き換える。
+ * SET_INSTRUMENTED_ALLOCATORSの後、SDKがメモリを確保する前に呼び出すこと。
+ * GStreamer (GLib) のアロケーションはmallocのヒープ全体との差分として集計する。
+ */
+STATUS initAllocationStats()
+{
+  auto retStatus = STATUS_SUCCESS;
 
-  // エラーチェック
-  if (sendError) {
-    DLOGE("Failed to create sender pipeline: %s", sendError->message);
-    g_error_free(sendError);
-    CHK(FALSE, STATUS_INTERNAL_ERROR);
-  }
+  // 無効の場合は何もしない
+  CHK(getEnvBool(ALLOCATION_STATS_ENV_VAR, FALSE) && !allocationStats.isEnabled, retStatus);
+
+  // 置き換え前のアロケーター (SET_INSTRUMENTED_ALLOCATORSで置き換えられている場合はそれを呼び出す)
+  allocationStats.previousMemAlloc = globalMemAlloc;
+  allocationStats.previousMemAlignAlloc = globalMemAlignAlloc;
+  allocationStats.previousMemCalloc = globalMemCalloc;
+  allocationStats.previousMemRealloc = globalMemRealloc;
+  allocationStats.previousMemFree = globalMemFree;
+  allocationStats.lastReportTime = GETTIME();
+
+  // アロケーターを置き換える
+  globalMemAlloc = allocationStatsMemAlloc;
+  globalMemAlignAlloc = allocationStatsMemAlignAlloc;
+  globalMemCalloc = allocationStatsMemCalloc;
+  globalMemRealloc = allocationStatsMemRealloc;
+  globalMemFree = allocationStatsMemFree;
+  allocationStats.isEnabled = TRUE;
 
-  // 受信用パイプラインを作成
-  pKvsWebrtcConfig->recvPipeline = gst_parse_launch(
-    "rtpbin name=rtpbin "
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief アロケーション統計を終了する
+ *
+ * SDKが確保したメモリをすべて解放した後、RESET_INSTRUMENTED_ALLOCATORSの前に呼び出すこと。
+ */
+VOID deinitAllocationStats()
+{
+  // 開始していない場合は無視
+  if (!allocationStats.isEnabled) {
+    return;
+  }
+
+  // 解放されていないメモリがある場合はアロケーターを戻さない
+  // (ヘッダー付きのポインターを元のアロケーターで解放するとヒープが壊れるため)
+  if (ATOMIC_LOAD(&allocationStats.inUseBytes) != 0) {
+    DLOGW("%zu bytes allocated through the SDK allocators were not freed, keeping the tracking allocators installed",
+          ATOMIC_LOAD(&allocationStats.inUseBytes));
+    return;
+  }
+
+  // アロケーターを戻す
+  globalMemAlloc = allocationStats.previousMemAlloc;
+  globalMemAlignAlloc = allocationStats.previousMemAlignAlloc;
+  globalMemCalloc = allocationStats.previousMemCalloc;
+  globalMemRealloc = allocationStats.previousMemRealloc;
+  globalMemFree = allocationStats.previousMemFree;
+  allocationStats.isEnabled = FALSE;
+}
+
+/**
+ * @brief メモリを確保する (アロケーション統計用)
+ */
+PVOID allocationStatsMemAlloc(SIZE_T size)
+{
+  auto pHeader = reinterpret_cast<AllocationHeader*>(allocationStats.previousMemAlloc(SIZEOF(AllocationHeader) + size));
+
+  if (!pHeader) {
+    return nullptr;
+  }
+
+  trackAllocation(pHeader, size);
+
+  return pHeader + 1;
+}
+
+/**
+ * @brief アラインメントを指定してメモリを確保する (アロケーション統計用)
+ *
+ * SDKのinstrumented allocatorsと同様に、ヘッダーの16バイトを超えるアラインメントは保証しない。
+ */
+PVOID allocationStatsMemAlignAlloc(SIZE_T size, SIZE_T alignment)
+{
+  UNUSED_PARAM(alignment);
+
+  return allocationStatsMemAlloc(size);
+}
+
+/**
+ * @brief 0で初期化したメモリを確保する (アロケーション統計用)
+ */
+PVOID allocationStatsMemCalloc(SIZE_T num, SIZE_T size)
+{
+  AllocationHeader* pHeader;
+
+  // オーバーフローチェック
+  if (size != 0 && num > (MAX_UINT64 - SIZEOF(AllocationHeader)) / size) {
+    return nullptr;
+  }
+
+  if (!(pHeader = reinterpret_cast<AllocationHeader*>(allocationStats.previousMemCalloc(1, SIZEOF(AllocationHeader) + num * size)))) {
+    return nullptr;
+  }
+
+  trackAllocation(pHeader, num * size);
+
+  return pHeader + 1;
+}
+
+/**
+ * @brief メモリを再確保する (アロケーション統計用)
+ */
+PVOID allocationStatsMemRealloc(PVOID ptr, SIZE_T size)
+{
+  AllocationHeader* pHeader;
+  AllocationHeader header;
+
+  if (!ptr) {
+    return allocationStatsMemAlloc(size);
+  }
+
+  // 再確保に失敗した場合は元のメモリが残るため、成功した場合のみ集計を更新
+  header = *(reinterpret_cast<AllocationHeader*>(ptr) - 1);
+  if (!(pHeader = reinterpret_cast<AllocationHeader*>(allocationStats.previousMemRealloc(reinterpret_cast<AllocationHeader*>(ptr) - 1,
+                                                                                         SIZEOF(AllocationHeader) + size)))) {
+    return nullptr;
+  }
+
+  untrackAllocation(header);
+  trackAllocation(pHeader, size);
+
+  return pHeader + 1;
+}
+
+/**
+ * @brief メモリを解放する (アロケーション統計用)
+ */
+VOID allocationStatsMemFree(PVOID ptr)
+{
+  AllocationHeader* pHeader;
+
+  if (!ptr) {
+    return;
+  }
+
+  pHeader = reinterpret_cast<AllocationHeader*>(ptr) - 1;
+  untrackAllocation(*pHeader);
+  allocationStats.previousMemFree(pHeader);
+}
+
+/**
+ * @brief セッションのスロットを取得する
+ *
+ * 空きがない場合は0 (セッションに割り当てない) を返す。
+ */
+UINT32 acquireAllocationSessionSlot()
+{
+  // 開始していない場合は割り当てない
+  if (!allocationStats.isEnabled) {
+    return 0;
+  }
+
+  for (UINT32 slot = 1; slot <= ALLOCATION_SESSION_SLOTS; slot++) {
+    if (!ATOMIC_EXCHANGE_BOOL(&allocationStats.sessions[slot].isUsed, TRUE)) {
+      return slot;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * @brief セッションのスロットを解放する
+ *
+ * セッションの解放後も使用中のメモリは解放済みのセッションとして集計を続ける。
+ */
+VOID releaseAllocationSessionSlot(UINT32 slot, const CHAR* pPeerClientId)
+{
+  SIZE_T retainedBytes;
+
+  // 割り当てていない場合は無視
+  if (slot == 0 || slot > ALLOCATION_SESSION_SLOTS) {
+    return;
+  }
+
+  auto& sessionSlot = allocationStats.sessions[slot];
+
+  // 世代を進めて、以降の解放を解放済みのセッションとして集計
+  // (集計中のアロケーションと競合しないよう、世代と使用中のバイト数の移し替えはロック中に行う)
+  lockAllocationSessionSlot(sessionSlot);
+  sessionSlot.generation++;
+  retainedBytes = sessionSlot.inUseBytes;
+  sessionSlot.inUseBytes = 0;
+  ATOMIC_ADD(&allocationStats.closedSessionBytes, retainedBytes);
+  unlockAllocationSessionSlot(sessionSlot);
+  if (retainedBytes != 0) {
+    DLOGD("Session %s still holds %zu bytes after close", pPeerClientId, retainedBytes);
+  }
+
+  ATOMIC_STORE_BOOL(&sessionSlot.isUsed, FALSE);
+}
+
+/**
+ * @brief セッションが使用中のバイト数を取得する
+ */
+SIZE_T getAllocationSessionBytes(UINT32 slot)
+{
+  if (slot == 0 || slot > ALLOCATION_SESSION_SLOTS) {
+    return 0;
+  }
+
+  return ATOMIC_LOAD(&allocationStats.sessions[slot].inUseBytes);
+}
+
+/**
+ * @brief mallocのヒープで使用中のバイト数を取得する
+ *
+ * mallinfo2はglibc 2.33以降のため、それ以前はmallinfo (2GiBを超えると正しくない) を使用する。
+ */
+SIZE_T getHeapInUseBytes()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  auto heapInfo = mallinfo2();
+  return heapInfo.uordblks + heapInfo.hblkhd;
+#elif defined(__GLIBC__)
+  auto heapInfo = mallinfo();
+  return static_cast<SIZE_T>(static_cast<UINT32>(heapInfo.uordblks)) + static_cast<UINT32>(heapInfo.hblkhd);
+#else
+  return 0;
+#endif
+}
+
+/**
+ * @brief アロケーション統計を出力する
+ */
+VOID logAllocationStats()
+{
+  static const CHAR* const pTagNames[ALLOCATION_TAG_COUNT] = {"other", "signaling", "peerConnection"};
+  auto now = GETTIME();
+  auto inUseBytes = ATOMIC_LOAD(&allocationStats.inUseBytes);
+  auto heapBytes = getHeapInUseBytes();
+  DOUBLE elapsed;
+
+  // 開始していない場合は無視
+  if (!allocationStats.isEnabled) {
+    return;
+  }
+
+  elapsed = now > allocationStats.lastReportTime ? static_cast<DOUBLE>(now - allocationStats.lastReportTime) / HUNDREDS_OF_NANOS_IN_A_SECOND : 1.0;
+  allocationStats.lastReportTime = now;
+
+  // 全体 (SDK以外のGStreamerなどはmallocのヒープとの差分)
+  DLOGP("allocations: sdk inUse: %zu bytes, peak: %zu bytes, closedSessions: %zu bytes, heap: %zu bytes, gstreamer/other: %zu bytes",
+        inUseBytes,
+        ATOMIC_EXCHANGE(&allocationStats.peakInUseBytes, inUseBytes),
+        ATOMIC_LOAD(&allocationStats.closedSessionBytes),
+        heapBytes,
+        heapBytes > inUseBytes ? heapBytes - inUseBytes : 0);
+
+  // サブシステムごと
+  for (UINT32 tag = 0; tag < ALLOCATION_TAG_COUNT; tag++) {
+    auto& counter = allocationStats.tags[tag];
+    DLOGP("allocations %s: inUse: %zu bytes, rate: %.0f bytes/s, %.1f allocs/s",
+          pTagNames[tag],
+          ATOMIC_LOAD(&counter.inUseBytes),
+          static_cast<DOUBLE>(ATOMIC_EXCHANGE(&counter.allocatedBytes, 0)) / elapsed,
+          static_cast<DOUBLE>(ATOMIC_EXCHANGE(&counter.allocationCount, 0)) / elapsed);
+  }
+}
+
+// ============================================================================
+// 非同期ロガー
+// ============================================================================
+
+/**
+ * @brief 非同期ロガーを開始する (SDKのログ出力関数を置き換える)
+ *
+ * ログは呼び出し元のスレッドのリングバッファに引数のまま書き込み、整形と出力はロガースレッドで行う。
+ * SDKのログ出力関数 (globalCustomLogPrintFn) を置き換えるため、DLOG*はすべて非同期になる。
+ */
+STATUS initAsyncLogger()
+{
+  auto retStatus = STATUS_SUCCESS;
+  SIZE_T ringSize;
+
+  // 無効の場合は何もしない
+  CHK(getEnvBool(ASYNC_LOG_ENV_VAR, TRUE) && !asyncLogger.isEnabled, retStatus);
+
+  // レート制限
+  asyncLogger.rateLimit = getEnvUint32(LOG_RATE_LIMIT_ENV_VAR, DEFAULT_LOG_RATE_LIMIT);
+
+  // リングバッファのサイズ (2のべき乗に切り上げ)
+  ringSize = static_cast<SIZE_T>(getEnvUint32(ASYNC_LOG_RING_SIZE_ENV_VAR, DEFAULT_ASYNC_LOG_RING_SIZE_KB)) * 1024;
+  asyncLogger.ringSize = ASYNC_LOG_MIN_RING_SIZE;
+  while (asyncLogger.ringSize < ringSize) {
+    asyncLogger.ringSize <<= 1;
+  }
+
+  // ロガースレッドを開始
+  asyncLogger.lock = MUTEX_CREATE(FALSE);
+  asyncLogger.cvar = CVAR_CREATE();
+  ATOMIC_STORE_BOOL(&asyncLogger.hasPendingLogs, FALSE);
+  ATOMIC_STORE_BOOL(&asyncLogger.isStopping, FALSE);
+  ATOMIC_STORE_BOOL(&asyncLogger.isTerminated, FALSE);
+  CHK_STATUS(THREAD_CREATE(&asyncLogger.threadId, asyncLoggerRoutine, nullptr));
+
+  // ログ出力関数を置き換える
+  asyncLogger.previousLogPrint = globalCustomLogPrintFn;
+  globalCustomLogPrintFn = asyncLogPrint;
+  asyncLogger.isEnabled = TRUE;
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief 非同期ロガーを終了する (書き込み済みのログはすべて出力する)
+ */
+VOID deinitAsyncLogger()
+{
+  // 開始していない場合は無視
+  if (!asyncLogger.isEnabled) {
+    return;
+  }
+
+  // 新しい書き込み (リングバッファの登録を含む) を止めてログ出力関数を戻す
+  ATOMIC_STORE_BOOL(&asyncLogger.isStopping, TRUE);
+  globalCustomLogPrintFn = asyncLogger.previousLogPrint;
+  asyncLogger.isEnabled = FALSE;
+
+  // 書き込み中のスレッドがロックを使い終わるまで待つ
+  while (ATOMIC_LOAD(&asyncLogger.activeWriters) != 0) {
+    THREAD_SLEEP(ASYNC_LOG_STOP_POLL_INTERVAL);
+  }
+
+  // 残りのログを出力してロガースレッドを停止
+  MUTEX_LOCK(asyncLogger.lock);
+  ATOMIC_STORE_BOOL(&asyncLogger.isTerminated, TRUE);
+  CVAR_SIGNAL(asyncLogger.cvar);
+  MUTEX_UNLOCK(asyncLogger.lock);
+  THREAD_JOIN(asyncLogger.threadId, nullptr);
+
+  MUTEX_LOCK(asyncLogger.lock);
+  asyncLogger.rings.clear();
+  MUTEX_UNLOCK(asyncLogger.lock);
+  CVAR_FREE(asyncLogger.cvar);
+  MUTEX_FREE(asyncLogger.lock);
+}
+
+/**
+ * @brief ログを呼び出し元のスレッドのリングバッファに書き込む (SDKのログ出力関数)
+ *
+ * 呼び出し箇所 (フォーマット文字列) ごとに1秒間の出力数を制限し、抑制した数は次の期間の最初に出力する。
+ * リングバッファに空きがない場合はブロックせずに破棄する。
+ */
+VOID asyncLogPrint(UINT32 level, const PCHAR tag, const PCHAR fmt, ...)
+{
+  auto& thread = asyncLogThread;
+  auto isSuppressed = FALSE;
+  va_list args;
+  UINT64 now;
+
+  // ログレベル
+  if (level < GET_LOGGER_LOG_LEVEL()) {
+    return;
+  }
+
+  // 終了処理中は書き込まない (終了処理は書き込み中のスレッドがなくなるまでロックを解放しない)
+  ATOMIC_INCREMENT(&asyncLogger.activeWriters);
+  if (ATOMIC_LOAD_BOOL(&asyncLogger.isStopping)) {
+    ATOMIC_DECREMENT(&asyncLogger.activeWriters);
+    return;
+  }
+
+  // 初回はリングバッファを作成
+  if (!thread.pRing) {
+    thread.pRing = registerAsyncLogRing();
+  }
+
+  // 呼び出し箇所ごとのレート制限 (メトリクスは制限しない)
+  if (asyncLogger.rateLimit != 0 && level != LOG_LEVEL_PROFILE) {
+    now = GETTIME();
+    auto& rate = thread.rates[fmt];
+    if (now - rate.windowStart >= HUNDREDS_OF_NANOS_IN_A_SECOND) {
+      if (rate.suppressed != 0) {
+        captureLog(thread, level, tag, "%u similar messages suppressed: %s", rate.suppressed, fmt);
+      }
+      rate = {now, 0, 0};
+    }
+    if (rate.count++ >= asyncLogger.rateLimit) {
+      rate.suppressed++;
+      ATOMIC_INCREMENT(&thread.pRing->suppressedCount);
+      isSuppressed = TRUE;
+    }
+  }
+
+  // 引数を整形せずに書き込む
+  if (!isSuppressed) {
+    va_start(args, fmt);
+    captureLogRecord(thread, level, tag, fmt, args);
+    va_end(args);
+  }
+
+  ATOMIC_DECREMENT(&asyncLogger.activeWriters);
+}
+
+/**
+ * @brief リングバッファのログを整形して出力するスレッド
+ *
+ * 全スレッドのリングバッファから読み出したログを時刻順に並べて標準出力に書き込む。
+ */
+PVOID asyncLoggerRoutine(PVOID arg)
+{
+  std::vector<std::shared_ptr<AsyncLogRing>> rings;
+  std::vector<std::pair<UINT64, std::string>> lines;
+  std::vector<BYTE> record;
+  AsyncLogRecordHeader header;
+  BOOL isTerminated = FALSE;
+  SIZE_T droppedCount;
+
+  UNUSED_PARAM(arg);
+
+  while (!isTerminated) {
+    // 終了前に書き込まれたログはすべて出力する
+    isTerminated = ATOMIC_LOAD_BOOL(&asyncLogger.isTerminated);
+
+    // 読み出し中に書き込まれたログは次の起床で出力する
+    ATOMIC_STORE_BOOL(&asyncLogger.hasPendingLogs, FALSE);
+
+    MUTEX_LOCK(asyncLogger.lock);
+    rings = asyncLogger.rings;
+    MUTEX_UNLOCK(asyncLogger.lock);
+
+    // 全スレッドのログを読み出して整形
+    for (auto&& pRing : rings) {
+      while (readAsyncLogRing(*pRing, record)) {
+        MEMCPY(&header, record.data(), SIZEOF(header));
+        lines.emplace_back(header.time, formatLogRecord(record));
+      }
+
+      // 容量不足で破棄したログ
+      droppedCount = ATOMIC_LOAD(&pRing->droppedCount);
+      if (droppedCount != pRing->reportedDroppedCount) {
+        lines.emplace_back(GETTIME(),
+                           "asyncLogger: dropped " + std::to_string(droppedCount - pRing->reportedDroppedCount) + " messages from thread " +
+                             std::to_string(pRing->tid) + "\n");
+        pRing->reportedDroppedCount = droppedCount;
+      }
+    }
+
+    // 時刻順に出力
+    std::stable_sort(lines.begin(), lines.end(), [](auto&& a, auto&& b) {
+      return a.first < b.first;
+    });
+    for (auto&& line : lines) {
+      fputs(line.second.c_str(), stdout);
+    }
+    if (!lines.empty()) {
+      fflush(stdout);
+    }
+    lines.clear();
+
+    // 終了したスレッドのリングバッファを破棄 (カウンタは引き継ぐ)
+    MUTEX_LOCK(asyncLogger.lock);
+    std::erase_if(asyncLogger.rings, [](auto&& pRing) {
+      if (!ATOMIC_LOAD_BOOL(&pRing->isAbandoned) || __atomic_load_n(&pRing->head, __ATOMIC_ACQUIRE) != pRing->tail) {
+        return false;
+      }
+      asyncLogger.retiredCapturedCount += ATOMIC_LOAD(&pRing->capturedCount);
+      asyncLogger.retiredDroppedCount += ATOMIC_LOAD(&pRing->droppedCount);
+      asyncLogger.retiredSuppressedCount += ATOMIC_LOAD(&pRing->suppressedCount);
+      return true;
+    });
+    rings.clear();
+
+    // 書き込みがあるまで待機 (書き込んだスレッドが条件変数で起床する)
+    while (!isTerminated && !ATOMIC_LOAD_BOOL(&asyncLogger.hasPendingLogs) && !ATOMIC_LOAD_BOOL(&asyncLogger.isTerminated)) {
+      CVAR_WAIT(asyncLogger.cvar, asyncLogger.lock, INFINITE_TIME_VALUE);
+    }
+    MUTEX_UNLOCK(asyncLogger.lock);
+  }
+
+  return nullptr;
+}
+
+/**
+ * @brief 非同期ロガーのメトリクスを出力する
+ */
+VOID logAsyncLoggerStats()
+{
+  SIZE_T capturedCount, droppedCount, suppressedCount, threadCount;
+
+  // 開始していない場合は無視
+  if (!asyncLogger.isEnabled) {
+    return;
+  }
+
+  // 全スレッドの合計
+  MUTEX_LOCK(asyncLogger.lock);
+  capturedCount = asyncLogger.retiredCapturedCount;
+  droppedCount = asyncLogger.retiredDroppedCount;
+  suppressedCount = asyncLogger.retiredSuppressedCount;
+  threadCount = asyncLogger.rings.size();
+  for (auto&& pRing : asyncLogger.rings) {
+    capturedCount += ATOMIC_LOAD(&pRing->capturedCount);
+    droppedCount += ATOMIC_LOAD(&pRing->droppedCount);
+    suppressedCount += ATOMIC_LOAD(&pRing->suppressedCount);
+  }
+  MUTEX_UNLOCK(asyncLogger.lock);
+
+  DLOGP("asyncLogger: threads: %zu, captured: %zu, dropped: %zu, suppressed: %zu",
+        threadCount,
+        capturedCount - asyncLogger.lastCapturedCount,
+        droppedCount - asyncLogger.lastDroppedCount,
+        suppressedCount - asyncLogger.lastSuppressedCount);
+
+  asyncLogger.lastCapturedCount = capturedCount;
+  asyncLogger.lastDroppedCount = droppedCount;
+  asyncLogger.lastSuppressedCount = suppressedCount;
+}
+
+// ============================================================================
+// バッファプール
+// ============================================================================
+
+/**
+ * @brief バッファプールを初期化する
+ */
+STATUS initBufferPool(BufferPool& bufferPool, SIZE_T blockSize, UINT32 maxFreeBlocks)
+{
+  auto retStatus = STATUS_SUCCESS;
+
+  // 設定
+  bufferPool.blockSize = blockSize;
+  bufferPool.maxFreeBlocks = maxFreeBlocks;
+  bufferPool.freeBlocks.reserve(maxFreeBlocks);
+  bufferPool.inUseCount = 0;
+  bufferPool.peakInUseCount = 0;
+  bufferPool.hitCount = 0;
+  bufferPool.missCount = 0;
+
+  // 保護用ミューテックス
+  bufferPool.lock = MUTEX_CREATE(FALSE);
+  CHK(IS_VALID_MUTEX_VALUE(bufferPool.lock), STATUS_INVALID_OPERATION);
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief バッファプールを解放する
+ */
+STATUS freeBufferPool(BufferPool& bufferPool)
+{
+  auto retStatus = STATUS_SUCCESS;
+
+  // 空きバッファを解放
+  for (auto pBlock : bufferPool.freeBlocks) {
+    MEMFREE(pBlock);
+  }
+  bufferPool.freeBlocks.clear();
+
+  // 保護用ミューテックスを解放
+  if (IS_VALID_MUTEX_VALUE(bufferPool.lock)) {
+    MUTEX_FREE(bufferPool.lock);
+    bufferPool.lock = INVALID_MUTEX_VALUE;
+  }
+
+  return retStatus;
+}
+
+/**
+ * @brief バッファプールからバッファを取得する
+ *
+ * 空きバッファがあれば再利用し、なければ新たに確保する。内容は初期化しない。
+ */
+PBYTE acquireBuffer(BufferPool& bufferPool)
+{
+  PBYTE pBlock = nullptr;
+
+  MUTEX_LOCK(bufferPool.lock);
+
+  // 空きバッファを再利用
+  if (!bufferPool.freeBlocks.empty()) {
+    pBlock = bufferPool.freeBlocks.back();
+    bufferPool.freeBlocks.pop_back();
+    bufferPool.hitCount++;
+  } else if ((pBlock = reinterpret_cast<PBYTE>(MEMALLOC(bufferPool.blockSize)))) {
+    bufferPool.missCount++;
+  }
+
+  // 確保中のバッファ数
+  if (pBlock) {
+    bufferPool.inUseCount++;
+    bufferPool.peakInUseCount = MAX(bufferPool.peakInUseCount, bufferPool.inUseCount);
+  }
+
+  MUTEX_UNLOCK(bufferPool.lock);
+
+  return pBlock;
+}
+
+/**
+ * @brief バッファをバッファプールに返却する
+ */
+VOID releaseBuffer(BufferPool& bufferPool, PBYTE pBlock)
+{
+  // NULLチェック
+  if (!pBlock) {
+    return;
+  }
+
+  MUTEX_LOCK(bufferPool.lock);
+
+  // 上限まで空きバッファとして保持し、超えた分は解放
+  bufferPool.inUseCount--;
+  if (bufferPool.freeBlocks.size() < bufferPool.maxFreeBlocks) {
+    bufferPool.freeBlocks.push_back(pBlock);
+    pBlock = nullptr;
+  }
+
+  MUTEX_UNLOCK(bufferPool.lock);
+
+  if (pBlock) {
+    MEMFREE(pBlock);
+  }
+}
+
+/**
+ * @brief バッファプールのメトリクスを出力する
+ */
+VOID logBufferPoolStats(const CHAR* pName, BufferPool& bufferPool)
+{
+  // 初期化されていない場合は無視
+  if (!IS_VALID_MUTEX_VALUE(bufferPool.lock)) {
+    return;
+  }
+
+  MUTEX_LOCK(bufferPool.lock);
+
+  DLOGP("%s: blockSize: %zu, inUse: %zu, peak: %zu, free: %zu, hits: %zu, misses: %zu",
+        pName,
+        bufferPool.blockSize,
+        bufferPool.inUseCount,
+        bufferPool.peakInUseCount,
+        bufferPool.freeBlocks.size(),
+        bufferPool.hitCount,
+        bufferPool.missCount);
+
+  bufferPool.peakInUseCount = bufferPool.inUseCount;
+  bufferPool.hitCount = 0;
+  bufferPool.missCount = 0;
+
+  MUTEX_UNLOCK(bufferPool.lock);
+}
+
+// ============================================================================
+// スレッド配置
+// ============================================================================
+
+/**
+ * @brief 役割ごとのスレッドの配置を環境変数から読み込む
+ *
+ * 役割ごとに「KVS_WEBRTC_<役割>_CPUS」でCPUアフィニティ、「KVS_WEBRTC_<役割>_SCHED」で
+ * スケジューリングを設定する。設定のない役割はプロセス開始時のアフィニティとSCHED_OTHERに戻す。
+ */
+STATUS initThreadPolicies(PKvsWebrtcHost pKvsWebrtcHost)
+{
+  auto retStatus = STATUS_SUCCESS;
+  PCHAR pCpus, pSched;
+
+  // NULLチェック
+  CHK(pKvsWebrtcHost, STATUS_NULL_ARG);
+
+  // プロセス開始時のアフィニティ
+  CPU_ZERO(&pKvsWebrtcHost->defaultCpus);
+  CHK_ERR(sched_getaffinity(0, SIZEOF(cpu_set_t), &pKvsWebrtcHost->defaultCpus) == 0, STATUS_INTERNAL_ERROR, "CPUアフィニティを取得できません。");
+
+  for (UINT32 role = 0; role < THREAD_ROLE_COUNT; role++) {
+    auto& threadPolicy = pKvsWebrtcHost->threadPolicies[role];
+
+    // デフォルト値
+    threadPolicy.hasCpus = FALSE;
+    CPU_ZERO(&threadPolicy.cpus);
+    threadPolicy.schedPolicy = SCHED_OTHER;
+    threadPolicy.priority = 0;
+    threadPolicy.niceValue = 0;
+
+    // CPUアフィニティ
+    if ((pCpus = GETENV(threadRoleSettings[role].pCpusEnvVar)) && pCpus[0] != '\0') {
+      CHK_ERR(STATUS_SUCCEEDED(parseCpuList(pCpus, threadPolicy.cpus)),
+              STATUS_INVALID_ARG,
+              "環境変数「%s」の値「%s」は不正です。", threadRoleSettings[role].pCpusEnvVar, pCpus);
+      threadPolicy.hasCpus = TRUE;
+      pKvsWebrtcHost->threadPolicyEnabled = TRUE;
+    }
+
+    // スケジューリング
+    if ((pSched = GETENV(threadRoleSettings[role].pSchedEnvVar)) && pSched[0] != '\0') {
+      CHK_ERR(STATUS_SUCCEEDED(parseThreadSched(pSched, threadPolicy)),
+              STATUS_INVALID_ARG,
+              "環境変数「%s」の値「%s」は不正です。", threadRoleSettings[role].pSchedEnvVar, pSched);
+      pKvsWebrtcHost->threadPolicyEnabled = TRUE;
+    }
+  }
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief CPUリスト (例: 0-1,3) を解析する
+ */
+STATUS parseCpuList(PCHAR pCpuList, cpu_set_t& cpus)
+{
+  auto retStatus = STATUS_SUCCESS;
+  std::istringstream ranges(pCpuList);
+  std::string range;
+  UINT32 first, last;
+  size_t pos;
+
+  CPU_ZERO(&cpus);
+
+  while (std::getline(ranges, range, ',')) {
+    // 「開始-終了」または単独のCPU番号
+    pos = range.find('-');
+    CHK(STATUS_SUCCEEDED(STRTOUI32(const_cast<PCHAR>(range.c_str()), const_cast<PCHAR>(range.c_str()) + (pos == std::string::npos ? range.size() : pos), 10, &first)),
+        STATUS_INVALID_ARG);
+    last = first;
+    if (pos != std::string::npos) {
+      CHK(STATUS_SUCCEEDED(STRTOUI32(const_cast<PCHAR>(range.c_str()) + pos + 1, nullptr, 10, &last)), STATUS_INVALID_ARG);
+    }
+    CHK(first <= last && last < CPU_SETSIZE, STATUS_INVALID_ARG);
+
+    for (auto cpu = first; cpu <= last; cpu++) {
+      CPU_SET(cpu, &cpus);
+    }
+  }
+
+  CHK(CPU_COUNT(&cpus) > 0, STATUS_INVALID_ARG);
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief スケジューリングの設定 (fifo:優先度、nice:nice値) を解析する
+ */
+STATUS parseThreadSched(PCHAR pSched, ThreadPolicy& threadPolicy)
+{
+  auto retStatus = STATUS_SUCCESS;
+  std::string sched(pSched);
+  auto pos = sched.find(':');
+  auto kind = sched.substr(0, pos);
+  INT32 value = 0;
+
+  // 値 (省略した場合は0)
+  if (pos != std::string::npos) {
+    CHK(STATUS_SUCCEEDED(STRTOI32(const_cast<PCHAR>(sched.c_str()) + pos + 1, nullptr, 10, &value)), STATUS_INVALID_ARG);
+  }
+
+  if (STRCMPI(kind.c_str(), "fifo") == 0) {
+    // リアルタイム (CAP_SYS_NICEまたはRLIMIT_RTPRIOが必要)
+    CHK(value >= sched_get_priority_min(SCHED_FIFO) && value <= sched_get_priority_max(SCHED_FIFO), STATUS_INVALID_ARG);
+    threadPolicy.schedPolicy = SCHED_FIFO;
+    threadPolicy.priority = value;
+  } else if (STRCMPI(kind.c_str(), "nice") == 0) {
+    CHK(value >= -20 && value <= 19, STATUS_INVALID_ARG);
+    threadPolicy.schedPolicy = SCHED_OTHER;
+    threadPolicy.niceValue = value;
+  } else {
+    CHK(FALSE, STATUS_INVALID_ARG);
+  }
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief 呼び出し元のスレッドに役割を設定する
+ *
+ * 実行待ち時間の統計は配置を設定しない場合も記録し、設定の効果を比較できるようにする。
+ */
+VOID applyThreadPolicy(PKvsWebrtcHost pKvsWebrtcHost, ThreadRole role)
+{
+  auto threadId = static_cast<INT32>(syscall(SYS_gettid));
+  ThreadRoleStats threadStats;
+  struct sched_param param;
+
+  // NULLチェック
+  if (!pKvsWebrtcHost || !IS_VALID_MUTEX_VALUE(pKvsWebrtcHost->threadLock) || role >= THREAD_ROLE_COUNT) {
+    return;
+  }
+
+  // 配置を適用
+  if (pKvsWebrtcHost->threadPolicyEnabled) {
+    auto& threadPolicy = pKvsWebrtcHost->threadPolicies[role];
+
+    // CPUアフィニティ
+    if (sched_setaffinity(0, SIZEOF(cpu_set_t), threadPolicy.hasCpus ? &threadPolicy.cpus : &pKvsWebrtcHost->defaultCpus) != 0) {
+      DLOGW("Failed to set the cpu affinity of %s thread %d: %d", threadRoleSettings[role].pName, threadId, errno);
+    }
+
+    // スケジューリングポリシー (SCHED_OTHERのnice値はスレッドごとに設定する)
+    MEMSET(&param, 0x00, SIZEOF(param));
+    param.sched_priority = threadPolicy.schedPolicy == SCHED_FIFO ? threadPolicy.priority : 0;
+    if (pthread_setschedparam(pthread_self(), threadPolicy.schedPolicy, &param) != 0) {
+      DLOGW("Failed to set the scheduling policy of %s thread %d (CAP_SYS_NICE or RLIMIT_RTPRIO is required for fifo)",
+            threadRoleSettings[role].pName,
+            threadId);
+    }
+    if (threadPolicy.schedPolicy == SCHED_OTHER && setpriority(PRIO_PROCESS, static_cast<id_t>(threadId), threadPolicy.niceValue) != 0) {
+      DLOGW("Failed to set the nice value of %s thread %d: %d", threadRoleSettings[role].pName, threadId, errno);
+    }
+  }
+
+  // 実行待ち時間の基準値
+  threadStats.role = role;
+  threadStats.waitTime = 0;
+  threadStats.timeslices = 0;
+  getThreadSchedStat(threadId, threadStats.waitTime, threadStats.timeslices);
+
+  MUTEX_LOCK(pKvsWebrtcHost->threadLock);
+  pKvsWebrtcHost->threads[threadId] = threadStats;
+  MUTEX_UNLOCK(pKvsWebrtcHost->threadLock);
+}
+
+/**
+ * @brief 呼び出し元のスレッドの役割を解除する
+ */
+VOID releaseThreadPolicy(PKvsWebrtcHost pKvsWebrtcHost)
+{
+  // NULLチェック
+  if (!pKvsWebrtcHost || !IS_VALID_MUTEX_VALUE(pKvsWebrtcHost->threadLock)) {
+    return;
+  }
+
+  MUTEX_LOCK(pKvsWebrtcHost->threadLock);
+  pKvsWebrtcHost->threads.erase(static_cast<INT32>(syscall(SYS_gettid)));
+  MUTEX_UNLOCK(pKvsWebrtcHost->threadLock);
+}
+
+/**
+ * @brief スレッドの実行待ち時間 (ナノ秒) と実行回数を取得する
+ *
+ * /proc/self/task/<tid>/schedstat は「実行時間 実行待ち時間 実行回数」の形式 (ナノ秒)。
+ */
+BOOL getThreadSchedStat(INT32 threadId, UINT64& waitTime, UINT64& timeslices)
+{
+  std::ifstream schedstat("/proc/self/task/" + std::to_string(threadId) + "/schedstat");
+  UINT64 runTime;
+
+  return static_cast<BOOL>(static_cast<bool>(schedstat >> runTime >> waitTime >> timeslices));
+}
+
+/**
+ * @brief 役割ごとの実行待ち時間を出力する
+ *
+ * 実行可能になってからCPUが割り当てられるまでの待ち時間 (ランキュー遅延) を、
+ * 実行1回あたりの平均と役割内で最も待たされたスレッドの平均で出力する。
+ */
+VOID logThreadRoleStats(PKvsWebrtcHost pKvsWebrtcHost)
+{
+  UINT64 waitTime, timeslices;
+  UINT64 roleWaitTime[THREAD_ROLE_COUNT] = {0}, roleTimeslices[THREAD_ROLE_COUNT] = {0};
+  UINT32 roleThreads[THREAD_ROLE_COUNT] = {0};
+  DOUBLE roleWorstWait[THREAD_ROLE_COUNT] = {0}, threadWait;
+
+  // NULLチェック
+  if (!pKvsWebrtcHost || !IS_VALID_MUTEX_VALUE(pKvsWebrtcHost->threadLock)) {
+    return;
+  }
+
+  MUTEX_LOCK(pKvsWebrtcHost->threadLock);
+
+  for (auto it = pKvsWebrtcHost->threads.begin(); it != pKvsWebrtcHost->threads.end();) {
+    auto& threadStats = it->second;
+
+    // 終了したスレッドを削除
+    if (!getThreadSchedStat(it->first, waitTime, timeslices)) {
+      it = pKvsWebrtcHost->threads.erase(it);
+      continue;
+    }
+
+    // 前回からの増分を役割ごとに集計
+    roleThreads[threadStats.role]++;
+    if (timeslices > threadStats.timeslices) {
+      roleWaitTime[threadStats.role] += waitTime - threadStats.waitTime;
+      roleTimeslices[threadStats.role] += timeslices - threadStats.timeslices;
+      threadWait = static_cast<DOUBLE>(waitTime - threadStats.waitTime) / static_cast<DOUBLE>(timeslices - threadStats.timeslices);
+      roleWorstWait[threadStats.role] = MAX(roleWorstWait[threadStats.role], threadWait);
+    }
+
+    threadStats.waitTime = waitTime;
+    threadStats.timeslices = timeslices;
+    it++;
+  }
+
+  MUTEX_UNLOCK(pKvsWebrtcHost->threadLock);
+
+  // ログを出力 (マイクロ秒)
+  for (UINT32 role = 0; role < THREAD_ROLE_COUNT; role++) {
+    if (roleThreads[role] == 0) {
+      continue;
+    }
+    DLOGP("threads %s: count: %u, runqueue wait: mean: %.1f us, worst thread: %.1f us",
+          threadRoleSettings[role].pName,
+          roleThreads[role],
+          roleTimeslices[role] > 0 ? static_cast<DOUBLE>(roleWaitTime[role]) / static_cast<DOUBLE>(roleTimeslices[role]) / 1000.0 : 0.0,
+          roleWorstWait[role] / 1000.0);
+  }
+}
+
+// ============================================================================
+// KvsWebrtcConfig 管理
+// ============================================================================
+
+/**
+ * @brief KVS WebRTCの設定を作成する
+ */
+STATUS createKvsWebrtcConfig(PKvsWebrtcHost pKvsWebrtcHost,
+                             PCHAR pChannelName,
+                             UINT32 channelIndex,
+                             UINT32 logLevel,
+                             std::unique_ptr<KvsWebrtcConfig>& pKvsWebrtcConfig)
+{
+  auto retStatus = STATUS_SUCCESS;
+
+  // NULLチェック
+  CHK(pKvsWebrtcHost && pChannelName, STATUS_NULL_ARG);
+
+  // KVS WebRTCの設定を初期化
+  pKvsWebrtcConfig = std::make_unique<KvsWebrtcConfig>();
+
+  // ホストとチャネル番号
+  pKvsWebrtcConfig->pKvsWebrtcHost = pKvsWebrtcHost;
+  pKvsWebrtcConfig->channelIndex = channelIndex;
+
+  // 接続フラグ
+  ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->isConnected, FALSE);
+
+  // 中断フラグ
+  ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->isInterrupted, FALSE);
+
+  // 終了フラグ
+  ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->isTerminated, FALSE);
+
+  // 設定オブジェクト保護用ミューテックス
+  pKvsWebrtcConfig->kvsWebrtcConfigObjLock = MUTEX_CREATE(TRUE);
+
+  // シグナリングメッセージ送信用ミューテックス
+  pKvsWebrtcConfig->signalingSendMessageLock = MUTEX_CREATE(FALSE);
+
+  // 条件変数
+  pKvsWebrtcConfig->cvar = CVAR_CREATE();
+
+  // シグナリングクライアント再作成フラグ
+  ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->recreateSignalingClient, FALSE);
+  ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->isRecreatingSignalingClient, FALSE);
+
+  // ICEサーバーの数
+  pKvsWebrtcConfig->iceUriCount = 0;
+
+  // 送信用パイプライン
+  pKvsWebrtcConfig->sendPipeline = nullptr;
+
+  // 受信用パイプライン
+  pKvsWebrtcConfig->recvPipeline = nullptr;
+
+  // フレームバス
+  pKvsWebrtcConfig->frameBus.fd = -1;
+  pKvsWebrtcConfig->frameBus.socketFd = -1;
+  pKvsWebrtcConfig->frameBus.threadId = INVALID_TID_VALUE;
+
+  // チャネルごとに重ならないRTP/RTCPのポート
+  pKvsWebrtcConfig->rtpPortBase = RTP_PORT_BASE + channelIndex * RTP_PORTS_PER_CHANNEL;
+
+  // 入力モード
+  CHK_STATUS(initInputMode(pKvsWebrtcConfig.get()));
+
+  // 送信用パイプラインの設定
+  CHK_STATUS(initPipelineSettings(pKvsWebrtcConfig.get()));
+
+  // 映像コーデック
+  CHK_STATUS(initVideoCodecs(pKvsWebrtcConfig.get()));
+
+  // キーフレーム間隔
+  CHK_STATUS(initGopSettings(pKvsWebrtcConfig.get()));
+
+  // レイテンシ計測用SEIを埋め込むか
+  pKvsWebrtcConfig->latencySeiEnabled = getEnvBool(LATENCY_SEI_ENV_VAR, FALSE);
+
+  // ストリーミングスレッド保護用ミューテックス
+  pKvsWebrtcConfig->gstThreadLock = MUTEX_CREATE(FALSE);
+
+  // レイテンシ統計
+  CHK_STATUS(initLatencyStats(pKvsWebrtcConfig->captureToAppsinkLatency, LATENCY_STATS_CAPACITY));
+  CHK_STATUS(initLatencyStats(pKvsWebrtcConfig->appsinkToWriteLatency, LATENCY_STATS_CAPACITY));
+  CHK_STATUS(initLatencyStats(pKvsWebrtcConfig->audioCaptureToWriteLatency, LATENCY_STATS_CAPACITY));
+
+  // 音声のキャプチャ時刻のリングバッファ
+  pKvsWebrtcConfig->audioLatencyLock = MUTEX_CREATE(FALSE);
+  pKvsWebrtcConfig->audioLatencyRecords.resize(AUDIO_LATENCY_RECORDS);
+  pKvsWebrtcConfig->audioLatencyHead = 0;
+  pKvsWebrtcConfig->audioLatencySum = 0;
+  pKvsWebrtcConfig->audioLatencyCount = 0;
+
+  // メディアクロック
+  CHK_STATUS(initMediaClock(pKvsWebrtcConfig->mediaClock));
+
+  // フレームペーサー
+  CHK_STATUS(initFramePacer(pKvsWebrtcConfig.get()));
+
+  // メトリクスの出力間隔
+  pKvsWebrtcConfig->metricsInterval = getEnvUint32(METRICS_INTERVAL_ENV_VAR, DEFAULT_METRICS_INTERVAL_SECONDS) * HUNDREDS_OF_NANOS_IN_A_SECOND;
+  pKvsWebrtcConfig->lastMetricsTime = GETTIME();
+
+  // アドミッション制御
+  CHK_STATUS(initAdmissionControl(pKvsWebrtcConfig.get()));
+
+  // 切断から終了するまでの猶予期間と再接続時間の統計
+  pKvsWebrtcConfig->disconnectGracePeriod =
+    getChannelEnvUint32(pKvsWebrtcConfig.get(), DISCONNECT_GRACE_ENV_VAR, DEFAULT_DISCONNECT_GRACE_MS) * HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+  CHK_STATUS(initLatencyStats(pKvsWebrtcConfig->reconnectLatency, RECONNECT_STATS_CAPACITY));
+  CHK_STATUS(initLatencyStats(pKvsWebrtcConfig->recreateLatency, RECONNECT_STATS_CAPACITY));
+
+  // トークバック
+  CHK_STATUS(initTalkback(pKvsWebrtcConfig.get()));
+
+  // データチャネル
+  CHK_STATUS(initDataChannelSettings(pKvsWebrtcConfig.get()));
+
+  // 録画
+  CHK_STATUS(initRecorder(pKvsWebrtcConfig.get()));
+
+  // CA証明書のパスと認証情報プロバイダー (ホストと共有)
+  pKvsWebrtcConfig->pCaCertPath = pKvsWebrtcHost->pCaCertPath;
+  pKvsWebrtcConfig->pCredentialProvider = pKvsWebrtcHost->pCredentialProvider;
+
+  // クライアント情報を初期化
+  CHK_STATUS(initClientInfo(logLevel, pKvsWebrtcConfig->clientInfo));
+
+  // チャネル情報を初期化
+  CHK_STATUS(initChannelInfo(pChannelName,
+                             pKvsWebrtcConfig->pCaCertPath,
+                             GETENV(DEFAULT_REGION_ENV_VAR),
+                             pKvsWebrtcConfig->channelInfo));
+
+  // コールバックを初期化
+  CHK_STATUS(initCallbacks(reinterpret_cast<UINT64>(pKvsWebrtcConfig.get()), pKvsWebrtcConfig->callbacks));
+
+  // シグナリングクライアントに関するメトリクス初期化
+  CHK_STATUS(initMetrics(pKvsWebrtcConfig->metrics));
+
+CleanUp:
+
+  if (STATUS_FAILED(retStatus)) {
+    freeKvsWebrtcConfig(pKvsWebrtcConfig);
+  }
+
+  return retStatus;
+}
+
+/**
+ * @brief KVS WebRTCの設定を解放する
+ */
+STATUS freeKvsWebrtcConfig(std::unique_ptr<KvsWebrtcConfig>& pKvsWebrtcConfig)
+{
+  ENTERS();
+  auto retStatus = STATUS_SUCCESS;
+
+  // NULLチェック
+  CHK(pKvsWebrtcConfig, retStatus);
+
+  // GStreamerパイプラインを解放 (appsinkのコールバックがロックを使用するため先に停止)
+  freeGstPipelines(pKvsWebrtcConfig.get());
+
+  // フレームバスを解放 (読み出しスレッドがロックを使用するため先に停止)
+  freeFrameBus(pKvsWebrtcConfig->frameBus);
+
+  // フレームペーサーを停止 (送信スレッドがロックを使用するため先に停止)
+  freeFramePacer(pKvsWebrtcConfig.get());
+
+  // 録画を終了 (フレームの入力を停止した後)
+  freeRecorder(pKvsWebrtcConfig->recorder);
+
+  // 設定オブジェクト保護用ミューテックスを解放
+  if (IS_VALID_MUTEX_VALUE(pKvsWebrtcConfig->kvsWebrtcConfigObjLock)) {
+    MUTEX_FREE(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  }
+
+  // シグナリングメッセージ送信用ミューテックスを解放
+  if (IS_VALID_MUTEX_VALUE(pKvsWebrtcConfig->signalingSendMessageLock)) {
+    MUTEX_FREE(pKvsWebrtcConfig->signalingSendMessageLock);
+  }
+
+  // 条件変数を解放
+  if (IS_VALID_CVAR_VALUE(pKvsWebrtcConfig->cvar)) {
+    CVAR_FREE(pKvsWebrtcConfig->cvar);
+  }
+
+  // ストリーミングスレッド保護用ミューテックスを解放
+  if (IS_VALID_MUTEX_VALUE(pKvsWebrtcConfig->gstThreadLock)) {
+    MUTEX_FREE(pKvsWebrtcConfig->gstThreadLock);
+  }
+
+  // 音声のキャプチャ時刻保護用ミューテックスを解放
+  if (IS_VALID_MUTEX_VALUE(pKvsWebrtcConfig->audioLatencyLock)) {
+    MUTEX_FREE(pKvsWebrtcConfig->audioLatencyLock);
+  }
+
+  // ストリーミングセッションを解放
+  for (auto&& value : pKvsWebrtcConfig->streamingSessions) {
+    freeKvsWebrtcStreamingSession(value.second);
+  }
+
+  // ストリーミングセッションをクリア
+  pKvsWebrtcConfig->streamingSessions.clear();
+
+  // トークバックを解放 (ピア接続の解放後はフレームのコールバックが呼ばれない)
+  freeTalkback(pKvsWebrtcConfig->talkback);
+
+  // レイテンシ統計を解放
+  freeLatencyStats(pKvsWebrtcConfig->captureToAppsinkLatency);
+  freeLatencyStats(pKvsWebrtcConfig->appsinkToWriteLatency);
+  freeLatencyStats(pKvsWebrtcConfig->audioCaptureToWriteLatency);
+  freeLatencyStats(pKvsWebrtcConfig->reconnectLatency);
+  freeLatencyStats(pKvsWebrtcConfig->recreateLatency);
+  freeLatencyStats(pKvsWebrtcConfig->dataChannelRtt);
+  freeMediaClock(pKvsWebrtcConfig->mediaClock);
+
+  // 映像コーデックの経路を解放 (パイプラインの解放後)
+  freeVideoCodecs(pKvsWebrtcConfig.get());
+
+  // KVS WebRTCの設定を解放
+  pKvsWebrtcConfig.reset();
+
+CleanUp:
+
+  LEAVES();
+  return retStatus;
+}
+
+/**
+ * @brief 入力モードを初期化する
+ */
+STATUS initInputMode(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto retStatus = STATUS_SUCCESS;
+  PCHAR pInputMode = getChannelEnv(pKvsWebrtcConfig, INPUT_MODE_ENV_VAR);
+
+  // 入力モード
+  if (!pInputMode || STRCMPI(pInputMode, "device") == 0) {
+    pKvsWebrtcConfig->inputMode = INPUT_MODE_DEVICE;
+  } else if (STRCMPI(pInputMode, "test") == 0) {
+    pKvsWebrtcConfig->inputMode = INPUT_MODE_TEST;
+  } else if (STRCMPI(pInputMode, "file") == 0) {
+    pKvsWebrtcConfig->inputMode = INPUT_MODE_FILE;
+  } else if (STRCMPI(pInputMode, "bus") == 0) {
+    pKvsWebrtcConfig->inputMode = INPUT_MODE_BUS;
+  } else {
+    CHK_ERR(FALSE, STATUS_INVALID_ARG, "環境変数「%s」の値「%s」は不正です。", INPUT_MODE_ENV_VAR, pInputMode);
+  }
+
+  // 入力ファイル (音声ファイルを省略した場合は映像ファイルから取り出す)
+  pKvsWebrtcConfig->pVideoFile = getChannelEnv(pKvsWebrtcConfig, VIDEO_FILE_ENV_VAR);
+  pKvsWebrtcConfig->pAudioFile = getChannelEnv(pKvsWebrtcConfig, AUDIO_FILE_ENV_VAR) ? getChannelEnv(pKvsWebrtcConfig, AUDIO_FILE_ENV_VAR) : pKvsWebrtcConfig->pVideoFile;
+  if (pKvsWebrtcConfig->inputMode == INPUT_MODE_FILE) {
+    CHK_ERR(pKvsWebrtcConfig->pVideoFile, STATUS_INVALID_OPERATION, "環境変数「%s」は必須です。", VIDEO_FILE_ENV_VAR);
+  }
+
+  // テストパターン
+  pKvsWebrtcConfig->pTestPattern = getChannelEnv(pKvsWebrtcConfig, TEST_PATTERN_ENV_VAR) ? getChannelEnv(pKvsWebrtcConfig, TEST_PATTERN_ENV_VAR) : const_cast<PCHAR>(DEFAULT_TEST_PATTERN);
+
+  // ビットレート (テスト入力では再現性のために固定する)
+  pKvsWebrtcConfig->videoBitrate = getChannelEnvUint32(pKvsWebrtcConfig, VIDEO_BITRATE_ENV_VAR, pKvsWebrtcConfig->inputMode == INPUT_MODE_TEST ? DEFAULT_TEST_VIDEO_BITRATE : 0);
+  pKvsWebrtcConfig->audioBitrate = getChannelEnvUint32(pKvsWebrtcConfig, AUDIO_BITRATE_ENV_VAR, pKvsWebrtcConfig->inputMode == INPUT_MODE_TEST ? DEFAULT_TEST_AUDIO_BITRATE : 0);
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief 送信用パイプラインの設定を初期化する
+ */
+STATUS initPipelineSettings(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto retStatus = STATUS_SUCCESS;
+  PCHAR pAudioProfile = getChannelEnv(pKvsWebrtcConfig, AUDIO_PROFILE_ENV_VAR);
+
+  // 送信用パイプラインの定義
+  pKvsWebrtcConfig->pSendPipeline = getChannelEnv(pKvsWebrtcConfig, SEND_PIPELINE_ENV_VAR);
+
+  // キャプチャデバイス
+  pKvsWebrtcConfig->pVideoDevice = getChannelEnv(pKvsWebrtcConfig, VIDEO_DEVICE_ENV_VAR);
+  pKvsWebrtcConfig->pAudioDevice = getChannelEnv(pKvsWebrtcConfig, AUDIO_DEVICE_ENV_VAR) ? getChannelEnv(pKvsWebrtcConfig, AUDIO_DEVICE_ENV_VAR) : const_cast<PCHAR>(DEFAULT_AUDIO_DEVICE);
+
+  // 解像度とフレームレート
+  pKvsWebrtcConfig->videoWidth = getChannelEnvUint32(pKvsWebrtcConfig, VIDEO_WIDTH_ENV_VAR, DEFAULT_VIDEO_WIDTH);
+  pKvsWebrtcConfig->videoHeight = getChannelEnvUint32(pKvsWebrtcConfig, VIDEO_HEIGHT_ENV_VAR, DEFAULT_VIDEO_HEIGHT);
+  pKvsWebrtcConfig->videoFramerate = getChannelEnvUint32(pKvsWebrtcConfig, VIDEO_FRAMERATE_ENV_VAR, DEFAULT_VIDEO_FRAMERATE);
+  CHK_ERR(pKvsWebrtcConfig->videoWidth != 0 && pKvsWebrtcConfig->videoHeight != 0 && pKvsWebrtcConfig->videoFramerate != 0,
+          STATUS_INVALID_ARG,
+          "解像度とフレームレートは0より大きい値を指定してください。");
+
+  // H.264エンコーダー (selectVideoEncoderで決定される)
+  pKvsWebrtcConfig->pRequestedVideoEncoder = getChannelEnv(pKvsWebrtcConfig, VIDEO_ENCODER_ENV_VAR) ? getChannelEnv(pKvsWebrtcConfig, VIDEO_ENCODER_ENV_VAR) : const_cast<PCHAR>(DEFAULT_VIDEO_ENCODER);
+  pKvsWebrtcConfig->videoEncoder.clear();
+
+  // ベンチマーク結果のキャッシュファイル
+  pKvsWebrtcConfig->pVideoEncoderCacheFile = getChannelEnv(pKvsWebrtcConfig, VIDEO_ENCODER_CACHE_FILE_ENV_VAR) ? getChannelEnv(pKvsWebrtcConfig, VIDEO_ENCODER_CACHE_FILE_ENV_VAR) : const_cast<PCHAR>(DEFAULT_VIDEO_ENCODER_CACHE_FILE);
+
+  // v4l2h264encのextra-controls
+  pKvsWebrtcConfig->pV4l2Controls = getChannelEnv(pKvsWebrtcConfig, V4L2_CONTROLS_ENV_VAR) ? getChannelEnv(pKvsWebrtcConfig, V4L2_CONTROLS_ENV_VAR) : const_cast<PCHAR>(DEFAULT_V4L2_CONTROLS);
+
+  // v4l2h265encのextra-controls (H.264の設定は含めない)
+  pKvsWebrtcConfig->pV4l2H265Controls = getChannelEnv(pKvsWebrtcConfig, V4L2_H265_CONTROLS_ENV_VAR) ? getChannelEnv(pKvsWebrtcConfig, V4L2_H265_CONTROLS_ENV_VAR) : const_cast<PCHAR>(DEFAULT_V4L2_H265_CONTROLS);
+
+  // 時刻表示
+  pKvsWebrtcConfig->clockOverlayEnabled = getChannelEnvBool(pKvsWebrtcConfig, CLOCK_OVERLAY_ENV_VAR, TRUE);
+
+  // 解像度とフレームレートの適応
+  pKvsWebrtcConfig->videoScalingEnabled = getChannelEnvBool(pKvsWebrtcConfig, VIDEO_SCALING_ENV_VAR, TRUE);
+  pKvsWebrtcConfig->videoScaleCaps = nullptr;
+
+  // 音声のプロファイル
+  if (!pAudioProfile || STRCMPI(pAudioProfile, "default") == 0) {
+    pKvsWebrtcConfig->audioProfile = AUDIO_PROFILE_DEFAULT;
+  } else if (STRCMPI(pAudioProfile, "lowlatency") == 0) {
+    pKvsWebrtcConfig->audioProfile = AUDIO_PROFILE_LOW_LATENCY;
+  } else {
+    CHK_ERR(FALSE, STATUS_INVALID_ARG, "環境変数「%s」の値「%s」は不正です。", AUDIO_PROFILE_ENV_VAR, pAudioProfile);
+  }
+
+  // キューのサイズ (低遅延プロファイルでは音声のキューを小さくする)
+  pKvsWebrtcConfig->videoQueueSize = getChannelEnvUint32(pKvsWebrtcConfig, VIDEO_QUEUE_SIZE_ENV_VAR, DEFAULT_VIDEO_QUEUE_SIZE);
+  pKvsWebrtcConfig->audioQueueSize = getChannelEnvUint32(pKvsWebrtcConfig,
+                                                         AUDIO_QUEUE_SIZE_ENV_VAR,
+                                                         pKvsWebrtcConfig->audioProfile == AUDIO_PROFILE_LOW_LATENCY ? LOW_LATENCY_AUDIO_QUEUE_SIZE
+                                                                                                                   : DEFAULT_AUDIO_QUEUE_SIZE);
+
+  // Opusの初期設定 (適応制御が有効な場合は無音の間の送信を止め、損失に応じてFECを有効にする)
+  pKvsWebrtcConfig->audioAdaptive = getChannelEnvBool(pKvsWebrtcConfig, AUDIO_ADAPTIVE_ENV_VAR, TRUE);
+  pKvsWebrtcConfig->audioEncoder = nullptr;
+  pKvsWebrtcConfig->audioEncoderSettings.inbandFec = FALSE;
+  pKvsWebrtcConfig->audioEncoderSettings.dtx = pKvsWebrtcConfig->audioAdaptive;
+  pKvsWebrtcConfig->audioEncoderSettings.packetLossPercent = 0;
+  pKvsWebrtcConfig->audioEncoderSettings.frameSize =
+    pKvsWebrtcConfig->audioProfile == AUDIO_PROFILE_LOW_LATENCY ? OPUS_FRAME_SIZE_LOW_LATENCY : OPUS_FRAME_SIZE_DEFAULT;
+  pKvsWebrtcConfig->audioEncoderSettings.bitrate = pKvsWebrtcConfig->audioBitrate;
+  pKvsWebrtcConfig->audioLoss = 0;
+  pKvsWebrtcConfig->audioRtt = 0;
+  pKvsWebrtcConfig->lastAudioAdaptTime = GETTIME();
+
+CleanUp:
+
+  return retStatus;
+}
+
+// ============================================================================
+// KvsWebrtcStreamingSession 管理
+// ============================================================================
+
+/**
+ * @brief ストリーミングセッションを作成する
+ */
+STATUS createKvsWebrtcStreamingSession(PKvsWebrtcConfig pKvsWebrtcConfig, PCHAR pPeerClientId, std::unique_ptr<KvsWebrtcStreamingSession>& pStreamingSession)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto allocationSlot = acquireAllocationSessionSlot();
+  AllocationScope allocationScope(ALLOCATION_TAG_PEER_CONNECTION, allocationSlot);
+  RtcMediaStreamTrack audioTrack;
+  RtcRtpTransceiverInit audioRtpTransceiverInit;
+
+  // 音声のトラックを初期化 (映像のトラックはオファーのコーデックに合わせてhandleOfferで追加する)
+  MEMSET(&audioTrack, 0x00, SIZEOF(RtcMediaStreamTrack));
+
+  // ストリーミングセッションを初期化
+  pStreamingSession = std::make_unique<KvsWebrtcStreamingSession>();
+
+  // KVS WebRTCの設定
+  pStreamingSession->pKvsWebrtcConfig = pKvsWebrtcConfig;
+
+  // アロケーション統計のスロット
+  pStreamingSession->allocationSlot = allocationSlot;
+
+  // クライアントID
+  STRCPY(pStreamingSession->peerClientId, pPeerClientId);
+
+  // 終了フラグ
+  ATOMIC_STORE_BOOL(&pStreamingSession->isTerminated, FALSE);
+
+  // ICE候補収集完了フラグ
+  ATOMIC_STORE_BOOL(&pStreamingSession->candidateGatheringDone, FALSE);
+
+  // Trickle ICEフラグ (handleOfferで設定される)
+  pStreamingSession->remoteCanTrickleIce = FALSE;
+
+  // フレームインデックス
+  pStreamingSession->frameIndex = 0;
+
+  // 映像コーデック (handleOfferで選択される)
+  pStreamingSession->videoCodec = VIDEO_CODEC_TYPE_H264;
+
+  // 送信するメディア (handleOfferで設定される) と送信処理の統計
+  ATOMIC_STORE_BOOL(&pStreamingSession->videoEnabled, FALSE);
+  ATOMIC_STORE_BOOL(&pStreamingSession->audioEnabled, FALSE);
+  ATOMIC_STORE(&pStreamingSession->writtenFrames, 0);
+  ATOMIC_STORE(&pStreamingSession->writeTime, 0);
+
+  // 必要とする映像の解像度とフレームレート (データチャネルで通知されるまでは制限なし) と損失率に応じた段
+  ATOMIC_STORE(&pStreamingSession->maxVideoWidth, 0);
+  ATOMIC_STORE(&pStreamingSession->maxVideoHeight, 0);
+  ATOMIC_STORE(&pStreamingSession->maxVideoFramerate, 0);
+  pStreamingSession->videoScaleLevel = 0;
+  pStreamingSession->videoLowLossTime = 0;
+  pStreamingSession->lastPliCount = 0;
+
+  // 接続フラグと作成した時刻 (アドミッション制御で使用)
+  ATOMIC_STORE_BOOL(&pStreamingSession->isConnected, FALSE);
+  pStreamingSession->createTime = GETTIME();
+  pStreamingSession->lastBytesSent = 0;
+  pStreamingSession->egressBitrate = 0;
+
+  // 切断後に終了したセッションを作り直す場合は切断した時刻から再接続時間を計測
+  pStreamingSession->reconnectLock = MUTEX_CREATE(FALSE);
+  pStreamingSession->disconnectTime = 0;
+  pStreamingSession->reconnectStartTime = 0;
+  pStreamingSession->isRecreated = FALSE;
+  if (auto disconnectedPeer = pKvsWebrtcConfig->disconnectedPeers.find(pPeerClientId); disconnectedPeer != pKvsWebrtcConfig->disconnectedPeers.end()) {
+    pStreamingSession->reconnectStartTime = disconnectedPeer->second;
+    pStreamingSession->isRecreated = TRUE;
+    pKvsWebrtcConfig->disconnectedPeers.erase(disconnectedPeer);
+  }
+
+  // ネゴシエーション中の状態
+  pStreamingSession->negotiationLock = MUTEX_CREATE(FALSE);
+  CHK(pStreamingSession->pAnswerSessionDescriptionInit = reinterpret_cast<PRtcSessionDescriptionInit>(
+        acquireBuffer(pKvsWebrtcConfig->pKvsWebrtcHost->sessionDescriptionPool)),
+      STATUS_NOT_ENOUGH_MEMORY);
+  MEMSET(pStreamingSession->pAnswerSessionDescriptionInit, 0x00, SIZEOF(RtcSessionDescriptionInit));
+
+  // ピア接続を初期化
+  CHK_STATUS(initPeerConnection(pKvsWebrtcConfig, pStreamingSession->pPeerConnection));
+
+  // ICE Candidateを受信した際のコールバックを設定
+  CHK_STATUS(peerConnectionOnIceCandidate(pStreamingSession->pPeerConnection,
+                                          reinterpret_cast<UINT64>(pStreamingSession.get()),
+                                          onIceCandidateHandler));
+
+  // ピア接続の状態が変化した際のコールバックを設定
+  CHK_STATUS(peerConnectionOnConnectionStateChange(pStreamingSession->pPeerConnection,
+                                                   reinterpret_cast<UINT64>(pStreamingSession.get()),
+                                                   onConnectionStateChanged));
+
+  // サポートされるコーデックを追加
+  CHK_STATUS(addSupportedCodec(pStreamingSession->pPeerConnection, AUDIO_CODEC));
+
+  // トラックの種類
+  audioTrack.kind = MEDIA_STREAM_TRACK_KIND_AUDIO;
+
+  // トラックのコーデック
+  audioTrack.codec = AUDIO_CODEC;
+
+  // トランシーバーの方向
+  audioRtpTransceiverInit.direction = RTC_RTP_TRANSCEIVER_DIRECTION_SENDRECV;
+
+  // トラックのストリームID
+  STRCPY(audioTrack.streamId, AUDIO_STREAM_ID);
+
+  // トラックのID
+  STRCPY(audioTrack.trackId, AUDIO_TRACK_ID);
+
+  // トランシーバーを追加
+  CHK_STATUS(addTransceiver(pStreamingSession->pPeerConnection, &audioTrack, &audioRtpTransceiverInit, &pStreamingSession->pAudioRtcRtpTransceiver));
+
+  // 受信した音声を再生する場合はフレームのコールバックを設定
+  if (pKvsWebrtcConfig->talkbackEnabled) {
+    CHK_STATUS(transceiverOnFrame(pStreamingSession->pAudioRtcRtpTransceiver,
+                                  reinterpret_cast<UINT64>(pStreamingSession.get()),
+                                  onTalkbackFrame));
+  }
+
+  // データチャネル
+  CHK_STATUS(initStreamingSessionDataChannels(pStreamingSession.get()));
+
+CleanUp:
+
+  if (STATUS_FAILED(retStatus)) {
+    freeKvsWebrtcStreamingSession(pStreamingSession);
+  }
+
+  return retStatus;
+}
+
+/**
+ * @brief ストリーミングセッションを解放する
+ */
+STATUS freeKvsWebrtcStreamingSession(std::unique_ptr<KvsWebrtcStreamingSession>& pStreamingSession)
+{
+  auto retStatus = STATUS_SUCCESS;
+
+  // NULLチェック
+  CHK(pStreamingSession, retStatus);
+
+  // ピア接続を解放
+  CHK_LOG_ERR(closePeerConnection(pStreamingSession->pPeerConnection));
+  CHK_LOG_ERR(freePeerConnection(&pStreamingSession->pPeerConnection));
+
+  // データチャネルを解放 (ピア接続の解放後はコールバックが呼ばれない)
+  pStreamingSession->dataChannels.clear();
+  if (IS_VALID_MUTEX_VALUE(pStreamingSession->dataChannelLock)) {
+    MUTEX_FREE(pStreamingSession->dataChannelLock);
+  }
+
+  // ネゴシエーション中の状態を解放
+  releaseNegotiationState(pStreamingSession.get());
+  if (IS_VALID_MUTEX_VALUE(pStreamingSession->negotiationLock)) {
+    MUTEX_FREE(pStreamingSession->negotiationLock);
+  }
+  if (IS_VALID_MUTEX_VALUE(pStreamingSession->reconnectLock)) {
+    MUTEX_FREE(pStreamingSession->reconnectLock);
+  }
+
+  // アロケーション統計のスロットを解放
+  releaseAllocationSessionSlot(pStreamingSession->allocationSlot, pStreamingSession->peerClientId);
+
+  // ストリーミングセッションを解放
+  pStreamingSession.reset();
+
+CleanUp:
+
+  CHK_LOG_ERR(retStatus);
+
+  return retStatus;
+}
+
+/**
+ * @brief ネゴシエーション中のみ使用するバッファを解放する
+ *
+ * SDPアンサーは接続後に参照しないため、セッションの間保持せずにバッファプールに返却する。
+ */
+VOID releaseNegotiationState(PKvsWebrtcStreamingSession pStreamingSession)
+{
+  // NULLチェック
+  if (!pStreamingSession || !IS_VALID_MUTEX_VALUE(pStreamingSession->negotiationLock)) {
+    return;
+  }
+
+  MUTEX_LOCK(pStreamingSession->negotiationLock);
+  releaseBuffer(pStreamingSession->pKvsWebrtcConfig->pKvsWebrtcHost->sessionDescriptionPool,
+                reinterpret_cast<PBYTE>(pStreamingSession->pAnswerSessionDescriptionInit));
+  pStreamingSession->pAnswerSessionDescriptionInit = nullptr;
+  MUTEX_UNLOCK(pStreamingSession->negotiationLock);
+}
+
+/**
+ * @brief セッションが切断した時刻を取得する (0の場合は切断していない)
+ */
+UINT64 getDisconnectTime(PKvsWebrtcStreamingSession pStreamingSession)
+{
+  UINT64 disconnectTime;
+
+  MUTEX_LOCK(pStreamingSession->reconnectLock);
+  disconnectTime = pStreamingSession->disconnectTime;
+  MUTEX_UNLOCK(pStreamingSession->reconnectLock);
+
+  return disconnectTime;
+}
+
+/**
+ * @brief ストリーミングセッションが保持するメモリ (バイト) を取得する
+ *
+ * ピア接続の内部で確保されるメモリは含まない。
+ */
+SIZE_T getStreamingSessionMemory(PKvsWebrtcStreamingSession pStreamingSession)
+{
+  return SIZEOF(KvsWebrtcStreamingSession) +
+         (pStreamingSession->pAnswerSessionDescriptionInit ? pStreamingSession->pKvsWebrtcConfig->pKvsWebrtcHost->sessionDescriptionPool.blockSize : 0) +
+         pStreamingSession->dataChannels.size() * SIZEOF(KvsWebrtcDataChannel);
+}
+
+/**
+ * @brief 猶予期間を過ぎた切断中のストリーミングセッションを終了する
+ *
+ * 猶予期間中に接続が回復するか、同じクライアントIDから再オファーを受信した場合は既存のセッションを使い続ける。
+ * 設定オブジェクトのロックを保持して呼び出すこと。
+ */
+VOID expireDisconnectedSessions(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto now = GETTIME();
+  UINT64 disconnectTime;
+
+  for (auto&& value : pKvsWebrtcConfig->streamingSessions) {
+    auto& pStreamingSession = value.second;
+    if (!pStreamingSession || ATOMIC_LOAD_BOOL(&pStreamingSession->isTerminated)) {
+      continue;
+    }
+
+    // 猶予期間を過ぎたか
+    disconnectTime = getDisconnectTime(pStreamingSession.get());
+    if (disconnectTime != 0 && now - disconnectTime >= pKvsWebrtcConfig->disconnectGracePeriod) {
+      DLOGI("Session %s did not recover within the grace period", pStreamingSession->peerClientId);
+      ATOMIC_STORE_BOOL(&pStreamingSession->isTerminated, TRUE);
+    }
+  }
+}
+
+// ============================================================================
+// 初期化
+// ============================================================================
+
+/**
+ * @brief 認証情報プロバイダーを作成する
+ */
+STATUS createCredentialProvider(PCHAR pCaCertPath, PAwsCredentialProvider& pCredentialProvider)
+{
+  auto retStatus = STATUS_SUCCESS;
+  PCHAR pIotCoreCredentialEndPoint;
+  PCHAR pIotCoreCert;
+  PCHAR pIotCorePrivateKey;
+  PCHAR pIotCoreRoleAlias;
+  PCHAR pIotCoreThingName;
+
+  // 認証情報プロバイダー
+  CHK_ERR(pIotCoreCredentialEndPoint = GETENV(IOT_CORE_CREDENTIAL_ENDPOINT), STATUS_INVALID_OPERATION, "環境変数「%s」は必須です。", IOT_CORE_CREDENTIAL_ENDPOINT);
+  CHK_ERR(pIotCoreCert               = GETENV(IOT_CORE_CERT),                STATUS_INVALID_OPERATION, "環境変数「%s」は必須です。", IOT_CORE_CERT);
+  CHK_ERR(pIotCorePrivateKey         = GETENV(IOT_CORE_PRIVATE_KEY),         STATUS_INVALID_OPERATION, "環境変数「%s」は必須です。", IOT_CORE_PRIVATE_KEY);
+  CHK_ERR(pIotCoreRoleAlias          = GETENV(IOT_CORE_ROLE_ALIAS),          STATUS_INVALID_OPERATION, "環境変数「%s」は必須です。", IOT_CORE_ROLE_ALIAS);
+  CHK_ERR(pIotCoreThingName          = GETENV(IOT_CORE_THING_NAME),          STATUS_INVALID_OPERATION, "環境変数「%s」は必須です。", IOT_CORE_THING_NAME);
+  CHK_STATUS(createLwsIotCredentialProvider(pIotCoreCredentialEndPoint,
+                                            pIotCoreCert,
+                                            pIotCorePrivateKey,
+                                            pCaCertPath,
+                                            pIotCoreRoleAlias,
+                                            pIotCoreThingName,
+                                            &pCredentialProvider));
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief クライアント情報を初期化する
+ */
+STATUS initClientInfo(UINT32 logLevel, SignalingClientInfo& clientInfo)
+{
+  auto retStatus = STATUS_SUCCESS;
+
+  // クライアント情報のバージョン
+  clientInfo.version = SIGNALING_CLIENT_INFO_CURRENT_VERSION;
+
+  // クライアントID
+  STRCPY(clientInfo.clientId, CLIENT_ID);
+
+  // ログレベル
+  clientInfo.loggingLevel = logLevel;
+
+  // キャッシュファイルのパス
+  clientInfo.cacheFilePath = NULL;
+
+  // 再作成の試行回数
+  clientInfo.signalingClientCreationMaxRetryAttempts = CREATE_SIGNALING_CLIENT_RETRY_ATTEMPTS_SENTINEL_VALUE;
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief チャネル情報を初期化する
+ */
+STATUS initChannelInfo(PCHAR pChannelName, PCHAR pCaCertPath, PCHAR pRegion, ChannelInfo& channelInfo)
+{
+  auto retStatus = STATUS_SUCCESS;
+
+  // チャネル情報のバージョン
+  channelInfo.version = CHANNEL_INFO_CURRENT_VERSION;
+
+  // チャネル名
+  channelInfo.pChannelName = pChannelName;
+
+  // リージョン
+  channelInfo.pRegion = pRegion ? pRegion : const_cast<PCHAR>(DEFAULT_AWS_REGION);
+
+  // KMSキーID
+  channelInfo.pKmsKeyId = NULL;
+
+  // ストリームに紐付くタグの数
+  channelInfo.tagCount = 0;
+
+  // ストリームに紐付くタグ
+  channelInfo.pTags = NULL;
+
+  // チャネルタイプ
+  channelInfo.channelType = SIGNALING_CHANNEL_TYPE_SINGLE_MASTER;
+
+  // チャネルロールタイプ
+  channelInfo.channelRoleType = SIGNALING_CHANNEL_ROLE_TYPE_MASTER;
+
+  // キャッシュポリシー
+  channelInfo.cachingPolicy = SIGNALING_API_CALL_CACHE_TYPE_FILE;
+
+  // キャッシュ期間
+  channelInfo.cachingPeriod = SIGNALING_API_CALL_CACHE_TTL_SENTINEL_VALUE;
+
+  // ICEサーバーの構成情報を非同期で取得する
+  channelInfo.asyncIceServerConfig = TRUE;
+
+  // エラーの発生時に再試行する
+  channelInfo.retry = TRUE;
+
+  // 再接続する
+  channelInfo.reconnect = TRUE;
+
+  // CA証明書のパス
+  channelInfo.pCertPath = pCaCertPath;
+
+  // メッセージのTTL (60ns)
+  channelInfo.messageTtl = 0;
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief コールバックを初期化する
+ */
+STATUS initCallbacks(UINT64 customData, SignalingClientCallbacks& callbacks)
+{
+  auto retStatus = STATUS_SUCCESS;
+
+  // コールバックのバージョン
+  callbacks.version = SIGNALING_CLIENT_CALLBACKS_CURRENT_VERSION;
+
+  // カスタムデータ
+  callbacks.customData = customData;
+
+  // メッセージの受信時
+  callbacks.messageReceivedFn = onSignalingMessageReceived;
+
+  // クライアント状態の変化時
+  callbacks.stateChangeFn = onSignalingClientStateChanged;
+
+  // エラーの発生時
+  callbacks.errorReportFn = onSignalingClientError;
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief メトリクスを初期化する
+ */
+STATUS initMetrics(SignalingClientMetrics& metrics)
+{
+  auto retStatus = STATUS_SUCCESS;
+
+  // シグナリングクライアントに関するメトリクスのバージョン
+  metrics.version = SIGNALING_CLIENT_METRICS_CURRENT_VERSION;
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief ピア接続を初期化する
+ */
+STATUS initPeerConnection(PKvsWebrtcConfig pKvsWebrtcConfig, PRtcPeerConnection& pPeerConnection)
+{
+  ENTERS();
+  auto retStatus = STATUS_SUCCESS;
+  RtcConfiguration configuration;
+  UINT32 i, j, iceConfigCount, uriCount = 0;
+  PIceConfigInfo pIceConfigInfo;
+
+  // ピア接続の設定を初期化
+  MEMSET(&configuration, 0x00, SIZEOF(RtcConfiguration));
+
+  // ネットワークインターフェースを制限するためのフィルター関数
+  configuration.kvsRtcConfiguration.iceSetInterfaceFilterFunc = NULL;
+
+  // ICEモード
+  configuration.iceTransportPolicy = ICE_TRANSPORT_POLICY_ALL;
+
+  // STUNサーバーのエンドポイント
+  SNPRINTF(configuration.iceServers[0].urls,
+           MAX_ICE_CONFIG_URI_LEN,
+           KINESIS_VIDEO_STUN_URL,
+           pKvsWebrtcConfig->channelInfo.pRegion,
+           KINESIS_VIDEO_STUN_URL_POSTFIX);
+
+  // TURNサーバーの設定
+  CHK_STATUS(signalingClientGetIceConfigInfoCount(pKvsWebrtcConfig->signalingHandle, &iceConfigCount));
+
+  // TURNサーバーを1つだけ使用 (候補収集の遅延を最適化)
+  for (uriCount = 0, i = 0; i < 1 && i < iceConfigCount; i++) {
+    CHK_STATUS(signalingClientGetIceConfigInfo(pKvsWebrtcConfig->signalingHandle, i, &pIceConfigInfo));
+
+    for (j = 0; j < pIceConfigInfo->uriCount; j++) {
+      CHECK(uriCount < MAX_ICE_SERVERS_COUNT);
+
+      DLOGD("TURN server %d urls: %s", j + 1, pIceConfigInfo->uris[j]);
+
+      STRNCPY(configuration.iceServers[uriCount + 1].urls, pIceConfigInfo->uris[j], MAX_ICE_CONFIG_URI_LEN);
+      STRNCPY(configuration.iceServers[uriCount + 1].credential, pIceConfigInfo->password, MAX_ICE_CONFIG_CREDENTIAL_LEN);
+      STRNCPY(configuration.iceServers[uriCount + 1].username, pIceConfigInfo->userName, MAX_ICE_CONFIG_USER_NAME_LEN);
+
+      uriCount++;
+    }
+  }
+
+  // ICEサーバーの数を保存
+  pKvsWebrtcConfig->iceUriCount = uriCount + 1;
+
+  // ピア接続を作成
+  CHK_STATUS(createPeerConnection(&configuration, &pPeerConnection));
+
+CleanUp:
+
+  LEAVES();
+  return retStatus;
+}
+
+// ============================================================================
+// シグナリング
+// ============================================================================
+
+/**
+ * @brief シグナリングクライアントを初期化する
+ */
+STATUS initSignaling(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto retStatus = STATUS_SUCCESS;
+  AllocationScope allocationScope(ALLOCATION_TAG_SIGNALING);
+
+  // シグナリングクライアントを作成
+  CHK_STATUS(createSignalingClientSync(&pKvsWebrtcConfig->clientInfo,
+                                       &pKvsWebrtcConfig->channelInfo,
+                                       &pKvsWebrtcConfig->callbacks,
+                                       pKvsWebrtcConfig->pCredentialProvider,
+                                       &pKvsWebrtcConfig->signalingHandle));
+
+  // シグナリングクライアントの接続に必要な情報を取得
+  CHK_STATUS(signalingClientFetchSync(pKvsWebrtcConfig->signalingHandle));
+
+  // シグナリングクライアントを接続
+  CHK_STATUS(signalingClientConnectSync(pKvsWebrtcConfig->signalingHandle));
+
+  // シグナリングクライアントに関するメトリクスを取得
+  CHK_STATUS(signalingClientGetMetrics(pKvsWebrtcConfig->signalingHandle, &pKvsWebrtcConfig->metrics));
+
+  // ログを出力
+  DLOGP(     "getTokenCallTime: %" PRIu64 " ms", pKvsWebrtcConfig->metrics.signalingClientStats.getTokenCallTime);
+  DLOGP(     "describeCallTime: %" PRIu64 " ms", pKvsWebrtcConfig->metrics.signalingClientStats.describeCallTime);
+  DLOGP("describeMediaCallTime: %" PRIu64 " ms", pKvsWebrtcConfig->metrics.signalingClientStats.describeMediaCallTime);
+  DLOGP(       "createCallTime: %" PRIu64 " ms", pKvsWebrtcConfig->metrics.signalingClientStats.createCallTime);
+  DLOGP(  "getEndpointCallTime: %" PRIu64 " ms", pKvsWebrtcConfig->metrics.signalingClientStats.getEndpointCallTime);
+  DLOGP( "getIceConfigCallTime: %" PRIu64 " ms", pKvsWebrtcConfig->metrics.signalingClientStats.getIceConfigCallTime);
+  DLOGP(      "connectCallTime: %" PRIu64 " ms", pKvsWebrtcConfig->metrics.signalingClientStats.connectCallTime);
+  DLOGP(  "joinSessionCallTime: %" PRIu64 " ms", pKvsWebrtcConfig->metrics.signalingClientStats.joinSessionCallTime);
+  DLOGP(     "createClientTime: %" PRIu64 " ms", pKvsWebrtcConfig->metrics.signalingClientStats.createClientTime);
+  DLOGP(      "fetchClientTime: %" PRIu64 " ms", pKvsWebrtcConfig->metrics.signalingClientStats.fetchClientTime);
+  DLOGP(    "connectClientTime: %" PRIu64 " ms", pKvsWebrtcConfig->metrics.signalingClientStats.connectClientTime);
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief シグナリングクライアントを解放する
+ */
+STATUS deinitSignaling(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto retStatus = STATUS_SUCCESS;
+  AllocationScope allocationScope(ALLOCATION_TAG_SIGNALING);
+
+  // NULLチェック
+  CHK(pKvsWebrtcConfig, retStatus);
+
+  // 終了フラグをON
+  ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->isTerminated, TRUE);
+
+  // シグナリングクライアントを解放 (スレッドプールでの再作成と排他)
+  MUTEX_LOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  retStatus = freeSignalingClient(&pKvsWebrtcConfig->signalingHandle);
+  MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  CHK_STATUS(retStatus);
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief 終了したセッションの解放とシグナリングクライアントの再作成を行う
+ */
+STATUS serviceSignaling(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  ENTERS();
+  auto retStatus = STATUS_SUCCESS;
+  auto isConfigObjLocked = FALSE;
+  auto isMetricsDue = FALSE;
+
+  // ロックを開始
+  MUTEX_LOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  isConfigObjLocked = TRUE;
+
+  // 猶予期間を過ぎた切断中のストリーミングセッションを終了
+  expireDisconnectedSessions(pKvsWebrtcConfig);
+
+  // 終了したストリーミングセッションをファンアウトの対象から外し、解放はスレッドで行う
+  // (切断が原因の場合は作り直した際に再接続時間を計測する)
+  for (auto&& value : pKvsWebrtcConfig->streamingSessions) {
+    if (ATOMIC_LOAD_BOOL(&value.second->isTerminated)) {
+      if (auto disconnectTime = getDisconnectTime(value.second.get()); disconnectTime != 0) {
+        pKvsWebrtcConfig->disconnectedPeers[value.first] = disconnectTime;
+      }
+      reapStreamingSession(pKvsWebrtcConfig->pKvsWebrtcHost, std::move(value.second));
+    }
+  }
+
+  // ファンアウトの対象から外したストリーミングセッションをマップから削除
+  std::erase_if(pKvsWebrtcConfig->streamingSessions, [](auto&& value) {
+    return !value.second;
+  });
+
+  // 使用されなくなったコーデックの経路を停止し、削除中に要求された経路を開始
+  updateVideoCodecBranches(pKvsWebrtcConfig);
+
+  // 拒否したオファーのクライアントIDを期限切れで削除
+  std::erase_if(pKvsWebrtcConfig->rejectedPeers, [now = GETTIME()](auto&& value) {
+    return now - value.second >= ADMISSION_REJECTED_PEER_TTL;
+  });
+  std::erase_if(pKvsWebrtcConfig->disconnectedPeers, [now = GETTIME()](auto&& value) {
+    return now - value.second >= RECONNECT_TRACKING_TTL;
+  });
+
+  // シグナリングクライアントの再作成が必要な場合はスレッドプールで実行 (ほかのチャネルを待たせない)
+  if (ATOMIC_LOAD_BOOL(&pKvsWebrtcConfig->recreateSignalingClient) &&
+      !ATOMIC_EXCHANGE_BOOL(&pKvsWebrtcConfig->isRecreatingSignalingClient, TRUE)) {
+    retStatus = threadpoolPush(pKvsWebrtcConfig->pKvsWebrtcHost->pThreadpool, recreateSignalingClientRoutine, pKvsWebrtcConfig);
+    if (STATUS_FAILED(retStatus)) {
+      ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->isRecreatingSignalingClient, FALSE);
+      CHK(FALSE, retStatus);
+    }
+  }
+
+  // メトリクスを出力
+  isMetricsDue = pKvsWebrtcConfig->metricsInterval != 0 && GETTIME() - pKvsWebrtcConfig->lastMetricsTime >= pKvsWebrtcConfig->metricsInterval;
+  if (isMetricsDue) {
+    reportKvsWebrtcMetrics(pKvsWebrtcConfig);
+    pKvsWebrtcConfig->lastMetricsTime = GETTIME();
+  }
+
+  // ロックを解除
+  MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  isConfigObjLocked = FALSE;
+
+  // トークバックのメトリクス (話者のRTTは設定オブジェクトのロックの外で取得する)
+  if (isMetricsDue) {
+    logTalkbackStats(pKvsWebrtcConfig);
+  }
+
+  // データチャネルの疎通確認 (送信は設定オブジェクトのロックの外で行う)
+  if (pKvsWebrtcConfig->pKvsWebrtcHost->dataChannelPingInterval != 0 &&
+      GETTIME() - pKvsWebrtcConfig->lastDataChannelPingTime >= pKvsWebrtcConfig->pKvsWebrtcHost->dataChannelPingInterval) {
+    pingDataChannels(pKvsWebrtcConfig);
+    pKvsWebrtcConfig->lastDataChannelPingTime = GETTIME();
+  }
+
+  // 損失率、RTT、PLIに応じて音声、解像度、キーフレーム間隔を変更 (統計は設定オブジェクトのロックの外で取得する)
+  adaptToSessionStats(pKvsWebrtcConfig);
+
+CleanUp:
+
+  CHK_LOG_ERR(retStatus);
+
+  if (isConfigObjLocked) {
+    MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  }
+
+  LEAVES();
+  return retStatus;
+}
+
+/**
+ * @brief セッションの統計をまとめて取得し、音声、解像度、キーフレーム間隔の適応に渡す
+ *
+ * 統計の取得はピア接続のロックを取るため、対象のセッションを設定オブジェクトのロックを保持して集め、
+ * ロックの外で1回の走査で全適応の分を取得してから、ロックを保持して各適応に渡す。
+ */
+VOID adaptToSessionStats(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto pKvsWebrtcHost = pKvsWebrtcConfig->pKvsWebrtcHost;
+  auto now = GETTIME();
+  std::vector<SessionLinkStats> sessionStats;
+  SessionLinkStats stats;
+  BOOL isAudioDue, isVideoScalingDue, isGopDue;
+
+  // 実行する適応 (前回からの間隔)
+  MUTEX_LOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  isAudioDue = pKvsWebrtcConfig->audioAdaptive && pKvsWebrtcConfig->audioEncoder && now - pKvsWebrtcConfig->lastAudioAdaptTime >= AUDIO_ADAPT_INTERVAL;
+  isVideoScalingDue = pKvsWebrtcConfig->videoScaleCaps && now - pKvsWebrtcConfig->lastVideoScalingTime >= VIDEO_SCALING_INTERVAL;
+  isGopDue = pKvsWebrtcConfig->gopAdaptive && now - pKvsWebrtcConfig->lastGopAdaptTime >= GOP_ADAPT_INTERVAL;
+  MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  if (!isAudioDue && !isVideoScalingDue && !isGopDue) {
+    return;
+  }
+
+  // 統計の取得から適用までセッションが解放されないよう解放スレッドを待たせる
+  MUTEX_LOCK(pKvsWebrtcHost->sessionStatsLock);
+
+  // 接続中のセッションを集める
+  MUTEX_LOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  for (auto&& value : pKvsWebrtcConfig->streamingSessions) {
+    if (!value.second || ATOMIC_LOAD_BOOL(&value.second->isTerminated) || !ATOMIC_LOAD_BOOL(&value.second->isConnected)) {
+      continue;
+    }
+    MEMSET(&stats, 0x00, SIZEOF(SessionLinkStats));
+    stats.pStreamingSession = value.second.get();
+    sessionStats.push_back(stats);
+  }
+  MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+
+  // ロックの外で統計を取得
+  for (auto&& sessionStat : sessionStats) {
+    getSessionLinkStats(sessionStat, isAudioDue, isVideoScalingDue, isGopDue);
+  }
+
+  // ロックを保持して各適応に渡す
+  MUTEX_LOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+
+  // 損失率とRTTに応じてOpusの設定を変更
+  if (isAudioDue) {
+    adaptAudioEncoder(pKvsWebrtcConfig, sessionStats);
+    pKvsWebrtcConfig->lastAudioAdaptTime = GETTIME();
+  }
+
+  // 視聴中のビューアーに合わせて解像度とフレームレートを変更
+  if (isVideoScalingDue) {
+    adaptVideoScaling(pKvsWebrtcConfig, sessionStats);
+    pKvsWebrtcConfig->lastVideoScalingTime = GETTIME();
+  }
+
+  // 参加とPLIのレートに合わせてキーフレーム間隔を変更
+  if (isGopDue) {
+    adaptGop(pKvsWebrtcConfig, sessionStats);
+  }
+
+  MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  MUTEX_UNLOCK(pKvsWebrtcHost->sessionStatsLock);
+}
+
+/**
+ * @brief セッションの統計を取得する (設定オブジェクトのロックを保持せずに呼び出す)
+ *
+ * 音声の適応には音声の損失率とRTT、解像度の適応には映像の損失率、キーフレーム間隔の適応にはPLIとFIRの累計を取得する。
+ */
+VOID getSessionLinkStats(SessionLinkStats& stats, BOOL isAudioDue, BOOL isVideoScalingDue, BOOL isGopDue)
+{
+  auto pStreamingSession = stats.pStreamingSession;
+  RtcStats rtcStats;
+
+  // 音声の損失率とRTT
+  if (isAudioDue) {
+    MEMSET(&rtcStats, 0x00, SIZEOF(RtcStats));
+    rtcStats.requestedTypeOfStats = RTC_STATS_TYPE_REMOTE_INBOUND_RTP;
+    if (STATUS_SUCCEEDED(rtcPeerConnectionGetMetrics(pStreamingSession->pPeerConnection, pStreamingSession->pAudioRtcRtpTransceiver, &rtcStats))) {
+      stats.audioLoss = rtcStats.rtcStatsObject.remoteInboundRtpStreamStats.fractionLost * 100.0;
+      stats.hasAudioLoss = TRUE;
+    }
+
+    MEMSET(&rtcStats, 0x00, SIZEOF(RtcStats));
+    rtcStats.requestedTypeOfStats = RTC_STATS_TYPE_CANDIDATE_PAIR;
+    if (STATUS_SUCCEEDED(rtcPeerConnectionGetMetrics(pStreamingSession->pPeerConnection, nullptr, &rtcStats))) {
+      stats.rtt = rtcStats.rtcStatsObject.iceCandidatePairStats.currentRoundTripTime * 1000.0;
+      stats.hasRtt = TRUE;
+    }
+  }
+
+  // 映像がない場合は以降を取得しない
+  if (!pStreamingSession->pVideoRtcRtpTransceiver) {
+    return;
+  }
+
+  // 映像の損失率
+  if (isVideoScalingDue) {
+    MEMSET(&rtcStats, 0x00, SIZEOF(RtcStats));
+    rtcStats.requestedTypeOfStats = RTC_STATS_TYPE_REMOTE_INBOUND_RTP;
+    if (STATUS_SUCCEEDED(rtcPeerConnectionGetMetrics(pStreamingSession->pPeerConnection, pStreamingSession->pVideoRtcRtpTransceiver, &rtcStats))) {
+      stats.videoLoss = rtcStats.rtcStatsObject.remoteInboundRtpStreamStats.fractionLost * 100.0;
+      stats.hasVideoLoss = TRUE;
+    }
+  }
+
+  // PLIとFIRの累計
+  if (isGopDue) {
+    MEMSET(&rtcStats, 0x00, SIZEOF(RtcStats));
+    rtcStats.requestedTypeOfStats = RTC_STATS_TYPE_OUTBOUND_RTP;
+    if (STATUS_SUCCEEDED(rtcPeerConnectionGetMetrics(pStreamingSession->pPeerConnection, pStreamingSession->pVideoRtcRtpTransceiver, &rtcStats))) {
+      stats.pliCount = static_cast<UINT64>(rtcStats.rtcStatsObject.outboundRtpStreamStats.pliCount) + rtcStats.rtcStatsObject.outboundRtpStreamStats.firCount;
+      stats.hasPliCount = TRUE;
+    }
+  }
+}
+
+/**
+ * @brief シグナリングクライアントを再作成する (スレッドプールで実行)
+ *
+ * 作成と接続はネットワーク通信を伴うため、ロックはハンドルの入れ替えにのみ使用する。
+ */
+PVOID recreateSignalingClientRoutine(PVOID arg)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto pKvsWebrtcConfig = reinterpret_cast<PKvsWebrtcConfig>(arg);
+  auto oldSignalingHandle = INVALID_SIGNALING_CLIENT_HANDLE_VALUE;
+  auto newSignalingHandle = INVALID_SIGNALING_CLIENT_HANDLE_VALUE;
+  auto isTerminated = FALSE;
+  AllocationScope allocationScope(ALLOCATION_TAG_SIGNALING);
+
+  // 古いハンドルを取り出す (終了処理中は再作成しない)
+  MUTEX_LOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  isTerminated = ATOMIC_LOAD_BOOL(&pKvsWebrtcConfig->isTerminated);
+  if (!isTerminated) {
+    oldSignalingHandle = pKvsWebrtcConfig->signalingHandle;
+    pKvsWebrtcConfig->signalingHandle = INVALID_SIGNALING_CLIENT_HANDLE_VALUE;
+  }
+  MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  CHK(!isTerminated, retStatus);
+
+  // シグナリングクライアントを再作成 (ロックの外で実行)
+  DLOGI("Recreating signaling client for channel %s", pKvsWebrtcConfig->channelInfo.pChannelName);
+  CHK_STATUS(freeSignalingClient(&oldSignalingHandle));
+  CHK_STATUS(createSignalingClientSync(&pKvsWebrtcConfig->clientInfo,
+                                       &pKvsWebrtcConfig->channelInfo,
+                                       &pKvsWebrtcConfig->callbacks,
+                                       pKvsWebrtcConfig->pCredentialProvider,
+                                       &newSignalingHandle));
+  CHK_STATUS(signalingClientFetchSync(newSignalingHandle));
+  CHK_STATUS(signalingClientConnectSync(newSignalingHandle));
+
+  // 新しいハンドルに入れ替え (再作成中に終了処理が始まった場合は破棄する)
+  MUTEX_LOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  if (!ATOMIC_LOAD_BOOL(&pKvsWebrtcConfig->isTerminated)) {
+    pKvsWebrtcConfig->signalingHandle = newSignalingHandle;
+    newSignalingHandle = INVALID_SIGNALING_CLIENT_HANDLE_VALUE;
+    ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->recreateSignalingClient, FALSE);
+  }
+  MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+
+CleanUp:
+
+  CHK_LOG_ERR(retStatus);
+
+  // 入れ替えなかったハンドルを解放
+  freeSignalingClient(&newSignalingHandle);
+
+  // 再作成中フラグをOFF (失敗した場合は次のループで再試行する)
+  ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->isRecreatingSignalingClient, FALSE);
+
+  return nullptr;
+}
+
+/**
+ * @brief チャネルのメトリクスを出力する
+ */
+VOID reportKvsWebrtcMetrics(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  SIZE_T sessionMemory = 0, negotiatingSessions = 0, sessionAllocations = 0, maxSessionAllocations = 0;
+  const CHAR* pMaxSessionPeerClientId = "";
+
+  // ストリーミングセッションが保持するメモリとSDK内で確保したメモリ
+  for (auto&& value : pKvsWebrtcConfig->streamingSessions) {
+    sessionMemory += getStreamingSessionMemory(value.second.get());
+    negotiatingSessions += value.second->pAnswerSessionDescriptionInit ? 1 : 0;
+    sessionAllocations += getAllocationSessionBytes(value.second->allocationSlot);
+    if (getAllocationSessionBytes(value.second->allocationSlot) > maxSessionAllocations) {
+      maxSessionAllocations = getAllocationSessionBytes(value.second->allocationSlot);
+      pMaxSessionPeerClientId = value.second->peerClientId;
+    }
+  }
+
+  // ストリーミングセッション数と送信量
+  DLOGP("channel %s: streamingSessions: %zu, sentFrames: %zu, sentBytes: %zu",
+        pKvsWebrtcConfig->channelInfo.pChannelName,
+        pKvsWebrtcConfig->streamingSessions.size(),
+        ATOMIC_EXCHANGE(&pKvsWebrtcConfig->sentFrameCount, 0),
+        ATOMIC_EXCHANGE(&pKvsWebrtcConfig->sentByteCount, 0));
+  DLOGP("channel %s: negotiatingSessions: %zu, sessionMemory: %zu bytes (%zu bytes/session)",
+        pKvsWebrtcConfig->channelInfo.pChannelName,
+        negotiatingSessions,
+        sessionMemory,
+        pKvsWebrtcConfig->streamingSessions.empty() ? 0 : sessionMemory / pKvsWebrtcConfig->streamingSessions.size());
+
+  // セッションごとのSDK内のアロケーション (アロケーション統計が有効な場合)
+  if (getEnvBool(ALLOCATION_STATS_ENV_VAR, FALSE)) {
+    DLOGP("channel %s: sessionAllocations: %zu bytes, largest: %zu bytes (%s)",
+          pKvsWebrtcConfig->channelInfo.pChannelName,
+          sessionAllocations,
+          maxSessionAllocations,
+          pMaxSessionPeerClientId);
+  }
+
+  // セッションごとの送信メディアと負荷
+  logStreamingSessionStats(pKvsWebrtcConfig);
+
+  // アドミッション制御の結果
+  logAdmissionStats(pKvsWebrtcConfig);
+
+  // 再オファーと再接続時間 (既存のセッションで再接続した場合とセッションを作り直した場合)
+  DLOGP("channel %s: reoffers: %zu, iceRestarts: %zu, replacedSessions: %zu",
+        pKvsWebrtcConfig->channelInfo.pChannelName,
+        ATOMIC_EXCHANGE(&pKvsWebrtcConfig->reoffers, 0),
+        ATOMIC_EXCHANGE(&pKvsWebrtcConfig->iceRestarts, 0),
+        ATOMIC_EXCHANGE(&pKvsWebrtcConfig->replacedSessions, 0));
+  logLatencyStats("reconnect", pKvsWebrtcConfig->reconnectLatency);
+  logLatencyStats("recreate", pKvsWebrtcConfig->recreateLatency);
+
+  // レイテンシの分布
+  if (pKvsWebrtcConfig->latencySeiEnabled) {
+    logLatencyStats("captureToAppsink", pKvsWebrtcConfig->captureToAppsinkLatency);
+    logLatencyStats("appsinkToWriteFrame", pKvsWebrtcConfig->appsinkToWriteLatency);
+  }
+
+  // A/Vオフセットとタイムスタンプのジッタ
+  logMediaClockStats(pKvsWebrtcConfig->mediaClock);
+
+  // フレームペーシング
+  if (pKvsWebrtcConfig->pacingEnabled) {
+    logFramePacerStats(pKvsWebrtcConfig->framePacer);
+  }
+
+  // フレームバス
+  logFrameBusStats(pKvsWebrtcConfig);
+
+  // データチャネル
+  logDataChannelStats(pKvsWebrtcConfig);
+
+  // 録画
+  logRecorderStats(pKvsWebrtcConfig);
+
+  // 音声の適応制御とレイテンシ
+  logAudioStats(pKvsWebrtcConfig);
+
+  // 映像コーデックごとのセッション数と帯域
+  logVideoCodecStats(pKvsWebrtcConfig);
+
+  // 解像度とフレームレートの適応
+  logVideoScalingStats(pKvsWebrtcConfig);
+
+  // キーフレーム間隔の適応
+  logGopStats(pKvsWebrtcConfig);
+
+  // ストリーミングスレッドごとのCPU使用率
+  logGstThreadStats(pKvsWebrtcConfig);
+}
+
+/**
+ * @brief ストリーミングセッションごとの送信メディア、送信ビットレート、送信処理時間を出力する
+ *
+ * 送信ビットレートはアドミッション制御で更新した値、送信処理時間はwriteFrame (パケット化、暗号化、送信) の経過時間で、
+ * 出力間隔に対する割合を1コアあたりのCPU使用率の目安とする。設定オブジェクトのロックを保持して呼び出すこと。
+ */
+VOID logStreamingSessionStats(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  SIZE_T writtenFrames, writeTime, videoSessions = 0, audioOnlySessions = 0;
+  DOUBLE interval;
+
+  // 出力間隔 (100ナノ秒単位)
+  interval = static_cast<DOUBLE>(MAX(GETTIME() - pKvsWebrtcConfig->lastMetricsTime, 1ULL));
+
+  for (auto&& value : pKvsWebrtcConfig->streamingSessions) {
+    auto pStreamingSession = value.second.get();
+    if (!pStreamingSession) {
+      continue;
+    }
+
+    auto videoEnabled = ATOMIC_LOAD_BOOL(&pStreamingSession->videoEnabled);
+    auto audioEnabled = ATOMIC_LOAD_BOOL(&pStreamingSession->audioEnabled);
+    videoSessions += videoEnabled ? 1 : 0;
+    audioOnlySessions += !videoEnabled && audioEnabled ? 1 : 0;
+    writtenFrames = ATOMIC_EXCHANGE(&pStreamingSession->writtenFrames, 0);
+    writeTime = ATOMIC_EXCHANGE(&pStreamingSession->writeTime, 0);
+    DLOGP("session %s: media: %s, egress: %.2f kbps, writeFrame: %zu frames, %.2f us/frame, cpu: %.3f%%",
+          pStreamingSession->peerClientId,
+          videoEnabled && audioEnabled ? "video+audio" : videoEnabled ? "video" : audioEnabled ? "audio" : "none",
+          static_cast<DOUBLE>(pStreamingSession->egressBitrate) / 1000,
+          writtenFrames,
+          writtenFrames > 0 ? static_cast<DOUBLE>(writeTime) / writtenFrames / 10.0 : 0.0,
+          static_cast<DOUBLE>(writeTime) / interval * 100.0);
+  }
+
+  DLOGP("channel %s: videoSessions: %zu, audioOnlySessions: %zu", pKvsWebrtcConfig->channelInfo.pChannelName, videoSessions, audioOnlySessions);
+}
+
+// ============================================================================
+// WebRTCセッション処理
+// ============================================================================
+
+/**
+ * @brief SDPオファーを処理する
+ */
+STATUS handleOffer(PKvsWebrtcConfig pKvsWebrtcConfig, PKvsWebrtcStreamingSession pStreamingSession, SignalingMessage& signalingMessage)
+{
+  auto retStatus = STATUS_SUCCESS;
+  AllocationScope allocationScope(ALLOCATION_TAG_PEER_CONNECTION, pStreamingSession->allocationSlot);
+  auto isNegotiationLocked = FALSE;
+  PRtcSessionDescriptionInit pSessionDescriptionInit = nullptr;
+  NullableBool canTrickle;
+  std::string remoteIceUfrag;
+  BOOL isReoffer, isIceRestart, videoEnabled, audioEnabled;
+
+  // セッション情報をバッファプールから取得して初期化
+  CHK(pSessionDescriptionInit = reinterpret_cast<PRtcSessionDescriptionInit>(acquireBuffer(pKvsWebrtcConfig->pKvsWebrtcHost->sessionDescriptionPool)),
+      STATUS_NOT_ENOUGH_MEMORY);
+  MEMSET(pSessionDescriptionInit, 0x00, SIZEOF(RtcSessionDescriptionInit));
+
+  // セッション情報を取得
+  CHK_STATUS(deserializeSessionDescriptionInit(signalingMessage.payload,
+                                               signalingMessage.payloadLen,
+                                               pSessionDescriptionInit));
+
+  // 既存のセッションへの再オファーか、ICEユーザー名フラグメントが変わった (ICEリスタート) か
+  // (フィンガープリントかセッションIDが変わったオファーは呼び出し元で新しいセッションに振り分け済み)
+  remoteIceUfrag = getIceUfrag(pSessionDescriptionInit->sdp);
+  isReoffer = !pStreamingSession->remoteIceUfrag.empty();
+  isIceRestart = isReoffer && remoteIceUfrag != pStreamingSession->remoteIceUfrag;
+  pStreamingSession->remoteIceUfrag = remoteIceUfrag;
+  pStreamingSession->remoteFingerprint = getSdpFingerprint(pSessionDescriptionInit->sdp);
+  pStreamingSession->remoteSdpSessionId = getSdpSessionId(pSessionDescriptionInit->sdp);
+
+  if (isReoffer) {
+    DLOGI("Re-offer from %s (ICE restart: %s)", pStreamingSession->peerClientId, isIceRestart ? "yes" : "no");
+    ATOMIC_INCREMENT(&pKvsWebrtcConfig->reoffers);
+  }
+
+  // ICEリスタートの場合はローカルのICE認証情報を作り直して候補を収集し直す
+  if (isIceRestart) {
+    ATOMIC_INCREMENT(&pKvsWebrtcConfig->iceRestarts);
+    MUTEX_LOCK(pStreamingSession->reconnectLock);
+    if (pStreamingSession->reconnectStartTime == 0) {
+      pStreamingSession->reconnectStartTime = GETTIME();
+    }
+    MUTEX_UNLOCK(pStreamingSession->reconnectLock);
+    ATOMIC_STORE_BOOL(&pStreamingSession->candidateGatheringDone, FALSE);
+    CHK_STATUS(restartIce(pStreamingSession->pPeerConnection));
+  }
+
+  // リモートが受信するメディア
+  getOfferedMedia(pSessionDescriptionInit->sdp, videoEnabled, audioEnabled);
+
+  // 最初のオファーでは映像のコーデックを選択してトランシーバーを追加 (再オファーでは変更しない)
+  if (!pStreamingSession->pVideoRtcRtpTransceiver) {
+    CHK_STATUS(addVideoTransceiver(pKvsWebrtcConfig, pStreamingSession, getOfferedVideoCodecs(pSessionDescriptionInit->sdp), videoEnabled));
+  }
+
+  // リモートのピア接続を設定
+  CHK_STATUS(setRemoteDescription(pStreamingSession->pPeerConnection, pSessionDescriptionInit));
+
+  // リモートが受信するメディアのみ送信 (拒否または送信専用のメディアはパケット化と暗号化を省く)
+  ATOMIC_STORE_BOOL(&pStreamingSession->videoEnabled, videoEnabled);
+  ATOMIC_STORE_BOOL(&pStreamingSession->audioEnabled, audioEnabled);
+
+  // 映像の受信を開始するビューアー (キーフレーム間隔の制御で使用)
+  if (videoEnabled && (!isReoffer || isIceRestart)) {
+    ATOMIC_INCREMENT(&pKvsWebrtcConfig->gopJoins);
+  }
+  if (!videoEnabled || !audioEnabled) {
+    DLOGI("Session %s receives %s", pStreamingSession->peerClientId, videoEnabled ? "video only" : audioEnabled ? "audio only" : "no media");
+  }
+
+  // 再オファーで映像の受信を再開した場合はエンコードの経路を開始 (最初のオファーではトランシーバーの追加時に開始済み)
+  if (isReoffer && videoEnabled && pStreamingSession->videoCodec != VIDEO_CODEC_TYPE_H264) {
+    CHK_LOG_ERR(startVideoCodecBranch(pKvsWebrtcConfig->videoCodecBranches[pStreamingSession->videoCodec]));
+  }
+
+  // リモートがTrickle ICEをサポートしているか確認
+  canTrickle = canTrickleIceCandidates(pStreamingSession->pPeerConnection);
+
+  // setRemoteDescription後はNULLにならない
+  CHECK(!NULLABLE_CHECK_EMPTY(canTrickle));
+  pStreamingSession->remoteCanTrickleIce = canTrickle.value;
+
+  // ロックを開始
+  MUTEX_LOCK(pStreamingSession->negotiationLock);
+  isNegotiationLocked = TRUE;
+
+  // 接続後に返却したSDPアンサーを取得し直す (再オファー)
+  if (!pStreamingSession->pAnswerSessionDescriptionInit) {
+    CHK(pStreamingSession->pAnswerSessionDescriptionInit = reinterpret_cast<PRtcSessionDescriptionInit>(
+          acquireBuffer(pKvsWebrtcConfig->pKvsWebrtcHost->sessionDescriptionPool)),
+        STATUS_NOT_ENOUGH_MEMORY);
+    MEMSET(pStreamingSession->pAnswerSessionDescriptionInit, 0x00, SIZEOF(RtcSessionDescriptionInit));
+  }
+
+  // ローカルのピア接続を設定
+  CHK_STATUS(setLocalDescription(pStreamingSession->pPeerConnection, pStreamingSession->pAnswerSessionDescriptionInit));
+
+  // Trickle ICEをサポートしている場合、またはICE候補を収集し直さない再オファーの場合は即座にアンサーを送信
+  // それ以外はICE候補収集完了後に送信 (onIceCandidateHandlerで処理)
+  if (pStreamingSession->remoteCanTrickleIce || (isReoffer && !isIceRestart)) {
+    // SDPアンサーを作成
+    CHK_STATUS(createAnswer(pStreamingSession->pPeerConnection, pStreamingSession->pAnswerSessionDescriptionInit));
+
+    // SDPアンサーを送信
+    CHK_STATUS(sendAnswer(pStreamingSession));
+  }
+
+  // 接続を維持したままの再オファーは接続状態が変化しないため、ここでSDPアンサーを返却
+  if (isReoffer && !isIceRestart && ATOMIC_LOAD_BOOL(&pStreamingSession->isConnected)) {
+    releaseBuffer(pKvsWebrtcConfig->pKvsWebrtcHost->sessionDescriptionPool, reinterpret_cast<PBYTE>(pStreamingSession->pAnswerSessionDescriptionInit));
+    pStreamingSession->pAnswerSessionDescriptionInit = nullptr;
+  }
+
+CleanUp:
+
+  CHK_LOG_ERR(retStatus);
+
+  // ロックを解除
+  if (isNegotiationLocked) {
+    MUTEX_UNLOCK(pStreamingSession->negotiationLock);
+  }
+
+  // セッション情報をバッファプールに返却
+  releaseBuffer(pKvsWebrtcConfig->pKvsWebrtcHost->sessionDescriptionPool, reinterpret_cast<PBYTE>(pSessionDescriptionInit));
+
+  return retStatus;
+}
+
+/**
+ * @brief SDPから指定した接頭辞で始まる最初の行の値を取得する
+ */
+std::string getSdpValue(const CHAR* pSdp, const std::string& prefix)
+{
+  std::istringstream sdp(pSdp);
+  std::string line;
+
+  while (std::getline(sdp, line)) {
+    if (line.compare(0, prefix.size(), prefix) == 0) {
+      line = line.substr(prefix.size());
+      if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+      }
+      return line;
+    }
+  }
+
+  return "";
+}
+
+/**
+ * @brief SDPからICEユーザー名フラグメントを取得する
+ */
+std::string getIceUfrag(const CHAR* pSdp)
+{
+  return getSdpValue(pSdp, "a=ice-ufrag:");
+}
+
+/**
+ * @brief SDPからDTLS証明書のフィンガープリントを取得する
+ */
+std::string getSdpFingerprint(const CHAR* pSdp)
+{
+  return getSdpValue(pSdp, "a=fingerprint:");
+}
+
+/**
+ * @brief SDPのセッションID (o=行の2番目の値) を取得する
+ */
+std::string getSdpSessionId(const CHAR* pSdp)
+{
+  std::istringstream origin(getSdpValue(pSdp, "o="));
+  std::string username, sessionId;
+
+  origin >> username >> sessionId;
+  return sessionId;
+}
+
+/**
+ * @brief オファーが既存のセッションと同じリモートのピア接続からのものか確認する
+ *
+ * DTLS証明書のフィンガープリントかSDPのセッションIDが変わったオファーは、リモートがピア接続を作り直したものとして
+ * 新しいセッションで処理する。両方が同じでICEユーザー名フラグメントのみ変わったオファーはICEリスタートとして扱う。
+ */
+BOOL isSameRemotePeerConnection(PKvsWebrtcConfig pKvsWebrtcConfig, PKvsWebrtcStreamingSession pStreamingSession, SignalingMessage& signalingMessage)
+{
+  auto isSame = TRUE;
+  PRtcSessionDescriptionInit pSessionDescriptionInit;
+
+  // 最初のオファーを処理していないセッションは比較しない
+  if (pStreamingSession->remoteIceUfrag.empty()) {
+    return TRUE;
+  }
+
+  // セッション情報をバッファプールから取得して比較 (取得できない場合は再オファーとして処理する)
+  pSessionDescriptionInit = reinterpret_cast<PRtcSessionDescriptionInit>(acquireBuffer(pKvsWebrtcConfig->pKvsWebrtcHost->sessionDescriptionPool));
+  if (pSessionDescriptionInit) {
+    MEMSET(pSessionDescriptionInit, 0x00, SIZEOF(RtcSessionDescriptionInit));
+    if (STATUS_SUCCEEDED(deserializeSessionDescriptionInit(signalingMessage.payload, signalingMessage.payloadLen, pSessionDescriptionInit))) {
+      isSame = getSdpFingerprint(pSessionDescriptionInit->sdp) == pStreamingSession->remoteFingerprint &&
+               getSdpSessionId(pSessionDescriptionInit->sdp) == pStreamingSession->remoteSdpSessionId;
+    }
+    releaseBuffer(pKvsWebrtcConfig->pKvsWebrtcHost->sessionDescriptionPool, reinterpret_cast<PBYTE>(pSessionDescriptionInit));
+  }
+
+  return isSame;
+}
+
+/**
+ * @brief SDPオファーからリモートが受信するメディア (映像、音声) を取得する
+ *
+ * メディアセクションの方向属性 (ない場合はセッションの方向属性、それもない場合はsendrecv) が
+ * sendrecvかrecvonlyの場合に受信するとみなす。ポートが0のセクション (バンドルのみのセクションを除く) は拒否されたものとして扱う。
+ */
+VOID getOfferedMedia(const CHAR* pSdp, BOOL& receivesVideo, BOOL& receivesAudio)
+{
+  std::istringstream sdp(pSdp);
+  std::string line, kind, sessionDirection = "sendrecv", direction;
+  BOOL inMedia = FALSE, isRejected = FALSE, isBundleOnly = FALSE;
+
+  receivesVideo = FALSE;
+  receivesAudio = FALSE;
+
+  // メディアセクションの終わりで判定する
+  auto finishMedia = [&]() {
+    auto& mediaDirection = direction.empty() ? sessionDirection : direction;
+    auto receives = (!isRejected || isBundleOnly) && (mediaDirection == "sendrecv" || mediaDirection == "recvonly");
+    if (kind == "video") {
+      receivesVideo = receivesVideo || receives;
+    } else if (kind == "audio") {
+      receivesAudio = receivesAudio || receives;
+    }
+  };
+
+  while (std::getline(sdp, line)) {
+    // 行末のCRを削除
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+
+    if (line.rfind("m=", 0) == 0) {
+      // 新しいメディアセクション (m=<メディア> <ポート> ...)
+      if (inMedia) {
+        finishMedia();
+      }
+      std::istringstream media(line.substr(2));
+      std::string port;
+      media >> kind >> port;
+      inMedia = TRUE;
+      isRejected = port == "0";
+      isBundleOnly = FALSE;
+      direction.clear();
+    } else if (line == "a=sendrecv" || line == "a=sendonly" || line == "a=recvonly" || line == "a=inactive") {
+      // 方向属性 (セッションレベルの場合は全セクションのデフォルト)
+      (inMedia ? direction : sessionDirection) = line.substr(2);
+    } else if (inMedia && line == "a=bundle-only") {
+      isBundleOnly = TRUE;
+    }
+  }
+
+  if (inMedia) {
+    finishMedia();
+  }
+}
+
+/**
+ * @brief SDPアンサーを送信する
+ */
+STATUS sendAnswer(PKvsWebrtcStreamingSession pStreamingSession)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto pKvsWebrtcConfig = pStreamingSession->pKvsWebrtcConfig;
+  auto isLocked = FALSE;
+  UINT32 signalingMessageLen = MAX_SIGNALING_MESSAGE_LEN;
+  PSignalingMessage pSignalingMessage = nullptr;
+
+  // SDPアンサーが解放済み (接続済み) の場合は送信しない
+  CHK(pStreamingSession->pAnswerSessionDescriptionInit, STATUS_INVALID_OPERATION);
+
+  // シグナリングメッセージをバッファプールから取得
+  CHK(pSignalingMessage = reinterpret_cast<PSignalingMessage>(acquireBuffer(pKvsWebrtcConfig->pKvsWebrtcHost->signalingMessagePool)),
+      STATUS_NOT_ENOUGH_MEMORY);
+
+  // SDPアンサーをシリアライズ
+  CHK_STATUS(serializeSessionDescriptionInit(pStreamingSession->pAnswerSessionDescriptionInit,
+                                             pSignalingMessage->payload,
+                                             &signalingMessageLen));
+
+  // シグナリングメッセージのバージョン
+  pSignalingMessage->version = SIGNALING_MESSAGE_CURRENT_VERSION;
+
+  // シグナリングメッセージのタイプ
+  pSignalingMessage->messageType = SIGNALING_MESSAGE_TYPE_ANSWER;
+
+  // クライアントID
+  STRNCPY(pSignalingMessage->peerClientId, pStreamingSession->peerClientId, MAX_SIGNALING_CLIENT_ID_LEN);
+  pSignalingMessage->peerClientId[MAX_SIGNALING_CLIENT_ID_LEN] = '\0';
+
+  // ペイロードの長さ
+  pSignalingMessage->payloadLen = STRLEN(pSignalingMessage->payload);
+
+  // 関連付けID
+  SNPRINTF(pSignalingMessage->correlationId, MAX_CORRELATION_ID_LEN, "%llu", GETTIME());
+
+  // ロックを開始
+  MUTEX_LOCK(pKvsWebrtcConfig->signalingSendMessageLock);
+  isLocked = TRUE;
+
+  // シグナリングメッセージを送信
+  CHK_STATUS(signalingClientSendMessageSync(pKvsWebrtcConfig->signalingHandle, pSignalingMessage));
+
+CleanUp:
+
+  // ロックを解除
+  if (isLocked) {
+    MUTEX_UNLOCK(pKvsWebrtcConfig->signalingSendMessageLock);
+  }
+
+  // シグナリングメッセージをバッファプールに返却
+  if (pSignalingMessage) {
+    releaseBuffer(pKvsWebrtcConfig->pKvsWebrtcHost->signalingMessagePool, reinterpret_cast<PBYTE>(pSignalingMessage));
+  }
+
+  CHK_LOG_ERR(retStatus);
+
+  return retStatus;
+}
+
+/**
+ * @brief ICE候補を送信する
+ */
+STATUS sendIceCandidate(PKvsWebrtcStreamingSession pStreamingSession, PCHAR candidateJson)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto pKvsWebrtcConfig = pStreamingSession->pKvsWebrtcConfig;
+  auto isLocked = FALSE;
+  PSignalingMessage pSignalingMessage = nullptr;
+
+  // NULLチェック
+  CHK(pStreamingSession && candidateJson, STATUS_NULL_ARG);
+
+  // シグナリングメッセージをバッファプールから取得
+  CHK(pSignalingMessage = reinterpret_cast<PSignalingMessage>(acquireBuffer(pKvsWebrtcConfig->pKvsWebrtcHost->signalingMessagePool)),
+      STATUS_NOT_ENOUGH_MEMORY);
+
+  // シグナリングメッセージのバージョン
+  pSignalingMessage->version = SIGNALING_MESSAGE_CURRENT_VERSION;
+
+  // シグナリングメッセージのタイプ
+  pSignalingMessage->messageType = SIGNALING_MESSAGE_TYPE_ICE_CANDIDATE;
+
+  // クライアントID
+  STRNCPY(pSignalingMessage->peerClientId, pStreamingSession->peerClientId, MAX_SIGNALING_CLIENT_ID_LEN);
+  pSignalingMessage->peerClientId[MAX_SIGNALING_CLIENT_ID_LEN] = '\0';
+
+  // ペイロード (終端文字を含めて長さ分だけコピー)
+  pSignalingMessage->payloadLen = static_cast<UINT32>(STRNLEN(candidateJson, MAX_SIGNALING_MESSAGE_LEN));
+  MEMCPY(pSignalingMessage->payload, candidateJson, pSignalingMessage->payloadLen);
+  pSignalingMessage->payload[pSignalingMessage->payloadLen] = '\0';
+
+  // 関連付けID
+  pSignalingMessage->correlationId[0] = '\0';
+
+  // ロックを開始
+  MUTEX_LOCK(pKvsWebrtcConfig->signalingSendMessageLock);
+  isLocked = TRUE;
+
+  // シグナリングメッセージを送信
+  CHK_STATUS(signalingClientSendMessageSync(pKvsWebrtcConfig->signalingHandle, pSignalingMessage));
+
+CleanUp:
+
+  // ロックを解除
+  if (isLocked) {
+    MUTEX_UNLOCK(pKvsWebrtcConfig->signalingSendMessageLock);
+  }
+
+  // シグナリングメッセージをバッファプールに返却
+  if (pSignalingMessage) {
+    releaseBuffer(pKvsWebrtcConfig->pKvsWebrtcHost->signalingMessagePool, reinterpret_cast<PBYTE>(pSignalingMessage));
+  }
+
+  CHK_LOG_ERR(retStatus);
+
+  return retStatus;
+}
+
+/**
+ * @brief リモートからのICE候補を処理する
+ */
+STATUS handleRemoteCandidate(PKvsWebrtcStreamingSession pStreamingSession, SignalingMessage& signalingMessage)
+{
+  auto retStatus = STATUS_SUCCESS;
+  AllocationScope allocationScope(ALLOCATION_TAG_PEER_CONNECTION, pStreamingSession ? pStreamingSession->allocationSlot : 0);
+  RtcIceCandidateInit iceCandidate;
+
+  // NULLチェック
+  CHK(pStreamingSession, STATUS_NULL_ARG);
+
+  // ICE候補をデシリアライズ
+  CHK_STATUS(deserializeRtcIceCandidateInit(signalingMessage.payload, signalingMessage.payloadLen, &iceCandidate));
+
+  // ICE候補を追加
+  CHK_STATUS(addIceCandidate(pStreamingSession->pPeerConnection, iceCandidate.candidate));
+
+CleanUp:
+
+  CHK_LOG_ERR(retStatus);
+
+  return retStatus;
+}
+
+// ============================================================================
+// コールバック
+// ============================================================================
+
+/**
+ * @brief シグナリングクライアントの状態が変化した際のコールバック
+ */
+STATUS onSignalingClientStateChanged(UINT64 customData, SIGNALING_CLIENT_STATE state)
+{
+  UNUSED_PARAM(customData);
+  auto retStatus = STATUS_SUCCESS;
+  PCHAR pStateStr;
+
+  // 状態を表す文字列を取得
+  CHK_STATUS(signalingClientGetStateString(state, &pStateStr));
+
+  // ログを出力
+  DLOGV("state: %d (%s)", state, pStateStr);
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief シグナリングメッセージを受信した際のコールバック
+ */
+STATUS onSignalingMessageReceived(UINT64 customData, PReceivedSignalingMessage pReceivedSignalingMessage)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto pKvsWebrtcConfig = reinterpret_cast<PKvsWebrtcConfig>(customData);
+  std::unique_ptr<KvsWebrtcStreamingSession> pStreamingSession;
+  auto isConfigObjLocked = FALSE;
+  AllocationScope allocationScope(ALLOCATION_TAG_SIGNALING);
+  PCHAR pPeerClientId;
+  AdmissionResult admissionResult;
+
+  // ログを出力 (ペイロード全体を含むためロックの外で出力する)
+  DLOGV("messageType: %d, correlationId: %s, peerClientId: %s, payloadLen: %d, payload: %s, statusCode: %d, errorType: %s, description: %s",
+        pReceivedSignalingMessage->signalingMessage.messageType,
+        pReceivedSignalingMessage->signalingMessage.correlationId,
+        pReceivedSignalingMessage->signalingMessage.peerClientId,
+        pReceivedSignalingMessage->signalingMessage.payloadLen,
+        pReceivedSignalingMessage->signalingMessage.payload,
+        pReceivedSignalingMessage->statusCode,
+        pReceivedSignalingMessage->errorType,
+        pReceivedSignalingMessage->description);
+
+  // ロックを開始
+  MUTEX_LOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  isConfigObjLocked = TRUE;
+
+  // クライアントID
+  pPeerClientId = pReceivedSignalingMessage->signalingMessage.peerClientId;
+
+  // メッセージタイプ別の処理
+  switch (pReceivedSignalingMessage->signalingMessage.messageType) {
+    case SIGNALING_MESSAGE_TYPE_OFFER:
+      // 同じクライアントIDのストリーミングセッションが存在する場合
+      if (auto existingSession = pKvsWebrtcConfig->streamingSessions.find(pPeerClientId);
+          existingSession != pKvsWebrtcConfig->streamingSessions.end()) {
+        // 終了していなければ既存のセッションで再オファーを処理 (ICEリスタートを含む)
+        // (リモートがピア接続を作り直したオファーは既存のセッションを終了して新しいセッションで処理する)
+        if (!ATOMIC_LOAD_BOOL(&existingSession->second->isTerminated)) {
+          if (isSameRemotePeerConnection(pKvsWebrtcConfig, existingSession->second.get(), pReceivedSignalingMessage->signalingMessage)) {
+            CHK_STATUS(handleOffer(pKvsWebrtcConfig, existingSession->second.get(), pReceivedSignalingMessage->signalingMessage));
+            break;
+          }
+          DLOGI("Offer from %s comes from a new peer connection, replacing the session", pPeerClientId);
+          ATOMIC_INCREMENT(&pKvsWebrtcConfig->replacedSessions);
+          ATOMIC_STORE_BOOL(&existingSession->second->isTerminated, TRUE);
+        }
+
+        // 終了したセッションはメインループを待たずにファンアウトの対象から外す
+        if (auto disconnectTime = getDisconnectTime(existingSession->second.get()); disconnectTime != 0) {
+          pKvsWebrtcConfig->disconnectedPeers[pPeerClientId] = disconnectTime;
+        }
+        reapStreamingSession(pKvsWebrtcConfig->pKvsWebrtcHost, std::move(existingSession->second));
+        pKvsWebrtcConfig->streamingSessions.erase(existingSession);
+      }
+
+      // アドミッション制御 (拒否した場合はアンサーを送信しない)
+      admissionResult = admitStreamingSession(pKvsWebrtcConfig, pPeerClientId);
+      if (admissionResult != ADMISSION_RESULT_ADMITTED && admissionResult != ADMISSION_RESULT_EVICTED) {
+        DLOGW("Rejected offer from %s (reason: %u)", pPeerClientId, admissionResult);
+        break;
+      }
+
+      // ストリーミングセッションを作成
+      CHK_STATUS(createKvsWebrtcStreamingSession(pKvsWebrtcConfig, pPeerClientId, pStreamingSession));
+
+      // SDPオファーを処理
+      CHK_STATUS(handleOffer(pKvsWebrtcConfig, pStreamingSession.get(), pReceivedSignalingMessage->signalingMessage));
+
+      // ストリーミングセッションを保存
+      pKvsWebrtcConfig->streamingSessions.emplace(pPeerClientId, std::move(pStreamingSession));
+      break;
+    case SIGNALING_MESSAGE_TYPE_ICE_CANDIDATE:
+      // 拒否したオファーのICE候補は無視する
+      if (!pKvsWebrtcConfig->streamingSessions.contains(pPeerClientId) && pKvsWebrtcConfig->rejectedPeers.contains(pPeerClientId)) {
+        break;
+      }
+
+      // ストリーミングセッションの存在チェック
+      CHK_ERR(pKvsWebrtcConfig->streamingSessions.contains(pPeerClientId),
+              STATUS_INVALID_OPERATION,
+              "クライアントID「%s」のピア接続が見つかりません。",
+              pPeerClientId);
+
+      // リモートからのICE候補を処理
+      CHK_STATUS(handleRemoteCandidate(pKvsWebrtcConfig->streamingSessions[pPeerClientId].get(),
+                                       pReceivedSignalingMessage->signalingMessage));
+      break;
+    default:
+      break;
+  }
+
+  // ロックを解除
+  MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  isConfigObjLocked = FALSE;
+
+CleanUp:
+
+  CHK_LOG_ERR(retStatus);
+
+  if (isConfigObjLocked) {
+    MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  }
+
+  return retStatus;
+}
+
+/**
+ * @brief ICE Candidateを受信した際のコールバック
+ */
+VOID onIceCandidateHandler(UINT64 customData, PCHAR candidateJson)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto pStreamingSession = reinterpret_cast<PKvsWebrtcStreamingSession>(customData);
+  AllocationScope allocationScope(ALLOCATION_TAG_SIGNALING, pStreamingSession ? pStreamingSession->allocationSlot : 0);
+
+  // NULLチェック
+  CHK(pStreamingSession, STATUS_NULL_ARG);
+
+  if (candidateJson == NULL) {
+    // ログを出力
+    DLOGD("ICE candidate gathering done");
+
+    // ICE候補収集完了
+    ATOMIC_STORE_BOOL(&pStreamingSession->candidateGatheringDone, TRUE);
+
+    // Trickle ICEをサポートしていない場合はここでアンサーを送信
+    if (!pStreamingSession->remoteCanTrickleIce) {
+      MUTEX_LOCK(pStreamingSession->negotiationLock);
+      if (pStreamingSession->pAnswerSessionDescriptionInit) {
+        retStatus = createAnswer(pStreamingSession->pPeerConnection, pStreamingSession->pAnswerSessionDescriptionInit);
+        if (STATUS_SUCCEEDED(retStatus)) {
+          retStatus = sendAnswer(pStreamingSession);
+        }
+      }
+      MUTEX_UNLOCK(pStreamingSession->negotiationLock);
+      CHK_STATUS(retStatus);
+    }
+  } else if (pStreamingSession->remoteCanTrickleIce) {
+    // ログを出力
+    DLOGV("candidate: %s", candidateJson);
+
+    // Trickle ICEをサポートしている場合はICE候補を送信
+    CHK_STATUS(sendIceCandidate(pStreamingSession, candidateJson));
+  }
+
+CleanUp:
+
+  CHK_LOG_ERR(retStatus);
+}
+
+/**
+ * @brief ピア接続の状態が変化した際のコールバック
+ */
+VOID onConnectionStateChanged(UINT64 customData, RTC_PEER_CONNECTION_STATE state)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto pStreamingSession = reinterpret_cast<PKvsWebrtcStreamingSession>(customData);
+  auto pKvsWebrtcConfig = pStreamingSession->pKvsWebrtcConfig;
+  AllocationScope allocationScope(ALLOCATION_TAG_PEER_CONNECTION, pStreamingSession->allocationSlot);
+  UINT64 now = GETTIME(), reconnectStartTime;
+
+  // ログを出力
+  DLOGI("state: %u", state);
+
+  // 状態別の処理
+  switch (state) {
+    case RTC_PEER_CONNECTION_STATE_CONNECTED:
+      // 接続フラグをON
+      ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->isConnected, TRUE);
+      ATOMIC_STORE_BOOL(&pStreamingSession->isConnected, TRUE);
+
+      // 切断を解除して再接続時間を記録
+      MUTEX_LOCK(pStreamingSession->reconnectLock);
+      pStreamingSession->disconnectTime = 0;
+      reconnectStartTime = pStreamingSession->reconnectStartTime;
+      pStreamingSession->reconnectStartTime = 0;
+      MUTEX_UNLOCK(pStreamingSession->reconnectLock);
+      if (reconnectStartTime != 0) {
+        addLatencySample(pStreamingSession->isRecreated ? pKvsWebrtcConfig->recreateLatency : pKvsWebrtcConfig->reconnectLatency,
+                         now - reconnectStartTime);
+        pStreamingSession->isRecreated = FALSE;
+      }
+
+      // ネゴシエーションが完了したためSDPアンサーを解放
+      releaseNegotiationState(pStreamingSession);
+
+      // ブロックを解除
+      if (IS_VALID_CVAR_VALUE(pKvsWebrtcConfig->cvar)) {
+        CVAR_BROADCAST(pKvsWebrtcConfig->cvar);
+      }
+      break;
+    case RTC_PEER_CONNECTION_STATE_FAILED:
+    case RTC_PEER_CONNECTION_STATE_CLOSED:
+    case RTC_PEER_CONNECTION_STATE_DISCONNECTED:
+      if (state == RTC_PEER_CONNECTION_STATE_DISCONNECTED) {
+        // 切断した時刻を記録し、猶予期間中は回復または再オファーを待つ (猶予期間を過ぎた場合はメインループで終了する)
+        MUTEX_LOCK(pStreamingSession->reconnectLock);
+        if (pStreamingSession->disconnectTime == 0) {
+          pStreamingSession->disconnectTime = now;
+        }
+        if (pStreamingSession->reconnectStartTime == 0) {
+          pStreamingSession->reconnectStartTime = now;
+        }
+        MUTEX_UNLOCK(pStreamingSession->reconnectLock);
+      }
+
+      // 終了フラグをON
+      if (state != RTC_PEER_CONNECTION_STATE_DISCONNECTED || pKvsWebrtcConfig->disconnectGracePeriod == 0) {
+        ATOMIC_STORE_BOOL(&pStreamingSession->isTerminated, TRUE);
+      }
+    default:
+      // 接続フラグをOFF
+      ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->isConnected, FALSE);
+      ATOMIC_STORE_BOOL(&pStreamingSession->isConnected, FALSE);
+
+      // ブロックを解除
+      if (IS_VALID_CVAR_VALUE(pKvsWebrtcConfig->cvar)) {
+        CVAR_BROADCAST(pKvsWebrtcConfig->cvar);
+      }
+      break;
+  }
+
+  // ホストのメインループを起床 (終了したセッションをファンアウトの対象から外して解放する)
+  if (pKvsWebrtcConfig->pKvsWebrtcHost) {
+    wakeKvsWebrtcHost(pKvsWebrtcConfig->pKvsWebrtcHost);
+  }
+
+CleanUp:
+
+  CHK_LOG_ERR(retStatus);
+}
+
+/**
+ * @brief シグナリングクライアントでエラーが発生した際のコールバック
+ */
+STATUS onSignalingClientError(UINT64 customData, STATUS status, PCHAR message, UINT32 messageLen)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto pKvsWebrtcConfig = reinterpret_cast<PKvsWebrtcConfig>(customData);
+
+  // ログを出力
+  DLOGW("status: 0x%08x, message: %s, messageLen: %d", status, message, messageLen);
+
+  // 特定のエラーの場合はシグナリングクライアントを再作成
+  if (status == STATUS_SIGNALING_ICE_CONFIG_REFRESH_FAILED ||
+      status == STATUS_SIGNALING_RECONNECT_FAILED) {
+    ATOMIC_STORE_BOOL(&pKvsWebrtcConfig->recreateSignalingClient, TRUE);
+    CVAR_BROADCAST(pKvsWebrtcConfig->cvar);
+  }
+
+CleanUp:
+
+  return retStatus;
+}
+
+// ============================================================================
+// GStreamer
+// ============================================================================
+
+/**
+ * @brief エレメントのパッドテンプレートのキャップスを取得する
+ */
+GstCaps* getPadTemplateCaps(const CHAR* pFactoryName, GstPadDirection direction)
+{
+  GstElementFactory* factory;
+  const GList* templates;
+  GstStaticPadTemplate* padTemplate;
+  GstCaps* caps = gst_caps_new_empty();
+
+  // エレメントが存在しない場合は空のキャップス
+  if (!(factory = gst_element_factory_find(pFactoryName))) {
+    return caps;
+  }
+
+  // 指定された方向のパッドテンプレートのキャップスを結合
+  for (templates = gst_element_factory_get_static_pad_templates(factory); templates; templates = templates->next) {
+    padTemplate = static_cast<GstStaticPadTemplate*>(templates->data);
+    if (padTemplate->direction == direction) {
+      caps = gst_caps_merge(caps, gst_static_pad_template_get_caps(padTemplate));
+    }
+  }
+
+  gst_object_unref(factory);
+
+  return caps;
+}
+
+/**
+ * @brief H.264エンコーダーがVIDEO_CODECのプロファイルとレベルを満たすか検証する
+ */
+STATUS validateVideoEncoder(const CHAR* pVideoEncoder, UINT32 width, UINT32 height, UINT32 framerate)
+{
+  auto retStatus = STATUS_SUCCESS;
+  GstElementFactory* factory = nullptr;
+  GstCaps* profileCaps = nullptr;
+  GstCaps* templateCaps = nullptr;
+  UINT32 frameSizeInMbs;
+
+  // レベル3.1のフレームサイズとマクロブロック処理速度の上限
+  frameSizeInMbs = ((width + 15) / 16) * ((height + 15) / 16);
+  CHK_ERR(frameSizeInMbs <= H264_LEVEL_3_1_MAX_FS,
+          STATUS_INVALID_ARG,
+          "解像度「%ux%u」はH.264レベル3.1の上限を超えています。", width, height);
+  CHK_ERR(frameSizeInMbs * framerate <= H264_LEVEL_3_1_MAX_MBPS,
+          STATUS_INVALID_ARG,
+          "解像度とフレームレート「%ux%u@%u」はH.264レベル3.1の上限を超えています。", width, height, framerate);
+
+  // エンコーダーが存在するか
+  CHK_ERR(factory = gst_element_factory_find(pVideoEncoder),
+          STATUS_INVALID_OPERATION,
+          "エンコーダー「%s」が見つかりません。", pVideoEncoder);
+
+  // Constrained Baselineを出力できるか
+  profileCaps = gst_caps_from_string("video/x-h264,profile=constrained-baseline");
+  templateCaps = getPadTemplateCaps(pVideoEncoder, GST_PAD_SRC);
+  CHK_ERR(gst_caps_can_intersect(templateCaps, profileCaps),
+          STATUS_INVALID_OPERATION,
+          "エンコーダー「%s」はConstrained Baselineプロファイルを出力できません。", pVideoEncoder);
+
+CleanUp:
+
+  if (templateCaps) {
+    gst_caps_unref(templateCaps);
+  }
+
+  if (profileCaps) {
+    gst_caps_unref(profileCaps);
+  }
+
+  if (factory) {
+    gst_object_unref(factory);
+  }
+
+  return retStatus;
+}
+
+/**
+ * @brief 使用するH.264エンコーダーを選択する
+ *
+ * 要求されたエンコーダーが使用できない場合はソフトウェアエンコーダーにフォールバックする。
+ */
+STATUS selectVideoEncoder(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto retStatus = STATUS_SUCCESS;
+  std::vector<const CHAR*> candidates;
+
+  // NULLチェック
+  CHK(pKvsWebrtcConfig, STATUS_NULL_ARG);
+
+  // 自動選択の場合はベンチマーク結果から選択
+  if (STRCMPI(pKvsWebrtcConfig->pRequestedVideoEncoder, VIDEO_ENCODER_AUTO) == 0) {
+    CHK_STATUS(autoSelectVideoEncoder(pKvsWebrtcConfig));
+    CHK(FALSE, retStatus);
+  }
+
+  // 候補 (要求されたエンコーダーを優先)
+  candidates.push_back(pKvsWebrtcConfig->pRequestedVideoEncoder);
+  for (auto pCandidate : videoEncoderCandidates) {
+    if (STRCMP(pCandidate, pKvsWebrtcConfig->pRequestedVideoEncoder) != 0) {
+      candidates.push_back(pCandidate);
+    }
+  }
+
+  // 検証に成功した最初のエンコーダーを使用
+  pKvsWebrtcConfig->videoEncoder.clear();
+  for (auto pCandidate : candidates) {
+    if (STATUS_SUCCEEDED(validateVideoEncoder(pCandidate,
+                                              pKvsWebrtcConfig->videoWidth,
+                                              pKvsWebrtcConfig->videoHeight,
+                                              pKvsWebrtcConfig->videoFramerate))) {
+      pKvsWebrtcConfig->videoEncoder = pCandidate;
+      break;
+    }
+  }
+
+  CHK_ERR(!pKvsWebrtcConfig->videoEncoder.empty(), STATUS_INVALID_OPERATION, "使用できるH.264エンコーダーがありません。");
+
+  // フォールバックした場合は警告
+  if (pKvsWebrtcConfig->videoEncoder != pKvsWebrtcConfig->pRequestedVideoEncoder) {
+    DLOGW("Video encoder %s is not available, falling back to %s", pKvsWebrtcConfig->pRequestedVideoEncoder, pKvsWebrtcConfig->videoEncoder.c_str());
+  }
+
+  DLOGI("video encoder: %s", pKvsWebrtcConfig->videoEncoder.c_str());
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief H.264エンコーダーのベンチマークを実行する
+ *
+ * videotestsrcの映像を実際の解像度とフレームレートでエンコードし、
+ * フレームごとのエンコード遅延とCPU時間を計測する。
+ * CPU時間はエンコーダーのワーカースレッドも含めるためプロセス全体で計測し、
+ * 直前の待機中に計測したプロセスの負荷 (起動済みのチャネルなど) を差し引く。
+ */
+STATUS probeVideoEncoder(PKvsWebrtcConfig pKvsWebrtcConfig, const std::string& videoEncoder, VideoEncoderProbeResult& result)
+{
+  auto retStatus = STATUS_SUCCESS;
+  GstElement* pipeline = nullptr;
+  GstElement* element = nullptr;
+  GstPad* pad = nullptr;
+  GstBus* bus = nullptr;
+  GstMessage* message = nullptr;
+  GError* error = nullptr;
+  std::string description;
+  VideoEncoderProbeContext context;
+  UINT64 startTime, wallTime, startCpuTime, cpuTime, baselineWallTime, baselineCpuTime, totalLatency = 0;
+
+  // 計測用のコンテキスト
+  context.lock = MUTEX_CREATE(FALSE);
+
+  // 計測用パイプラインの定義
+  description =
+    "videotestsrc "
+    "  num-buffers=" + std::to_string(VIDEO_ENCODER_PROBE_FRAMES) + " "
+    "  pattern=smpte ! "
+    "video/x-raw"
+    ",width=" + std::to_string(pKvsWebrtcConfig->videoWidth) +
+    ",height=" + std::to_string(pKvsWebrtcConfig->videoHeight) +
+    ",framerate=" + std::to_string(pKvsWebrtcConfig->videoFramerate) + "/1 ! "
+    "videoconvert ! " +
+    buildVideoEncoderDescription(pKvsWebrtcConfig, videoEncoder) +
+    "fakesink "
+    "  name=probe-sink "
+    "  sync=false";
+
+  // 計測用パイプラインを作成
+  pipeline = gst_parse_launch(description.c_str(), &error);
+  if (error) {
+    DLOGW("Failed to create probe pipeline for %s: %s", videoEncoder.c_str(), error->message);
+    g_error_free(error);
+    CHK(FALSE, STATUS_INTERNAL_ERROR);
+  }
+
+  // エンコーダーへの入力時刻を記録するプローブ
+  CHK(element = gst_bin_get_by_name(GST_BIN(pipeline), "video-encoder"), STATUS_INTERNAL_ERROR);
+  pad = gst_element_get_static_pad(element, "sink");
+  gst_object_unref(element);
+  CHK(pad, STATUS_INTERNAL_ERROR);
+  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, [](GstPad*, GstPadProbeInfo* info, gpointer data) {
+    auto pContext = reinterpret_cast<PVideoEncoderProbeContext>(data);
+    auto buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    MUTEX_LOCK(pContext->lock);
+    pContext->inputTimes[GST_BUFFER_PTS(buffer)] = GETTIME();
+    MUTEX_UNLOCK(pContext->lock);
+    return GST_PAD_PROBE_OK;
+  }, &context, nullptr);
+  gst_object_unref(pad);
+
+  // エンコーダーからの出力時刻を記録するプローブ
+  CHK(element = gst_bin_get_by_name(GST_BIN(pipeline), "probe-sink"), STATUS_INTERNAL_ERROR);
+  pad = gst_element_get_static_pad(element, "sink");
+  gst_object_unref(element);
+  CHK(pad, STATUS_INTERNAL_ERROR);
+  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, [](GstPad*, GstPadProbeInfo* info, gpointer data) {
+    auto pContext = reinterpret_cast<PVideoEncoderProbeContext>(data);
+    auto buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    MUTEX_LOCK(pContext->lock);
+    auto it = pContext->inputTimes.find(GST_BUFFER_PTS(buffer));
+    if (it != pContext->inputTimes.end()) {
+      pContext->latencies.push_back(GETTIME() - it->second);
+      pContext->inputTimes.erase(it);
+    }
+    MUTEX_UNLOCK(pContext->lock);
+    return GST_PAD_PROBE_OK;
+  }, &context, nullptr);
+  gst_object_unref(pad);
+
+  // 計測前のプロセスの負荷を計測
+  startTime = GETTIME();
+  startCpuTime = getProcessCpuTime();
+  THREAD_SLEEP(VIDEO_ENCODER_PROBE_BASELINE_DURATION);
+  baselineCpuTime = getProcessCpuTime() - startCpuTime;
+  baselineWallTime = GETTIME() - startTime;
+
+  // 計測を開始
+  startTime = GETTIME();
+  startCpuTime = getProcessCpuTime();
+  gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+  // 終了を待機
+  bus = gst_element_get_bus(pipeline);
+  message = gst_bus_timed_pop_filtered(bus,
+                                       VIDEO_ENCODER_PROBE_TIMEOUT_SECONDS * GST_SECOND,
+                                       static_cast<GstMessageType>(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+  CHK_ERR(message && GST_MESSAGE_TYPE(message) == GST_MESSAGE_EOS,
+          STATUS_INTERNAL_ERROR,
+          "エンコーダー「%s」のベンチマークに失敗しました。", videoEncoder.c_str());
+
+  // 計測を終了 (待機中の負荷を計測時間に換算して差し引く)
+  cpuTime = getProcessCpuTime() - startCpuTime;
+  wallTime = GETTIME() - startTime;
+  baselineCpuTime = baselineCpuTime * wallTime / MAX(baselineWallTime, 1);
+  cpuTime = cpuTime > baselineCpuTime ? cpuTime - baselineCpuTime : 0;
+
+  // 結果を集計
+  CHK_ERR(!context.latencies.empty(), STATUS_INTERNAL_ERROR, "エンコーダー「%s」の出力がありません。", videoEncoder.c_str());
+  for (auto latency : context.latencies) {
+    totalLatency += latency;
+  }
+  result.videoEncoder = videoEncoder;
+  result.frames = static_cast<UINT32>(context.latencies.size());
+  result.meanLatency = totalLatency / result.frames;
+  result.cpuTimePerFrame = cpuTime / result.frames;
+  result.wallTimePerFrame = wallTime / result.frames;
+
+  DLOGP("encoder probe: %s, frames: %u, latency: %.2f ms, cpu: %.2f ms/frame, throughput: %.2f ms/frame",
+        result.videoEncoder.c_str(),
+        result.frames,
+        static_cast<DOUBLE>(result.meanLatency) / HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+        static_cast<DOUBLE>(result.cpuTimePerFrame) / HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+        static_cast<DOUBLE>(result.wallTimePerFrame) / HUNDREDS_OF_NANOS_IN_A_MILLISECOND);
+
+CleanUp:
+
+  if (message) {
+    gst_message_unref(message);
+  }
+
+  if (bus) {
+    gst_object_unref(bus);
+  }
+
+  if (pipeline) {
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+  }
+
+  if (IS_VALID_MUTEX_VALUE(context.lock)) {
+    MUTEX_FREE(context.lock);
+  }
+
+  return retStatus;
+}
+
+/**
+ * @brief ベンチマークでH.264エンコーダーを自動選択する
+ *
+ * 結果をキャッシュファイルに保存して次回以降の起動ではベンチマークを省略する。
+ */
+STATUS autoSelectVideoEncoder(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto retStatus = STATUS_SUCCESS;
+  std::string cacheKey, cachedKey, cachedEncoder;
+  std::ifstream cacheInput;
+  std::ofstream cacheOutput;
+  std::vector<VideoEncoderProbeResult> results;
+  VideoEncoderProbeResult result;
+  PVideoEncoderProbeResult pBest = nullptr;
+  UINT64 frameInterval;
+  GstElementFactory* factory;
+
+  // キャッシュのキー (解像度、フレームレート、ビットレート)
+  cacheKey = std::to_string(pKvsWebrtcConfig->videoWidth) + "x" + std::to_string(pKvsWebrtcConfig->videoHeight) +
+             "@" + std::to_string(pKvsWebrtcConfig->videoFramerate) +
+             ":" + std::to_string(pKvsWebrtcConfig->videoBitrate);
+
+  // キャッシュを確認 (エンコーダーが削除されている場合は再計測)
+  cacheInput.open(pKvsWebrtcConfig->pVideoEncoderCacheFile);
+  if (cacheInput >> cachedKey >> cachedEncoder && cachedKey == cacheKey && (factory = gst_element_factory_find(cachedEncoder.c_str()))) {
+    gst_object_unref(factory);
+    pKvsWebrtcConfig->videoEncoder = cachedEncoder;
+    DLOGI("video encoder: %s (cached in %s)", cachedEncoder.c_str(), pKvsWebrtcConfig->pVideoEncoderCacheFile);
+    CHK(FALSE, retStatus);
+  }
+
+  // 検証に成功した候補のベンチマークを実行
+  for (auto pCandidate : videoEncoderCandidates) {
+    if (STATUS_SUCCEEDED(validateVideoEncoder(pCandidate,
+                                              pKvsWebrtcConfig->videoWidth,
+                                              pKvsWebrtcConfig->videoHeight,
+                                              pKvsWebrtcConfig->videoFramerate)) &&
+        STATUS_SUCCEEDED(probeVideoEncoder(pKvsWebrtcConfig, pCandidate, result))) {
+      results.push_back(result);
+    }
+  }
+
+  CHK_ERR(!results.empty(), STATUS_INVALID_OPERATION, "使用できるH.264エンコーダーがありません。");
+
+  // 最適な候補を選択
+  frameInterval = HUNDREDS_OF_NANOS_IN_A_SECOND / pKvsWebrtcConfig->videoFramerate;
+  for (auto&& candidate : results) {
+    if (!pBest || isBetterVideoEncoder(candidate, *pBest, frameInterval)) {
+      pBest = &candidate;
+    }
+  }
+  pKvsWebrtcConfig->videoEncoder = pBest->videoEncoder;
+  DLOGI("video encoder: %s (selected by probe)", pKvsWebrtcConfig->videoEncoder.c_str());
+
+  // キャッシュを保存
+  cacheOutput.open(pKvsWebrtcConfig->pVideoEncoderCacheFile, std::ios::trunc);
+  if (cacheOutput) {
+    cacheOutput << cacheKey << " " << pBest->videoEncoder << "\n";
+  } else {
+    DLOGW("Failed to write encoder cache %s", pKvsWebrtcConfig->pVideoEncoderCacheFile);
+  }
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief エンコードする映像のキャップスの定義を作成する
+ */
+std::string buildVideoCapsDescription(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  return "video/x-raw"
+         ",width=" + std::to_string(pKvsWebrtcConfig->videoWidth) +
+         ",height=" + std::to_string(pKvsWebrtcConfig->videoHeight) +
+         ",framerate=" + std::to_string(pKvsWebrtcConfig->videoFramerate) + "/1";
+}
+
+/**
+ * @brief 変換なしでエンコーダーに入力できるキャプチャのキャップスをネゴシエーションする
+ *
+ * ソースが出力でき、エンコーダー (と時刻表示) が入力できるキャップスのうち
+ * 解像度とフレームレートが一致するものがあれば、videoconvert/videoscale/videorateを省略する。
+ */
+STATUS negotiateCaptureCaps(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto retStatus = STATUS_SUCCESS;
+  GstElement* source = nullptr;
+  GstPad* sourcePad = nullptr;
+  GstCaps* caps = nullptr;
+  GstCaps* otherCaps = nullptr;
+  GstCaps* intersection = nullptr;
+  gchar* pCapsStr = nullptr;
+
+  // NULLチェック
+  CHK(pKvsWebrtcConfig, STATUS_NULL_ARG);
+
+  // 変換ありの場合は空
+  pKvsWebrtcConfig->captureCaps.clear();
+
+  // ソースを作成してデバイスが出力できるキャップスを取得 (失敗した場合は変換ありにする)
+  CHK(source = gst_element_factory_make(pKvsWebrtcConfig->inputMode == INPUT_MODE_TEST ? "videotestsrc" : "v4l2src", nullptr), retStatus);
+  if (pKvsWebrtcConfig->inputMode == INPUT_MODE_DEVICE && pKvsWebrtcConfig->pVideoDevice) {
+    g_object_set(source, "device", pKvsWebrtcConfig->pVideoDevice, nullptr);
+  }
+  CHK(gst_element_set_state(source, GST_STATE_READY) == GST_STATE_CHANGE_SUCCESS, retStatus);
+  CHK(sourcePad = gst_element_get_static_pad(source, "src"), retStatus);
+  caps = gst_pad_query_caps(sourcePad, nullptr);
+
+  // 解像度とフレームレート
+  otherCaps = gst_caps_from_string(buildVideoCapsDescription(pKvsWebrtcConfig).c_str());
+  intersection = gst_caps_intersect(caps, otherCaps);
+  gst_caps_unref(otherCaps);
+  gst_caps_unref(caps);
+  caps = intersection;
+
+  // エンコーダーの入力
+  otherCaps = getPadTemplateCaps(pKvsWebrtcConfig->videoEncoder.c_str(), GST_PAD_SINK);
+  intersection = gst_caps_intersect(caps, otherCaps);
+  gst_caps_unref(otherCaps);
+  gst_caps_unref(caps);
+  caps = intersection;
+
+  // 時刻表示の入力
+  if (pKvsWebrtcConfig->clockOverlayEnabled) {
+    otherCaps = getPadTemplateCaps("clockoverlay", GST_PAD_SINK);
+    intersection = gst_caps_intersect(caps, otherCaps);
+    gst_caps_unref(otherCaps);
+    gst_caps_unref(caps);
+    caps = intersection;
+  }
+
+  // 一致するキャップスがなければ変換ありにする
+  if (gst_caps_is_empty(caps)) {
+    DLOGI("capture caps: conversion required");
+    CHK(FALSE, retStatus);
+  }
+
+  // キャップスを固定
+  caps = gst_caps_fixate(caps);
+  pCapsStr = gst_caps_to_string(caps);
+  pKvsWebrtcConfig->captureCaps = pCapsStr;
+  DLOGI("capture caps: %s (conversion-free)", pCapsStr);
+
+CleanUp:
+
+  if (pCapsStr) {
+    g_free(pCapsStr);
+  }
+
+  if (caps) {
+    gst_caps_unref(caps);
+  }
+
+  if (sourcePad) {
+    gst_object_unref(sourcePad);
+  }
+
+  if (source) {
+    gst_element_set_state(source, GST_STATE_NULL);
+    gst_object_unref(source);
+  }
+
+  return retStatus;
+}
+
+/**
+ * @brief H.264エンコーダーの定義を作成する
+ */
+std::string buildVideoEncoderDescription(PKvsWebrtcConfig pKvsWebrtcConfig, const std::string& videoEncoder)
+{
+  std::string description;
+  std::string controls = pKvsWebrtcConfig->pV4l2Controls;
+  std::string keyFrameInterval;
+
+  // キーフレーム間隔を制御する場合はエンコーダー自身の間隔を最大値の2倍にする (キーフレームは要求して挿入する)
+  if (pKvsWebrtcConfig->gopAdaptive) {
+    keyFrameInterval = std::to_string(2 * pKvsWebrtcConfig->gopMaxDuration * pKvsWebrtcConfig->videoFramerate / HUNDREDS_OF_NANOS_IN_A_SECOND);
+  }
+
+  if (videoEncoder == "x264enc") {
+    // ビットレートはkbps単位
+    description =
+      "x264enc "
+      "  name=video-encoder "
+      "  tune=zerolatency "
+      "  speed-preset=ultrafast "
+      "  byte-stream=true" +
+      (pKvsWebrtcConfig->videoBitrate != 0 ? " bitrate=" + std::to_string(pKvsWebrtcConfig->videoBitrate / 1000) : std::string()) +
+      (!keyFrameInterval.empty() ? " key-int-max=" + keyFrameInterval : std::string()) + " ! "
+      "video/x-h264,stream-format=byte-stream,alignment=au,profile=constrained-baseline ! ";
+  } else if (videoEncoder == "openh264enc") {
+    description =
+      "openh264enc "
+      "  name=video-encoder "
+      "  complexity=low" +
+      (pKvsWebrtcConfig->videoBitrate != 0 ? " bitrate=" + std::to_string(pKvsWebrtcConfig->videoBitrate) : std::string()) +
+      (!keyFrameInterval.empty() ? " gop-size=" + keyFrameInterval : std::string()) + " ! "
+      "video/x-h264,stream-format=byte-stream,alignment=au,profile=constrained-baseline ! ";
+  } else {
+    if (pKvsWebrtcConfig->videoBitrate != 0) {
+      controls += ",video_bitrate=" + std::to_string(pKvsWebrtcConfig->videoBitrate);
+    }
+    if (!keyFrameInterval.empty()) {
+      controls += ",h264_i_frame_period=" + keyFrameInterval;
+    }
+    description =
+      "v4l2h264enc "
+      "  name=video-encoder "
+      "  extra-controls=\"" + controls + ";\" ! "
+      "video/x-h264,stream-format=byte-stream,alignment=au,level=(string)" H264_LEVEL_CAPS " ! ";
+  }
+
+  return description;
+}
+
+/**
+ * @brief 送信用パイプラインの定義を作成する
+ */
+STATUS buildSendPipelineDescription(PKvsWebrtcConfig pKvsWebrtcConfig, std::string& description)
+{
+  auto retStatus = STATUS_SUCCESS;
+  std::string rtpSinkAsync;
+  std::string videoCaps;
+  std::string clockOverlay;
+  std::string videoTee;
+  std::string videoScale;
+  BOOL lowLatencyAudio;
+
+  // NULLチェック
+  CHK(pKvsWebrtcConfig, STATUS_NULL_ARG);
+  lowLatencyAudio = pKvsWebrtcConfig->audioProfile == AUDIO_PROFILE_LOW_LATENCY;
+
+  // 定義が設定されている場合はそのまま使用
+  if (pKvsWebrtcConfig->pSendPipeline) {
+    description = pKvsWebrtcConfig->pSendPipeline;
+    CHK(FALSE, retStatus);
+  }
+
+  // ファイル入力の場合はプリロールさせるためにRTPのudpsinkを非同期にする
+  rtpSinkAsync = pKvsWebrtcConfig->inputMode == INPUT_MODE_FILE ? "true" : "false";
+
+  // エンコードする映像のキャップス
+  videoCaps = buildVideoCapsDescription(pKvsWebrtcConfig);
+
+  // 時刻表示
+  if (pKvsWebrtcConfig->clockOverlayEnabled) {
+    clockOverlay =
+      "clockoverlay "
+      "  time-format=\"%Y-%m-%d %H:%M:%S\" "
+      "  halignment=right "
+      "  valignment=top ! ";
+  }
+
+  // H.264以外のコーデックを使用できる場合はエンコード前に分岐させる (経路はオファーに応じて追加する)
+  for (UINT32 codec = VIDEO_CODEC_TYPE_H264 + 1; codec < VIDEO_CODEC_TYPE_COUNT; codec++) {
+    if (isVideoCodecAvailable(pKvsWebrtcConfig, static_cast<VideoCodecType>(codec))) {
+      videoTee = "tee name=video-tee allow-not-linked=true ! ";
+    }
+  }
+
+  // 解像度とフレームレートを変更するキャップスフィルター (変換しない場合も追加する、変更するまではパススルー)
+  if (pKvsWebrtcConfig->videoScalingEnabled) {
+    videoScale =
+      "videoscale ! "
+      "videorate ! "
+      "capsfilter name=video-scale-caps caps=\"" + videoCaps + "\" ! ";
+  }
+
+  description = "rtpbin name=rtpbin ";
+
+  // Video
+  switch (pKvsWebrtcConfig->inputMode) {
+    case INPUT_MODE_FILE:
+      description +=
+        "filesrc location=\"" + std::string(pKvsWebrtcConfig->pVideoFile) + "\" ! "
+        "parsebin ! "
+        "video/x-h264 ! ";
+      break;
+    case INPUT_MODE_TEST:
+      description +=
+        "videotestsrc "
+        "  is-live=true "
+        "  pattern=" + std::string(pKvsWebrtcConfig->pTestPattern) + " ! ";
+      break;
+    default:
+      description +=
+        "v4l2src" + (pKvsWebrtcConfig->pVideoDevice ? " device=" + std::string(pKvsWebrtcConfig->pVideoDevice) : std::string()) + " ! ";
+      break;
+  }
+
+  // Videoエンコード (ファイル入力はエンコード済みのため不要)
+  if (pKvsWebrtcConfig->inputMode != INPUT_MODE_FILE && !pKvsWebrtcConfig->captureCaps.empty()) {
+    // ソースがエンコーダーの入力形式で出力できる場合は変換しない (キャップスはパイプライン作成後に設定)
+    description +=
+      "capsfilter name=capture-caps ! "
+      "queue "
+      "  name=video-queue "
+      "  max-size-buffers=" + std::to_string(pKvsWebrtcConfig->videoQueueSize) + " "
+      "  leaky=downstream ! " +
+      videoScale +
+      clockOverlay +
+      videoTee +
+      buildVideoEncoderDescription(pKvsWebrtcConfig, pKvsWebrtcConfig->videoEncoder);
+  } else if (pKvsWebrtcConfig->inputMode != INPUT_MODE_FILE) {
+    description +=
+      "queue "
+      "  name=video-queue "
+      "  max-size-buffers=" + std::to_string(pKvsWebrtcConfig->videoQueueSize) + " "
+      "  leaky=downstream ! "
+      "videoconvert ! " +
+      (pKvsWebrtcConfig->videoScalingEnabled ? videoScale : "videoscale ! videorate ! " + videoCaps + " ! ") +
+      clockOverlay +
+      videoTee +
+      buildVideoEncoderDescription(pKvsWebrtcConfig, pKvsWebrtcConfig->videoEncoder);
+  }
+
+  description +=
+    "h264parse name=video-parse config-interval=-1 ! "
+    "video/x-h264,stream-format=byte-stream,alignment=au ! "
+    "rtph264pay ! "
+    "rtpbin.send_rtp_sink_0 "
+    "rtpbin.send_rtp_src_0 ! "
+    "udpsink "
+    "  host=225.0.0.37 "
+    "  port=" + std::to_string(pKvsWebrtcConfig->rtpPortBase + 0) + " "
+    "  multicast-iface=lo "
+    "  ttl-mc=0 "
+    "  bind-address=127.0.0.1 "
+    "  async=" + rtpSinkAsync + " "
+    "  sync=true "
+    "rtpbin.send_rtcp_src_0 ! "
+    "udpsink "
+    "  host=225.0.0.37 "
+    "  port=" + std::to_string(pKvsWebrtcConfig->rtpPortBase + 1) + " "
+    "  multicast-iface=lo "
+    "  ttl-mc=0 "
+    "  bind-address=127.0.0.1 "
+    "  async=false "
+    "  sync=false ";
+
+  // Audio
+  switch (pKvsWebrtcConfig->inputMode) {
+    case INPUT_MODE_FILE:
+      description +=
+        "filesrc location=\"" + std::string(pKvsWebrtcConfig->pAudioFile) + "\" ! "
+        "parsebin ! "
+        "audio/x-opus ! ";
+      break;
+    case INPUT_MODE_TEST:
+      description +=
+        "audiotestsrc "
+        "  is-live=true "
+        "  wave=sine" + (lowLatencyAudio ? " samplesperbuffer=" + std::to_string(LOW_LATENCY_TEST_SAMPLES_PER_BUFFER) : std::string()) + " ! ";
+      break;
+    default:
+      description +=
+        "alsasrc device=" + std::string(pKvsWebrtcConfig->pAudioDevice) +
+        (lowLatencyAudio ? " latency-time=" + std::to_string(LOW_LATENCY_ALSA_LATENCY_TIME_US) + " buffer-time=" + std::to_string(LOW_LATENCY_ALSA_BUFFER_TIME_US)
+                         : std::string()) +
+        " ! ";
+      break;
+  }
+
+  // Audioエンコード (ファイル入力はエンコード済みのため不要)
+  if (pKvsWebrtcConfig->inputMode != INPUT_MODE_FILE) {
+    description +=
+      "queue "
+      "  name=audio-queue "
+      "  max-size-buffers=" + std::to_string(pKvsWebrtcConfig->audioQueueSize) + " "
+      "  leaky=downstream ! "
+      "audioconvert ! "
+      "audioresample ! " +
+      buildAudioEncoderDescription(pKvsWebrtcConfig) +
+      "audio/x-opus,rate=48000,channels=2 ! ";
+  }
+
+  // RTPのタイムスタンプをランニングタイムに合わせる (受信用パイプラインで音声のキャプチャ時刻を求めるため)
+  description +=
+    "rtpopuspay timestamp-offset=0 ! "
+    "rtpbin.send_rtp_sink_1 "
+    "rtpbin.send_rtp_src_1 ! "
+    "udpsink "
+    "  host=225.0.0.37 "
+    "  port=" + std::to_string(pKvsWebrtcConfig->rtpPortBase + 2) + " "
+    "  multicast-iface=lo "
+    "  ttl-mc=0 "
+    "  bind-address=127.0.0.1 "
+    "  async=" + rtpSinkAsync + " "
+    "  sync=true "
+    "rtpbin.send_rtcp_src_1 ! "
+    "udpsink "
+    "  host=225.0.0.37 "
+    "  port=" + std::to_string(pKvsWebrtcConfig->rtpPortBase + 3) + " "
+    "  multicast-iface=lo "
+    "  ttl-mc=0 "
+    "  bind-address=127.0.0.1 "
+    "  async=false "
+    "  sync=false";
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief ストリーミングスレッドを登録する
+ */
+VOID registerGstThread(PKvsWebrtcConfig pKvsWebrtcConfig, INT32 threadId, PCHAR pName)
+{
+  GstThreadStats threadStats;
+
+  // NULLチェック
+  if (!pKvsWebrtcConfig || !IS_VALID_MUTEX_VALUE(pKvsWebrtcConfig->gstThreadLock)) {
+    return;
+  }
+
+  // CPU時間の基準値
+  threadStats.name = pName ? pName : "unknown";
+  threadStats.cpuTicks = 0;
+  threadStats.time = GETTIME();
+  getThreadCpuTicks(threadId, threadStats.cpuTicks);
+
+  MUTEX_LOCK(pKvsWebrtcConfig->gstThreadLock);
+  pKvsWebrtcConfig->gstThreads[threadId] = threadStats;
+  MUTEX_UNLOCK(pKvsWebrtcConfig->gstThreadLock);
+}
+
+/**
+ * @brief ストリーミングスレッドの登録を解除する
+ */
+VOID unregisterGstThread(PKvsWebrtcConfig pKvsWebrtcConfig, INT32 threadId)
+{
+  // NULLチェック
+  if (!pKvsWebrtcConfig || !IS_VALID_MUTEX_VALUE(pKvsWebrtcConfig->gstThreadLock)) {
+    return;
+  }
+
+  MUTEX_LOCK(pKvsWebrtcConfig->gstThreadLock);
+  pKvsWebrtcConfig->gstThreads.erase(threadId);
+  MUTEX_UNLOCK(pKvsWebrtcConfig->gstThreadLock);
+}
+
+/**
+ * @brief ストリーミングスレッドの役割を判定する
+ *
+ * 受信用パイプラインのスレッドはappsinkからwriteFrameを呼び出すため配信、
+ * 送信用パイプラインはキュー (video-queue、audio-queue) 以降をエンコード、それ以前をキャプチャとする。
+ * トークバックの再生用パイプラインはオーディオデバイスに出力するためキャプチャと同じ扱いとする。
+ * 録画用パイプラインはディスクへの書き込みで待たされるため、独自の役割 (デフォルトは通常の優先度) とする。
+ */
+ThreadRole getGstThreadRole(PKvsWebrtcConfig pKvsWebrtcConfig, const CHAR* pPath)
+{
+  std::string path(pPath ? pPath : "");
+
+  if (path.rfind("/" + std::string(pKvsWebrtcConfig->channelInfo.pChannelName) + "-recv/", 0) == 0) {
+    return THREAD_ROLE_FANOUT;
+  }
+
+  if (path.rfind("/" + std::string(pKvsWebrtcConfig->channelInfo.pChannelName) + "-talkback/", 0) == 0) {
+    return THREAD_ROLE_CAPTURE;
+  }
+
+  if (path.rfind("/" + std::string(pKvsWebrtcConfig->channelInfo.pChannelName) + "-record/", 0) == 0) {
+    return THREAD_ROLE_RECORD;
+  }
+
+  if (path.find("/video-queue") != std::string::npos || path.find("/audio-queue") != std::string::npos) {
+    return THREAD_ROLE_ENCODE;
+  }
+
+  return THREAD_ROLE_CAPTURE;
+}
+
+/**
+ * @brief スレッドのCPU時間 (クロックティック) を取得する
+ */
+BOOL getThreadCpuTicks(INT32 threadId, UINT64& cpuTicks)
+{
+  std::ifstream stat("/proc/self/task/" + std::to_string(threadId) + "/stat");
+  std::string line, field;
+  UINT64 utime = 0, stime = 0;
+  size_t pos;
+
+  // コマンド名に空白が含まれる場合があるため「)」以降を解析
+  if (!std::getline(stat, line) || (pos = line.rfind(')')) == std::string::npos) {
+    return FALSE;
+  }
+
+  // 3番目以降のフィールドからutime (14番目) とstime (15番目) を取得
+  std::istringstream fields(line.substr(pos + 2));
+  for (UINT32 i = 3; fields >> field && i <= 15; i++) {
+    if (i == 14 && STATUS_FAILED(STRTOUI64(const_cast<PCHAR>(field.c_str()), NULL, 10, &utime))) {
+      return FALSE;
+    } else if (i == 15 && STATUS_FAILED(STRTOUI64(const_cast<PCHAR>(field.c_str()), NULL, 10, &stime))) {
+      return FALSE;
+    }
+  }
+
+  cpuTicks = utime + stime;
+  return TRUE;
+}
+
+/**
+ * @brief ストリーミングスレッドごとのCPU使用率を出力する
+ *
+ * スレッドはキューで区切られたエレメントの区間ごとに作成されるため、
+ * スレッドを開始したエレメント (ソースやキュー) の名前で区間ごとのCPU使用率を出力する。
+ */
+VOID logGstThreadStats(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto now = GETTIME();
+  auto ticksPerSecond = static_cast<DOUBLE>(sysconf(_SC_CLK_TCK));
+  UINT64 cpuTicks;
+  DOUBLE elapsed, cpuUsage, totalCpuUsage = 0;
+
+  // NULLチェック
+  if (!pKvsWebrtcConfig || !IS_VALID_MUTEX_VALUE(pKvsWebrtcConfig->gstThreadLock)) {
+    return;
+  }
+
+  MUTEX_LOCK(pKvsWebrtcConfig->gstThreadLock);
+
+  for (auto&& [threadId, threadStats] : pKvsWebrtcConfig->gstThreads) {
+    if (!getThreadCpuTicks(threadId, cpuTicks) || now <= threadStats.time) {
+      continue;
+    }
+
+    // 前回からのCPU使用率
+    elapsed = static_cast<DOUBLE>(now - threadStats.time) / HUNDREDS_OF_NANOS_IN_A_SECOND;
+    cpuUsage = static_cast<DOUBLE>(cpuTicks - threadStats.cpuTicks) / ticksPerSecond / elapsed * 100.0;
+    totalCpuUsage += cpuUsage;
+    DLOGP("gst thread %s (%d): cpu: %.1f %%", threadStats.name.c_str(), threadId, cpuUsage);
+
+    threadStats.cpuTicks = cpuTicks;
+    threadStats.time = now;
+  }
+
+  MUTEX_UNLOCK(pKvsWebrtcConfig->gstThreadLock);
+
+  // チャネルのパイプライン全体のCPU使用率
+  DLOGP("channel %s: gst threads cpu: %.1f %%", pKvsWebrtcConfig->channelInfo.pChannelName, totalCpuUsage);
+}
+
+/**
+ * @brief パイプラインのバスメッセージを処理する
+ */
+GstBusSyncReply onGstBusSyncMessage(GstBus* bus, GstMessage* message, gpointer data)
+{
+  UNUSED_PARAM(bus);
+  auto pKvsWebrtcConfig = reinterpret_cast<PKvsWebrtcConfig>(data);
+  GstStreamStatusType streamStatusType;
+  GstElement* owner;
+  gchar* pPath;
+
+  switch (GST_MESSAGE_TYPE(message)) {
+    case GST_MESSAGE_STREAM_STATUS:
+      // ストリーミングスレッドの開始と終了を記録 (ENTER/LEAVEは対象のスレッド上で通知される)
+      gst_message_parse_stream_status(message, &streamStatusType, &owner);
+      if (streamStatusType == GST_STREAM_STATUS_TYPE_ENTER) {
+        pPath = gst_object_get_path_string(GST_OBJECT(owner));
+        registerGstThread(pKvsWebrtcConfig, static_cast<INT32>(syscall(SYS_gettid)), pPath);
+        applyThreadPolicy(pKvsWebrtcConfig->pKvsWebrtcHost, getGstThreadRole(pKvsWebrtcConfig, pPath));
+        g_free(pPath);
+      } else if (streamStatusType == GST_STREAM_STATUS_TYPE_LEAVE) {
+        unregisterGstThread(pKvsWebrtcConfig, static_cast<INT32>(syscall(SYS_gettid)));
+        releaseThreadPolicy(pKvsWebrtcConfig->pKvsWebrtcHost);
+      }
+      break;
+    case GST_MESSAGE_SEGMENT_DONE:
+      // 入力ファイルの終端に達したら先頭にセグメントシーク (ストリーミングスレッド外で実行)
+      gst_element_call_async(GST_ELEMENT(GST_MESSAGE_SRC(message)), [](GstElement* element, gpointer) {
+        gst_element_seek(element,
+                         1.0,
+                         GST_FORMAT_TIME,
+                         GST_SEEK_FLAG_SEGMENT,
+                         GST_SEEK_TYPE_SET,
+                         0,
+                         GST_SEEK_TYPE_NONE,
+                         GST_CLOCK_TIME_NONE);
+      }, nullptr, nullptr);
+      break;
+    case GST_MESSAGE_EOS:
+      DLOGW("Pipeline reached end of stream");
+      break;
+    case GST_MESSAGE_ERROR: {
+      GError* error = nullptr;
+      gst_message_parse_error(message, &error, nullptr);
+      DLOGE("Pipeline error from %s: %s", GST_OBJECT_NAME(GST_MESSAGE_SRC(message)), error ? error->message : "unknown");
+      g_clear_error(&error);
+      break;
+    }
+    default:
+      break;
+  }
+
+  // バスを読み出す箇所はないためメッセージは破棄する
+  return GST_BUS_DROP;
+}
+
+/**
+ * @brief GStreamerパイプラインを作成する
+ */
+STATUS createGstPipelines(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto retStatus = STATUS_SUCCESS;
+  GError* sendError = nullptr;
+  GError* recvError = nullptr;
+  GstElement* appsinkVideo = nullptr;
+  GstElement* appsinkAudio = nullptr;
+  GstElement* videoParse = nullptr;
+  GstPad* videoParseSrcPad = nullptr;
+  GstBus* bus = nullptr;
+  GstElement* captureCapsFilter = nullptr;
+  GstCaps* captureCaps = nullptr;
+  GstElement* audioDepay = nullptr;
+  GstPad* audioDepaySinkPad = nullptr;
+  std::string sendPipelineDescription;
+  std::string recvPipelineDescription;
+  BOOL lowLatencyAudio;
+
+  // NULLチェック
+  CHK(pKvsWebrtcConfig, STATUS_NULL_ARG);
+  lowLatencyAudio = pKvsWebrtcConfig->audioProfile == AUDIO_PROFILE_LOW_LATENCY;
+
+  // H.264エンコーダーを選択 (ファイル入力と定義が設定されている場合はエンコードしない)
+  if (pKvsWebrtcConfig->inputMode != INPUT_MODE_FILE && !pKvsWebrtcConfig->pSendPipeline) {
+    CHK_STATUS(selectVideoEncoder(pKvsWebrtcConfig));
+    CHK_STATUS(negotiateCaptureCaps(pKvsWebrtcConfig));
+
+    // H.264以外のコーデックのエンコーダー (オファーに応じて経路を追加する)
+    selectVideoCodecEncoders(pKvsWebrtcConfig);
+  }
+
+  // 送信用パイプラインの定義を作成
+  CHK_STATUS(buildSendPipelineDescription(pKvsWebrtcConfig, sendPipelineDescription));
+  DLOGD("send pipeline: %s", sendPipelineDescription.c_str());
+
+  // 送信用パイプラインを作成
+  pKvsWebrtcConfig->sendPipeline = gst_parse_launch(sendPipelineDescription.c_str(), &sendError);
+
+  // エラーチェック
+  if (sendError) {
+    DLOGE("Failed to create sender pipeline: %s", sendError->message);
+    g_error_free(sendError);
+    CHK(FALSE, STATUS_INTERNAL_ERROR);
+  }
+
+  // スレッドごとのCPU使用率の出力用に名前を設定
+  gst_object_set_name(GST_OBJECT(pKvsWebrtcConfig->sendPipeline), (std::string(pKvsWebrtcConfig->channelInfo.pChannelName) + "-send").c_str());
+
+  // 変換なしで入力するキャプチャのキャップスを設定
+  if (!pKvsWebrtcConfig->captureCaps.empty()) {
+    CHK(captureCapsFilter = gst_bin_get_by_name(GST_BIN(pKvsWebrtcConfig->sendPipeline), "capture-caps"), STATUS_INTERNAL_ERROR);
+    captureCaps = gst_caps_from_string(pKvsWebrtcConfig->captureCaps.c_str());
+    g_object_set(captureCapsFilter, "caps", captureCaps, nullptr);
+    gst_caps_unref(captureCaps);
+    gst_object_unref(captureCapsFilter);
+  }
+
+  // 損失率とRTTに応じて設定を変更するOpusエンコーダーを取得 (定義が設定されている場合は存在しないことがある)
+  pKvsWebrtcConfig->audioEncoder = gst_bin_get_by_name(GST_BIN(pKvsWebrtcConfig->sendPipeline), "audio-encoder");
+
+  // 音声のレイテンシはキャプチャする場合のみ計測 (ファイル入力と定義が設定されている場合はRTPのタイムスタンプがキャプチャ時刻に対応しない)
+  pKvsWebrtcConfig->audioLatencyEnabled = pKvsWebrtcConfig->inputMode != INPUT_MODE_FILE && !pKvsWebrtcConfig->pSendPipeline;
+
+  // 解像度とフレームレートの適応
+  initVideoScaling(pKvsWebrtcConfig);
+
+  // 受信用パイプラインの定義を作成 (ポートはチャネルごとに異なる)
+  // (低遅延プロファイルでは音声に合わせて受信用のジッタバッファも短くする)
+  recvPipelineDescription =
+    "rtpbin name=rtpbin" + (lowLatencyAudio ? " latency=" + std::to_string(LOW_LATENCY_RTPBIN_LATENCY_MS) : std::string()) + " "
     // Video受信
     "udpsrc "
     "  address=225.0.0.37 "
-    "  port=50000 "
+    "  port=" + std::to_string(pKvsWebrtcConfig->rtpPortBase + 0) + " "
     "  multicast-iface=lo "
     "  caps=\"application/x-rtp,media=video,clock-rate=90000,encoding-name=H264\" ! "
     "rtpbin.recv_rtp_sink_0 "
     "udpsrc "
     "  address=225.0.0.37 "
-    "  port=50001 "
+    "  port=" + std::to_string(pKvsWebrtcConfig->rtpPortBase + 1) + " "
     "  multicast-iface=lo "
     "  caps=\"application/x-rtcp\" ! "
     "rtpbin.recv_rtcp_sink_0 "
     // Audio受信
     "udpsrc "
     "  address=225.0.0.37 "
-    "  port=50002 "
+    "  port=" + std::to_string(pKvsWebrtcConfig->rtpPortBase + 2) + " "
     "  multicast-iface=lo "
     "  caps=\"application/x-rtp,media=audio,clock-rate=48000,encoding-name=OPUS\" ! "
     "rtpbin.recv_rtp_sink_1 "
     "udpsrc "
     "  address=225.0.0.37 "
-    "  port=50003 "
+    "  port=" + std::to_string(pKvsWebrtcConfig->rtpPortBase + 3) + " "
     "  multicast-iface=lo "
     "  caps=\"application/x-rtcp\" ! "
     "rtpbin.recv_rtcp_sink_1 "
@@ -1159,220 +6222,4284 @@ STATUS createGstPipelines(PKvsWebrtcConfig pKvsWebrtcConfig)
     "video/x-h264,stream-format=byte-stream,alignment=au ! "
     "h264parse ! "
     "queue "
-    "  max-size-buffers=240 "
-    "  leaky=downstream ! "
-    "appsink "
-    "  name=appsink-video "
-    "  emit-signals=true "
-    "  async=false "
-    "  sync=true "
-    // Audio出力
-    "rtpbin. ! "
-    "rtpopusdepay ! "
-    "queue "
-    "  max-size-buffers=400 "
+    "  max-size-buffers=240 "
+    "  leaky=downstream ! "
+    "appsink "
+    "  name=appsink-video "
+    "  emit-signals=true "
+    "  async=false "
+    "  sync=true "
+    // Audio出力
+    "rtpbin. ! "
+    "rtpopusdepay name=audio-depay ! "
+    "queue "
+    "  max-size-buffers=" + std::to_string(lowLatencyAudio ? LOW_LATENCY_AUDIO_QUEUE_SIZE : DEFAULT_AUDIO_QUEUE_SIZE) + " "
+    "  leaky=downstream ! "
+    "appsink "
+    "  name=appsink-audio "
+    "  emit-signals=true "
+    "  async=false "
+    "  sync=true";
+
+  // 受信用パイプラインを作成
+  pKvsWebrtcConfig->recvPipeline = gst_parse_launch(recvPipelineDescription.c_str(), &recvError);
+
+  // エラーチェック
+  if (recvError) {
+    DLOGE("Failed to create receiver pipeline: %s", recvError->message);
+    g_error_free(recvError);
+    CHK(FALSE, STATUS_INTERNAL_ERROR);
+  }
+
+  // スレッドごとのCPU使用率の出力用に名前を設定
+  gst_object_set_name(GST_OBJECT(pKvsWebrtcConfig->recvPipeline), (std::string(pKvsWebrtcConfig->channelInfo.pChannelName) + "-recv").c_str());
+
+  // レイテンシ計測用SEIを挿入するプローブを設定
+  if (pKvsWebrtcConfig->latencySeiEnabled) {
+    CHK(videoParse = gst_bin_get_by_name(GST_BIN(pKvsWebrtcConfig->sendPipeline), "video-parse"), STATUS_INTERNAL_ERROR);
+    videoParseSrcPad = gst_element_get_static_pad(videoParse, "src");
+    gst_object_unref(videoParse);
+    CHK(videoParseSrcPad, STATUS_INTERNAL_ERROR);
+    gst_pad_add_probe(videoParseSrcPad, GST_PAD_PROBE_TYPE_BUFFER, onLatencySeiProbe, pKvsWebrtcConfig, nullptr);
+    gst_object_unref(videoParseSrcPad);
+  }
+
+  // 音声のキャプチャ時刻を記録するプローブを設定
+  if (pKvsWebrtcConfig->audioLatencyEnabled) {
+    CHK(audioDepay = gst_bin_get_by_name(GST_BIN(pKvsWebrtcConfig->recvPipeline), "audio-depay"), STATUS_INTERNAL_ERROR);
+    audioDepaySinkPad = gst_element_get_static_pad(audioDepay, "sink");
+    gst_object_unref(audioDepay);
+    CHK(audioDepaySinkPad, STATUS_INTERNAL_ERROR);
+    gst_pad_add_probe(audioDepaySinkPad, GST_PAD_PROBE_TYPE_BUFFER, onAudioLatencyProbe, pKvsWebrtcConfig, nullptr);
+    gst_object_unref(audioDepaySinkPad);
+  }
+
+  // Video appsinkを取得してシグナルを接続
+  CHK(appsinkVideo = gst_bin_get_by_name(GST_BIN(pKvsWebrtcConfig->recvPipeline), "appsink-video"), STATUS_INTERNAL_ERROR);
+  g_signal_connect(appsinkVideo, "new-sample", G_CALLBACK(onNewSampleVideo), pKvsWebrtcConfig);
+  gst_object_unref(appsinkVideo);
+
+  // Audio appsinkを取得してシグナルを接続
+  CHK(appsinkAudio = gst_bin_get_by_name(GST_BIN(pKvsWebrtcConfig->recvPipeline), "appsink-audio"), STATUS_INTERNAL_ERROR);
+  g_signal_connect(appsinkAudio, "new-sample", G_CALLBACK(onNewSampleAudio), pKvsWebrtcConfig);
+  gst_object_unref(appsinkAudio);
+
+  // パイプラインのバスメッセージを処理
+  bus = gst_element_get_bus(pKvsWebrtcConfig->sendPipeline);
+  gst_bus_set_sync_handler(bus, onGstBusSyncMessage, pKvsWebrtcConfig, nullptr);
+  gst_object_unref(bus);
+  bus = gst_element_get_bus(pKvsWebrtcConfig->recvPipeline);
+  gst_bus_set_sync_handler(bus, onGstBusSyncMessage, pKvsWebrtcConfig, nullptr);
+  gst_object_unref(bus);
+
+  // ファイル入力の場合はプリロール後にセグメントシークしてループ再生する
+  if (pKvsWebrtcConfig->inputMode == INPUT_MODE_FILE) {
+    gst_element_set_state(pKvsWebrtcConfig->sendPipeline, GST_STATE_PAUSED);
+    CHK_ERR(gst_element_get_state(pKvsWebrtcConfig->sendPipeline, nullptr, nullptr, 10 * GST_SECOND) == GST_STATE_CHANGE_SUCCESS,
+            STATUS_INTERNAL_ERROR,
+            "入力ファイルのプリロールに失敗しました。");
+    CHK_ERR(gst_element_seek(pKvsWebrtcConfig->sendPipeline,
+                             1.0,
+                             GST_FORMAT_TIME,
+                             static_cast<GstSeekFlags>(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_SEGMENT),
+                             GST_SEEK_TYPE_SET,
+                             0,
+                             GST_SEEK_TYPE_NONE,
+                             GST_CLOCK_TIME_NONE),
+            STATUS_INTERNAL_ERROR,
+            "入力ファイルのシークに失敗しました。");
+  }
+
+  // パイプラインを開始
+  gst_element_set_state(pKvsWebrtcConfig->sendPipeline, GST_STATE_PLAYING);
+  gst_element_set_state(pKvsWebrtcConfig->recvPipeline, GST_STATE_PLAYING);
+
+CleanUp:
+
+  // エラー時はパイプラインを解放
+  if (STATUS_FAILED(retStatus)) {
+    freeGstPipelines(pKvsWebrtcConfig);
+  }
+
+  return retStatus;
+}
+
+/**
+ * @brief GStreamerパイプラインを解放する
+ */
+STATUS freeGstPipelines(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto retStatus = STATUS_SUCCESS;
+
+  // NULLチェック
+  CHK(pKvsWebrtcConfig, STATUS_NULL_ARG);
+
+  // 受信用パイプラインを解放 (音声のプローブが送信用パイプラインのクロックを参照するため先に停止する)
+  if (pKvsWebrtcConfig->recvPipeline) {
+    gst_element_set_state(pKvsWebrtcConfig->recvPipeline, GST_STATE_NULL);
+    gst_object_unref(pKvsWebrtcConfig->recvPipeline);
+    pKvsWebrtcConfig->recvPipeline = nullptr;
+  }
+
+  // Opusエンコーダーの参照を解放
+  if (pKvsWebrtcConfig->audioEncoder) {
+    gst_object_unref(pKvsWebrtcConfig->audioEncoder);
+    pKvsWebrtcConfig->audioEncoder = nullptr;
+  }
+
+  // 解像度とフレームレートのキャップスフィルターの参照を解放
+  if (pKvsWebrtcConfig->videoScaleCaps) {
+    gst_object_unref(pKvsWebrtcConfig->videoScaleCaps);
+    pKvsWebrtcConfig->videoScaleCaps = nullptr;
+  }
+
+  // 削除中のコーデックの経路の完了を待つ (削除はGStreamerのスレッドで送信用パイプラインを参照する)
+  while (ATOMIC_LOAD(&pKvsWebrtcConfig->stoppingVideoCodecBranches) > 0) {
+    THREAD_SLEEP(10 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND);
+  }
+
+  // 送信用パイプラインを解放
+  if (pKvsWebrtcConfig->sendPipeline) {
+    gst_element_set_state(pKvsWebrtcConfig->sendPipeline, GST_STATE_NULL);
+    gst_object_unref(pKvsWebrtcConfig->sendPipeline);
+    pKvsWebrtcConfig->sendPipeline = nullptr;
+  }
+
+  // コーデックの経路 (ビンは送信用パイプラインとともに解放される)
+  for (auto& branch : pKvsWebrtcConfig->videoCodecBranches) {
+    if (branch.teePad) {
+      gst_object_unref(branch.teePad);
+      branch.teePad = nullptr;
+    }
+    branch.bin = nullptr;
+    ATOMIC_STORE(&branch.state, VIDEO_CODEC_BRANCH_STOPPED);
+  }
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief エンコード済みフレームにレイテンシ計測用SEIを挿入するプローブ
+ */
+GstPadProbeReturn onLatencySeiProbe(GstPad* pad, GstPadProbeInfo* info, gpointer data)
+{
+  UNUSED_PARAM(data);
+  auto buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+  GstElement* element = nullptr;
+  GstClock* clock = nullptr;
+  GstClockTime clockTime, captureClockTime;
+  GstBuffer* seiBuffer = nullptr;
+  GstBuffer* newBuffer = nullptr;
+  GstMapInfo mapInfo;
+  std::vector<BYTE> sei;
+  UINT64 captureTime = GETTIME();
+  UINT32 vclOffset;
+
+  // タイムスタンプが無効なバッファはそのまま流す
+  if (!buffer || !GST_BUFFER_PTS_IS_VALID(buffer)) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  // キャプチャ時刻を算出 (パイプラインクロック上の経過時間を壁時計に換算)
+  if ((element = gst_pad_get_parent_element(pad))) {
+    if ((clock = gst_element_get_clock(element))) {
+      clockTime = gst_clock_get_time(clock);
+      captureClockTime = gst_element_get_base_time(element) + GST_BUFFER_PTS(buffer);
+      if (clockTime > captureClockTime) {
+        captureTime -= (clockTime - captureClockTime) / DEFAULT_TIME_UNIT_IN_NANOS;
+      }
+      gst_object_unref(clock);
+    }
+    gst_object_unref(element);
+  }
+
+  // 最初のVCL NALユニットの位置を取得
+  if (!gst_buffer_map(buffer, &mapInfo, GST_MAP_READ)) {
+    return GST_PAD_PROBE_OK;
+  }
+  vclOffset = findH264VclOffset(mapInfo.data, static_cast<UINT32>(mapInfo.size));
+  gst_buffer_unmap(buffer, &mapInfo);
+
+  // SEIを作成
+  buildLatencySei(captureTime, sei);
+  seiBuffer = gst_buffer_new_allocate(nullptr, sei.size(), nullptr);
+  gst_buffer_fill(seiBuffer, 0, sei.data(), sei.size());
+
+  // VCL NALユニットの直前にSEIを挿入したバッファを作成 (元のメモリはコピーせずに共有)
+  newBuffer = gst_buffer_new();
+  gst_buffer_copy_into(newBuffer, buffer, GST_BUFFER_COPY_METADATA, 0, -1);
+  if (vclOffset > 0) {
+    gst_buffer_copy_into(newBuffer, buffer, GST_BUFFER_COPY_MEMORY, 0, vclOffset);
+  }
+  newBuffer = gst_buffer_append(newBuffer, seiBuffer);
+  newBuffer = gst_buffer_append(newBuffer, gst_buffer_copy_region(buffer, GST_BUFFER_COPY_MEMORY, vclOffset, -1));
+
+  // バッファを差し替え
+  gst_buffer_unref(buffer);
+  GST_PAD_PROBE_INFO_DATA(info) = newBuffer;
+
+  return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief 全セッションにフレームを送信する
+ * @param pLatencySei フレーム内のレイテンシ計測用SEI (書き込み可能なコピー上にある場合のみ。なければnullptr)
+ */
+VOID writeFrameToSessions(PKvsWebrtcConfig pKvsWebrtcConfig, Frame& frame, VideoCodecType videoCodec, PBYTE pLatencySei)
+{
+  PRtcRtpTransceiver pRtcRtpTransceiver;
+  std::shared_ptr<std::vector<BYTE>> pPacedFrameData;
+  auto isVideo = frame.trackId == DEFAULT_VIDEO_TRACK_ID;
+  auto appsinkTime = pLatencySei ? getLatencySeiTimestamp(pLatencySei, LATENCY_SEI_TIMESTAMP_APPSINK) : 0;
+
+  // ロックを開始
+  MUTEX_LOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+
+  // コーデックごとのエンコード量
+  if (isVideo) {
+    ATOMIC_INCREMENT(&pKvsWebrtcConfig->videoCodecBranches[videoCodec].encodedFrames);
+    ATOMIC_ADD(&pKvsWebrtcConfig->videoCodecBranches[videoCodec].encodedBytes, frame.size);
+    if (videoCodec == VIDEO_CODEC_TYPE_H264) {
+      ATOMIC_ADD(&pKvsWebrtcConfig->videoScaleEncodedBytes, frame.size);
+    }
+  }
+
+  // 全セッションにフレームを送信
+  for (auto&& value : pKvsWebrtcConfig->streamingSessions) {
+    // 終了していないセッションにのみ送信 (リモートが受信しないトラックはパケット化と暗号化を省くため送信しない)
+    // (映像はセッションが選択したコーデックのフレームのみ送信)
+    if (!ATOMIC_LOAD_BOOL(&value.second->isTerminated) &&
+        ATOMIC_LOAD_BOOL(isVideo ? &value.second->videoEnabled : &value.second->audioEnabled) &&
+        (!isVideo || value.second->videoCodec == videoCodec)) {
+      AllocationScope allocationScope(ALLOCATION_TAG_PEER_CONNECTION, value.second->allocationSlot);
+
+      // ペーシングする場合はビデオフレームを送信スレッドに渡す (データは全セッションで共有)
+      // (SEIのwriteFrameの呼び出し時刻はキューに積んだ時刻になる)
+      if (pKvsWebrtcConfig->pacingEnabled && isVideo) {
+        if (!pPacedFrameData) {
+          pPacedFrameData = std::make_shared<std::vector<BYTE>>(frame.frameData, frame.frameData + frame.size);
+        }
+        enqueuePacedFrame(pKvsWebrtcConfig, value.second.get(), frame, pPacedFrameData);
+        continue;
+      }
+
+      // フレームインデックスを設定
+      frame.index = static_cast<UINT32>(ATOMIC_INCREMENT(&value.second->frameIndex));
+
+      // トラックIDに応じてトランシーバーを選択
+      pRtcRtpTransceiver = isVideo ? value.second->pVideoRtcRtpTransceiver : value.second->pAudioRtcRtpTransceiver;
+
+      // フレームを送信 (パケット化と暗号化にかかった時間をセッションごとに集計)
+      auto writeStartTime = GETTIME();
+
+      // writeFrameはフレームを同期的にパケット化するため、SEIの呼び出し時刻をセッションごとに書き換えて記録する
+      if (pLatencySei) {
+        setLatencySeiTimestamp(pLatencySei, LATENCY_SEI_TIMESTAMP_WRITE, writeStartTime);
+        addLatencySample(pKvsWebrtcConfig->appsinkToWriteLatency, writeStartTime - appsinkTime);
+      }
+      auto status = writeFrame(pRtcRtpTransceiver, &frame);
+      ATOMIC_ADD(&value.second->writeTime, GETTIME() - writeStartTime);
+      ATOMIC_INCREMENT(&value.second->writtenFrames);
+      if (STATUS_FAILED(status) && status != STATUS_SRTP_NOT_READY_YET) {
+        DLOGV("writeFrame failed: 0x%08x", status);
+      } else if (STATUS_SUCCEEDED(status)) {
+        ATOMIC_INCREMENT(&pKvsWebrtcConfig->sentFrameCount);
+        ATOMIC_ADD(&pKvsWebrtcConfig->sentByteCount, frame.size);
+      }
+    }
+  }
+
+  // キーフレーム間隔の制御 (コーデックごと)
+  if (isVideo) {
+    onGopVideoFrame(pKvsWebrtcConfig, pKvsWebrtcConfig->videoCodecBranches[videoCodec], frame);
+  }
+
+  // ロックを解除
+  MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+}
+
+/**
+ * @brief 新しいサンプルを受信した際の共通処理
+ */
+GstFlowReturn onNewSample(GstElement* sink, gpointer data, UINT64 trackId)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto ret = GST_FLOW_OK;
+  auto pKvsWebrtcConfig = reinterpret_cast<PKvsWebrtcConfig>(data);
+  GstSample* sample = nullptr;
+  GstBuffer* buffer = nullptr;
+  GstSegment* segment = nullptr;
+  GstMapInfo info;
+  GstClockTime duration = GST_CLOCK_TIME_NONE;
+  UINT64 ptsHundredsNanos = 0;
+  UINT64 durationHundredsNanos = 0;
+  UINT64 timestamp;
+  Frame frame;
+  BOOL isDroppable, isDelta;
+  UINT64 arrivalTime = GETTIME();
+  UINT64 captureTime;
+  PBYTE pLatencySei = nullptr;
+  std::vector<BYTE> latencyFrameData;
+
+  // NULLチェック
+  CHK(pKvsWebrtcConfig, STATUS_NULL_ARG);
+
+  // マップ情報を初期化
+  info.data = nullptr;
+
+  // サンプルを取得
+  CHK(sample = gst_app_sink_pull_sample(GST_APP_SINK(sink)), STATUS_INTERNAL_ERROR);
+
+  // バッファを取得
+  CHK(buffer = gst_sample_get_buffer(sample), STATUS_INTERNAL_ERROR);
+
+  // ドロップすべきフレームかどうかを判定
+  isDroppable = GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_CORRUPTED) ||
+                GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DECODE_ONLY) ||
+                (GST_BUFFER_FLAGS(buffer) == GST_BUFFER_FLAG_DISCONT) ||
+                (GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DISCONT) &&
+                 GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT)) ||
+                !GST_BUFFER_PTS_IS_VALID(buffer);
+
+  // ドロップすべきフレームはスキップ
+  CHK(!isDroppable, retStatus);
+
+  // バッファをマップ
+  CHK(gst_buffer_map(buffer, &info, GST_MAP_READ), STATUS_INTERNAL_ERROR);
+
+  // フレームフラグを設定 (デルタフレームかキーフレームか)
+  isDelta = GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+
+  // セグメントを取得
+  segment = gst_sample_get_segment(sample);
+
+  // ランニングタイムを取得して100ナノ秒単位に変換
+  ptsHundredsNanos = gst_segment_to_running_time(segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer)) / DEFAULT_TIME_UNIT_IN_NANOS;
+
+  // ビデオとオーディオ共通のセッションクロックに写像 (全セッションで同じタイムスタンプを使用)
+  timestamp = getMediaClockTimestamp(pKvsWebrtcConfig->mediaClock,
+                                     trackId == DEFAULT_VIDEO_TRACK_ID ? MEDIA_CLOCK_TRACK_VIDEO : MEDIA_CLOCK_TRACK_AUDIO,
+                                     ptsHundredsNanos,
+                                     arrivalTime);
+
+  // フレーム長を取得して100ナノ秒単位に変換
+  duration = GST_BUFFER_DURATION(buffer);
+  if (GST_CLOCK_TIME_IS_VALID(duration)) {
+    durationHundredsNanos = duration / 100;
+  }
+
+  // フレームを初期化
+  MEMSET(&frame, 0, SIZEOF(Frame));
+  frame.version = FRAME_CURRENT_VERSION;
+  frame.flags = isDelta ? FRAME_FLAG_NONE : FRAME_FLAG_KEY_FRAME;
+  frame.duration = durationHundredsNanos;
+  frame.presentationTs = timestamp;
+  frame.decodingTs = timestamp;
+  frame.size = static_cast<UINT32>(info.size);
+  frame.frameData = info.data;
+  frame.trackId = trackId;
+
+  // ロックを開始
+  MUTEX_LOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+
+  // レイテンシ計測用SEIにappsinkへの到着時刻とwriteFrameの呼び出し時刻を書き込む
+  // (サンプルのバッファは書き込み不可のため計測時のみコピーする)
+  if (pKvsWebrtcConfig->latencySeiEnabled && trackId == DEFAULT_VIDEO_TRACK_ID &&
+      (pLatencySei = findLatencySei(info.data, static_cast<UINT32>(info.size)))) {
+    latencyFrameData.assign(info.data, info.data + info.size);
+    pLatencySei = latencyFrameData.data() + (pLatencySei - info.data);
+    captureTime = getLatencySeiTimestamp(pLatencySei, LATENCY_SEI_TIMESTAMP_CAPTURE);
+    setLatencySeiTimestamp(pLatencySei, LATENCY_SEI_TIMESTAMP_APPSINK, arrivalTime);
+    // (フレームバスとペーシングには公開時刻を渡し、直接送信する場合はセッションごとに書き換える)
+    setLatencySeiTimestamp(pLatencySei, LATENCY_SEI_TIMESTAMP_WRITE, GETTIME());
+    frame.frameData = latencyFrameData.data();
+
+    // レイテンシを記録 (appsink→writeFrameはセッションごとに記録)
+    if (arrivalTime > captureTime) {
+      addLatencySample(pKvsWebrtcConfig->captureToAppsinkLatency, arrivalTime - captureTime);
+    }
+  }
+
+  // フレームバスに公開 (ワーカープロセスが読み出す)
+  if (pKvsWebrtcConfig->frameBus.pHeader) {
+    publishFrameBus(pKvsWebrtcConfig->frameBus, frame);
+  }
+
+  // 全セッションにフレームを送信
+  writeFrameToSessions(pKvsWebrtcConfig, frame, VIDEO_CODEC_TYPE_H264, pLatencySei);
+
+  // ロックを解除
+  MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+
+  // 音声のキャプチャからwriteFrameまでのレイテンシを記録
+  if (pKvsWebrtcConfig->audioLatencyEnabled && trackId == DEFAULT_AUDIO_TRACK_ID) {
+    addAudioLatencySample(pKvsWebrtcConfig, GST_BUFFER_PTS(buffer), GETTIME());
+  }
+
+  // 録画 (ディスクへの書き込みは録画用パイプラインのスレッドで行う)
+  recordFrame(pKvsWebrtcConfig, frame, buffer, gst_sample_get_caps(sample));
+
+CleanUp:
+
+  // バッファのマップを解除
+  if (info.data) {
+    gst_buffer_unmap(buffer, &info);
+  }
+
+  // サンプルの参照を解放
+  if (sample) {
+    gst_sample_unref(sample);
+  }
+
+  // 終了フラグが立っていたらEOSを返す
+  if (ATOMIC_LOAD_BOOL(&pKvsWebrtcConfig->isTerminated)) {
+    ret = GST_FLOW_EOS;
+  }
+
+  return ret;
+}
+
+/**
+ * @brief Videoサンプルを受信した際のコールバック
+ */
+GstFlowReturn onNewSampleVideo(GstElement* sink, gpointer data)
+{
+  return onNewSample(sink, data, DEFAULT_VIDEO_TRACK_ID);
+}
+
+/**
+ * @brief Audioサンプルを受信した際のコールバック
+ */
+GstFlowReturn onNewSampleAudio(GstElement* sink, gpointer data)
+{
+  return onNewSample(sink, data, DEFAULT_AUDIO_TRACK_ID);
+}
+
+// ============================================================================
+// フレームバス
+// ============================================================================
+
+/**
+ * @brief メディア入力を開始する (GStreamerパイプラインまたはフレームバス)
+ */
+STATUS startMediaInput(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto retStatus = STATUS_SUCCESS;
+
+  // NULLチェック
+  CHK(pKvsWebrtcConfig, STATUS_NULL_ARG);
+
+  // 録画を開始 (フレームの入力より先に開始する)
+  CHK_STATUS(startRecorder(pKvsWebrtcConfig));
+
+  if (pKvsWebrtcConfig->inputMode == INPUT_MODE_BUS) {
+    // ワーカー: ほかのプロセスのフレームバスから読み出す
+    CHK_STATUS(connectFrameBus(pKvsWebrtcConfig));
+  } else {
+    // GStreamerパイプラインを作成
+    CHK_STATUS(createGstPipelines(pKvsWebrtcConfig));
+
+    // ソケットが設定されている場合はワーカーにフレームを公開
+    if (getChannelEnv(pKvsWebrtcConfig, FRAME_BUS_SOCKET_ENV_VAR)) {
+      CHK_STATUS(createFrameBus(pKvsWebrtcConfig));
+    }
+  }
+
+  // 受信した音声の再生を開始
+  CHK_STATUS(startTalkback(pKvsWebrtcConfig));
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief フレームバスを作成してワーカーへの受け渡しを開始する
+ *
+ * エンコード済みフレームをmemfdのリングバッファに書き込み、UNIXドメインソケットで
+ * ファイルディスクリプタをワーカープロセスに受け渡す。書き込みは1つ、読み出しは複数で、
+ * スロットごとのシーケンスロックで読み出し中の上書きを検出する。
+ * 共有メモリはサイズの変更と書き込み可能なマップの追加を封印し、ワーカーからは読み出しのみとする。
+ * ソケットは所有者のみに開き、同じユーザーのプロセスにのみ受け渡す。
+ */
+STATUS createFrameBus(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto& frameBus = pKvsWebrtcConfig->frameBus;
+  UINT32 slotCount, slotSize;
+  struct sockaddr_un address;
+
+  // 設定
+  frameBus.fd = -1;
+  frameBus.socketFd = -1;
+  frameBus.threadId = INVALID_TID_VALUE;
+  frameBus.isWriter = TRUE;
+  frameBus.socketPath = getChannelEnv(pKvsWebrtcConfig, FRAME_BUS_SOCKET_ENV_VAR);
+  slotCount = getChannelEnvUint32(pKvsWebrtcConfig, FRAME_BUS_SLOTS_ENV_VAR, DEFAULT_FRAME_BUS_SLOTS);
+  slotSize = getChannelEnvUint32(pKvsWebrtcConfig, FRAME_BUS_SLOT_SIZE_ENV_VAR, DEFAULT_FRAME_BUS_SLOT_SIZE);
+  CHK_ERR(slotCount > 0 && slotSize > 0, STATUS_INVALID_ARG, "フレームバスのスロット数とサイズは0より大きい値を指定してください。");
+  CHK_ERR(frameBus.socketPath.size() < SIZEOF(address.sun_path),
+          STATUS_INVALID_ARG,
+          "フレームバスのソケットのパス「%s」が長すぎます。", frameBus.socketPath.c_str());
+  ATOMIC_STORE_BOOL(&frameBus.isTerminated, FALSE);
+
+  // 共有メモリを作成
+  frameBus.slotStride = ROUND_UP(SIZEOF(FrameBusSlot) + slotSize, FRAME_BUS_ALIGNMENT);
+  frameBus.memorySize = ROUND_UP(SIZEOF(FrameBusHeader), FRAME_BUS_ALIGNMENT) + frameBus.slotStride * slotCount;
+  CHK_ERR((frameBus.fd = memfd_create("kvsWebrtcFrameBus", MFD_CLOEXEC | MFD_ALLOW_SEALING)) >= 0,
+          STATUS_INTERNAL_ERROR,
+          "フレームバスの共有メモリを作成できません。");
+  CHK_ERR(ftruncate(frameBus.fd, static_cast<off_t>(frameBus.memorySize)) == 0,
+          STATUS_NOT_ENOUGH_MEMORY,
+          "フレームバスの共有メモリを確保できません。");
+  frameBus.pMemory = static_cast<PBYTE>(mmap(nullptr, frameBus.memorySize, PROT_READ | PROT_WRITE, MAP_SHARED, frameBus.fd, 0));
+  if (frameBus.pMemory == MAP_FAILED) {
+    frameBus.pMemory = nullptr;
+    CHK_ERR(FALSE, STATUS_NOT_ENOUGH_MEMORY, "フレームバスの共有メモリをマップできません。");
+  }
+
+  // サイズの変更と書き込み可能なマップの追加を封印 (自身のマップは書き込み可能なまま残る)
+  // (F_SEAL_FUTURE_WRITEに対応しないカーネルではサイズの変更のみ封印する)
+  if (fcntl(frameBus.fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) != 0) {
+    DLOGW("The kernel does not support F_SEAL_FUTURE_WRITE, workers can map the frame bus writable");
+    CHK_ERR(fcntl(frameBus.fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == 0,
+            STATUS_INTERNAL_ERROR,
+            "フレームバスの共有メモリを封印できません。");
+  }
+
+  // ヘッダー
+  frameBus.pHeader = reinterpret_cast<FrameBusHeader*>(frameBus.pMemory);
+  frameBus.pHeader->magic = FRAME_BUS_MAGIC;
+  frameBus.pHeader->version = FRAME_BUS_VERSION;
+  frameBus.pHeader->slotCount = slotCount;
+  frameBus.pHeader->slotSize = slotSize;
+  frameBus.pHeader->futexWord = 0;
+  frameBus.pHeader->writeSequence = 0;
+  frameBus.pHeader->keyframeSequence = FRAME_BUS_NO_SEQUENCE;
+
+  // ワーカーを待ち受けるソケット
+  MEMSET(&address, 0x00, SIZEOF(address));
+  address.sun_family = AF_UNIX;
+  STRNCPY(address.sun_path, frameBus.socketPath.c_str(), SIZEOF(address.sun_path) - 1);
+  unlink(frameBus.socketPath.c_str());
+  CHK_ERR((frameBus.socketFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0, STATUS_INTERNAL_ERROR, "ソケットを作成できません。");
+  CHK_ERR(bind(frameBus.socketFd, reinterpret_cast<struct sockaddr*>(&address), SIZEOF(address)) == 0 &&
+            chmod(frameBus.socketPath.c_str(), S_IRUSR | S_IWUSR) == 0 &&
+            listen(frameBus.socketFd, SOMAXCONN) == 0,
+          STATUS_INTERNAL_ERROR,
+          "ソケット「%s」で待ち受けできません。", frameBus.socketPath.c_str());
+
+  // 受け渡しスレッドを開始
+  CHK_STATUS(THREAD_CREATE(&frameBus.threadId, frameBusListenerRoutine, reinterpret_cast<PVOID>(pKvsWebrtcConfig)));
+  DLOGI("Frame bus published on %s: %u slots of %u bytes", frameBus.socketPath.c_str(), slotCount, slotSize);
+
+CleanUp:
+
+  if (STATUS_FAILED(retStatus)) {
+    freeFrameBus(frameBus);
+  }
+
+  return retStatus;
+}
+
+/**
+ * @brief フレームバスの書き込み側に接続して共有メモリをマップする
+ *
+ * 書き込み側の終了を検出するため、ソケットは接続したまま保持する。
+ */
+STATUS attachFrameBus(FrameBus& frameBus)
+{
+  auto retStatus = STATUS_SUCCESS;
+  struct sockaddr_un address;
+  struct msghdr message;
+  struct iovec iov;
+  struct cmsghdr* pControlMessage;
+  struct stat fileStat;
+  INT32 seals;
+  CHAR byte;
+  alignas(struct cmsghdr) CHAR control[CMSG_SPACE(SIZEOF(INT32))];
+
+  // 書き込み側に接続 (書き込み側の再起動中は失敗する)
+  MEMSET(&address, 0x00, SIZEOF(address));
+  address.sun_family = AF_UNIX;
+  STRNCPY(address.sun_path, frameBus.socketPath.c_str(), SIZEOF(address.sun_path) - 1);
+  CHK((frameBus.socketFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0, STATUS_INTERNAL_ERROR);
+  CHK(connect(frameBus.socketFd, reinterpret_cast<struct sockaddr*>(&address), SIZEOF(address)) == 0, STATUS_INTERNAL_ERROR);
+
+  // 共有メモリのファイルディスクリプタを受信
+  MEMSET(&message, 0x00, SIZEOF(message));
+  iov.iov_base = &byte;
+  iov.iov_len = SIZEOF(byte);
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = SIZEOF(control);
+  CHK_ERR(recvmsg(frameBus.socketFd, &message, MSG_CMSG_CLOEXEC) > 0 &&
+            (pControlMessage = CMSG_FIRSTHDR(&message)) &&
+            pControlMessage->cmsg_level == SOL_SOCKET &&
+            pControlMessage->cmsg_type == SCM_RIGHTS,
+          STATUS_INTERNAL_ERROR,
+          "フレームバスの共有メモリを受信できません。");
+  MEMCPY(&frameBus.fd, CMSG_DATA(pControlMessage), SIZEOF(INT32));
+
+  // 読み取り専用でマップ (サイズの変更が封印されていない共有メモリは縮小でSIGBUSになるため拒否)
+  seals = fcntl(frameBus.fd, F_GET_SEALS);
+  CHK_ERR(fstat(frameBus.fd, &fileStat) == 0 && static_cast<SIZE_T>(fileStat.st_size) >= SIZEOF(FrameBusHeader) &&
+            seals >= 0 && (seals & (F_SEAL_SHRINK | F_SEAL_GROW)) == (F_SEAL_SHRINK | F_SEAL_GROW),
+          STATUS_INTERNAL_ERROR,
+          "フレームバスの共有メモリが不正です。");
+  frameBus.memorySize = static_cast<SIZE_T>(fileStat.st_size);
+  frameBus.pMemory = static_cast<PBYTE>(mmap(nullptr, frameBus.memorySize, PROT_READ, MAP_SHARED, frameBus.fd, 0));
+  if (frameBus.pMemory == MAP_FAILED) {
+    frameBus.pMemory = nullptr;
+    CHK_ERR(FALSE, STATUS_NOT_ENOUGH_MEMORY, "フレームバスの共有メモリをマップできません。");
+  }
+
+  // ヘッダーを検証
+  frameBus.pHeader = reinterpret_cast<FrameBusHeader*>(frameBus.pMemory);
+  frameBus.slotStride = ROUND_UP(SIZEOF(FrameBusSlot) + frameBus.pHeader->slotSize, FRAME_BUS_ALIGNMENT);
+  CHK_ERR(frameBus.pHeader->magic == FRAME_BUS_MAGIC &&
+            frameBus.pHeader->version == FRAME_BUS_VERSION &&
+            ROUND_UP(SIZEOF(FrameBusHeader), FRAME_BUS_ALIGNMENT) + frameBus.slotStride * frameBus.pHeader->slotCount <= frameBus.memorySize,
+          STATUS_INTERNAL_ERROR,
+          "フレームバスの共有メモリが不正です。");
+
+CleanUp:
+
+  if (STATUS_FAILED(retStatus)) {
+    detachFrameBus(frameBus);
+  }
+
+  return retStatus;
+}
+
+/**
+ * @brief フレームバスの書き込み側から切断して共有メモリのマップを解除する
+ */
+VOID detachFrameBus(FrameBus& frameBus)
+{
+  // ソケットを閉じる
+  if (frameBus.socketFd >= 0) {
+    close(frameBus.socketFd);
+    frameBus.socketFd = -1;
+  }
+
+  // 共有メモリを解放
+  if (frameBus.pMemory) {
+    munmap(frameBus.pMemory, frameBus.memorySize);
+    frameBus.pMemory = nullptr;
+  }
+  frameBus.pHeader = nullptr;
+  if (frameBus.fd >= 0) {
+    close(frameBus.fd);
+    frameBus.fd = -1;
+  }
+}
+
+/**
+ * @brief フレームバスに接続して読み出しを開始する
+ */
+STATUS connectFrameBus(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto& frameBus = pKvsWebrtcConfig->frameBus;
+  PCHAR pSocketPath;
+  struct sockaddr_un address;
+
+  // 設定
+  frameBus.fd = -1;
+  frameBus.socketFd = -1;
+  frameBus.threadId = INVALID_TID_VALUE;
+  frameBus.isWriter = FALSE;
+  ATOMIC_STORE_BOOL(&frameBus.isTerminated, FALSE);
+  CHK_ERR(pSocketPath = getChannelEnv(pKvsWebrtcConfig, FRAME_BUS_SOCKET_ENV_VAR),
+          STATUS_INVALID_OPERATION,
+          "環境変数「%s」は必須です。", FRAME_BUS_SOCKET_ENV_VAR);
+  frameBus.socketPath = pSocketPath;
+  CHK_ERR(frameBus.socketPath.size() < SIZEOF(address.sun_path),
+          STATUS_INVALID_ARG,
+          "フレームバスのソケットのパス「%s」が長すぎます。", pSocketPath);
+
+  // 書き込み側に接続
+  retStatus = attachFrameBus(frameBus);
+  CHK_ERR(STATUS_SUCCEEDED(retStatus), retStatus, "フレームバス「%s」に接続できません。", pSocketPath);
+
+  // 読み出しスレッドを開始
+  CHK_STATUS(THREAD_CREATE(&frameBus.threadId, frameBusReaderRoutine, reinterpret_cast<PVOID>(pKvsWebrtcConfig)));
+  DLOGI("Frame bus connected on %s: %u slots of %u bytes", pSocketPath, frameBus.pHeader->slotCount, frameBus.pHeader->slotSize);
+
+CleanUp:
+
+  if (STATUS_FAILED(retStatus)) {
+    freeFrameBus(frameBus);
+  }
+
+  return retStatus;
+}
+
+/**
+ * @brief フレームバスを解放する
+ */
+STATUS freeFrameBus(FrameBus& frameBus)
+{
+  auto retStatus = STATUS_SUCCESS;
+  // スレッドを停止
+  ATOMIC_STORE_BOOL(&frameBus.isTerminated, TRUE);
+  if (IS_VALID_TID_VALUE(frameBus.threadId)) {
+    THREAD_JOIN(frameBus.threadId, nullptr);
+    frameBus.threadId = INVALID_TID_VALUE;
+  }
+
+  // 書き込み側はソケットのファイルを削除
+  if (frameBus.isWriter && frameBus.socketFd >= 0) {
+    unlink(frameBus.socketPath.c_str());
+  }
+
+  // ソケットを閉じて共有メモリを解放
+  detachFrameBus(frameBus);
+
+  return retStatus;
+}
+
+/**
+ * @brief フレームバスのスロットを取得する
+ */
+FrameBusSlot* getFrameBusSlot(FrameBus& frameBus, UINT64 sequence)
+{
+  return reinterpret_cast<FrameBusSlot*>(frameBus.pMemory + ROUND_UP(SIZEOF(FrameBusHeader), FRAME_BUS_ALIGNMENT) +
+                                         (sequence % frameBus.pHeader->slotCount) * frameBus.slotStride);
+}
+
+/**
+ * @brief フレームバスにフレームを書き込む
+ *
+ * 呼び出し元 (onNewSample) が設定オブジェクトのロックを保持しているため書き込みは直列化される。
+ */
+VOID publishFrameBus(FrameBus& frameBus, Frame& frame)
+{
+  auto sequence = __atomic_load_n(&frameBus.pHeader->writeSequence, __ATOMIC_RELAXED);
+  auto pSlot = getFrameBusSlot(frameBus, sequence);
+
+  // スロットに収まらないフレームは破棄
+  if (frame.size > frameBus.pHeader->slotSize) {
+    ATOMIC_INCREMENT(&frameBus.oversizedCount);
+    return;
+  }
+
+  // 書き込み中にする (読み出し側は奇数のシーケンスで上書きを検出する)
+  __atomic_store_n(&pSlot->sequence, sequence * 2 + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  // フレームを書き込む
+  pSlot->trackId = frame.trackId;
+  pSlot->presentationTs = frame.presentationTs;
+  pSlot->duration = frame.duration;
+  pSlot->flags = frame.flags;
+  pSlot->size = frame.size;
+  MEMCPY(reinterpret_cast<PBYTE>(pSlot) + SIZEOF(FrameBusSlot), frame.frameData, frame.size);
+
+  // 書き込みを完了して公開
+  __atomic_store_n(&pSlot->sequence, sequence * 2 + 2, __ATOMIC_RELEASE);
+  if (frame.trackId == DEFAULT_VIDEO_TRACK_ID && (frame.flags & FRAME_FLAG_KEY_FRAME)) {
+    __atomic_store_n(&frameBus.pHeader->keyframeSequence, sequence, __ATOMIC_RELEASE);
+  }
+  __atomic_store_n(&frameBus.pHeader->writeSequence, sequence + 1, __ATOMIC_RELEASE);
+  ATOMIC_INCREMENT(&frameBus.publishedCount);
+
+  // 待機中の読み出し側を起床
+  __atomic_fetch_add(&frameBus.pHeader->futexWord, 1, __ATOMIC_RELEASE);
+  syscall(SYS_futex, &frameBus.pHeader->futexWord, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+/**
+ * @brief ワーカーにフレームバスのファイルディスクリプタを受け渡すスレッド
+ *
+ * ワーカーとの接続は終了まで保持し、ワーカーは切断を書き込み側の終了として検出する。
+ */
+PVOID frameBusListenerRoutine(PVOID arg)
+{
+  auto pKvsWebrtcConfig = reinterpret_cast<PKvsWebrtcConfig>(arg);
+  auto& frameBus = pKvsWebrtcConfig->frameBus;
+  std::vector<struct pollfd> pollFds;
+  std::vector<INT32> readerFds;
+  struct msghdr message;
+  struct iovec iov;
+  struct cmsghdr* pControlMessage;
+  struct ucred credentials;
+  socklen_t credentialsLength;
+  CHAR byte = 0;
+  alignas(struct cmsghdr) CHAR control[CMSG_SPACE(SIZEOF(INT32))];
+  INT32 clientFd;
+
+  while (!ATOMIC_LOAD_BOOL(&frameBus.isTerminated)) {
+    // 接続と切断を待機 (終了を確認するためにタイムアウトする)
+    pollFds.assign(1, {frameBus.socketFd, POLLIN, 0});
+    for (auto readerFd : readerFds) {
+      pollFds.push_back({readerFd, POLLIN, 0});
+    }
+    if (poll(pollFds.data(), pollFds.size(), FRAME_BUS_WAIT_TIMEOUT_MS) <= 0) {
+      continue;
+    }
+
+    // 切断したワーカーのソケットを閉じる (ワーカーは何も送信しないため、イベントは切断を意味する)
+    for (auto i = pollFds.size() - 1; i > 0; i--) {
+      if (pollFds[i].revents) {
+        close(readerFds[i - 1]);
+        readerFds.erase(readerFds.begin() + (i - 1));
+        ATOMIC_DECREMENT(&frameBus.readerCount);
+        DLOGI("A worker left the frame bus");
+      }
+    }
+
+    // 新しいワーカーを受け付ける
+    if (!(pollFds[0].revents & POLLIN) || (clientFd = accept4(frameBus.socketFd, nullptr, nullptr, SOCK_CLOEXEC)) < 0) {
+      continue;
+    }
+
+    // 同じユーザーのプロセス以外には受け渡さない (ソケットの権限を設定する前に接続された場合に備える)
+    credentialsLength = SIZEOF(credentials);
+    if (getsockopt(clientFd, SOL_SOCKET, SO_PEERCRED, &credentials, &credentialsLength) != 0 || credentials.uid != geteuid()) {
+      DLOGW("Refused to hand the frame bus to a process of another user");
+      close(clientFd);
+      continue;
+    }
+
+    // 共有メモリのファイルディスクリプタを送信
+    MEMSET(&message, 0x00, SIZEOF(message));
+    iov.iov_base = &byte;
+    iov.iov_len = SIZEOF(byte);
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = SIZEOF(control);
+    pControlMessage = CMSG_FIRSTHDR(&message);
+    pControlMessage->cmsg_level = SOL_SOCKET;
+    pControlMessage->cmsg_type = SCM_RIGHTS;
+    pControlMessage->cmsg_len = CMSG_LEN(SIZEOF(INT32));
+    MEMCPY(CMSG_DATA(pControlMessage), &frameBus.fd, SIZEOF(INT32));
+    if (sendmsg(clientFd, &message, MSG_NOSIGNAL) > 0) {
+      readerFds.push_back(clientFd);
+      ATOMIC_INCREMENT(&frameBus.readerCount);
+      DLOGI("Frame bus handed to a worker");
+    } else {
+      DLOGW("Failed to hand the frame bus to a worker: %d", errno);
+      close(clientFd);
+    }
+  }
+
+  // ワーカーとの接続を閉じる (ワーカーは再接続を試みる)
+  for (auto readerFd : readerFds) {
+    close(readerFd);
+  }
+  ATOMIC_STORE(&frameBus.readerCount, 0);
+
+  return nullptr;
+}
+
+/**
+ * @brief フレームバスからフレームを読み出して全セッションに送信するスレッド
+ *
+ * スロットのデータを読み出し側のバッファにコピーしてからシーケンスロックを再確認し、
+ * コピー中に上書きされた (書き込みに追い越された) フレームは送信せずに数える。
+ * 開始時と追い越された場合は、ビデオはキーフレームから再開する。
+ * 書き込み側のソケットが切断された場合は、再接続して新しい共有メモリをマップし直す。
+ */
+PVOID frameBusReaderRoutine(PVOID arg)
+{
+  auto pKvsWebrtcConfig = reinterpret_cast<PKvsWebrtcConfig>(arg);
+  auto& frameBus = pKvsWebrtcConfig->frameBus;
+  auto pHeader = frameBus.pHeader;
+  auto waitingForKeyframe = TRUE;
+  auto isAttached = FALSE;
+  struct timespec timeout = {0, FRAME_BUS_WAIT_TIMEOUT_MS * 1000 * 1000};
+  struct pollfd pollFd;
+  FrameBusSlot* pSlot;
+  Frame frame;
+  std::vector<BYTE> frameData;
+  UINT64 readSequence = 0, writeSequence, keyframeSequence, slotSequence;
+  UINT32 futexWord;
+
+  // 配信スレッドとして配置
+  applyThreadPolicy(pKvsWebrtcConfig->pKvsWebrtcHost, THREAD_ROLE_FANOUT);
+
+  while (!ATOMIC_LOAD_BOOL(&frameBus.isTerminated) && !ATOMIC_LOAD_BOOL(&pKvsWebrtcConfig->isTerminated)) {
+    // 書き込み側を失った場合は再接続する (再起動するまで一定間隔で試みる)
+    if (!frameBus.pHeader) {
+      if (STATUS_FAILED(attachFrameBus(frameBus))) {
+        THREAD_SLEEP(FRAME_BUS_RECONNECT_INTERVAL);
+        continue;
+      }
+      ATOMIC_INCREMENT(&frameBus.reconnectCount);
+      DLOGI("Frame bus reconnected on %s: %u slots of %u bytes",
+            frameBus.socketPath.c_str(),
+            frameBus.pHeader->slotCount,
+            frameBus.pHeader->slotSize);
+    }
+
+    // 接続した共有メモリの最後のキーフレームがリングに残っていればそこから読み出す
+    if (!isAttached) {
+      pHeader = frameBus.pHeader;
+      frameData.resize(pHeader->slotSize);
+      writeSequence = __atomic_load_n(&pHeader->writeSequence, __ATOMIC_ACQUIRE);
+      keyframeSequence = __atomic_load_n(&pHeader->keyframeSequence, __ATOMIC_ACQUIRE);
+      readSequence = keyframeSequence != FRAME_BUS_NO_SEQUENCE && writeSequence - keyframeSequence < pHeader->slotCount ? keyframeSequence : writeSequence;
+      waitingForKeyframe = TRUE;
+      isAttached = TRUE;
+    }
+
+    // 新しいフレームがなければ書き込まれるまで待機
+    futexWord = __atomic_load_n(&pHeader->futexWord, __ATOMIC_ACQUIRE);
+    writeSequence = __atomic_load_n(&pHeader->writeSequence, __ATOMIC_ACQUIRE);
+    if (readSequence >= writeSequence) {
+      syscall(SYS_futex, &pHeader->futexWord, FUTEX_WAIT, futexWord, &timeout, nullptr, 0);
+
+      // 書き込み側の終了を確認 (書き込み側は何も送信しないため、イベントは切断を意味する)
+      pollFd.fd = frameBus.socketFd;
+      pollFd.events = POLLIN;
+      pollFd.revents = 0;
+      if (poll(&pollFd, 1, 0) > 0) {
+        DLOGW("Frame bus writer on %s is gone, reconnecting", frameBus.socketPath.c_str());
+        detachFrameBus(frameBus);
+        isAttached = FALSE;
+      }
+      continue;
+    }
+
+    // 書き込みに追い越された場合は最新から再開
+    pSlot = getFrameBusSlot(frameBus, readSequence);
+    slotSequence = __atomic_load_n(&pSlot->sequence, __ATOMIC_ACQUIRE);
+    if (writeSequence - readSequence >= pHeader->slotCount || slotSequence != readSequence * 2 + 2) {
+      ATOMIC_INCREMENT(&frameBus.overrunCount);
+      readSequence = writeSequence;
+      waitingForKeyframe = TRUE;
+      continue;
+    }
+
+    // フレームを初期化
+    MEMSET(&frame, 0, SIZEOF(Frame));
+    frame.version = FRAME_CURRENT_VERSION;
+    frame.trackId = pSlot->trackId;
+    frame.presentationTs = pSlot->presentationTs;
+    frame.decodingTs = pSlot->presentationTs;
+    frame.duration = pSlot->duration;
+    frame.flags = static_cast<FRAME_FLAGS>(pSlot->flags);
+    frame.size = MIN(pSlot->size, pHeader->slotSize);
+    frame.frameData = frameData.data();
+    readSequence++;
+
+    // キーフレームを待っている間はビデオを読み飛ばす
+    if (frame.trackId == DEFAULT_VIDEO_TRACK_ID && waitingForKeyframe && !(frame.flags & FRAME_FLAG_KEY_FRAME)) {
+      continue;
+    }
+
+    // データを共有メモリからコピー
+    MEMCPY(frame.frameData, reinterpret_cast<PBYTE>(pSlot) + SIZEOF(FrameBusSlot), frame.size);
+
+    // コピー中に上書きされた場合は送信しない (ビデオはキーフレームから再開)
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&pSlot->sequence, __ATOMIC_RELAXED) != slotSequence) {
+      ATOMIC_INCREMENT(&frameBus.tornCount);
+      if (frame.trackId == DEFAULT_VIDEO_TRACK_ID) {
+        waitingForKeyframe = TRUE;
+      }
+      continue;
+    }
+    if (frame.trackId == DEFAULT_VIDEO_TRACK_ID) {
+      waitingForKeyframe = FALSE;
+    }
+
+    // 全セッションに送信
+    writeFrameToSessions(pKvsWebrtcConfig, frame, VIDEO_CODEC_TYPE_H264, nullptr);
+    recordFrame(pKvsWebrtcConfig, frame, nullptr, nullptr);
+    ATOMIC_INCREMENT(&frameBus.consumedCount);
+  }
+
+  releaseThreadPolicy(pKvsWebrtcConfig->pKvsWebrtcHost);
+
+  return nullptr;
+}
+
+/**
+ * @brief フレームバスのメトリクスを出力する
+ */
+VOID logFrameBusStats(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto& frameBus = pKvsWebrtcConfig->frameBus;
+
+  // 作成されていない場合は無視 (読み出し側のヘッダーは再接続で変わるためスレッドで判定する)
+  if (!IS_VALID_TID_VALUE(frameBus.threadId)) {
+    return;
+  }
+
+  // ログを出力
+  if (pKvsWebrtcConfig->inputMode == INPUT_MODE_BUS) {
+    DLOGP("frameBus: consumed: %zu, overruns: %zu, torn: %zu, reconnects: %zu",
+          ATOMIC_EXCHANGE(&frameBus.consumedCount, 0),
+          ATOMIC_EXCHANGE(&frameBus.overrunCount, 0),
+          ATOMIC_EXCHANGE(&frameBus.tornCount, 0),
+          ATOMIC_EXCHANGE(&frameBus.reconnectCount, 0));
+  } else {
+    DLOGP("frameBus: published: %zu, oversized: %zu, workers: %zu",
+          ATOMIC_EXCHANGE(&frameBus.publishedCount, 0),
+          ATOMIC_EXCHANGE(&frameBus.oversizedCount, 0),
+          ATOMIC_LOAD(&frameBus.readerCount));
+  }
+}
+
+// ============================================================================
+// トークバック
+// ============================================================================
+
+
+/**
+ * @brief トークバックを初期化する
+ */
+STATUS initTalkback(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto& talkback = pKvsWebrtcConfig->talkback;
+
+  // 設定 (最大遅延は話者のリングバッファに収まる範囲)
+  talkback.pipeline = nullptr;
+  talkback.appsrc = nullptr;
+  talkback.clock = nullptr;
+  talkback.mixerThreadId = INVALID_TID_VALUE;
+  ATOMIC_STORE_BOOL(&talkback.isTerminated, FALSE);
+  talkback.minDelay = getChannelEnvUint32(pKvsWebrtcConfig, TALKBACK_MIN_DELAY_ENV_VAR, DEFAULT_TALKBACK_MIN_DELAY_MS) * HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+  talkback.maxDelay = getChannelEnvUint32(pKvsWebrtcConfig, TALKBACK_MAX_DELAY_ENV_VAR, DEFAULT_TALKBACK_MAX_DELAY_MS) * HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+  talkback.maxDelay = MIN(talkback.maxDelay,
+                          static_cast<UINT64>(TALKBACK_SOURCE_RING_FRAMES - 2 * TALKBACK_MAX_DECODE_FRAMES) * HUNDREDS_OF_NANOS_IN_A_SECOND / TALKBACK_SAMPLE_RATE);
+  talkback.minDelay = MIN(talkback.minDelay, talkback.maxDelay);
+  talkback.maxSources = MIN(MAX(getChannelEnvUint32(pKvsWebrtcConfig, TALKBACK_MAX_SOURCES_ENV_VAR, DEFAULT_TALKBACK_MAX_SOURCES), 1U), static_cast<UINT32>(TALKBACK_MAX_SOURCES));
+  talkback.defaultGain =
+    MIN(getChannelEnvUint32(pKvsWebrtcConfig, TALKBACK_GAIN_ENV_VAR, DEFAULT_TALKBACK_GAIN_PERCENT), TALKBACK_MAX_GAIN_PERCENT) * TALKBACK_GAIN_UNITY / 100;
+  talkback.mixPosition = 0;
+
+  // 有効でない場合は受信した音声を破棄する
+  pKvsWebrtcConfig->talkbackEnabled = getChannelEnvBool(pKvsWebrtcConfig, TALKBACK_ENV_VAR, FALSE);
+  CHK(pKvsWebrtcConfig->talkbackEnabled, retStatus);
+
+  // 同期オブジェクト、作業領域、バッファプール、メトリクス
+  talkback.lock = MUTEX_CREATE(FALSE);
+  talkback.decodeBuffer.resize(TALKBACK_MAX_DECODE_FRAMES * TALKBACK_CHANNELS);
+  CHK_STATUS(initBufferPool(talkback.mixPool, TALKBACK_MIX_BUFFER_SIZE, TALKBACK_POOL_MAX_FREE));
+  CHK_STATUS(initLatencyStats(talkback.playoutDelay, LATENCY_STATS_CAPACITY));
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief トークバックの再生用パイプラインとミキサーを開始する
+ *
+ * 話者ごとにデコードしたPCMをミキサースレッドで1つにまとめてappsrcに入力し、シンクで再生する。
+ * ミキサーの出力時刻の基準にするため、パイプラインのクロックはシステムクロックに固定する。
+ */
+STATUS startTalkback(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto& talkback = pKvsWebrtcConfig->talkback;
+  GError* error = nullptr;
+  GstBus* bus = nullptr;
+  PCHAR pSink = nullptr;
+  std::string description;
+
+  // NULLチェック
+  CHK(pKvsWebrtcConfig, STATUS_NULL_ARG);
+
+  // 有効でない場合は何もしない
+  CHK(pKvsWebrtcConfig->talkbackEnabled, retStatus);
+
+  // 再生用パイプラインの定義を作成
+  pSink = getChannelEnv(pKvsWebrtcConfig, TALKBACK_SINK_ENV_VAR);
+  description =
+    "appsrc "
+    "  name=talkback-src "
+    "  is-live=true "
+    "  format=time "
+    "  do-timestamp=false "
+    "  caps=\"audio/x-raw,format=S16LE,layout=interleaved,rate=" + std::to_string(TALKBACK_SAMPLE_RATE) +
+    ",channels=" + std::to_string(TALKBACK_CHANNELS) + "\" ! "
+    "audioconvert ! "
+    "audioresample ! " +
+    std::string(pSink ? pSink : DEFAULT_TALKBACK_SINK);
+  DLOGD("talkback pipeline: %s", description.c_str());
+
+  // 再生用パイプラインを作成
+  talkback.pipeline = gst_parse_launch(description.c_str(), &error);
+
+  // エラーチェック
+  if (error) {
+    DLOGE("Failed to create talkback pipeline: %s", error->message);
+    g_error_free(error);
+    CHK(FALSE, STATUS_INTERNAL_ERROR);
+  }
+
+  // スレッドごとのCPU使用率の出力用に名前を設定
+  gst_object_set_name(GST_OBJECT(talkback.pipeline), (std::string(pKvsWebrtcConfig->channelInfo.pChannelName) + "-talkback").c_str());
+
+  // appsrcを取得
+  CHK_ERR(talkback.appsrc = gst_bin_get_by_name(GST_BIN(talkback.pipeline), "talkback-src"),
+          STATUS_INTERNAL_ERROR,
+          "トークバックのappsrcが見つかりません。");
+
+  // パイプラインのバスメッセージを処理
+  bus = gst_element_get_bus(talkback.pipeline);
+  gst_bus_set_sync_handler(bus, onGstBusSyncMessage, pKvsWebrtcConfig, nullptr);
+  gst_object_unref(bus);
+
+  // クロックをシステムクロックに固定してパイプラインを開始
+  talkback.clock = gst_system_clock_obtain();
+  gst_pipeline_use_clock(GST_PIPELINE(talkback.pipeline), talkback.clock);
+  CHK_ERR(gst_element_set_state(talkback.pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE &&
+            gst_element_get_state(talkback.pipeline, nullptr, nullptr, 5 * GST_SECOND) != GST_STATE_CHANGE_FAILURE,
+          STATUS_INTERNAL_ERROR,
+          "トークバックのパイプラインを開始できません。");
+
+  // ミキサースレッドを開始
+  CHK_STATUS(THREAD_CREATE(&talkback.mixerThreadId, talkbackMixerRoutine, reinterpret_cast<PVOID>(pKvsWebrtcConfig)));
+  DLOGI("Talkback enabled: delay: %" PRIu64 "-%" PRIu64 " ms, max sources: %u",
+        talkback.minDelay / HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+        talkback.maxDelay / HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+        talkback.maxSources);
+
+CleanUp:
+
+  // エラー時はパイプラインを解放 (受信した音声は破棄する)
+  if (STATUS_FAILED(retStatus) && pKvsWebrtcConfig) {
+    MUTEX_LOCK(talkback.lock);
+    if (talkback.appsrc) {
+      gst_object_unref(talkback.appsrc);
+      talkback.appsrc = nullptr;
+    }
+    if (talkback.pipeline) {
+      gst_element_set_state(talkback.pipeline, GST_STATE_NULL);
+      gst_object_unref(talkback.pipeline);
+      talkback.pipeline = nullptr;
+    }
+    if (talkback.clock) {
+      gst_object_unref(talkback.clock);
+      talkback.clock = nullptr;
+    }
+    MUTEX_UNLOCK(talkback.lock);
+  }
+
+  return retStatus;
+}
+
+/**
+ * @brief トークバックを解放する
+ *
+ * ピア接続を解放してフレームのコールバックが呼ばれなくなってから呼び出すこと。
+ */
+STATUS freeTalkback(Talkback& talkback)
+{
+  auto retStatus = STATUS_SUCCESS;
+
+  // 初期化されていない場合は何もしない
+  CHK(IS_VALID_MUTEX_VALUE(talkback.lock), retStatus);
+
+  // ミキサースレッドを停止
+  ATOMIC_STORE_BOOL(&talkback.isTerminated, TRUE);
+  if (IS_VALID_TID_VALUE(talkback.mixerThreadId)) {
+    THREAD_JOIN(talkback.mixerThreadId, nullptr);
+    talkback.mixerThreadId = INVALID_TID_VALUE;
+  }
+
+  // 再生用パイプラインを停止 (再生待ちのバッファはプールに返却される)
+  if (talkback.appsrc) {
+    gst_object_unref(talkback.appsrc);
+    talkback.appsrc = nullptr;
+  }
+  if (talkback.pipeline) {
+    gst_element_set_state(talkback.pipeline, GST_STATE_NULL);
+    gst_object_unref(talkback.pipeline);
+    talkback.pipeline = nullptr;
+  }
+  if (talkback.clock) {
+    gst_object_unref(talkback.clock);
+    talkback.clock = nullptr;
+  }
+
+  // 話者を解放
+  for (auto&& value : talkback.sources) {
+    freeTalkbackSource(value.second);
+  }
+  talkback.sources.clear();
+
+  // 同期オブジェクト、バッファプール、メトリクスを解放
+  freeBufferPool(talkback.mixPool);
+  freeLatencyStats(talkback.playoutDelay);
+  MUTEX_FREE(talkback.lock);
+  talkback.lock = INVALID_MUTEX_VALUE;
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief トークバックのパイプラインのランニングタイムを取得する (100ナノ秒単位)
+ */
+BOOL getTalkbackRunningTime(Talkback& talkback, UINT64& runningTime)
+{
+  GstClockTime clockTime, baseTime;
+
+  // パイプラインが開始していない場合は取得できない
+  if (!talkback.pipeline || !talkback.clock) {
+    return FALSE;
+  }
+
+  clockTime = gst_clock_get_time(talkback.clock);
+  baseTime = gst_element_get_base_time(talkback.pipeline);
+  if (clockTime < baseTime) {
+    return FALSE;
+  }
+
+  runningTime = (clockTime - baseTime) / DEFAULT_TIME_UNIT_IN_NANOS;
+  return TRUE;
+}
+
+/**
+ * @brief 受信した音声フレームをデコードして話者のリングバッファに書き込むコールバック
+ *
+ * 話者ごとに到着間隔のジッタ (RFC 3550) から目標遅延を決め、発話の先頭でフレームの
+ * タイムスタンプを再生時刻に対応付ける (発話の途中では再生速度を変えない)。ミキサーが
+ * 再生時刻を出力済みのフレームはアンダーランとして数え、その時点で対応付けをやり直す。
+ * 発話の途中で失われたフレームはデコーダーで補間し、DTXと無音のフレームはデコードした上で
+ * ミキシングの対象にしない。フレームはSDKのバッファから直接デコードする。
+ */
+VOID onTalkbackFrame(UINT64 customData, PFrame pFrame)
+{
+  auto pStreamingSession = reinterpret_cast<PKvsWebrtcStreamingSession>(customData);
+  Talkback* pTalkback;
+  TalkbackSource* pSource;
+  UINT64 runningTime, mixTime, timestamp, pts, lostFrames;
+  INT64 transit;
+  INT32 decodedFrames, peak = 0;
+  BOOL newTalkspurt;
+
+  // NULLチェック
+  if (!pStreamingSession || !pFrame || !pFrame->frameData || pFrame->size == 0) {
+    return;
+  }
+  pTalkback = &pStreamingSession->pKvsWebrtcConfig->talkback;
+
+  MUTEX_LOCK(pTalkback->lock);
+
+  // ミキサーが開始していない場合は破棄
+  if (pTalkback->mixPosition == 0 || !getTalkbackRunningTime(*pTalkback, runningTime)) {
+    MUTEX_UNLOCK(pTalkback->lock);
+    return;
+  }
+  mixTime = pTalkback->mixPosition * HUNDREDS_OF_NANOS_IN_A_SECOND / TALKBACK_SAMPLE_RATE;
+  timestamp = pFrame->presentationTs;
+
+  // 話者を取得 (同時に再生する話者数を超える場合は破棄)
+  if (!(pSource = getTalkbackSource(*pTalkback, pStreamingSession->peerClientId))) {
+    MUTEX_UNLOCK(pTalkback->lock);
+    ATOMIC_INCREMENT(&pTalkback->droppedCount);
+    return;
+  }
+
+  // 新しい発話か (無音の後、タイムスタンプの巻き戻り)
+  newTalkspurt = !pSource->anchored || runningTime - pSource->lastArrival > TALKBACK_TALKSPURT_GAP || timestamp <= pSource->lastTimestamp;
+
+  // 発話の途中ではジッタと目標遅延を更新
+  if (!newTalkspurt) {
+    transit = static_cast<INT64>(runningTime - pSource->lastArrival) - static_cast<INT64>(timestamp - pSource->lastTimestamp);
+    transit = transit < 0 ? -transit : transit;
+    pSource->jitter = static_cast<UINT64>(static_cast<INT64>(pSource->jitter) + (transit - static_cast<INT64>(pSource->jitter)) / 16);
+    pSource->targetDelay = MIN(MAX(pTalkback->minDelay, TALKBACK_JITTER_MULTIPLIER * pSource->jitter), pTalkback->maxDelay);
+  }
+
+  // 発話の先頭で現在の目標遅延を使って再生時刻を対応付け、パイプラインのレイテンシを取得
+  if (newTalkspurt) {
+    pSource->offset = static_cast<INT64>(MAX(runningTime, mixTime) + pSource->targetDelay) - static_cast<INT64>(timestamp);
+    pSource->anchored = TRUE;
+    if (auto query = gst_query_new_latency(); query) {
+      GstClockTime minLatency = 0;
+      if (gst_element_query(pTalkback->pipeline, query)) {
+        gst_query_parse_latency(query, nullptr, &minLatency, nullptr);
+        pTalkback->sinkLatency = minLatency / DEFAULT_TIME_UNIT_IN_NANOS;
+      }
+      gst_query_unref(query);
+    }
+    ATOMIC_INCREMENT(&pTalkback->talkspurtCount);
+  }
+
+  // ミキサーが出力済みの場合はアンダーランとして対応付けをやり直す
+  pts = static_cast<UINT64>(static_cast<INT64>(timestamp) + pSource->offset);
+  if (pts < mixTime) {
+    ATOMIC_INCREMENT(&pTalkback->underrunCount);
+    pSource->offset = static_cast<INT64>(mixTime + pSource->targetDelay) - static_cast<INT64>(timestamp);
+    pts = mixTime + pSource->targetDelay;
+  }
+
+  // 受信から再生までの遅延 (シンクはランニングタイムにレイテンシを加えた時刻に再生する)
+  addLatencySample(pTalkback->playoutDelay, pts - MIN(pts, runningTime) + pTalkback->sinkLatency);
+
+  // 発話の途中で失われたフレームを補間 (前のフレームの終わりから今回のフレームまで)
+  if (!newTalkspurt && timestamp > pSource->lastTimestamp + pSource->frameDuration) {
+    // 補間するサンプル数はOpusのフレーム長の単位 (2.5ミリ秒) に切り捨てる
+    lostFrames = (timestamp - pSource->lastTimestamp - pSource->frameDuration) * TALKBACK_SAMPLE_RATE / HUNDREDS_OF_NANOS_IN_A_SECOND;
+    lostFrames -= lostFrames % (TALKBACK_SAMPLE_RATE / 400);
+    if (lostFrames > 0 && lostFrames <= MIN(TALKBACK_MAX_CONCEALED_FRAMES * pSource->frameDuration * TALKBACK_SAMPLE_RATE / HUNDREDS_OF_NANOS_IN_A_SECOND,
+                                            static_cast<UINT64>(TALKBACK_MAX_DECODE_FRAMES)) &&
+        (decodedFrames = opus_decode(pSource->pDecoder, nullptr, 0, pTalkback->decodeBuffer.data(), static_cast<INT32>(lostFrames), 0)) > 0) {
+      writeTalkbackSamples(*pSource,
+                           (pts - (timestamp - pSource->lastTimestamp - pSource->frameDuration)) * TALKBACK_SAMPLE_RATE / HUNDREDS_OF_NANOS_IN_A_SECOND,
+                           pTalkback->mixPosition,
+                           pTalkback->decodeBuffer.data(),
+                           static_cast<UINT32>(decodedFrames));
+      ATOMIC_INCREMENT(&pTalkback->concealedCount);
+    }
+  }
+
+  pSource->lastArrival = runningTime;
+  pSource->lastTimestamp = timestamp;
+
+  // デコード (DTXのフレームもデコーダーの状態を保つためにデコードし、ミキシングの対象からのみ外す)
+  decodedFrames = opus_decode(pSource->pDecoder,
+                              pFrame->frameData,
+                              static_cast<INT32>(pFrame->size),
+                              pTalkback->decodeBuffer.data(),
+                              TALKBACK_MAX_DECODE_FRAMES,
+                              0);
+  if (decodedFrames <= 0) {
+    MUTEX_UNLOCK(pTalkback->lock);
+    ATOMIC_INCREMENT(&pTalkback->droppedCount);
+    return;
+  }
+  pSource->frameDuration = static_cast<UINT64>(decodedFrames) * HUNDREDS_OF_NANOS_IN_A_SECOND / TALKBACK_SAMPLE_RATE;
+
+  // DTXと無音のフレームはミキシングの対象から外す (ミキサーは書き込みのない話者を読み出さない)
+  for (INT32 i = 0; pFrame->size > TALKBACK_DTX_PACKET_MAX && i < decodedFrames * TALKBACK_CHANNELS && peak < TALKBACK_SILENCE_PEAK; i++) {
+    peak = MAX(peak, ABS(static_cast<INT32>(pTalkback->decodeBuffer[i])));
+  }
+  if (peak < TALKBACK_SILENCE_PEAK) {
+    ATOMIC_INCREMENT(&pTalkback->silentCount);
+  } else {
+    writeTalkbackSamples(*pSource,
+                         pts * TALKBACK_SAMPLE_RATE / HUNDREDS_OF_NANOS_IN_A_SECOND,
+                         pTalkback->mixPosition,
+                         pTalkback->decodeBuffer.data(),
+                         static_cast<UINT32>(decodedFrames));
+    ATOMIC_INCREMENT(&pTalkback->frameCount);
+  }
+
+  MUTEX_UNLOCK(pTalkback->lock);
+}
+
+/**
+ * @brief 話者を取得する (存在しない場合は作成する)
+ *
+ * トークバックのロックを保持して呼び出すこと。同時に再生する話者数の上限に達している場合はnullptrを返す。
+ */
+TalkbackSource* getTalkbackSource(Talkback& talkback, const CHAR* pPeerClientId)
+{
+  std::unique_ptr<TalkbackSource> pSource;
+  INT32 error;
+
+  // 既存の話者
+  if (auto it = talkback.sources.find(pPeerClientId); it != talkback.sources.end()) {
+    return it->second.get();
+  }
+
+  // 上限に達している場合は作成しない
+  if (talkback.sources.size() >= talkback.maxSources) {
+    return nullptr;
+  }
+
+  // デコーダーを作成
+  pSource = std::make_unique<TalkbackSource>();
+  if (!(pSource->pDecoder = opus_decoder_create(TALKBACK_SAMPLE_RATE, TALKBACK_CHANNELS, &error))) {
+    DLOGW("Failed to create talkback decoder: %s", opus_strerror(error));
+    return nullptr;
+  }
+
+  // 再生の状態
+  pSource->gain = talkback.defaultGain;
+  pSource->anchored = FALSE;
+  pSource->frameDuration = TALKBACK_DEFAULT_FRAME_DURATION;
+  pSource->targetDelay = talkback.minDelay;
+  pSource->samples.assign(TALKBACK_SOURCE_RING_FRAMES * TALKBACK_CHANNELS, 0);
+  pSource->writePosition = 0;
+
+  DLOGI("Talkback from %s", pPeerClientId);
+  return (talkback.sources[pPeerClientId] = std::move(pSource)).get();
+}
+
+/**
+ * @brief 話者を解放する
+ */
+VOID freeTalkbackSource(std::unique_ptr<TalkbackSource>& pSource)
+{
+  // NULLチェック
+  if (!pSource) {
+    return;
+  }
+
+  // デコーダーを解放
+  if (pSource->pDecoder) {
+    opus_decoder_destroy(pSource->pDecoder);
+  }
+
+  pSource.reset();
+}
+
+/**
+ * @brief 話者のゲインを設定する (パーセント)
+ *
+ * 受信中の話者のみ設定できる。受信がなくなって解放された話者は次の発話でデフォルトのゲインに戻る。
+ */
+STATUS setTalkbackSourceGain(PKvsWebrtcConfig pKvsWebrtcConfig, const CHAR* pPeerClientId, UINT32 gain)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto isLocked = FALSE;
+  TalkbackSource* pSource = nullptr;
+
+  // NULLチェック
+  CHK(pKvsWebrtcConfig && pPeerClientId, STATUS_NULL_ARG);
+  CHK(pKvsWebrtcConfig->talkbackEnabled, STATUS_INVALID_OPERATION);
+
+  MUTEX_LOCK(pKvsWebrtcConfig->talkback.lock);
+  isLocked = TRUE;
+
+  // 話者を取得
+  if (auto it = pKvsWebrtcConfig->talkback.sources.find(pPeerClientId); it != pKvsWebrtcConfig->talkback.sources.end()) {
+    pSource = it->second.get();
+  }
+  CHK_ERR(pSource, STATUS_INVALID_ARG, "話者が見つかりません。");
+
+  // ゲインを設定 (Q14)
+  pSource->gain = static_cast<INT32>(MIN(gain, TALKBACK_MAX_GAIN_PERCENT) * TALKBACK_GAIN_UNITY / 100);
+
+CleanUp:
+
+  if (isLocked) {
+    MUTEX_UNLOCK(pKvsWebrtcConfig->talkback.lock);
+  }
+
+  return retStatus;
+}
+
+/**
+ * @brief デコード済みサンプルを話者のリングバッファに書き込む
+ *
+ * 書き込み済みの範囲やミキサーが出力済みの範囲と重なる部分は捨て、
+ * 前の書き込みとの間が空いた場合は無音で埋める。
+ */
+VOID writeTalkbackSamples(TalkbackSource& source, UINT64 position, UINT64 mixPosition, const INT16* pSamples, UINT32 frames)
+{
+  auto start = MAX(source.writePosition, mixPosition);
+  UINT64 skip, index, count;
+
+  // 重なる部分を捨てる
+  if (position < start) {
+    skip = MIN(static_cast<UINT64>(frames), start - position);
+    pSamples += skip * TALKBACK_CHANNELS;
+    frames -= static_cast<UINT32>(skip);
+    position += skip;
+  }
+
+  // リングバッファに収まらない場合は破棄
+  if (frames == 0 || position + frames - mixPosition > TALKBACK_SOURCE_RING_FRAMES) {
+    return;
+  }
+
+  // 間が空いた部分を無音で埋める
+  for (; start < position; start += count) {
+    index = start & (TALKBACK_SOURCE_RING_FRAMES - 1);
+    count = MIN(position - start, TALKBACK_SOURCE_RING_FRAMES - index);
+    MEMSET(&source.samples[index * TALKBACK_CHANNELS], 0x00, count * TALKBACK_CHANNELS * SIZEOF(INT16));
+  }
+
+  // サンプルを書き込む (リングバッファの終端で折り返す)
+  for (; frames > 0; frames -= static_cast<UINT32>(count)) {
+    index = position & (TALKBACK_SOURCE_RING_FRAMES - 1);
+    count = MIN(static_cast<UINT64>(frames), TALKBACK_SOURCE_RING_FRAMES - index);
+    MEMCPY(&source.samples[index * TALKBACK_CHANNELS], pSamples, count * TALKBACK_CHANNELS * SIZEOF(INT16));
+    pSamples += count * TALKBACK_CHANNELS;
+    position += count;
+  }
+
+  source.writePosition = position;
+}
+
+/**
+ * @brief 全話者のサンプルを1ブロック分ミキシングする
+ *
+ * ブロックの範囲に書き込みがない話者 (無音、DTX、受信の途切れ) は読み出さない。
+ * トークバックのロックを保持して呼び出すこと。ミキシングした話者数を返す。
+ */
+UINT32 mixTalkbackBlock(Talkback& talkback, UINT64 position, PINT16 pOutput)
+{
+  UINT32 mixedSources = 0;
+  UINT64 index, count, first;
+
+  // 無音で初期化
+  MEMSET(pOutput, 0x00, TALKBACK_MIX_FRAMES * TALKBACK_CHANNELS * SIZEOF(INT16));
+
+  for (auto&& value : talkback.sources) {
+    auto& source = *value.second;
+
+    // 書き込みのない話者とゲインが0の話者は読み出さない
+    if (source.writePosition <= position || source.gain == 0) {
+      continue;
+    }
+
+    // ゲインを掛けて飽和加算 (リングバッファの終端で折り返す)
+    index = position & (TALKBACK_SOURCE_RING_FRAMES - 1);
+    count = MIN(source.writePosition - position, static_cast<UINT64>(TALKBACK_MIX_FRAMES));
+    first = MIN(count, TALKBACK_SOURCE_RING_FRAMES - index);
+    mixTalkbackSamples(pOutput, &source.samples[index * TALKBACK_CHANNELS], static_cast<UINT32>(first * TALKBACK_CHANNELS), source.gain);
+    if (count > first) {
+      mixTalkbackSamples(pOutput + first * TALKBACK_CHANNELS, source.samples.data(), static_cast<UINT32>((count - first) * TALKBACK_CHANNELS), source.gain);
+    }
+    mixedSources++;
+  }
+
+  return mixedSources;
+}
+
+/**
+ * @brief ゲインを掛けたサンプルを飽和加算する (SSE2/NEON)
+ *
+ * 8サンプルずつゲイン (Q14) を掛けて16ビットに飽和させ、ミキシング先に飽和加算する。
+ * 端数はスカラーで処理する。
+ */
+VOID mixTalkbackSamples(PINT16 pMix, const INT16* pSource, UINT32 count, INT32 gain)
+{
+  UINT32 i = 0;
+
+#if defined(__SSE2__)
+  auto gainVector = _mm_set1_epi16(static_cast<INT16>(gain));
+  for (; i + 8 <= count; i += 8) {
+    auto source = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSource + i));
+    if (gain != TALKBACK_GAIN_UNITY) {
+      // 32ビットの積を作ってシフトし、飽和させて16ビットに戻す
+      auto low = _mm_mullo_epi16(source, gainVector);
+      auto high = _mm_mulhi_epi16(source, gainVector);
+      source = _mm_packs_epi32(_mm_srai_epi32(_mm_unpacklo_epi16(low, high), TALKBACK_GAIN_SHIFT),
+                               _mm_srai_epi32(_mm_unpackhi_epi16(low, high), TALKBACK_GAIN_SHIFT));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pMix + i),
+                     _mm_adds_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pMix + i)), source));
+  }
+#elif defined(__ARM_NEON)
+  auto gainVector = vdup_n_s16(static_cast<INT16>(gain));
+  for (; i + 8 <= count; i += 8) {
+    auto source = vld1q_s16(pSource + i);
+    if (gain != TALKBACK_GAIN_UNITY) {
+      // 32ビットの積をシフトして飽和させながら16ビットに戻す
+      source = vcombine_s16(vqshrn_n_s32(vmull_s16(vget_low_s16(source), gainVector), TALKBACK_GAIN_SHIFT),
+                            vqshrn_n_s32(vmull_s16(vget_high_s16(source), gainVector), TALKBACK_GAIN_SHIFT));
+    }
+    vst1q_s16(pMix + i, vqaddq_s16(vld1q_s16(pMix + i), source));
+  }
+#endif
+
+  // 端数 (SIMDが使えない場合は全サンプル)
+  mixTalkbackSamplesScalar(pMix + i, pSource + i, count - i, gain);
+}
+
+/**
+ * @brief ゲインを掛けたサンプルを飽和加算する (スカラー)
+ */
+VOID mixTalkbackSamplesScalar(PINT16 pMix, const INT16* pSource, UINT32 count, INT32 gain)
+{
+  INT32 sample;
+
+  for (UINT32 i = 0; i < count; i++) {
+    sample = MIN(MAX((static_cast<INT32>(pSource[i]) * gain) >> TALKBACK_GAIN_SHIFT, INT16_MIN), INT16_MAX);
+    pMix[i] = static_cast<INT16>(MIN(MAX(static_cast<INT32>(pMix[i]) + sample, INT16_MIN), INT16_MAX));
+  }
+}
+
+/**
+ * @brief ミキシングした音声を再生用パイプラインに入力するスレッド
+ *
+ * ランニングタイムより少し先までを10ミリ秒のブロック単位でミキシングし、
+ * プールのバッファにそのまま書き込んでGstBufferとしてラップする。
+ * 無音の間も出力を続けてシンクの再生を途切れさせない。
+ */
+PVOID talkbackMixerRoutine(PVOID arg)
+{
+  auto pKvsWebrtcConfig = reinterpret_cast<PKvsWebrtcConfig>(arg);
+  auto& talkback = pKvsWebrtcConfig->talkback;
+  GstBuffer* buffer;
+  PBYTE pBlock;
+  UINT64 runningTime, mixStartTime;
+
+  // オーディオデバイスへの出力のためキャプチャと同じ役割
+  applyThreadPolicy(pKvsWebrtcConfig->pKvsWebrtcHost, THREAD_ROLE_CAPTURE);
+
+  while (!ATOMIC_LOAD_BOOL(&talkback.isTerminated)) {
+    MUTEX_LOCK(talkback.lock);
+
+    if (getTalkbackRunningTime(talkback, runningTime)) {
+      // 開始時と再生時刻に遅れた場合は現在時刻から出力
+      if (talkback.mixPosition * HUNDREDS_OF_NANOS_IN_A_SECOND / TALKBACK_SAMPLE_RATE < runningTime) {
+        talkback.mixPosition = (runningTime + TALKBACK_MIX_LEAD) * TALKBACK_SAMPLE_RATE / HUNDREDS_OF_NANOS_IN_A_SECOND;
+      }
+
+      // 先に出力する時間までブロック単位でミキシング
+      while (talkback.mixPosition * HUNDREDS_OF_NANOS_IN_A_SECOND / TALKBACK_SAMPLE_RATE <= runningTime + TALKBACK_MIX_LEAD &&
+             (pBlock = acquireBuffer(talkback.mixPool))) {
+        *reinterpret_cast<BufferPool**>(pBlock) = &talkback.mixPool;
+        mixStartTime = GETTIME();
+        ATOMIC_ADD(&talkback.mixedSources, mixTalkbackBlock(talkback, talkback.mixPosition, reinterpret_cast<PINT16>(pBlock + TALKBACK_BUFFER_HEADER_SIZE)));
+        ATOMIC_ADD(&talkback.mixTime, GETTIME() - mixStartTime);
+        ATOMIC_INCREMENT(&talkback.mixedBlocks);
+
+        buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY,
+                                             pBlock,
+                                             TALKBACK_MIX_BUFFER_SIZE,
+                                             TALKBACK_BUFFER_HEADER_SIZE,
+                                             TALKBACK_MIX_BUFFER_SIZE - TALKBACK_BUFFER_HEADER_SIZE,
+                                             pBlock,
+                                             releaseTalkbackBuffer);
+        GST_BUFFER_PTS(buffer) = gst_util_uint64_scale(talkback.mixPosition, GST_SECOND, TALKBACK_SAMPLE_RATE);
+        GST_BUFFER_DURATION(buffer) = gst_util_uint64_scale(TALKBACK_MIX_FRAMES, GST_SECOND, TALKBACK_SAMPLE_RATE);
+
+        // appsrcがバッファの所有権を受け取る
+        gst_app_src_push_buffer(GST_APP_SRC(talkback.appsrc), buffer);
+        talkback.mixPosition += TALKBACK_MIX_FRAMES;
+      }
+
+      // 受信がなくなった話者を解放
+      for (auto it = talkback.sources.begin(); it != talkback.sources.end();) {
+        if (runningTime - MIN(runningTime, it->second->lastArrival) > TALKBACK_SOURCE_IDLE_TIMEOUT) {
+          DLOGI("Talkback from %s ended", it->first.c_str());
+          freeTalkbackSource(it->second);
+          it = talkback.sources.erase(it);
+        } else {
+          it++;
+        }
+      }
+    }
+
+    MUTEX_UNLOCK(talkback.lock);
+
+    // ブロックの半分の間隔で確認
+    THREAD_SLEEP(TALKBACK_MIX_FRAMES * HUNDREDS_OF_NANOS_IN_A_SECOND / TALKBACK_SAMPLE_RATE / 2);
+  }
+
+  releaseThreadPolicy(pKvsWebrtcConfig->pKvsWebrtcHost);
+  return nullptr;
+}
+
+/**
+ * @brief トークバックのGstBufferの解放時にバッファをプールに返却する
+ */
+VOID releaseTalkbackBuffer(gpointer data)
+{
+  auto pBlock = reinterpret_cast<PBYTE>(data);
+
+  releaseBuffer(**reinterpret_cast<BufferPool**>(pBlock), pBlock);
+}
+
+/**
+ * @brief トークバックのメトリクスを出力する (設定オブジェクトのロックを保持せずに呼び出す)
+ *
+ * 受信から再生までの遅延に加えて、話者ごとにピア接続のRTTの半分を片道の伝送遅延として出力する
+ * (話者側のキャプチャとエンコードの遅延は含まない)。
+ */
+VOID logTalkbackStats(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  struct SourceStats {
+    std::string peerClientId;
+    UINT64 jitter;
+    UINT64 targetDelay;
+    INT32 gain;
+    PRtcPeerConnection pPeerConnection;
+    DOUBLE oneWayDelay;
+  };
+  auto pKvsWebrtcHost = pKvsWebrtcConfig->pKvsWebrtcHost;
+  auto& talkback = pKvsWebrtcConfig->talkback;
+  std::vector<SourceStats> sourceStats;
+  RtcStats rtcStats;
+  SIZE_T mixedBlocks;
+
+  // 有効でない場合は出力しない
+  if (!pKvsWebrtcConfig->talkbackEnabled || !IS_VALID_MUTEX_VALUE(talkback.lock)) {
+    return;
+  }
+
+  MUTEX_LOCK(talkback.lock);
+  for (auto&& value : talkback.sources) {
+    sourceStats.push_back({value.first, value.second->jitter, value.second->targetDelay, value.second->gain, nullptr, 0});
+  }
+  MUTEX_UNLOCK(talkback.lock);
+
+  // ログを出力
+  mixedBlocks = ATOMIC_EXCHANGE(&talkback.mixedBlocks, 0);
+  DLOGP("talkback: sources: %zu, frames: %zu, underruns: %zu, talkspurts: %zu, silent: %zu, concealed: %zu, dropped: %zu",
+        sourceStats.size(),
+        ATOMIC_EXCHANGE(&talkback.frameCount, 0),
+        ATOMIC_EXCHANGE(&talkback.underrunCount, 0),
+        ATOMIC_EXCHANGE(&talkback.talkspurtCount, 0),
+        ATOMIC_EXCHANGE(&talkback.silentCount, 0),
+        ATOMIC_EXCHANGE(&talkback.concealedCount, 0),
+        ATOMIC_EXCHANGE(&talkback.droppedCount, 0));
+  DLOGP("talkback mixer: blocks: %zu, sources/block: %.2f, mix time: %.2f us/block",
+        mixedBlocks,
+        mixedBlocks > 0 ? static_cast<DOUBLE>(ATOMIC_EXCHANGE(&talkback.mixedSources, 0)) / static_cast<DOUBLE>(mixedBlocks) : 0.0,
+        mixedBlocks > 0 ? static_cast<DOUBLE>(ATOMIC_EXCHANGE(&talkback.mixTime, 0)) / static_cast<DOUBLE>(mixedBlocks) / 10.0 : 0.0);
+
+  // 話者のピア接続を集め、統計はロックの外で取得する (取得中にセッションが解放されないよう解放スレッドを待たせる)
+  MUTEX_LOCK(pKvsWebrtcHost->sessionStatsLock);
+  MUTEX_LOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  for (auto&& stats : sourceStats) {
+    if (auto it = pKvsWebrtcConfig->streamingSessions.find(stats.peerClientId); it != pKvsWebrtcConfig->streamingSessions.end() && it->second) {
+      stats.pPeerConnection = it->second->pPeerConnection;
+    }
+  }
+  MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  for (auto&& stats : sourceStats) {
+    MEMSET(&rtcStats, 0x00, SIZEOF(RtcStats));
+    rtcStats.requestedTypeOfStats = RTC_STATS_TYPE_CANDIDATE_PAIR;
+    if (stats.pPeerConnection && STATUS_SUCCEEDED(rtcPeerConnectionGetMetrics(stats.pPeerConnection, nullptr, &rtcStats))) {
+      stats.oneWayDelay = rtcStats.rtcStatsObject.iceCandidatePairStats.currentRoundTripTime * 1000.0 / 2;
+    }
+  }
+  MUTEX_UNLOCK(pKvsWebrtcHost->sessionStatsLock);
+
+  // 話者ごとのジッタ、目標遅延、ゲイン、片道の伝送遅延
+  for (auto&& stats : sourceStats) {
+    DLOGP("talkback source %s: jitter: %.2f ms, target delay: %.2f ms, gain: %d%%, network one-way: %.2f ms",
+          stats.peerClientId.c_str(),
+          static_cast<DOUBLE>(stats.jitter) / HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+          static_cast<DOUBLE>(stats.targetDelay) / HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+          stats.gain * 100 / TALKBACK_GAIN_UNITY,
+          stats.oneWayDelay);
+  }
+  logLatencyStats("talkbackPlayout", talkback.playoutDelay);
+}
+
+// ============================================================================
+// データチャネル
+// ============================================================================
+
+/**
+ * @brief データチャネルの設定を初期化し、組み込みのコマンドのハンドラーを登録する
+ */
+STATUS initDataChannelSettings(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto retStatus = STATUS_SUCCESS;
+  PCHAR pMaxRetransmits = getChannelEnv(pKvsWebrtcConfig, DATA_CHANNEL_MAX_RETRANSMITS_ENV_VAR);
+  UINT32 maxRetransmits;
+
+  // 有効でない場合はビューアーが作成したデータチャネルも受け入れない
+  pKvsWebrtcConfig->dataChannelEnabled = getChannelEnvBool(pKvsWebrtcConfig, DATA_CHANNEL_ENV_VAR, TRUE);
+  CHK(pKvsWebrtcConfig->dataChannelEnabled, retStatus);
+
+  // マスターが作成するデータチャネルのラベル
+  if (auto pLabel = getChannelEnv(pKvsWebrtcConfig, DATA_CHANNEL_LABEL_ENV_VAR); pLabel) {
+    CHK_ERR(STRLEN(pLabel) <= MAX_DATA_CHANNEL_NAME_LEN, STATUS_INVALID_ARG, "環境変数「%s」の値が長すぎます。", DATA_CHANNEL_LABEL_ENV_VAR);
+    pKvsWebrtcConfig->dataChannelLabel = pLabel;
+  }
+
+  // 再送回数の上限 (指定した場合は順序を保証しない)
+  pKvsWebrtcConfig->dataChannelMaxRetransmits = -1;
+  if (pMaxRetransmits) {
+    CHK_ERR(STATUS_SUCCEEDED(STRTOUI32(pMaxRetransmits, NULL, 10, &maxRetransmits)) && maxRetransmits <= MAX_UINT16,
+            STATUS_INVALID_ARG,
+            "環境変数「%s」の値「%s」は不正です。",
+            DATA_CHANNEL_MAX_RETRANSMITS_ENV_VAR,
+            pMaxRetransmits);
+    pKvsWebrtcConfig->dataChannelMaxRetransmits = static_cast<INT32>(maxRetransmits);
+  }
+
+  // 疎通確認のRTT
+  pKvsWebrtcConfig->lastDataChannelPingTime = GETTIME();
+  CHK_STATUS(initLatencyStats(pKvsWebrtcConfig->dataChannelRtt, LATENCY_STATS_CAPACITY));
+
+  // 組み込みのコマンド
+  CHK_STATUS(registerDataChannelHandler(pKvsWebrtcConfig, DATA_CHANNEL_COMMAND_PING, onDataChannelPing, reinterpret_cast<UINT64>(pKvsWebrtcConfig)));
+  CHK_STATUS(registerDataChannelHandler(pKvsWebrtcConfig,
+                                        DATA_CHANNEL_COMMAND_TALKBACK_GAIN,
+                                        onDataChannelTalkbackGain,
+                                        reinterpret_cast<UINT64>(pKvsWebrtcConfig)));
+  CHK_STATUS(registerDataChannelHandler(pKvsWebrtcConfig,
+                                        DATA_CHANNEL_COMMAND_VIDEO_CONSTRAINTS,
+                                        onDataChannelVideoConstraints,
+                                        reinterpret_cast<UINT64>(pKvsWebrtcConfig)));
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief データチャネルのコマンドのハンドラーを登録する (シグナリングの開始前に呼び出す)
+ *
+ * ハンドラーはSDKの受信スレッドから呼び出されるため、ブロックする処理は行わない。
+ * 登録後はロックを取らずに参照するため、セッションの作成が始まった後は登録しない。
+ */
+STATUS registerDataChannelHandler(PKvsWebrtcConfig pKvsWebrtcConfig, UINT16 command, DataChannelHandler handler, UINT64 customData)
+{
+  auto retStatus = STATUS_SUCCESS;
+
+  // NULLチェック
+  CHK(pKvsWebrtcConfig && handler, STATUS_NULL_ARG);
+  CHK_ERR(pKvsWebrtcConfig->streamingSessions.empty(), STATUS_INVALID_OPERATION, "セッションの作成後にハンドラーは登録できません。");
+
+  // ハンドラーを登録 (同じコマンドは上書きする)
+  pKvsWebrtcConfig->dataChannelHandlers[command] = {handler, customData};
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief ストリーミングセッションでデータチャネルを受け入れる (マスター側のデータチャネルも作成する)
+ *
+ * マスターはアンサー側のため、作成したデータチャネルはオファーにデータチャネルが含まれる場合のみ開く。
+ */
+STATUS initStreamingSessionDataChannels(PKvsWebrtcStreamingSession pStreamingSession)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto pKvsWebrtcConfig = pStreamingSession->pKvsWebrtcConfig;
+  PRtcDataChannel pRtcDataChannel = nullptr;
+  PKvsWebrtcDataChannel pDataChannel = nullptr;
+  RtcDataChannelInit dataChannelInit;
+
+  // 保護用ミューテックス
+  pStreamingSession->dataChannelLock = MUTEX_CREATE(FALSE);
+
+  // 有効でない場合は受け入れない
+  CHK(pKvsWebrtcConfig->dataChannelEnabled, retStatus);
+
+  // ビューアーが作成したデータチャネルを受け入れる
+  CHK_STATUS(peerConnectionOnDataChannel(pStreamingSession->pPeerConnection, reinterpret_cast<UINT64>(pStreamingSession), onDataChannel));
+
+  // ラベルが指定されている場合はマスター側のデータチャネルを作成
+  CHK(!pKvsWebrtcConfig->dataChannelLabel.empty(), retStatus);
+  MEMSET(&dataChannelInit, 0x00, SIZEOF(RtcDataChannelInit));
+  dataChannelInit.ordered = pKvsWebrtcConfig->dataChannelMaxRetransmits < 0;
+  dataChannelInit.maxPacketLifeTime.isNull = TRUE;
+  dataChannelInit.maxRetransmits.isNull = pKvsWebrtcConfig->dataChannelMaxRetransmits < 0;
+  dataChannelInit.maxRetransmits.value = static_cast<UINT16>(MAX(pKvsWebrtcConfig->dataChannelMaxRetransmits, 0));
+  CHK_STATUS(createDataChannel(pStreamingSession->pPeerConnection,
+                               const_cast<PCHAR>(pKvsWebrtcConfig->dataChannelLabel.c_str()),
+                               &dataChannelInit,
+                               &pRtcDataChannel));
+  CHK_STATUS(addDataChannel(pStreamingSession, pRtcDataChannel, TRUE, FALSE, &pDataChannel));
+  CHK_STATUS(dataChannelOnOpen(pRtcDataChannel, reinterpret_cast<UINT64>(pDataChannel), onDataChannelOpen));
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief ビューアーが作成したデータチャネルを受け入れるコールバック
+ */
+VOID onDataChannel(UINT64 customData, PRtcDataChannel pRtcDataChannel)
+{
+  auto pStreamingSession = reinterpret_cast<PKvsWebrtcStreamingSession>(customData);
+  PKvsWebrtcDataChannel pDataChannel = nullptr;
+
+  // NULLチェック
+  if (!pStreamingSession || !pRtcDataChannel) {
+    return;
+  }
+
+  // ビューアーが作成したデータチャネルは通知された時点で開いている
+  DLOGI("Data channel %s opened by %s", pRtcDataChannel->name, pStreamingSession->peerClientId);
+  CHK_LOG_ERR(addDataChannel(pStreamingSession, pRtcDataChannel, FALSE, TRUE, &pDataChannel));
+}
+
+/**
+ * @brief データチャネルをストリーミングセッションに追加する
+ *
+ * データチャネルはピア接続が解放されるまでコールバックから参照されるため、ピア接続の解放後に解放する。
+ */
+STATUS addDataChannel(PKvsWebrtcStreamingSession pStreamingSession, PRtcDataChannel pRtcDataChannel, BOOL isLocal, BOOL isOpen, PKvsWebrtcDataChannel* ppDataChannel)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto pDataChannel = std::make_unique<KvsWebrtcDataChannel>();
+
+  // データチャネルを初期化
+  pDataChannel->pStreamingSession = pStreamingSession;
+  pDataChannel->pRtcDataChannel = pRtcDataChannel;
+  pDataChannel->label = pRtcDataChannel->name;
+  pDataChannel->isLocal = isLocal;
+  ATOMIC_STORE_BOOL(&pDataChannel->isOpen, isOpen);
+  *ppDataChannel = pDataChannel.get();
+
+  // メッセージを受信した際のコールバックを設定
+  CHK_STATUS(dataChannelOnMessage(pRtcDataChannel, reinterpret_cast<UINT64>(pDataChannel.get()), onDataChannelMessage));
+
+  // ストリーミングセッションに追加
+  MUTEX_LOCK(pStreamingSession->dataChannelLock);
+  pStreamingSession->dataChannels.push_back(std::move(pDataChannel));
+  MUTEX_UNLOCK(pStreamingSession->dataChannelLock);
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief マスターが作成したデータチャネルが開いた際のコールバック
+ */
+VOID onDataChannelOpen(UINT64 customData, PRtcDataChannel pRtcDataChannel)
+{
+  auto pDataChannel = reinterpret_cast<PKvsWebrtcDataChannel>(customData);
+
+  // NULLチェック
+  if (!pDataChannel) {
+    return;
+  }
+
+  // 送信できるようにする
+  DLOGI("Data channel %s opened for %s", pDataChannel->label.c_str(), pDataChannel->pStreamingSession->peerClientId);
+  ATOMIC_STORE_BOOL(&pDataChannel->isOpen, TRUE);
+}
+
+/**
+ * @brief データチャネルのメッセージを受信した際のコールバック
+ *
+ * バイナリのメッセージの先頭16バイトのヘッダーからコマンドを取り出し、登録されたハンドラーを呼び出す。
+ * テキストのメッセージ、ヘッダーより短いメッセージ、バージョンが異なるメッセージは破棄する。
+ */
+VOID onDataChannelMessage(UINT64 customData, PRtcDataChannel pRtcDataChannel, BOOL isBinary, PBYTE pMessage, UINT32 messageLen)
+{
+  auto pDataChannel = reinterpret_cast<PKvsWebrtcDataChannel>(customData);
+  UINT64 startTime = GETTIME();
+  DataChannelMessage message;
+
+  UNUSED_PARAM(pRtcDataChannel);
+
+  // NULLチェック
+  if (!pDataChannel) {
+    return;
+  }
+  auto& handlers = pDataChannel->pStreamingSession->pKvsWebrtcConfig->dataChannelHandlers;
+
+  // 受信量
+  ATOMIC_INCREMENT(&pDataChannel->receivedMessages);
+  ATOMIC_ADD(&pDataChannel->receivedBytes, messageLen);
+
+  // ヘッダーを読み出す
+  if (!isBinary || !pMessage || messageLen < DATA_CHANNEL_HEADER_SIZE) {
+    ATOMIC_INCREMENT(&pDataChannel->malformedMessages);
+    return;
+  }
+  readDataChannelHeader(pMessage, message.header);
+  if (message.header.version != DATA_CHANNEL_MESSAGE_VERSION) {
+    ATOMIC_INCREMENT(&pDataChannel->malformedMessages);
+    return;
+  }
+
+  // ハンドラーを取得
+  auto handler = handlers.find(message.header.command);
+  if (handler == handlers.end()) {
+    ATOMIC_INCREMENT(&pDataChannel->unhandledMessages);
+    return;
+  }
+
+  // ハンドラーを呼び出す
+  message.pDataChannel = pDataChannel;
+  message.pPayload = pMessage + DATA_CHANNEL_HEADER_SIZE;
+  message.payloadLen = messageLen - DATA_CHANNEL_HEADER_SIZE;
+  CHK_LOG_ERR(handler->second.handler(handler->second.customData, message));
+
+  // ハンドラーの処理時間
+  MUTEX_LOCK(pDataChannel->pStreamingSession->dataChannelLock);
+  pDataChannel->handledMessages++;
+  pDataChannel->handlerTime += GETTIME() - startTime;
+  MUTEX_UNLOCK(pDataChannel->pStreamingSession->dataChannelLock);
+}
+
+/**
+ * @brief データチャネルのメッセージのヘッダーを書き込む (リトルエンディアン)
+ */
+VOID writeDataChannelHeader(PBYTE pBuffer, const DataChannelMessageHeader& header)
+{
+  pBuffer[0] = header.version;
+  pBuffer[1] = header.flags;
+  for (UINT32 i = 0; i < 2; i++) {
+    pBuffer[2 + i] = static_cast<BYTE>(header.command >> (8 * i));
+  }
+  for (UINT32 i = 0; i < 4; i++) {
+    pBuffer[4 + i] = static_cast<BYTE>(header.sequence >> (8 * i));
+  }
+  for (UINT32 i = 0; i < 8; i++) {
+    pBuffer[8 + i] = static_cast<BYTE>(header.timestamp >> (8 * i));
+  }
+}
+
+/**
+ * @brief データチャネルのメッセージのヘッダーを読み出す (リトルエンディアン)
+ */
+VOID readDataChannelHeader(const BYTE* pBuffer, DataChannelMessageHeader& header)
+{
+  header.version = pBuffer[0];
+  header.flags = pBuffer[1];
+  header.command = 0;
+  for (UINT32 i = 0; i < 2; i++) {
+    header.command |= static_cast<UINT16>(pBuffer[2 + i] << (8 * i));
+  }
+  header.sequence = 0;
+  for (UINT32 i = 0; i < 4; i++) {
+    header.sequence |= static_cast<UINT32>(pBuffer[4 + i]) << (8 * i);
+  }
+  header.timestamp = 0;
+  for (UINT32 i = 0; i < 8; i++) {
+    header.timestamp |= static_cast<UINT64>(pBuffer[8 + i]) << (8 * i);
+  }
+}
+
+/**
+ * @brief データチャネルでメッセージを送信する
+ *
+ * ヘッダーとペイロードはホストのバッファプールのバッファにまとめてから送信する。
+ */
+STATUS sendDataChannelMessage(PKvsWebrtcDataChannel pDataChannel, const DataChannelMessageHeader& header, const BYTE* pPayload, UINT32 payloadLen)
+{
+  auto retStatus = STATUS_SUCCESS;
+  PBYTE pBuffer = nullptr;
+  BufferPool* pPool = nullptr;
+
+  // NULLチェック
+  CHK(pDataChannel && (pPayload || payloadLen == 0), STATUS_NULL_ARG);
+  CHK(ATOMIC_LOAD_BOOL(&pDataChannel->isOpen), STATUS_INVALID_OPERATION);
+  CHK_ERR(payloadLen <= DATA_CHANNEL_MAX_MESSAGE_SIZE - DATA_CHANNEL_HEADER_SIZE, STATUS_INVALID_ARG, "ペイロードが大きすぎます。");
+
+  // バッファにヘッダーとペイロードを書き込む
+  pPool = &pDataChannel->pStreamingSession->pKvsWebrtcConfig->pKvsWebrtcHost->dataChannelMessagePool;
+  CHK(pBuffer = acquireBuffer(*pPool), STATUS_NOT_ENOUGH_MEMORY);
+  writeDataChannelHeader(pBuffer, header);
+  if (payloadLen > 0) {
+    MEMCPY(pBuffer + DATA_CHANNEL_HEADER_SIZE, pPayload, payloadLen);
+  }
+
+  // 送信
+  CHK_STATUS(dataChannelSend(pDataChannel->pRtcDataChannel, TRUE, pBuffer, DATA_CHANNEL_HEADER_SIZE + payloadLen));
+  ATOMIC_INCREMENT(&pDataChannel->sentMessages);
+  ATOMIC_ADD(&pDataChannel->sentBytes, DATA_CHANNEL_HEADER_SIZE + payloadLen);
+
+CleanUp:
+
+  if (STATUS_FAILED(retStatus) && pDataChannel) {
+    ATOMIC_INCREMENT(&pDataChannel->sendErrors);
+  }
+
+  if (pBuffer) {
+    releaseBuffer(*pPool, pBuffer);
+  }
+
+  return retStatus;
+}
+
+/**
+ * @brief データチャネルで新しいメッセージを送信する
+ */
+STATUS postDataChannelMessage(PKvsWebrtcDataChannel pDataChannel, UINT16 command, const BYTE* pPayload, UINT32 payloadLen)
+{
+  auto retStatus = STATUS_SUCCESS;
+  DataChannelMessageHeader header;
+
+  // NULLチェック
+  CHK(pDataChannel, STATUS_NULL_ARG);
+
+  // ヘッダー
+  header.version = DATA_CHANNEL_MESSAGE_VERSION;
+  header.flags = 0;
+  header.command = command;
+  header.sequence = static_cast<UINT32>(ATOMIC_INCREMENT(&pDataChannel->sequence));
+  header.timestamp = GETTIME();
+
+  // 送信
+  CHK_STATUS(sendDataChannelMessage(pDataChannel, header, pPayload, payloadLen));
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief 受信したメッセージに応答する (シーケンス番号と送信時刻は要求の値を返す)
+ */
+STATUS replyDataChannelMessage(DataChannelMessage& message, const BYTE* pPayload, UINT32 payloadLen)
+{
+  auto header = message.header;
+
+  header.flags |= DATA_CHANNEL_FLAG_RESPONSE;
+
+  return sendDataChannelMessage(message.pDataChannel, header, pPayload, payloadLen);
+}
+
+/**
+ * @brief 疎通確認のハンドラー
+ *
+ * 要求の場合はペイロードごと応答し、自身が送信した要求への応答の場合はRTTを記録する。
+ */
+STATUS onDataChannelPing(UINT64 customData, DataChannelMessage& message)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto pKvsWebrtcConfig = reinterpret_cast<PKvsWebrtcConfig>(customData);
+  auto pDataChannel = message.pDataChannel;
+  UINT64 now = GETTIME(), rtt;
+
+  // 要求の場合は応答
+  if ((message.header.flags & DATA_CHANNEL_FLAG_RESPONSE) == 0) {
+    CHK_STATUS(replyDataChannelMessage(message, message.pPayload, message.payloadLen));
+    CHK(FALSE, retStatus);
+  }
+
+  // RTTを記録 (応答の送信時刻は自身が送信した時刻)
+  CHK(message.header.timestamp <= now, STATUS_INVALID_ARG);
+  rtt = now - message.header.timestamp;
+  addLatencySample(pKvsWebrtcConfig->dataChannelRtt, rtt);
+  MUTEX_LOCK(pDataChannel->pStreamingSession->dataChannelLock);
+  pDataChannel->rttSum += rtt;
+  pDataChannel->rttCount++;
+  pDataChannel->rttMax = MAX(pDataChannel->rttMax, rtt);
+  MUTEX_UNLOCK(pDataChannel->pStreamingSession->dataChannelLock);
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief トークバックのゲインの設定のハンドラー (送信元のビューアーの音声のゲインを設定する)
+ *
+ * 応答のペイロードは設定結果のステータスコード (UINT32、リトルエンディアン)。
+ */
+STATUS onDataChannelTalkbackGain(UINT64 customData, DataChannelMessage& message)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto pKvsWebrtcConfig = reinterpret_cast<PKvsWebrtcConfig>(customData);
+  STATUS gainStatus;
+  BYTE result[SIZEOF(STATUS)];
+  UINT16 gain;
+
+  // ペイロード (パーセント、リトルエンディアン)
+  CHK(message.payloadLen >= SIZEOF(UINT16), STATUS_INVALID_ARG);
+  gain = static_cast<UINT16>(message.pPayload[0] | (message.pPayload[1] << 8));
+
+  // ゲインを設定して結果を応答
+  gainStatus = setTalkbackSourceGain(pKvsWebrtcConfig, message.pDataChannel->pStreamingSession->peerClientId, gain);
+  for (UINT32 i = 0; i < SIZEOF(result); i++) {
+    result[i] = static_cast<BYTE>(gainStatus >> (8 * i));
+  }
+  CHK_STATUS(replyDataChannelMessage(message, result, SIZEOF(result)));
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief 映像の最大の解像度とフレームレートの通知のハンドラー
+ *
+ * サムネイル表示のビューアーなどが必要な大きさを通知し、全ビューアーが小さい場合はエンコードする解像度を下げる。
+ * 反映はシグナリングのサービスループで行う。
+ */
+STATUS onDataChannelVideoConstraints(UINT64 customData, DataChannelMessage& message)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto pStreamingSession = message.pDataChannel->pStreamingSession;
+  BYTE result[SIZEOF(STATUS)] = {0};
+
+  UNUSED_PARAM(customData);
+
+  // ペイロード (幅、高さ、フレームレート、リトルエンディアン)
+  CHK(message.payloadLen >= 3 * SIZEOF(UINT16), STATUS_INVALID_ARG);
+  ATOMIC_STORE(&pStreamingSession->maxVideoWidth, static_cast<UINT16>(message.pPayload[0] | (message.pPayload[1] << 8)));
+  ATOMIC_STORE(&pStreamingSession->maxVideoHeight, static_cast<UINT16>(message.pPayload[2] | (message.pPayload[3] << 8)));
+  ATOMIC_STORE(&pStreamingSession->maxVideoFramerate, static_cast<UINT16>(message.pPayload[4] | (message.pPayload[5] << 8)));
+  DLOGI("Session %s requested video up to %zux%zu@%zu",
+        pStreamingSession->peerClientId,
+        ATOMIC_LOAD(&pStreamingSession->maxVideoWidth),
+        ATOMIC_LOAD(&pStreamingSession->maxVideoHeight),
+        ATOMIC_LOAD(&pStreamingSession->maxVideoFramerate));
+
+  // 結果を応答 (STATUS_SUCCESS)
+  CHK_STATUS(replyDataChannelMessage(message, result, SIZEOF(result)));
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief 開いている全データチャネルに疎通確認を送信する (設定オブジェクトのロックを保持せずに呼び出す)
+ *
+ * 送信先はロックを保持して集め、送信はロックの外で行う (送信中もファンアウトとオファーの処理を妨げない)。
+ */
+VOID pingDataChannels(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto pKvsWebrtcHost = pKvsWebrtcConfig->pKvsWebrtcHost;
+  std::vector<PKvsWebrtcDataChannel> dataChannels;
+
+  // 有効でない場合は送信しない
+  if (!pKvsWebrtcConfig->dataChannelEnabled) {
+    return;
+  }
+
+  // 送信中にセッション (とデータチャネル) が解放されないよう解放スレッドを待たせる
+  MUTEX_LOCK(pKvsWebrtcHost->sessionStatsLock);
+
+  // 開いているデータチャネルを集める
+  MUTEX_LOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  for (auto&& value : pKvsWebrtcConfig->streamingSessions) {
+    auto pStreamingSession = value.second.get();
+    if (!pStreamingSession || !IS_VALID_MUTEX_VALUE(pStreamingSession->dataChannelLock)) {
+      continue;
+    }
+
+    MUTEX_LOCK(pStreamingSession->dataChannelLock);
+    for (auto&& pDataChannel : pStreamingSession->dataChannels) {
+      if (ATOMIC_LOAD_BOOL(&pDataChannel->isOpen)) {
+        dataChannels.push_back(pDataChannel.get());
+      }
+    }
+    MUTEX_UNLOCK(pStreamingSession->dataChannelLock);
+  }
+  MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+
+  // ロックの外で送信 (送信の失敗はデータチャネルのメトリクスで集計する)
+  for (auto pDataChannel : dataChannels) {
+    postDataChannelMessage(pDataChannel, DATA_CHANNEL_COMMAND_PING, nullptr, 0);
+  }
+
+  MUTEX_UNLOCK(pKvsWebrtcHost->sessionStatsLock);
+}
+
+/**
+ * @brief データチャネルのメトリクスを出力する (設定オブジェクトのロックを保持して呼び出す)
+ */
+VOID logDataChannelStats(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  SIZE_T receivedMessages, receivedBytes, sentMessages, sentBytes, rttCount, handledMessages;
+  UINT64 rttSum, rttMax, handlerTime;
+  DOUBLE interval;
+
+  // 有効でない場合は出力しない
+  if (!pKvsWebrtcConfig->dataChannelEnabled) {
+    return;
+  }
+
+  // 出力間隔 (秒、スループットの計算に使用)
+  interval = static_cast<DOUBLE>(MAX(GETTIME() - pKvsWebrtcConfig->lastMetricsTime, 1ULL)) / HUNDREDS_OF_NANOS_IN_A_SECOND;
+
+  // データチャネルごとの受信量、送信量、破棄したメッセージ数、RTT、ハンドラーの処理時間
+  for (auto&& value : pKvsWebrtcConfig->streamingSessions) {
+    auto pStreamingSession = value.second.get();
+    if (!pStreamingSession || !IS_VALID_MUTEX_VALUE(pStreamingSession->dataChannelLock)) {
+      continue;
+    }
+
+    MUTEX_LOCK(pStreamingSession->dataChannelLock);
+    for (auto&& pDataChannel : pStreamingSession->dataChannels) {
+      receivedMessages = ATOMIC_EXCHANGE(&pDataChannel->receivedMessages, 0);
+      receivedBytes = ATOMIC_EXCHANGE(&pDataChannel->receivedBytes, 0);
+      sentMessages = ATOMIC_EXCHANGE(&pDataChannel->sentMessages, 0);
+      sentBytes = ATOMIC_EXCHANGE(&pDataChannel->sentBytes, 0);
+      rttCount = pDataChannel->rttCount;
+      rttSum = pDataChannel->rttSum;
+      rttMax = pDataChannel->rttMax;
+      handledMessages = pDataChannel->handledMessages;
+      handlerTime = pDataChannel->handlerTime;
+      pDataChannel->rttCount = 0;
+      pDataChannel->rttSum = 0;
+      pDataChannel->rttMax = 0;
+      pDataChannel->handledMessages = 0;
+      pDataChannel->handlerTime = 0;
+      DLOGP("dataChannel %s/%s%s: received: %zu (%.2f kbps), sent: %zu (%.2f kbps), malformed: %zu, unhandled: %zu, sendErrors: %zu",
+            pStreamingSession->peerClientId,
+            pDataChannel->label.c_str(),
+            pDataChannel->isLocal ? " (local)" : "",
+            receivedMessages,
+            static_cast<DOUBLE>(receivedBytes) * 8 / 1000 / interval,
+            sentMessages,
+            static_cast<DOUBLE>(sentBytes) * 8 / 1000 / interval,
+            ATOMIC_EXCHANGE(&pDataChannel->malformedMessages, 0),
+            ATOMIC_EXCHANGE(&pDataChannel->unhandledMessages, 0),
+            ATOMIC_EXCHANGE(&pDataChannel->sendErrors, 0));
+      DLOGP("dataChannel %s/%s: rtt: avg %.2f ms, max %.2f ms (%zu pings), handler: %.2f us/message",
+            pStreamingSession->peerClientId,
+            pDataChannel->label.c_str(),
+            rttCount > 0 ? static_cast<DOUBLE>(rttSum) / rttCount / HUNDREDS_OF_NANOS_IN_A_MILLISECOND : 0.0,
+            static_cast<DOUBLE>(rttMax) / HUNDREDS_OF_NANOS_IN_A_MILLISECOND,
+            rttCount,
+            handledMessages > 0 ? static_cast<DOUBLE>(handlerTime) / handledMessages / 10.0 : 0.0);
+    }
+    MUTEX_UNLOCK(pStreamingSession->dataChannelLock);
+  }
+
+  // 全データチャネルのRTTの分布
+  logLatencyStats("dataChannelRtt", pKvsWebrtcConfig->dataChannelRtt);
+}
+
+// ============================================================================
+// 録画
+// ============================================================================
+
+/**
+ * @brief 録画の設定を初期化する
+ */
+STATUS initRecorder(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto& recorder = pKvsWebrtcConfig->recorder;
+  PCHAR pDirectory = getChannelEnv(pKvsWebrtcConfig, RECORD_DIR_ENV_VAR);
+  PCHAR pFormat = getChannelEnv(pKvsWebrtcConfig, RECORD_FORMAT_ENV_VAR);
+
+  // パイプライン
+  recorder.pipeline = nullptr;
+  recorder.videoSrc = nullptr;
+  recorder.audioSrc = nullptr;
+
+  // 出力先が設定されていない場合は録画しない
+  pKvsWebrtcConfig->recordingEnabled = pDirectory != nullptr;
+  CHK(pKvsWebrtcConfig->recordingEnabled, retStatus);
+
+  // 出力形式 (MKVは書き込み中に終了してもそれまでのデータを再生できる)
+  if (!pFormat || STRCMPI(pFormat, "mp4") == 0) {
+    recorder.extension = "mp4";
+    recorder.muxer = "mp4mux";
+  } else if (STRCMPI(pFormat, "mkv") == 0) {
+    recorder.extension = "mkv";
+    recorder.muxer = "matroskamux";
+  } else {
+    CHK_ERR(FALSE, STATUS_INVALID_ARG, "環境変数「%s」の値「%s」は不正です。", RECORD_FORMAT_ENV_VAR, pFormat);
+  }
+
+  // 出力先とセグメントの長さ、ディスク使用量と書き込み待ちの上限
+  recorder.directory = pDirectory;
+  recorder.segmentDuration =
+    MAX(getChannelEnvUint32(pKvsWebrtcConfig, RECORD_SEGMENT_DURATION_ENV_VAR, DEFAULT_RECORD_SEGMENT_DURATION_SECONDS), 1U) * HUNDREDS_OF_NANOS_IN_A_SECOND;
+  recorder.maxSegments = getChannelEnvUint32(pKvsWebrtcConfig, RECORD_MAX_SEGMENTS_ENV_VAR, DEFAULT_RECORD_MAX_SEGMENTS);
+  recorder.maxBytes = static_cast<UINT64>(getChannelEnvUint32(pKvsWebrtcConfig, RECORD_MAX_SIZE_ENV_VAR, DEFAULT_RECORD_MAX_SIZE_MB)) * 1024 * 1024;
+  recorder.maxQueueBytes = static_cast<UINT64>(MAX(getChannelEnvUint32(pKvsWebrtcConfig, RECORD_QUEUE_SIZE_ENV_VAR, DEFAULT_RECORD_QUEUE_SIZE_KB), 1U)) * 1024;
+
+  // 入力の状態 (最初のキーフレームから録画する)
+  recorder.started = FALSE;
+  recorder.waitingForKeyframe = TRUE;
+  recorder.baseTimestamp = 0;
+  recorder.hasAudioCaps = FALSE;
+  recorder.isEos = FALSE;
+
+  // 同期オブジェクト
+  recorder.lock = MUTEX_CREATE(FALSE);
+  recorder.cvar = CVAR_CREATE();
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief 録画用パイプラインを開始する
+ *
+ * 受信用パイプライン (またはフレームバス) のエンコード済みフレームをappsrcに入力し、
+ * splitmuxsinkでキーフレームの位置で分割したセグメントに書き込む。ディスクへの書き込みは
+ * 録画用パイプラインのストリーミングスレッドで行うため、書き込みが滞っても配信は待たされない。
+ */
+STATUS startRecorder(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto& recorder = pKvsWebrtcConfig->recorder;
+  GError* error = nullptr;
+  GstBus* bus = nullptr;
+  GstElement* splitmuxsink = nullptr;
+  std::string description;
+
+  // NULLチェック
+  CHK(pKvsWebrtcConfig, STATUS_NULL_ARG);
+
+  // 有効でない場合は何もしない
+  CHK(pKvsWebrtcConfig->recordingEnabled, retStatus);
+
+  // 出力先を作成して前回までのセグメントを取得 (ディスク使用量の上限に含める)
+  recorder.prefix = std::string(pKvsWebrtcConfig->channelInfo.pChannelName) + "-";
+  CHK_ERR(mkdir(recorder.directory.c_str(), 0755) == 0 || errno == EEXIST,
+          STATUS_INVALID_ARG,
+          "録画の出力先「%s」を作成できません。", recorder.directory.c_str());
+  CHK_STATUS(scanRecordingSegments(recorder));
+
+  // 録画用パイプラインの定義を作成
+  description =
+    "splitmuxsink "
+    "  name=record-mux "
+    "  muxer-factory=" + recorder.muxer + " "
+    "  max-size-time=" + std::to_string(recorder.segmentDuration * DEFAULT_TIME_UNIT_IN_NANOS) + " "
+    "  send-keyframe-requests=false "
+    "appsrc "
+    "  name=record-video "
+    "  is-live=true "
+    "  format=time "
+    "  do-timestamp=false "
+    "  max-bytes=0 "
+    "  caps=\"video/x-h264,stream-format=byte-stream,alignment=au\" ! "
+    "h264parse ! "
+    "record-mux.video "
+    "appsrc "
+    "  name=record-audio "
+    "  is-live=true "
+    "  format=time "
+    "  do-timestamp=false "
+    "  max-bytes=0 ! "
+    "opusparse ! "
+    "record-mux.audio_0";
+  DLOGD("record pipeline: %s", description.c_str());
+
+  // 録画用パイプラインを作成
+  recorder.pipeline = gst_parse_launch(description.c_str(), &error);
+
+  // エラーチェック
+  if (error) {
+    DLOGE("Failed to create record pipeline: %s", error->message);
+    g_error_free(error);
+    CHK(FALSE, STATUS_INTERNAL_ERROR);
+  }
+
+  // スレッドごとのCPU使用率の出力用に名前を設定
+  gst_object_set_name(GST_OBJECT(recorder.pipeline), (std::string(pKvsWebrtcConfig->channelInfo.pChannelName) + "-record").c_str());
+
+  // appsrcを取得
+  CHK_ERR((recorder.videoSrc = gst_bin_get_by_name(GST_BIN(recorder.pipeline), "record-video")) &&
+            (recorder.audioSrc = gst_bin_get_by_name(GST_BIN(recorder.pipeline), "record-audio")),
+          STATUS_INTERNAL_ERROR,
+          "録画のappsrcが見つかりません。");
+
+  // セグメントのファイル名
+  CHK(splitmuxsink = gst_bin_get_by_name(GST_BIN(recorder.pipeline), "record-mux"), STATUS_INTERNAL_ERROR);
+  g_signal_connect(splitmuxsink, "format-location", G_CALLBACK(onRecorderFormatLocation), &recorder);
+  gst_object_unref(splitmuxsink);
+
+  // パイプラインのバスメッセージを処理 (セグメントの完了とEOS)
+  bus = gst_element_get_bus(recorder.pipeline);
+  gst_bus_set_sync_handler(bus, onRecorderBusSyncMessage, pKvsWebrtcConfig, nullptr);
+  gst_object_unref(bus);
+
+  // パイプラインを開始
+  CHK_ERR(gst_element_set_state(recorder.pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE,
+          STATUS_INTERNAL_ERROR,
+          "録画用パイプラインを開始できません。");
+  DLOGI("Recording to %s: segment: %" PRIu64 " s, max segments: %u, max size: %" PRIu64 " MB",
+        recorder.directory.c_str(),
+        recorder.segmentDuration / HUNDREDS_OF_NANOS_IN_A_SECOND,
+        recorder.maxSegments,
+        recorder.maxBytes / 1024 / 1024);
+
+CleanUp:
+
+  // エラー時はパイプラインを解放 (録画しない)
+  if (STATUS_FAILED(retStatus) && pKvsWebrtcConfig) {
+    if (recorder.videoSrc) {
+      gst_object_unref(recorder.videoSrc);
+      recorder.videoSrc = nullptr;
+    }
+    if (recorder.audioSrc) {
+      gst_object_unref(recorder.audioSrc);
+      recorder.audioSrc = nullptr;
+    }
+    if (recorder.pipeline) {
+      gst_element_set_state(recorder.pipeline, GST_STATE_NULL);
+      gst_object_unref(recorder.pipeline);
+      recorder.pipeline = nullptr;
+    }
+  }
+
+  return retStatus;
+}
+
+/**
+ * @brief 録画を終了する (最後のセグメントの書き込みを待つ)
+ *
+ * フレームの入力 (受信用パイプラインとフレームバス) を停止してから呼び出すこと。
+ */
+STATUS freeRecorder(Recorder& recorder)
+{
+  auto retStatus = STATUS_SUCCESS;
+  UINT64 deadline = GETTIME() + RECORD_EOS_TIMEOUT, now;
+
+  // 初期化されていない場合は何もしない
+  CHK(IS_VALID_MUTEX_VALUE(recorder.lock), retStatus);
+
+  // EOSを入力して最後のセグメントを完成させる (MP4はEOSまでファイルが完成しない)
+  if (recorder.pipeline) {
+    gst_app_src_end_of_stream(GST_APP_SRC(recorder.videoSrc));
+    gst_app_src_end_of_stream(GST_APP_SRC(recorder.audioSrc));
+    MUTEX_LOCK(recorder.lock);
+    while (!recorder.isEos && (now = GETTIME()) < deadline) {
+      CVAR_WAIT(recorder.cvar, recorder.lock, deadline - now);
+    }
+    if (!recorder.isEos) {
+      DLOGW("Timed out waiting for the last recording segment");
+    }
+    MUTEX_UNLOCK(recorder.lock);
+  }
+
+  // 録画用パイプラインを停止
+  if (recorder.videoSrc) {
+    gst_object_unref(recorder.videoSrc);
+    recorder.videoSrc = nullptr;
+  }
+  if (recorder.audioSrc) {
+    gst_object_unref(recorder.audioSrc);
+    recorder.audioSrc = nullptr;
+  }
+  if (recorder.pipeline) {
+    gst_element_set_state(recorder.pipeline, GST_STATE_NULL);
+    gst_object_unref(recorder.pipeline);
+    recorder.pipeline = nullptr;
+  }
+
+  // 同期オブジェクトを解放
+  if (IS_VALID_CVAR_VALUE(recorder.cvar)) {
+    CVAR_FREE(recorder.cvar);
+  }
+  MUTEX_FREE(recorder.lock);
+  recorder.lock = INVALID_MUTEX_VALUE;
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief エンコード済みフレームを録画用パイプラインに入力する
+ *
+ * 録画は最初のキーフレームから開始し、タイムスタンプはそのフレームからの経過時間にする。
+ * 書き込み待ちが上限を超えた場合はフレームを破棄し、映像は次のキーフレームから再開する。
+ * GStreamerのバッファはメモリを共有して入力し、フレームバスから読み出したフレームはコピーする。
+ * 音声のキャップスはappsinkのサンプルのキャップス (フレームバスの場合は固定のキャップス) を最初の入力前に設定する。
+ */
+VOID recordFrame(PKvsWebrtcConfig pKvsWebrtcConfig, Frame& frame, GstBuffer* buffer, GstCaps* caps)
+{
+  auto& recorder = pKvsWebrtcConfig->recorder;
+  auto isVideo = frame.trackId == DEFAULT_VIDEO_TRACK_ID;
+  GstBuffer* recordBuffer = nullptr;
+  GstCaps* audioCaps;
+  GstClockTime pts;
+  UINT64 queueBytes;
+
+  // 録画していない場合は何もしない
+  if (!recorder.pipeline) {
+    return;
+  }
+
+  MUTEX_LOCK(recorder.lock);
+
+  // 書き込み待ちが上限を超えた場合は破棄
+  queueBytes = gst_app_src_get_current_level_bytes(GST_APP_SRC(recorder.videoSrc)) +
+               gst_app_src_get_current_level_bytes(GST_APP_SRC(recorder.audioSrc));
+  if (queueBytes + frame.size > recorder.maxQueueBytes) {
+    recorder.waitingForKeyframe = TRUE;
+    MUTEX_UNLOCK(recorder.lock);
+    ATOMIC_INCREMENT(&recorder.droppedFrames);
+    return;
+  }
+
+  // キーフレームを待っている間は映像を破棄
+  if (isVideo && recorder.waitingForKeyframe) {
+    if (!(frame.flags & FRAME_FLAG_KEY_FRAME)) {
+      MUTEX_UNLOCK(recorder.lock);
+      ATOMIC_INCREMENT(&recorder.droppedFrames);
+      return;
+    }
+    recorder.waitingForKeyframe = FALSE;
+    if (!recorder.started) {
+      recorder.started = TRUE;
+      recorder.baseTimestamp = frame.presentationTs;
+    }
+  }
+
+  // 録画の開始前の音声は破棄
+  if (!recorder.started || frame.presentationTs < recorder.baseTimestamp) {
+    MUTEX_UNLOCK(recorder.lock);
+    return;
+  }
+  pts = (frame.presentationTs - recorder.baseTimestamp) * DEFAULT_TIME_UNIT_IN_NANOS;
+
+  // 最初の音声の入力前にキャップスを設定
+  if (!isVideo && !recorder.hasAudioCaps) {
+    if (caps) {
+      gst_app_src_set_caps(GST_APP_SRC(recorder.audioSrc), caps);
+    } else {
+      audioCaps = gst_caps_from_string(RECORD_FRAME_BUS_AUDIO_CAPS);
+      gst_app_src_set_caps(GST_APP_SRC(recorder.audioSrc), audioCaps);
+      gst_caps_unref(audioCaps);
+    }
+    recorder.hasAudioCaps = TRUE;
+  }
+
+  MUTEX_UNLOCK(recorder.lock);
+
+  // バッファを作成
+  if (buffer) {
+    recordBuffer = gst_buffer_copy_region(buffer, GST_BUFFER_COPY_MEMORY, 0, static_cast<gsize>(-1));
+  } else {
+    recordBuffer = gst_buffer_new_allocate(nullptr, frame.size, nullptr);
+    gst_buffer_fill(recordBuffer, 0, frame.frameData, frame.size);
+  }
+  GST_BUFFER_PTS(recordBuffer) = pts;
+  GST_BUFFER_DTS(recordBuffer) = pts;
+  GST_BUFFER_DURATION(recordBuffer) = frame.duration != 0 ? frame.duration * DEFAULT_TIME_UNIT_IN_NANOS : GST_CLOCK_TIME_NONE;
+  if (isVideo && !(frame.flags & FRAME_FLAG_KEY_FRAME)) {
+    GST_BUFFER_FLAG_SET(recordBuffer, GST_BUFFER_FLAG_DELTA_UNIT);
+  }
+
+  // 録画用パイプラインに入力 (バッファの所有権は移る)
+  if (gst_app_src_push_buffer(GST_APP_SRC(isVideo ? recorder.videoSrc : recorder.audioSrc), recordBuffer) != GST_FLOW_OK) {
+    ATOMIC_INCREMENT(&recorder.pushErrors);
+    return;
+  }
+  ATOMIC_INCREMENT(&recorder.recordedFrames);
+  ATOMIC_ADD(&recorder.recordedBytes, frame.size);
+}
+
+/**
+ * @brief 前回までに録画したセグメントを取得する
+ *
+ * ファイル名はチャネル名と開始時刻 (UTC) で始まるため、名前順が録画した順になる。
+ */
+STATUS scanRecordingSegments(Recorder& recorder)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto suffix = "." + recorder.extension;
+  std::vector<std::string> names;
+  DIR* pDir = nullptr;
+  struct dirent* pEntry;
+
+  // 出力先のチャネルのセグメントを取得
+  CHK_ERR(pDir = opendir(recorder.directory.c_str()), STATUS_INVALID_ARG, "録画の出力先「%s」を開けません。", recorder.directory.c_str());
+  while ((pEntry = readdir(pDir))) {
+    std::string name(pEntry->d_name);
+    if (name.rfind(recorder.prefix, 0) == 0 && name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+      names.push_back(name);
+    }
+  }
+
+  // 古い順に追加 (上限を超えたセグメントは削除する)
+  std::sort(names.begin(), names.end());
+  for (auto&& name : names) {
+    addRecordingSegment(recorder, recorder.directory + "/" + name);
+  }
+
+CleanUp:
+
+  if (pDir) {
+    closedir(pDir);
+  }
+
+  return retStatus;
+}
+
+/**
+ * @brief 書き込みが完了したセグメントを追加し、上限を超えた古いセグメントを削除する
+ *
+ * 録画用パイプラインのスレッド (開始前はメインスレッド) から呼び出す。最新のセグメントは削除しない。
+ */
+VOID addRecordingSegment(Recorder& recorder, const std::string& location)
+{
+  struct stat status;
+  UINT64 size = stat(location.c_str(), &status) == 0 ? static_cast<UINT64>(status.st_size) : 0;
+
+  // セグメントを追加
+  recorder.segments.emplace_back(location, size);
+  ATOMIC_ADD(&recorder.diskBytes, size);
+
+  // セグメント数とディスク使用量の上限を超えた場合は古いセグメントから削除
+  while (recorder.segments.size() > 1 &&
+         ((recorder.maxSegments != 0 && recorder.segments.size() > recorder.maxSegments) ||
+          (recorder.maxBytes != 0 && ATOMIC_LOAD(&recorder.diskBytes) > recorder.maxBytes))) {
+    auto& segment = recorder.segments.front();
+    if (unlink(segment.first.c_str()) == 0 || errno == ENOENT) {
+      ATOMIC_INCREMENT(&recorder.deletedSegments);
+    } else {
+      DLOGW("Failed to delete recording segment %s: %d", segment.first.c_str(), errno);
+      ATOMIC_INCREMENT(&recorder.deleteErrors);
+    }
+    ATOMIC_SUBTRACT(&recorder.diskBytes, segment.second);
+    recorder.segments.pop_front();
+  }
+  ATOMIC_STORE(&recorder.segmentCount, recorder.segments.size());
+}
+
+/**
+ * @brief セグメントのファイル名を作成するコールバック (<チャネル名>-<開始時刻>-<番号>.<拡張子>)
+ */
+gchar* onRecorderFormatLocation(GstElement* splitmuxsink, guint fragmentId, gpointer data)
+{
+  UNUSED_PARAM(splitmuxsink);
+  auto pRecorder = reinterpret_cast<Recorder*>(data);
+  auto now = time(nullptr);
+  struct tm utc;
+  CHAR timestamp[32];
+
+  gmtime_r(&now, &utc);
+  strftime(timestamp, SIZEOF(timestamp), "%Y%m%dT%H%M%SZ", &utc);
+
+  return g_strdup_printf("%s/%s%s-%05u.%s",
+                         pRecorder->directory.c_str(),
+                         pRecorder->prefix.c_str(),
+                         timestamp,
+                         fragmentId,
+                         pRecorder->extension.c_str());
+}
+
+/**
+ * @brief 録画用パイプラインのバスメッセージを処理するコールバック
+ *
+ * セグメントの完了とEOSを処理し、それ以外は共通の処理 (スレッドの登録、エラーのログ) に渡す。
+ */
+GstBusSyncReply onRecorderBusSyncMessage(GstBus* bus, GstMessage* message, gpointer data)
+{
+  auto pKvsWebrtcConfig = reinterpret_cast<PKvsWebrtcConfig>(data);
+  auto& recorder = pKvsWebrtcConfig->recorder;
+  const GstStructure* structure;
+  const gchar* pLocation;
+
+  switch (GST_MESSAGE_TYPE(message)) {
+    case GST_MESSAGE_ELEMENT:
+      // セグメントの書き込みが完了したらディスク使用量の上限を確認
+      structure = gst_message_get_structure(message);
+      if (structure && gst_structure_has_name(structure, "splitmuxsink-fragment-closed") &&
+          (pLocation = gst_structure_get_string(structure, "location"))) {
+        ATOMIC_INCREMENT(&recorder.closedSegments);
+        addRecordingSegment(recorder, pLocation);
+      }
+      return GST_BUS_DROP;
+    case GST_MESSAGE_EOS:
+      // 最後のセグメントの書き込みが完了
+      MUTEX_LOCK(recorder.lock);
+      recorder.isEos = TRUE;
+      CVAR_BROADCAST(recorder.cvar);
+      MUTEX_UNLOCK(recorder.lock);
+      return GST_BUS_DROP;
+    default:
+      return onGstBusSyncMessage(bus, message, data);
+  }
+}
+
+/**
+ * @brief 録画のメトリクスを出力する
+ */
+VOID logRecorderStats(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto& recorder = pKvsWebrtcConfig->recorder;
+
+  // 録画していない場合は出力しない
+  if (!recorder.pipeline) {
+    return;
+  }
+
+  DLOGP("recorder: frames: %zu, bytes: %zu, dropped: %zu, pushErrors: %zu, queued: %" PRIu64 " bytes",
+        ATOMIC_EXCHANGE(&recorder.recordedFrames, 0),
+        ATOMIC_EXCHANGE(&recorder.recordedBytes, 0),
+        ATOMIC_EXCHANGE(&recorder.droppedFrames, 0),
+        ATOMIC_EXCHANGE(&recorder.pushErrors, 0),
+        static_cast<UINT64>(gst_app_src_get_current_level_bytes(GST_APP_SRC(recorder.videoSrc)) +
+                            gst_app_src_get_current_level_bytes(GST_APP_SRC(recorder.audioSrc))));
+  DLOGP("recorder segments: onDisk: %zu (%zu bytes), closed: %zu, deleted: %zu, deleteErrors: %zu",
+        ATOMIC_LOAD(&recorder.segmentCount),
+        ATOMIC_LOAD(&recorder.diskBytes),
+        ATOMIC_EXCHANGE(&recorder.closedSegments, 0),
+        ATOMIC_EXCHANGE(&recorder.deletedSegments, 0),
+        ATOMIC_EXCHANGE(&recorder.deleteErrors, 0));
+}
+
+// ============================================================================
+// 音声の適応制御
+// ============================================================================
+
+/**
+ * @brief Opusエンコーダーの定義を作成する
+ */
+std::string buildAudioEncoderDescription(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto& settings = pKvsWebrtcConfig->audioEncoderSettings;
+
+  // 実行中に設定を変更するため名前を付ける
+  return "opusenc "
+         "  name=audio-encoder" +
+         (settings.bitrate != 0 ? " bitrate=" + std::to_string(settings.bitrate) : std::string()) +
+         " frame-size=" + std::to_string(settings.frameSize) +
+         " inband-fec=" + (settings.inbandFec ? "true" : "false") +
+         " dtx=" + (settings.dtx ? "true" : "false") +
+         " packet-loss-percentage=" + std::to_string(settings.packetLossPercent) + " ! ";
+}
+
+/**
+ * @brief 損失率とRTTからOpusの設定を選択する
+ *
+ * 現在の設定を受け取り、閾値にヒステリシスを持たせて更新する。
+ * 損失がある場合はFECを有効にして想定損失率を伝え、損失が大きい場合はDTXを止めて
+ * 無音からの復帰時の欠落を防ぎ、損失かRTTが大きい場合はフレーム長を伸ばしてパケット数を減らす。
+ * 低遅延プロファイルではフレーム長を変更しない。
+ */
+VOID selectAudioEncoderSettings(PKvsWebrtcConfig pKvsWebrtcConfig, DOUBLE loss, DOUBLE rtt, AudioEncoderSettings& settings)
+{
+  // FEC
+  if (loss >= AUDIO_FEC_ENABLE_LOSS) {
+    settings.inbandFec = TRUE;
+  } else if (loss < AUDIO_FEC_DISABLE_LOSS) {
+    settings.inbandFec = FALSE;
+  }
+
+  // 想定損失率 (FECが無効な場合は0)
+  settings.packetLossPercent = settings.inbandFec ? MIN(static_cast<UINT32>(ceil(loss)), static_cast<UINT32>(AUDIO_MAX_EXPECTED_LOSS)) : 0;
+
+  // DTX
+  if (loss >= AUDIO_HIGH_LOSS) {
+    settings.dtx = FALSE;
+  } else if (loss < AUDIO_HIGH_LOSS_RECOVER) {
+    settings.dtx = TRUE;
+  }
+
+  // フレーム長
+  if (pKvsWebrtcConfig->audioProfile == AUDIO_PROFILE_LOW_LATENCY) {
+    settings.frameSize = OPUS_FRAME_SIZE_LOW_LATENCY;
+  } else if (loss >= AUDIO_HIGH_LOSS || rtt >= AUDIO_HIGH_RTT) {
+    settings.frameSize = OPUS_FRAME_SIZE_LOSSY;
+  } else if (loss < AUDIO_HIGH_LOSS_RECOVER && rtt < AUDIO_HIGH_RTT_RECOVER) {
+    settings.frameSize = OPUS_FRAME_SIZE_DEFAULT;
+  }
+
+  // ビットレート (FECの冗長データの分を確保する、指定がない場合はエンコーダーのデフォルト値のまま)
+  if (pKvsWebrtcConfig->audioBitrate == 0) {
+    settings.bitrate = 0;
+  } else {
+    settings.bitrate = settings.inbandFec ? MAX(pKvsWebrtcConfig->audioBitrate, static_cast<UINT32>(AUDIO_FEC_MIN_BITRATE)) : pKvsWebrtcConfig->audioBitrate;
+  }
+}
+
+/**
+ * @brief 全セッションの音声の損失率とRTTを集計してOpusの設定を変更する
+ *
+ * エンコーダーは全セッションで共有するため、最も条件の悪いビューアーの値に合わせる。
+ * 損失率はビューアーのReceiver Reportの値、RTTは選択中の候補ペアの値を使用する (adaptToSessionStatsで取得する)。
+ * 設定オブジェクトのロックを保持して呼び出すこと。
+ */
+VOID adaptAudioEncoder(PKvsWebrtcConfig pKvsWebrtcConfig, const std::vector<SessionLinkStats>& sessionStats)
+{
+  DOUBLE loss = 0, rtt = 0;
+  BOOL measured = FALSE;
+  AudioEncoderSettings settings;
+  auto& current = pKvsWebrtcConfig->audioEncoderSettings;
+
+  // 接続中のセッションの最大の損失率とRTT
+  for (auto&& stats : sessionStats) {
+    if (stats.hasAudioLoss) {
+      loss = MAX(loss, stats.audioLoss);
+      measured = TRUE;
+    }
+    if (stats.hasRtt) {
+      rtt = MAX(rtt, stats.rtt);
+      measured = TRUE;
+    }
+  }
+
+  // 計測できない場合は現在の設定を維持
+  if (!measured) {
+    return;
+  }
+
+  // 平滑化 (一時的な損失で設定が振動しないようにする)
+  pKvsWebrtcConfig->audioLoss = AUDIO_ADAPT_SMOOTHING * loss + (1.0 - AUDIO_ADAPT_SMOOTHING) * pKvsWebrtcConfig->audioLoss;
+  pKvsWebrtcConfig->audioRtt = AUDIO_ADAPT_SMOOTHING * rtt + (1.0 - AUDIO_ADAPT_SMOOTHING) * pKvsWebrtcConfig->audioRtt;
+
+  // 設定を選択
+  settings = current;
+  selectAudioEncoderSettings(pKvsWebrtcConfig, pKvsWebrtcConfig->audioLoss, pKvsWebrtcConfig->audioRtt, settings);
+
+  // 変更されたプロパティのみ設定 (opusencは次のバッファから新しい設定でエンコードする)
+  if (settings.inbandFec != current.inbandFec) {
+    g_object_set(pKvsWebrtcConfig->audioEncoder, "inband-fec", static_cast<gboolean>(settings.inbandFec), nullptr);
+  }
+  if (settings.packetLossPercent != current.packetLossPercent) {
+    g_object_set(pKvsWebrtcConfig->audioEncoder, "packet-loss-percentage", static_cast<gint>(settings.packetLossPercent), nullptr);
+  }
+  if (settings.dtx != current.dtx) {
+    g_object_set(pKvsWebrtcConfig->audioEncoder, "dtx", static_cast<gboolean>(settings.dtx), nullptr);
+  }
+  if (settings.frameSize != current.frameSize) {
+    g_object_set(pKvsWebrtcConfig->audioEncoder, "frame-size", static_cast<gint>(settings.frameSize), nullptr);
+  }
+  if (settings.bitrate != current.bitrate) {
+    g_object_set(pKvsWebrtcConfig->audioEncoder, "bitrate", static_cast<gint>(settings.bitrate), nullptr);
+  }
+
+  // 変更があった場合はログを出力
+  if (settings.inbandFec != current.inbandFec || settings.packetLossPercent != current.packetLossPercent || settings.dtx != current.dtx ||
+      settings.frameSize != current.frameSize || settings.bitrate != current.bitrate) {
+    DLOGI("Adapted Opus encoder to loss %.2f%%, rtt %.2f ms: fec: %s, packet loss: %u%%, dtx: %s, frame size: %u ms, bitrate: %u",
+          pKvsWebrtcConfig->audioLoss,
+          pKvsWebrtcConfig->audioRtt,
+          settings.inbandFec ? "on" : "off",
+          settings.packetLossPercent,
+          settings.dtx ? "on" : "off",
+          settings.frameSize,
+          settings.bitrate);
+    current = settings;
+    ATOMIC_INCREMENT(&pKvsWebrtcConfig->audioAdaptations);
+  }
+}
+
+/**
+ * @brief 受信用パイプラインに届いた音声のRTPパケットのキャプチャ時刻を記録するプローブ
+ *
+ * 送信用パイプラインはRTPのタイムスタンプをキャプチャ時のランニングタイム (48kHz) にしているため、
+ * 送信用パイプラインの現在のランニングタイムとの差がキャプチャからの経過時間になる。
+ * 受信用パイプラインのPTSとキャプチャ時刻を記録し、appsinkで取り出した際に照合する。
+ */
+GstPadProbeReturn onAudioLatencyProbe(GstPad* pad, GstPadProbeInfo* info, gpointer data)
+{
+  UNUSED_PARAM(pad);
+  auto pKvsWebrtcConfig = static_cast<PKvsWebrtcConfig>(data);
+  auto buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+  GstClock* clock = nullptr;
+  GstClockTime clockTime, baseTime;
+  BYTE header[8];
+  UINT32 rtpTimestamp, rtpNow;
+  UINT64 age;
+
+  // タイムスタンプが無効なバッファとRTPヘッダーのないバッファは無視
+  if (!buffer || !GST_BUFFER_PTS_IS_VALID(buffer) || gst_buffer_extract(buffer, 0, header, SIZEOF(header)) != SIZEOF(header)) {
+    return GST_PAD_PROBE_OK;
+  }
+  rtpTimestamp = (static_cast<UINT32>(header[4]) << 24) | (static_cast<UINT32>(header[5]) << 16) | (static_cast<UINT32>(header[6]) << 8) |
+    static_cast<UINT32>(header[7]);
+
+  // 送信用パイプラインの現在のランニングタイム (受信用パイプラインの解放後に送信用パイプラインを解放する)
+  if (!(clock = gst_element_get_clock(pKvsWebrtcConfig->sendPipeline))) {
+    return GST_PAD_PROBE_OK;
+  }
+  clockTime = gst_clock_get_time(clock);
+  gst_object_unref(clock);
+  baseTime = gst_element_get_base_time(pKvsWebrtcConfig->sendPipeline);
+  if (clockTime < baseTime) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  // キャプチャからの経過時間 (32ビットの周回を考慮して差分を取る、不自然に古い場合は無視)
+  rtpNow = static_cast<UINT32>(gst_util_uint64_scale(clockTime - baseTime, 48000, GST_SECOND));
+  age = gst_util_uint64_scale(static_cast<UINT32>(rtpNow - rtpTimestamp), GST_SECOND, 48000) / DEFAULT_TIME_UNIT_IN_NANOS;
+  if (age > 10 * HUNDREDS_OF_NANOS_IN_A_SECOND) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  // リングバッファに記録
+  MUTEX_LOCK(pKvsWebrtcConfig->audioLatencyLock);
+  auto& record = pKvsWebrtcConfig->audioLatencyRecords[pKvsWebrtcConfig->audioLatencyHead++ % AUDIO_LATENCY_RECORDS];
+  record.pts = GST_BUFFER_PTS(buffer);
+  record.captureTime = GETTIME() - age;
+  MUTEX_UNLOCK(pKvsWebrtcConfig->audioLatencyLock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/**
+ * @brief 送信した音声のキャプチャからのレイテンシを記録する
+ */
+VOID addAudioLatencySample(PKvsWebrtcConfig pKvsWebrtcConfig, UINT64 pts, UINT64 writeTime)
+{
+  UINT64 captureTime = 0, latency = 0;
+
+  // 新しい方から照合 (appsinkのキューを超えて古い記録は上書きされている)
+  MUTEX_LOCK(pKvsWebrtcConfig->audioLatencyLock);
+  for (UINT64 i = 0; i < MIN(pKvsWebrtcConfig->audioLatencyHead, static_cast<UINT64>(AUDIO_LATENCY_RECORDS)); i++) {
+    auto& record = pKvsWebrtcConfig->audioLatencyRecords[(pKvsWebrtcConfig->audioLatencyHead - 1 - i) % AUDIO_LATENCY_RECORDS];
+    if (record.pts == pts) {
+      captureTime = record.captureTime;
+      break;
+    }
+  }
+
+  // 合計に加算 (32ビット環境でも桁あふれしないようUINT64をロック中に加算する)
+  if (captureTime != 0 && writeTime > captureTime) {
+    latency = writeTime - captureTime;
+    pKvsWebrtcConfig->audioLatencySum += latency;
+    pKvsWebrtcConfig->audioLatencyCount++;
+  }
+  MUTEX_UNLOCK(pKvsWebrtcConfig->audioLatencyLock);
+
+  // レイテンシを記録
+  if (latency != 0) {
+    addLatencySample(pKvsWebrtcConfig->audioCaptureToWriteLatency, latency);
+  }
+}
+
+/**
+ * @brief 音声のメトリクスを出力する (設定オブジェクトのロックを保持して呼び出す)
+ */
+VOID logAudioStats(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto& settings = pKvsWebrtcConfig->audioEncoderSettings;
+  UINT64 latencySum, latencyCount;
+  DOUBLE deviceLatency;
+
+  // エンコードしていない場合は出力しない
+  if (!pKvsWebrtcConfig->audioEncoder && !pKvsWebrtcConfig->audioLatencyEnabled) {
+    return;
+  }
+
+  // Opusの設定と適応制御の入力
+  if (pKvsWebrtcConfig->audioEncoder) {
+    DLOGP("audio: profile: %s, adaptive: %s, fec: %s, packet loss: %u%%, dtx: %s, frame size: %u ms, bitrate: %u, loss: %.2f%%, rtt: %.2f ms, adaptations: %zu",
+          pKvsWebrtcConfig->audioProfile == AUDIO_PROFILE_LOW_LATENCY ? "lowlatency" : "default",
+          pKvsWebrtcConfig->audioAdaptive ? "on" : "off",
+          settings.inbandFec ? "on" : "off",
+          settings.packetLossPercent,
+          settings.dtx ? "on" : "off",
+          settings.frameSize,
+          settings.bitrate,
+          pKvsWebrtcConfig->audioLoss,
+          pKvsWebrtcConfig->audioRtt,
+          ATOMIC_EXCHANGE(&pKvsWebrtcConfig->audioAdaptations, 0));
+  }
+
+  // 口から耳までの遅延の見積もり (デバイス内の遅延 + 片道の伝送遅延、ビューアーのジッタバッファと再生は含まない)
+  if (pKvsWebrtcConfig->audioLatencyEnabled) {
+    MUTEX_LOCK(pKvsWebrtcConfig->audioLatencyLock);
+    latencySum = pKvsWebrtcConfig->audioLatencySum;
+    latencyCount = pKvsWebrtcConfig->audioLatencyCount;
+    pKvsWebrtcConfig->audioLatencySum = 0;
+    pKvsWebrtcConfig->audioLatencyCount = 0;
+    MUTEX_UNLOCK(pKvsWebrtcConfig->audioLatencyLock);
+    deviceLatency = latencyCount > 0 ? static_cast<DOUBLE>(latencySum) / latencyCount / HUNDREDS_OF_NANOS_IN_A_MILLISECOND : 0.0;
+    DLOGP("audio latency: device: %.2f ms, network one-way: %.2f ms, mouth-to-ear (excluding viewer playout): %.2f ms",
+          deviceLatency,
+          pKvsWebrtcConfig->audioRtt / 2,
+          deviceLatency + pKvsWebrtcConfig->audioRtt / 2);
+    logLatencyStats("audioCaptureToWrite", pKvsWebrtcConfig->audioCaptureToWriteLatency);
+  }
+}
+
+// ============================================================================
+// 映像コーデック
+// ============================================================================
+
+/**
+ * @brief 映像コーデックの優先順位とエンコードの経路を初期化する
+ */
+STATUS initVideoCodecs(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto retStatus = STATUS_SUCCESS;
+  PCHAR pVideoCodecs = getChannelEnv(pKvsWebrtcConfig, VIDEO_CODECS_ENV_VAR);
+  std::istringstream names(pVideoCodecs && pVideoCodecs[0] != '\0' ? pVideoCodecs : DEFAULT_VIDEO_CODECS);
+  std::string name;
+  BOOL isFound;
+
+  // 優先順位 (カンマ区切り、H.264は常に最後の候補として使用できる)
+  pKvsWebrtcConfig->videoCodecs.clear();
+  while (std::getline(names, name, ',')) {
+    isFound = FALSE;
+    for (UINT32 codec = 0; codec < VIDEO_CODEC_TYPE_COUNT; codec++) {
+      if (STRCMPI(name.c_str(), videoCodecSettings[codec].pName) == 0) {
+        pKvsWebrtcConfig->videoCodecs.push_back(static_cast<VideoCodecType>(codec));
+        isFound = TRUE;
+      }
+    }
+    CHK_ERR(isFound, STATUS_INVALID_ARG, "環境変数「%s」の値「%s」は不正です。", VIDEO_CODECS_ENV_VAR, name.c_str());
+  }
+
+  // コーデックごとの経路
+  for (UINT32 codec = 0; codec < VIDEO_CODEC_TYPE_COUNT; codec++) {
+    auto& branch = pKvsWebrtcConfig->videoCodecBranches[codec];
+    branch.pKvsWebrtcConfig = pKvsWebrtcConfig;
+    branch.codec = static_cast<VideoCodecType>(codec);
+    branch.encoder.clear();
+    branch.state = VIDEO_CODEC_BRANCH_STOPPED;
+    branch.bin = nullptr;
+    branch.teePad = nullptr;
+    branch.encodedFrames = 0;
+    branch.encodedBytes = 0;
+    CHK_STATUS(initMediaClock(branch.mediaClock));
+  }
+  pKvsWebrtcConfig->stoppingVideoCodecBranches = 0;
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief 映像コーデックのエンコードの経路を解放する
+ */
+VOID freeVideoCodecs(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  for (auto& branch : pKvsWebrtcConfig->videoCodecBranches) {
+    freeMediaClock(branch.mediaClock);
+  }
+}
+
+/**
+ * @brief 映像コーデックの名前を取得する
+ */
+const CHAR* getVideoCodecName(VideoCodecType codec)
+{
+  return codec < VIDEO_CODEC_TYPE_COUNT ? videoCodecSettings[codec].pName : "unknown";
+}
+
+/**
+ * @brief 追加のコーデックのエンコーダーを選択する
+ *
+ * 優先順位に含まれるコーデックごとに、インストールされている最初のエンコーダーを使用する。
+ * エンコーダーがない場合はそのコーデックをネゴシエーションしない。
+ */
+VOID selectVideoCodecEncoders(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  GstElementFactory* factory;
+
+  for (auto codec : pKvsWebrtcConfig->videoCodecs) {
+    auto& branch = pKvsWebrtcConfig->videoCodecBranches[codec];
+    if (codec == VIDEO_CODEC_TYPE_H264) {
+      continue;
+    }
+
+    branch.encoder.clear();
+    for (auto pCandidate : videoCodecSettings[codec].pEncoders) {
+      if (pCandidate && (factory = gst_element_factory_find(pCandidate))) {
+        gst_object_unref(factory);
+        branch.encoder = pCandidate;
+        break;
+      }
+    }
+
+    if (branch.encoder.empty()) {
+      DLOGW("No encoder is available for %s, the codec will not be negotiated", getVideoCodecName(codec));
+    } else {
+      DLOGI("%s encoder: %s", getVideoCodecName(codec), branch.encoder.c_str());
+    }
+  }
+}
+
+/**
+ * @brief 映像コーデックを使用できるか
+ */
+BOOL isVideoCodecAvailable(PKvsWebrtcConfig pKvsWebrtcConfig, VideoCodecType codec)
+{
+  // H.264は常に使用できる (送信用パイプラインの出力またはフレームバス)
+  if (codec == VIDEO_CODEC_TYPE_H264) {
+    return TRUE;
+  }
+
+  return std::find(pKvsWebrtcConfig->videoCodecs.begin(), pKvsWebrtcConfig->videoCodecs.end(), codec) != pKvsWebrtcConfig->videoCodecs.end() &&
+         !pKvsWebrtcConfig->videoCodecBranches[codec].encoder.empty();
+}
+
+/**
+ * @brief SDPオファーの映像のメディアセクションに含まれるコーデックを取得する (VideoCodecTypeのビットマスク)
+ */
+UINT32 getOfferedVideoCodecs(const CHAR* pSdp)
+{
+  std::istringstream sdp(pSdp);
+  std::string line, kind, encodingName;
+  UINT32 offeredVideoCodecs = 0;
+  size_t start, end;
+
+  while (std::getline(sdp, line)) {
+    // 行末のCRを削除
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+
+    if (line.rfind("m=", 0) == 0) {
+      // 新しいメディアセクション
+      std::istringstream media(line.substr(2));
+      media >> kind;
+    } else if (kind == "video" && line.rfind("a=rtpmap:", 0) == 0) {
+      // a=rtpmap:<ペイロードタイプ> <エンコーディング名>/<クロックレート>
+      if ((start = line.find(' ')) == std::string::npos) {
+        continue;
+      }
+      end = line.find('/', start + 1);
+      encodingName = line.substr(start + 1, end == std::string::npos ? std::string::npos : end - start - 1);
+      for (UINT32 codec = 0; codec < VIDEO_CODEC_TYPE_COUNT; codec++) {
+        if (STRCMPI(encodingName.c_str(), videoCodecSettings[codec].pEncodingName) == 0) {
+          offeredVideoCodecs |= 1 << codec;
+        }
+      }
+    }
+  }
+
+  return offeredVideoCodecs;
+}
+
+/**
+ * @brief オファーに含まれるコーデックから使用するコーデックを選択する
+ */
+VideoCodecType selectVideoCodec(PKvsWebrtcConfig pKvsWebrtcConfig, UINT32 offeredVideoCodecs)
+{
+  // 優先順位の順に、オファーに含まれて使用できる最初のコーデック
+  for (auto codec : pKvsWebrtcConfig->videoCodecs) {
+    if ((offeredVideoCodecs & (1 << codec)) && isVideoCodecAvailable(pKvsWebrtcConfig, codec)) {
+      return codec;
+    }
+  }
+
+  // 該当しない場合はH.264 (オファーにH.264がなければネゴシエーションに失敗する)
+  return VIDEO_CODEC_TYPE_H264;
+}
+
+/**
+ * @brief 選択したコーデックで映像のトランシーバーを追加する
+ *
+ * H.264以外のコーデックはトランシーバーを追加する前にエンコードの経路を開始し (同じコーデックのセッションで共有する)、
+ * 開始できない場合はH.264で送信する。実行中の経路に参加する場合は次のキーフレームまで表示できないため要求する。
+ */
+STATUS addVideoTransceiver(PKvsWebrtcConfig pKvsWebrtcConfig, PKvsWebrtcStreamingSession pStreamingSession, UINT32 offeredVideoCodecs, BOOL videoEnabled)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto videoCodec = selectVideoCodec(pKvsWebrtcConfig, offeredVideoCodecs);
+  RtcMediaStreamTrack videoTrack;
+  RtcRtpTransceiverInit videoRtpTransceiverInit;
+
+  // エンコードの経路を開始または参加
+  if (videoEnabled && videoCodec != VIDEO_CODEC_TYPE_H264) {
+    auto& branch = pKvsWebrtcConfig->videoCodecBranches[videoCodec];
+    if (ATOMIC_LOAD(&branch.state) == VIDEO_CODEC_BRANCH_RUNNING) {
+      requestVideoCodecBranchKeyFrame(branch);
+    } else if (STATUS_FAILED(startVideoCodecBranch(branch))) {
+      DLOGW("Failed to start %s branch for session %s, falling back to %s",
+            getVideoCodecName(videoCodec),
+            pStreamingSession->peerClientId,
+            getVideoCodecName(VIDEO_CODEC_TYPE_H264));
+      videoCodec = VIDEO_CODEC_TYPE_H264;
+    }
+  }
+
+  // 映像のトラックを初期化
+  MEMSET(&videoTrack, 0x00, SIZEOF(RtcMediaStreamTrack));
+  MEMSET(&videoRtpTransceiverInit, 0x00, SIZEOF(RtcRtpTransceiverInit));
+
+  // サポートされるコーデックを追加 (アンサーには選択したコーデックのみ含まれる)
+  CHK_STATUS(addSupportedCodec(pStreamingSession->pPeerConnection, videoCodecSettings[videoCodec].rtcCodec));
+
+  // トラックの種類とコーデック
+  videoTrack.kind = MEDIA_STREAM_TRACK_KIND_VIDEO;
+  videoTrack.codec = videoCodecSettings[videoCodec].rtcCodec;
+
+  // トランシーバーの方向
+  videoRtpTransceiverInit.direction = RTC_RTP_TRANSCEIVER_DIRECTION_SENDONLY;
+
+  // トラックのストリームIDとID
+  STRCPY(videoTrack.streamId, VIDEO_STREAM_ID);
+  STRCPY(videoTrack.trackId, VIDEO_TRACK_ID);
+
+  // トランシーバーを追加
+  CHK_STATUS(addTransceiver(pStreamingSession->pPeerConnection, &videoTrack, &videoRtpTransceiverInit, &pStreamingSession->pVideoRtcRtpTransceiver));
+
+  // セッションのコーデック (フレームの送信先の判定に使用)
+  pStreamingSession->videoCodec = videoCodec;
+  DLOGI("Session %s uses video codec %s", pStreamingSession->peerClientId, getVideoCodecName(videoCodec));
+
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief 追加のコーデックのエンコードの経路の定義を作成する
+ */
+std::string buildVideoCodecBranchDescription(PKvsWebrtcConfig pKvsWebrtcConfig, VideoCodecBranch& branch)
+{
+  std::string name = getVideoCodecName(branch.codec);
+  std::string controls;
+  std::string description;
+  UINT32 keyframeInterval = pKvsWebrtcConfig->videoFramerate * VIDEO_CODEC_BRANCH_KEYFRAME_INTERVAL;
+  UINT32 bitrate = getVideoCodecBitrate(pKvsWebrtcConfig, branch.codec);
+
+  // キーフレーム間隔を制御する場合はH.264と同様にエンコーダー自身の間隔を最大値の2倍にする (キーフレームは要求して挿入する)
+  if (pKvsWebrtcConfig->gopAdaptive) {
+    keyframeInterval = static_cast<UINT32>(2 * pKvsWebrtcConfig->gopMaxDuration * pKvsWebrtcConfig->videoFramerate / HUNDREDS_OF_NANOS_IN_A_SECOND);
+  }
+
+  // エンコーダーが遅れた場合は古いフレームを捨てる (H.264の経路を止めない)
+  description =
+    "queue "
+    "  name=video-queue-" + name + " "
+    "  max-size-buffers=" + std::to_string(VIDEO_CODEC_BRANCH_QUEUE_SIZE) + " "
+    "  max-size-time=0 "
+    "  max-size-bytes=0 "
     "  leaky=downstream ! "
+    "videoconvert ! ";
+
+  if (branch.encoder == "x265enc") {
+    // ビットレートはkbps単位 (解像度の変更に合わせた現在のビットレート)
+    description +=
+      "x265enc "
+      "  name=video-encoder-" + name + " "
+      "  tune=zerolatency "
+      "  speed-preset=ultrafast "
+      "  key-int-max=" + std::to_string(keyframeInterval) +
+      (bitrate != 0 ? " bitrate=" + std::to_string(bitrate / 1000) : std::string()) + " ! "
+      "video/x-h265,stream-format=byte-stream,alignment=au ! "
+      "h265parse config-interval=-1 ! "
+      "video/x-h265,stream-format=byte-stream,alignment=au ! ";
+  } else if (branch.encoder == "v4l2h265enc") {
+    // H.264のextra-controls (h264_profileなど) は使用しない
+    controls = pKvsWebrtcConfig->pV4l2H265Controls;
+    if (bitrate != 0) {
+      controls += ",video_bitrate=" + std::to_string(bitrate);
+    }
+    controls += ",video_gop_size=" + std::to_string(keyframeInterval);
+    description +=
+      "v4l2h265enc "
+      "  name=video-encoder-" + name + " "
+      "  extra-controls=\"" + controls + ";\" ! "
+      "video/x-h265,stream-format=byte-stream,alignment=au ! "
+      "h265parse config-interval=-1 ! "
+      "video/x-h265,stream-format=byte-stream,alignment=au ! ";
+  } else {
+    // リアルタイム向けの設定 (先読みなし、ビットレートはbps単位)
+    description +=
+      "vp8enc "
+      "  name=video-encoder-" + name + " "
+      "  deadline=1 "
+      "  cpu-used=8 "
+      "  lag-in-frames=0 "
+      "  error-resilient=default "
+      "  keyframe-max-dist=" + std::to_string(keyframeInterval) +
+      (bitrate != 0 ? " end-usage=cbr target-bitrate=" + std::to_string(bitrate) : std::string()) + " ! "
+      "video/x-vp8 ! ";
+  }
+
+  description +=
     "appsink "
-    "  name=appsink-audio "
+    "  name=appsink-" + name + " "
     "  emit-signals=true "
-    "  async=false "
-    "  sync=true",
-    &recvError);
+    "  sync=false";
+
+  return description;
+}
+
+/**
+ * @brief セッションが使用するコーデックの経路を開始し、使用されなくなった経路を停止する
+ *
+ * 設定オブジェクトのロックを保持して呼び出す。
+ * 削除中の経路は削除の完了後に再び開始する。
+ */
+VOID updateVideoCodecBranches(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  BOOL isUsed;
+
+  for (UINT32 codec = VIDEO_CODEC_TYPE_H264 + 1; codec < VIDEO_CODEC_TYPE_COUNT; codec++) {
+    auto& branch = pKvsWebrtcConfig->videoCodecBranches[codec];
+
+    // 映像を受信するセッションが使用しているか
+    isUsed = FALSE;
+    for (auto&& value : pKvsWebrtcConfig->streamingSessions) {
+      if (value.second && !ATOMIC_LOAD_BOOL(&value.second->isTerminated) && ATOMIC_LOAD_BOOL(&value.second->videoEnabled) &&
+          value.second->videoCodec == codec) {
+        isUsed = TRUE;
+        break;
+      }
+    }
+
+    if (isUsed && ATOMIC_LOAD(&branch.state) == VIDEO_CODEC_BRANCH_STOPPED) {
+      CHK_LOG_ERR(startVideoCodecBranch(branch));
+    } else if (!isUsed && ATOMIC_LOAD(&branch.state) == VIDEO_CODEC_BRANCH_RUNNING) {
+      stopVideoCodecBranch(branch);
+    }
+  }
+}
+
+/**
+ * @brief 追加のコーデックのエンコードの経路を送信用パイプラインに追加する
+ *
+ * ビンを再生状態にしてからteeに接続するため、接続前のフレームは経路に流れない。
+ * 停止している場合のみ開始する (実行中と削除中の場合は何もしない)。
+ */
+STATUS startVideoCodecBranch(VideoCodecBranch& branch)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto pKvsWebrtcConfig = branch.pKvsWebrtcConfig;
+  GstElement* tee = nullptr;
+  GstElement* appsink = nullptr;
+  GstPad* binSinkPad = nullptr;
+  GError* error = nullptr;
+  std::string description;
+  auto isAdded = FALSE;
+
+  // 停止している場合のみ開始
+  CHK(ATOMIC_LOAD(&branch.state) == VIDEO_CODEC_BRANCH_STOPPED, retStatus);
+  CHK(isVideoCodecAvailable(pKvsWebrtcConfig, branch.codec) && pKvsWebrtcConfig->sendPipeline, STATUS_INVALID_OPERATION);
+  CHK(tee = gst_bin_get_by_name(GST_BIN(pKvsWebrtcConfig->sendPipeline), "video-tee"), STATUS_INVALID_OPERATION);
+
+  // 経路のビンを作成
+  description = buildVideoCodecBranchDescription(pKvsWebrtcConfig, branch);
+  DLOGD("%s branch: %s", getVideoCodecName(branch.codec), description.c_str());
+  branch.bin = gst_parse_bin_from_description(description.c_str(), TRUE, &error);
+  if (error) {
+    DLOGE("Failed to create %s branch: %s", getVideoCodecName(branch.codec), error->message);
+    g_error_free(error);
+    CHK(FALSE, STATUS_INTERNAL_ERROR);
+  }
+  gst_object_set_name(GST_OBJECT(branch.bin), (std::string("video-codec-") + getVideoCodecName(branch.codec)).c_str());
+
+  // appsinkにコールバックを設定
+  CHK(appsink = gst_bin_get_by_name(GST_BIN(branch.bin), (std::string("appsink-") + getVideoCodecName(branch.codec)).c_str()), STATUS_INTERNAL_ERROR);
+  g_signal_connect(appsink, "new-sample", G_CALLBACK(onNewSampleVideoCodecBranch), &branch);
+
+  // 送信用パイプラインに追加して再生状態にする
+  gst_bin_add(GST_BIN(pKvsWebrtcConfig->sendPipeline), branch.bin);
+  isAdded = TRUE;
+  CHK(gst_element_sync_state_with_parent(branch.bin), STATUS_INTERNAL_ERROR);
+
+  // teeの要求パッドに接続
+  CHK(branch.teePad = gst_element_request_pad_simple(tee, "src_%u"), STATUS_INTERNAL_ERROR);
+  CHK(binSinkPad = gst_element_get_static_pad(branch.bin, "sink"), STATUS_INTERNAL_ERROR);
+  CHK(gst_pad_link(branch.teePad, binSinkPad) == GST_PAD_LINK_OK, STATUS_INTERNAL_ERROR);
+
+  ATOMIC_STORE(&branch.state, VIDEO_CODEC_BRANCH_RUNNING);
+  DLOGI("%s branch started with %s", getVideoCodecName(branch.codec), branch.encoder.c_str());
+
+CleanUp:
+
+  // 失敗した場合は経路を削除
+  if (STATUS_FAILED(retStatus)) {
+    if (branch.teePad) {
+      gst_element_release_request_pad(tee, branch.teePad);
+      gst_object_unref(branch.teePad);
+      branch.teePad = nullptr;
+    }
+    if (branch.bin) {
+      gst_element_set_state(branch.bin, GST_STATE_NULL);
+      if (isAdded) {
+        gst_bin_remove(GST_BIN(pKvsWebrtcConfig->sendPipeline), branch.bin);
+      } else {
+        gst_object_unref(branch.bin);
+      }
+      branch.bin = nullptr;
+    }
+  }
+
+  if (binSinkPad) {
+    gst_object_unref(binSinkPad);
+  }
+
+  if (appsink) {
+    gst_object_unref(appsink);
+  }
+
+  if (tee) {
+    gst_object_unref(tee);
+  }
+
+  return retStatus;
+}
+
+/**
+ * @brief 追加のコーデックのエンコードの経路を送信用パイプラインから削除する
+ *
+ * teeの要求パッドがアイドルになってから切り離すため、H.264の経路は止まらない。
+ */
+VOID stopVideoCodecBranch(VideoCodecBranch& branch)
+{
+  // 実行中の場合のみ停止
+  if (ATOMIC_LOAD(&branch.state) != VIDEO_CODEC_BRANCH_RUNNING) {
+    return;
+  }
+
+  ATOMIC_STORE(&branch.state, VIDEO_CODEC_BRANCH_STOPPING);
+  ATOMIC_INCREMENT(&branch.pKvsWebrtcConfig->stoppingVideoCodecBranches);
+  DLOGI("Stopping %s branch", getVideoCodecName(branch.codec));
+
+  gst_pad_add_probe(branch.teePad, GST_PAD_PROBE_TYPE_IDLE, onVideoCodecBranchIdle, &branch, nullptr);
+}
+
+/**
+ * @brief teeの要求パッドがアイドルになった際に経路を切り離すプローブ
+ */
+GstPadProbeReturn onVideoCodecBranchIdle(GstPad* pad, GstPadProbeInfo* info, gpointer data)
+{
+  auto& branch = *reinterpret_cast<VideoCodecBranch*>(data);
+  GstElement* tee;
+  GstPad* peer;
+
+  UNUSED_PARAM(info);
+
+  // ビンから切り離してteeの要求パッドを解放
+  if ((peer = gst_pad_get_peer(pad))) {
+    gst_pad_unlink(pad, peer);
+    gst_object_unref(peer);
+  }
+  if ((tee = gst_pad_get_parent_element(pad))) {
+    gst_element_release_request_pad(tee, pad);
+    gst_object_unref(tee);
+  }
+  gst_object_unref(branch.teePad);
+  branch.teePad = nullptr;
+
+  // ストリーミングスレッドから状態を変更できないため、ビンの停止と削除は別のスレッドで行う
+  gst_element_call_async(branch.pKvsWebrtcConfig->sendPipeline, removeVideoCodecBranch, &branch, nullptr);
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/**
+ * @brief 切り離した経路を停止して送信用パイプラインから削除する (GStreamerのスレッドで実行)
+ */
+VOID removeVideoCodecBranch(GstElement* pipeline, gpointer data)
+{
+  auto& branch = *reinterpret_cast<VideoCodecBranch*>(data);
+
+  if (branch.bin) {
+    gst_element_set_state(branch.bin, GST_STATE_NULL);
+    gst_bin_remove(GST_BIN(pipeline), branch.bin);
+    branch.bin = nullptr;
+  }
+
+  ATOMIC_STORE(&branch.state, VIDEO_CODEC_BRANCH_STOPPED);
+  ATOMIC_DECREMENT(&branch.pKvsWebrtcConfig->stoppingVideoCodecBranches);
+  DLOGI("%s branch stopped", getVideoCodecName(branch.codec));
+}
+
+/**
+ * @brief 追加のコーデックのサンプルを受信した際のコールバック
+ */
+GstFlowReturn onNewSampleVideoCodecBranch(GstElement* sink, gpointer data)
+{
+  auto retStatus = STATUS_SUCCESS;
+  auto ret = GST_FLOW_OK;
+  auto& branch = *reinterpret_cast<VideoCodecBranch*>(data);
+  auto pKvsWebrtcConfig = branch.pKvsWebrtcConfig;
+  GstSample* sample = nullptr;
+  GstBuffer* buffer = nullptr;
+  GstMapInfo info;
+  UINT64 ptsHundredsNanos, timestamp;
+  UINT64 arrivalTime = GETTIME();
+  Frame frame;
+
+  // マップ情報を初期化
+  info.data = nullptr;
+
+  // サンプルを取得
+  CHK(sample = gst_app_sink_pull_sample(GST_APP_SINK(sink)), STATUS_INTERNAL_ERROR);
+
+  // 削除中の経路のフレームは送信しない
+  CHK(ATOMIC_LOAD(&branch.state) == VIDEO_CODEC_BRANCH_RUNNING, retStatus);
+
+  // バッファを取得してマップ
+  CHK((buffer = gst_sample_get_buffer(sample)) && GST_BUFFER_PTS_IS_VALID(buffer), retStatus);
+  CHK(gst_buffer_map(buffer, &info, GST_MAP_READ), STATUS_INTERNAL_ERROR);
+
+  // ランニングタイムを100ナノ秒単位に変換してセッションクロックに写像
+  ptsHundredsNanos = gst_segment_to_running_time(gst_sample_get_segment(sample), GST_FORMAT_TIME, GST_BUFFER_PTS(buffer)) / DEFAULT_TIME_UNIT_IN_NANOS;
+  timestamp = getMediaClockTimestamp(branch.mediaClock, MEDIA_CLOCK_TRACK_VIDEO, ptsHundredsNanos, arrivalTime);
+
+  // フレームを初期化
+  MEMSET(&frame, 0, SIZEOF(Frame));
+  frame.version = FRAME_CURRENT_VERSION;
+  frame.flags = GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT) ? FRAME_FLAG_NONE : FRAME_FLAG_KEY_FRAME;
+  frame.duration = GST_BUFFER_DURATION_IS_VALID(buffer) ? GST_BUFFER_DURATION(buffer) / DEFAULT_TIME_UNIT_IN_NANOS : 0;
+  frame.presentationTs = timestamp;
+  frame.decodingTs = timestamp;
+  frame.size = static_cast<UINT32>(info.size);
+  frame.frameData = info.data;
+  frame.trackId = DEFAULT_VIDEO_TRACK_ID;
+
+  // このコーデックを選択したセッションにフレームを送信
+  MUTEX_LOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  writeFrameToSessions(pKvsWebrtcConfig, frame, branch.codec, nullptr);
+  MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+
+CleanUp:
+
+  // バッファのマップを解除
+  if (info.data) {
+    gst_buffer_unmap(buffer, &info);
+  }
+
+  // サンプルの参照を解放
+  if (sample) {
+    gst_sample_unref(sample);
+  }
+
+  // 終了フラグが立っていたらEOSを返す
+  if (ATOMIC_LOAD_BOOL(&pKvsWebrtcConfig->isTerminated)) {
+    ret = GST_FLOW_EOS;
+  }
+
+  return ret;
+}
+
+/**
+ * @brief 映像コーデックごとのメトリクスを出力する (設定オブジェクトのロックを保持して呼び出す)
+ */
+VOID logVideoCodecStats(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  SIZE_T sessions, encodedFrames, encodedBytes;
+  UINT64 egressBitrate;
+  DOUBLE interval;
+  UINT32 width, height, framerate;
+
+  // 出力間隔 (秒)
+  interval = static_cast<DOUBLE>(MAX(GETTIME() - pKvsWebrtcConfig->lastMetricsTime, 1ULL)) / HUNDREDS_OF_NANOS_IN_A_SECOND;
+
+  // 現在の解像度とフレームレート (全コーデックで共有する、変更しない場合は設定どおり)
+  if (pKvsWebrtcConfig->videoScaleCaps) {
+    getVideoScalingSize(pKvsWebrtcConfig, pKvsWebrtcConfig->videoScaleLevel, width, height, framerate);
+  } else {
+    width = pKvsWebrtcConfig->videoWidth;
+    height = pKvsWebrtcConfig->videoHeight;
+    framerate = pKvsWebrtcConfig->videoFramerate;
+  }
 
-  // エラーチェック
-  if (recvError) {
-    DLOGE("Failed to create receiver pipeline: %s", recvError->message);
-    g_error_free(recvError);
-    CHK(FALSE, STATUS_INTERNAL_ERROR);
+  for (UINT32 codec = 0; codec < VIDEO_CODEC_TYPE_COUNT; codec++) {
+    auto& branch = pKvsWebrtcConfig->videoCodecBranches[codec];
+    if (!isVideoCodecAvailable(pKvsWebrtcConfig, branch.codec)) {
+      continue;
+    }
+
+    // コーデックを選択したセッション数と送信ビットレート
+    sessions = 0;
+    egressBitrate = 0;
+    for (auto&& value : pKvsWebrtcConfig->streamingSessions) {
+      if (value.second && ATOMIC_LOAD_BOOL(&value.second->videoEnabled) && value.second->videoCodec == branch.codec) {
+        sessions++;
+        egressBitrate += value.second->egressBitrate;
+      }
+    }
+
+    encodedFrames = ATOMIC_EXCHANGE(&branch.encodedFrames, 0);
+    encodedBytes = ATOMIC_EXCHANGE(&branch.encodedBytes, 0);
+    DLOGP("video codec %s: encoder: %s, %ux%u@%u, target: %.2f kbps, sessions: %zu, encoded: %.2f kbps, %.2f fps, egress: %.2f kbps/session, state: %s",
+          getVideoCodecName(branch.codec),
+          branch.codec == VIDEO_CODEC_TYPE_H264 ? pKvsWebrtcConfig->videoEncoder.c_str() : branch.encoder.c_str(),
+          width,
+          height,
+          framerate,
+          static_cast<DOUBLE>(getVideoCodecBitrate(pKvsWebrtcConfig, branch.codec)) / 1000,
+          sessions,
+          static_cast<DOUBLE>(encodedBytes) * 8 / 1000 / interval,
+          static_cast<DOUBLE>(encodedFrames) / interval,
+          sessions > 0 ? static_cast<DOUBLE>(egressBitrate) / sessions / 1000 : 0.0,
+          branch.codec == VIDEO_CODEC_TYPE_H264                      ? "always"
+            : ATOMIC_LOAD(&branch.state) == VIDEO_CODEC_BRANCH_RUNNING ? "running"
+            : ATOMIC_LOAD(&branch.state) == VIDEO_CODEC_BRANCH_STOPPING ? "stopping"
+                                                                        : "stopped");
   }
+}
 
-  // Video appsinkを取得してシグナルを接続
-  CHK(appsinkVideo = gst_bin_get_by_name(GST_BIN(pKvsWebrtcConfig->recvPipeline), "appsink-video"), STATUS_INTERNAL_ERROR);
-  g_signal_connect(appsinkVideo, "new-sample", G_CALLBACK(onNewSampleVideo), pKvsWebrtcConfig);
-  gst_object_unref(appsinkVideo);
+// ============================================================================
+// 解像度とフレームレートの適応
+// ============================================================================
 
-  // Audio appsinkを取得してシグナルを接続
-  CHK(appsinkAudio = gst_bin_get_by_name(GST_BIN(pKvsWebrtcConfig->recvPipeline), "appsink-audio"), STATUS_INTERNAL_ERROR);
-  g_signal_connect(appsinkAudio, "new-sample", G_CALLBACK(onNewSampleAudio), pKvsWebrtcConfig);
-  gst_object_unref(appsinkAudio);
+/**
+ * @brief 解像度とフレームレートの適応を初期化する (送信用パイプラインの作成後)
+ */
+VOID initVideoScaling(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  GstElement* encoder;
+  guint bitrate = 0;
+
+  // 設定どおりの段から開始
+  pKvsWebrtcConfig->videoScaleCaps = nullptr;
+  pKvsWebrtcConfig->videoScaleLevel = 0;
+  pKvsWebrtcConfig->videoScaleChangeTime = GETTIME();
+  pKvsWebrtcConfig->lastVideoScalingTime = GETTIME();
+  pKvsWebrtcConfig->videoScaleBaseBitrate = 0;
+  pKvsWebrtcConfig->videoTargetBitrate = pKvsWebrtcConfig->videoBitrate;
+  pKvsWebrtcConfig->videoScaleCpuTicks = 0;
+  ATOMIC_STORE(&pKvsWebrtcConfig->videoScaleEncodedBytes, 0);
+  ATOMIC_STORE(&pKvsWebrtcConfig->videoScaleChanges, 0);
+
+  if (!pKvsWebrtcConfig->videoScalingEnabled || !pKvsWebrtcConfig->sendPipeline) {
+    return;
+  }
 
-  // パイプラインを開始
-  gst_element_set_state(pKvsWebrtcConfig->sendPipeline, GST_STATE_PLAYING);
-  gst_element_set_state(pKvsWebrtcConfig->recvPipeline, GST_STATE_PLAYING);
+  // 録画はセグメントの途中で解像度が変わらないように、フレームバスはワーカーのビューアーが見えないため変更しない
+  if (pKvsWebrtcConfig->recordingEnabled || getChannelEnv(pKvsWebrtcConfig, FRAME_BUS_SOCKET_ENV_VAR)) {
+    DLOGI("Video scaling is disabled while recording or publishing to the frame bus");
+    return;
+  }
 
-CleanUp:
+  // キャップスフィルター (ファイル入力と定義が設定されている場合は存在しない)
+  if (!(pKvsWebrtcConfig->videoScaleCaps = gst_bin_get_by_name(GST_BIN(pKvsWebrtcConfig->sendPipeline), "video-scale-caps"))) {
+    return;
+  }
 
-  // エラー時はパイプラインを解放
-  if (STATUS_FAILED(retStatus)) {
-    freeGstPipelines(pKvsWebrtcConfig);
+  // 設定どおりの解像度でのビットレート (未設定の場合はエンコーダーのデフォルト値、v4l2h264encは取得できないため変更しない)
+  if (pKvsWebrtcConfig->videoBitrate != 0) {
+    pKvsWebrtcConfig->videoScaleBaseBitrate = pKvsWebrtcConfig->videoBitrate;
+  } else if ((encoder = gst_bin_get_by_name(GST_BIN(pKvsWebrtcConfig->sendPipeline), "video-encoder"))) {
+    if (pKvsWebrtcConfig->videoEncoder == "x264enc") {
+      g_object_get(encoder, "bitrate", &bitrate, nullptr);
+      pKvsWebrtcConfig->videoScaleBaseBitrate = bitrate * 1000;
+    } else if (pKvsWebrtcConfig->videoEncoder == "openh264enc") {
+      g_object_get(encoder, "bitrate", &bitrate, nullptr);
+      pKvsWebrtcConfig->videoScaleBaseBitrate = bitrate;
+    }
+    gst_object_unref(encoder);
   }
 
-  return retStatus;
+  DLOGI("video scaling: %zu levels, base bitrate: %u", ARRAY_SIZE(videoScalingLevels), pKvsWebrtcConfig->videoScaleBaseBitrate);
 }
 
 /**
- * @brief GStreamerパイプラインを解放する
+ * @brief 段に対応する解像度とフレームレートを取得する
  */
-STATUS freeGstPipelines(PKvsWebrtcConfig pKvsWebrtcConfig)
+VOID getVideoScalingSize(PKvsWebrtcConfig pKvsWebrtcConfig, UINT32 level, UINT32& width, UINT32& height, UINT32& framerate)
 {
-  auto retStatus = STATUS_SUCCESS;
+  auto& scalingLevel = videoScalingLevels[MIN(level, static_cast<UINT32>(ARRAY_SIZE(videoScalingLevels) - 1))];
 
-  // NULLチェック
-  CHK(pKvsWebrtcConfig, STATUS_NULL_ARG);
+  // エンコーダーが扱えるように幅と高さは8の倍数にする
+  width = MAX(pKvsWebrtcConfig->videoWidth * scalingLevel.sizePercent / 100 / 8 * 8, 16U);
+  height = MAX(pKvsWebrtcConfig->videoHeight * scalingLevel.sizePercent / 100 / 8 * 8, 16U);
+  framerate = MAX(pKvsWebrtcConfig->videoFramerate * scalingLevel.frameratePercent / 100, 1U);
+}
 
-  // 送信用パイプラインを解放
-  if (pKvsWebrtcConfig->sendPipeline) {
-    gst_element_set_state(pKvsWebrtcConfig->sendPipeline, GST_STATE_NULL);
-    gst_object_unref(pKvsWebrtcConfig->sendPipeline);
-    pKvsWebrtcConfig->sendPipeline = nullptr;
+/**
+ * @brief 段に対応するキャップスの定義を作成する
+ */
+std::string buildVideoScaleCapsDescription(PKvsWebrtcConfig pKvsWebrtcConfig, UINT32 level)
+{
+  UINT32 width, height, framerate;
+
+  getVideoScalingSize(pKvsWebrtcConfig, level, width, height, framerate);
+
+  return "video/x-raw"
+         ",width=" + std::to_string(width) +
+         ",height=" + std::to_string(height) +
+         ",framerate=" + std::to_string(framerate) + "/1";
+}
+
+/**
+ * @brief ビューアーが必要とする解像度とフレームレートを満たす最も低い段を取得する
+ */
+UINT32 getRequestedVideoScalingLevel(PKvsWebrtcConfig pKvsWebrtcConfig, PKvsWebrtcStreamingSession pStreamingSession)
+{
+  auto maxWidth = ATOMIC_LOAD(&pStreamingSession->maxVideoWidth);
+  auto maxHeight = ATOMIC_LOAD(&pStreamingSession->maxVideoHeight);
+  auto maxFramerate = ATOMIC_LOAD(&pStreamingSession->maxVideoFramerate);
+  UINT32 width, height, framerate;
+
+  // 低い段から順に、通知された大きさ以上の最初の段 (通知がない項目は設定どおり)
+  for (auto level = static_cast<UINT32>(ARRAY_SIZE(videoScalingLevels)); level-- > 0;) {
+    getVideoScalingSize(pKvsWebrtcConfig, level, width, height, framerate);
+    if ((maxWidth != 0 ? width >= maxWidth : width >= pKvsWebrtcConfig->videoWidth) &&
+        (maxHeight != 0 ? height >= maxHeight : height >= pKvsWebrtcConfig->videoHeight) &&
+        (maxFramerate != 0 ? framerate >= maxFramerate : framerate >= pKvsWebrtcConfig->videoFramerate)) {
+      return level;
+    }
   }
 
-  // 受信用パイプラインを解放
-  if (pKvsWebrtcConfig->recvPipeline) {
-    gst_element_set_state(pKvsWebrtcConfig->recvPipeline, GST_STATE_NULL);
-    gst_object_unref(pKvsWebrtcConfig->recvPipeline);
-    pKvsWebrtcConfig->recvPipeline = nullptr;
+  return 0;
+}
+
+/**
+ * @brief 視聴中のビューアーが必要とし、受信できる段を求めて解像度とフレームレートを変更する
+ *
+ * エンコードは全ビューアーで共有するため、ビューアーごとの段 (通知された大きさと損失率から求める) のうち
+ * 最も高い段に合わせる。ビューアーごとの段は損失率が高い場合に1段下げ、低い状態が続いた場合に1段上げる。
+ * 上げる方向はすぐに切り替え、下げる方向は切り替えの間隔を空ける。ビューアーがいない場合は現在の段を維持する。
+ * 損失率はadaptToSessionStatsで取得したものを使用する。設定オブジェクトのロックを保持して呼び出すこと。
+ */
+VOID adaptVideoScaling(PKvsWebrtcConfig pKvsWebrtcConfig, const std::vector<SessionLinkStats>& sessionStats)
+{
+  auto now = GETTIME();
+  auto lowestLevel = static_cast<UINT32>(ARRAY_SIZE(videoScalingLevels) - 1);
+  auto targetLevel = lowestLevel;
+  auto hasViewer = FALSE;
+  DOUBLE loss;
+
+  for (auto&& stats : sessionStats) {
+    auto pStreamingSession = stats.pStreamingSession;
+    if (ATOMIC_LOAD_BOOL(&pStreamingSession->isTerminated) || !ATOMIC_LOAD_BOOL(&pStreamingSession->isConnected) ||
+        !ATOMIC_LOAD_BOOL(&pStreamingSession->videoEnabled)) {
+      continue;
+    }
+
+    // 映像の損失率 (ビューアーのReceiver Report) に応じてビューアーの段を変更
+    if (stats.hasVideoLoss) {
+      loss = stats.videoLoss;
+      if (loss > VIDEO_SCALING_LOSS_DOWN) {
+        pStreamingSession->videoScaleLevel = MIN(pStreamingSession->videoScaleLevel + 1, lowestLevel);
+        pStreamingSession->videoLowLossTime = 0;
+      } else if (loss >= VIDEO_SCALING_LOSS_UP) {
+        pStreamingSession->videoLowLossTime = 0;
+      } else if (pStreamingSession->videoLowLossTime == 0) {
+        pStreamingSession->videoLowLossTime = now;
+      } else if (now - pStreamingSession->videoLowLossTime >= VIDEO_SCALING_UP_HOLD && pStreamingSession->videoScaleLevel > 0) {
+        pStreamingSession->videoScaleLevel--;
+        pStreamingSession->videoLowLossTime = now;
+      }
+    }
+
+    // ビューアーの段 (必要な大きさと受信できる大きさの小さい方) のうち最も高い段
+    targetLevel = MIN(targetLevel, MAX(getRequestedVideoScalingLevel(pKvsWebrtcConfig, pStreamingSession), pStreamingSession->videoScaleLevel));
+    hasViewer = TRUE;
   }
 
-CleanUp:
+  // ビューアーがいない場合と変わらない場合は維持
+  if (!hasViewer || targetLevel == pKvsWebrtcConfig->videoScaleLevel) {
+    return;
+  }
 
-  return retStatus;
+  // 下げる方向は切り替えの間隔を空ける (キーフレームが続かないようにする)
+  if (targetLevel > pKvsWebrtcConfig->videoScaleLevel && now - pKvsWebrtcConfig->videoScaleChangeTime < VIDEO_SCALING_DOWN_MIN_INTERVAL) {
+    return;
+  }
+
+  applyVideoScalingLevel(pKvsWebrtcConfig, targetLevel);
 }
 
 /**
- * @brief 新しいサンプルを受信した際の共通処理
+ * @brief 解像度とフレームレートを切り替える
+ *
+ * キャップスフィルターのキャップスを変更するとvideoscale/videorateが再ネゴシエーションし、
+ * エンコーダーは新しい解像度で再初期化される。パイプラインは再起動せず、切り替え後のフレームがキーフレームになるように要求する。
+ * 切り替え前の段のCPU使用率とビットレートを出力する。
  */
-GstFlowReturn onNewSample(GstElement* sink, gpointer data, UINT64 trackId)
+VOID applyVideoScalingLevel(PKvsWebrtcConfig pKvsWebrtcConfig, UINT32 level)
 {
-  auto retStatus = STATUS_SUCCESS;
-  auto ret = GST_FLOW_OK;
-  auto pKvsWebrtcConfig = reinterpret_cast<PKvsWebrtcConfig>(data);
-  GstSample* sample = nullptr;
-  GstBuffer* buffer = nullptr;
-  GstSegment* segment = nullptr;
-  GstMapInfo info;
-  GstClockTime duration = GST_CLOCK_TIME_NONE;
-  UINT64 ptsHundredsNanos = 0;
-  UINT64 durationHundredsNanos = 0;
-  Frame frame;
-  BOOL isDroppable, isDelta;
-  PRtcRtpTransceiver pRtcRtpTransceiver = nullptr;
+  auto now = GETTIME();
+  auto elapsed = static_cast<DOUBLE>(MAX(now - pKvsWebrtcConfig->videoScaleChangeTime, 1ULL)) / HUNDREDS_OF_NANOS_IN_A_SECOND;
+  auto cpuTicks = getGstThreadsCpuTicks(pKvsWebrtcConfig);
+  UINT32 fromWidth, fromHeight, fromFramerate, width, height, framerate;
+  GstCaps* caps;
+  DOUBLE pixelRateRatio;
+
+  getVideoScalingSize(pKvsWebrtcConfig, pKvsWebrtcConfig->videoScaleLevel, fromWidth, fromHeight, fromFramerate);
+  getVideoScalingSize(pKvsWebrtcConfig, level, width, height, framerate);
+
+  // 切り替え前の段のストリーミングスレッドのCPU使用率とビットレート
+  DLOGI("Video scaling %ux%u@%u -> %ux%u@%u, before: cpu: %.1f %%, bitrate: %.2f kbps over %.1f s",
+        fromWidth,
+        fromHeight,
+        fromFramerate,
+        width,
+        height,
+        framerate,
+        static_cast<DOUBLE>(cpuTicks > pKvsWebrtcConfig->videoScaleCpuTicks ? cpuTicks - pKvsWebrtcConfig->videoScaleCpuTicks : 0) /
+          sysconf(_SC_CLK_TCK) / elapsed * 100.0,
+        static_cast<DOUBLE>(ATOMIC_EXCHANGE(&pKvsWebrtcConfig->videoScaleEncodedBytes, 0)) * 8 / 1000 / elapsed,
+        elapsed);
+
+  // キャップスを変更
+  caps = gst_caps_from_string(buildVideoScaleCapsDescription(pKvsWebrtcConfig, level).c_str());
+  g_object_set(pKvsWebrtcConfig->videoScaleCaps, "caps", caps, nullptr);
+  gst_caps_unref(caps);
+
+  // 画素レートに合わせてビットレートを変更
+  if (pKvsWebrtcConfig->videoScaleBaseBitrate != 0) {
+    pixelRateRatio = static_cast<DOUBLE>(width) * height * framerate /
+                     (static_cast<DOUBLE>(pKvsWebrtcConfig->videoWidth) * pKvsWebrtcConfig->videoHeight * pKvsWebrtcConfig->videoFramerate);
+    setVideoEncoderBitrate(pKvsWebrtcConfig,
+                           static_cast<UINT32>(pKvsWebrtcConfig->videoScaleBaseBitrate * pow(MIN(pixelRateRatio, 1.0), VIDEO_SCALING_BITRATE_EXPONENT)));
+  }
 
-  // NULLチェック
-  CHK(pKvsWebrtcConfig, STATUS_NULL_ARG);
+  // 切り替え後の最初のフレームをキーフレームにする
+  requestVideoKeyFrame(pKvsWebrtcConfig);
 
-  // マップ情報を初期化
-  info.data = nullptr;
+  pKvsWebrtcConfig->videoScaleLevel = level;
+  pKvsWebrtcConfig->videoScaleChangeTime = now;
+  pKvsWebrtcConfig->videoScaleCpuTicks = cpuTicks;
+  ATOMIC_INCREMENT(&pKvsWebrtcConfig->videoScaleChanges);
+}
 
-  // サンプルを取得
-  CHK(sample = gst_app_sink_pull_sample(GST_APP_SINK(sink)), STATUS_INTERNAL_ERROR);
+/**
+ * @brief 映像のエンコーダーのビットレートを変更する
+ *
+ * H.264のビットレートを変更し、実行中の追加のコーデックの経路にもコーデックごとの割合で反映する
+ * (これから開始する経路は開始時にこのビットレートを使用する)。設定オブジェクトのロックを保持して呼び出す。
+ */
+VOID setVideoEncoderBitrate(PKvsWebrtcConfig pKvsWebrtcConfig, UINT32 bitrate)
+{
+  GstElement* encoder;
+  GstStructure* controls;
 
-  // バッファを取得
-  CHK(buffer = gst_sample_get_buffer(sample), STATUS_INTERNAL_ERROR);
+  pKvsWebrtcConfig->videoTargetBitrate = bitrate;
 
-  // ドロップすべきフレームかどうかを判定
-  isDroppable = GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_CORRUPTED) ||
-                GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DECODE_ONLY) ||
-                (GST_BUFFER_FLAGS(buffer) == GST_BUFFER_FLAG_DISCONT) ||
-                (GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DISCONT) &&
-                 GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT)) ||
-                !GST_BUFFER_PTS_IS_VALID(buffer);
+  for (auto& branch : pKvsWebrtcConfig->videoCodecBranches) {
+    if (branch.codec != VIDEO_CODEC_TYPE_H264 && ATOMIC_LOAD(&branch.state) == VIDEO_CODEC_BRANCH_RUNNING) {
+      setVideoCodecBranchBitrate(branch);
+    }
+  }
 
-  // ドロップすべきフレームはスキップ
-  CHK(!isDroppable, retStatus);
+  if (!pKvsWebrtcConfig->sendPipeline || !(encoder = gst_bin_get_by_name(GST_BIN(pKvsWebrtcConfig->sendPipeline), "video-encoder"))) {
+    return;
+  }
 
-  // バッファをマップ
-  CHK(gst_buffer_map(buffer, &info, GST_MAP_READ), STATUS_INTERNAL_ERROR);
+  if (pKvsWebrtcConfig->videoEncoder == "x264enc") {
+    // ビットレートはkbps単位
+    g_object_set(encoder, "bitrate", static_cast<guint>(bitrate / 1000), nullptr);
+  } else if (pKvsWebrtcConfig->videoEncoder == "openh264enc") {
+    g_object_set(encoder, "bitrate", static_cast<guint>(bitrate), nullptr);
+  } else if ((controls = gst_structure_from_string(("encode,video_bitrate=" + std::to_string(bitrate)).c_str(), nullptr))) {
+    // 開いているデバイスにはすぐに反映される (ほかのコントロールはストリーミング中に変更できないことがあるため含めない)
+    g_object_set(encoder, "extra-controls", controls, nullptr);
+    gst_structure_free(controls);
+  }
 
-  // フレームフラグを設定 (デルタフレームかキーフレームか)
-  isDelta = GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+  gst_object_unref(encoder);
+  DLOGI("video encoder bitrate: %u", bitrate);
+}
 
-  // セグメントを取得
-  segment = gst_sample_get_segment(sample);
+/**
+ * @brief コーデックのビットレートを取得する (bps、0の場合はエンコーダーのデフォルト値)
+ */
+UINT32 getVideoCodecBitrate(PKvsWebrtcConfig pKvsWebrtcConfig, VideoCodecType codec)
+{
+  // H.265は同等の画質をH.264より低いビットレートで得られる
+  return codec == VIDEO_CODEC_TYPE_H265 ? pKvsWebrtcConfig->videoTargetBitrate * H265_BITRATE_PERCENT / 100 : pKvsWebrtcConfig->videoTargetBitrate;
+}
 
-  // ランニングタイムを取得して100ナノ秒単位に変換
-  ptsHundredsNanos = gst_segment_to_running_time(segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer)) / 100;
+/**
+ * @brief 追加のコーデックのエンコーダーのビットレートを変更する
+ */
+VOID setVideoCodecBranchBitrate(VideoCodecBranch& branch)
+{
+  auto bitrate = getVideoCodecBitrate(branch.pKvsWebrtcConfig, branch.codec);
+  GstElement* encoder;
+  GstStructure* controls;
 
-  // フレーム長を取得して100ナノ秒単位に変換
-  duration = GST_BUFFER_DURATION(buffer);
-  if (GST_CLOCK_TIME_IS_VALID(duration)) {
-    durationHundredsNanos = duration / 100;
+  if (bitrate == 0 || !branch.bin ||
+      !(encoder = gst_bin_get_by_name(GST_BIN(branch.bin), (std::string("video-encoder-") + getVideoCodecName(branch.codec)).c_str()))) {
+    return;
   }
 
-  // フレームを初期化
-  MEMSET(&frame, 0, SIZEOF(Frame));
-  frame.version = FRAME_CURRENT_VERSION;
-  frame.flags = isDelta ? FRAME_FLAG_NONE : FRAME_FLAG_KEY_FRAME;
-  frame.duration = durationHundredsNanos;
-  frame.size = static_cast<UINT32>(info.size);
-  frame.frameData = info.data;
-  frame.trackId = trackId;
+  if (branch.encoder == "x265enc") {
+    // ビットレートはkbps単位
+    g_object_set(encoder, "bitrate", static_cast<guint>(bitrate / 1000), nullptr);
+  } else if (branch.encoder == "v4l2h265enc") {
+    if ((controls = gst_structure_from_string(("encode,video_bitrate=" + std::to_string(bitrate)).c_str(), nullptr))) {
+      g_object_set(encoder, "extra-controls", controls, nullptr);
+      gst_structure_free(controls);
+    }
+  } else {
+    g_object_set(encoder, "target-bitrate", static_cast<gint>(bitrate), nullptr);
+  }
 
-  // ロックを開始
-  MUTEX_LOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  gst_object_unref(encoder);
+  DLOGI("%s encoder bitrate: %u", getVideoCodecName(branch.codec), bitrate);
+}
 
-  // 全セッションにフレームを送信
-  for (auto&& value : pKvsWebrtcConfig->streamingSessions) {
-    // 終了していないセッションにのみ送信
-    if (!ATOMIC_LOAD_BOOL(&value.second->isTerminated)) {
-      // フレームインデックスを設定
-      frame.index = static_cast<UINT32>(ATOMIC_INCREMENT(&value.second->frameIndex));
+/**
+ * @brief 映像のエンコーダーにキーフレームを要求する
+ *
+ * H.264と実行中の追加のコーデックのエンコーダーに要求する。
+ */
+VOID requestVideoKeyFrame(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  if (!pKvsWebrtcConfig->sendPipeline) {
+    return;
+  }
 
-      // トラックIDに応じてトランシーバーとタイムスタンプを選択
-      // ビデオは到着時刻ベース、オーディオはPTSベースのタイムスタンプを使用
-      if (trackId == DEFAULT_VIDEO_TRACK_ID) {
-        pRtcRtpTransceiver = value.second->pVideoRtcRtpTransceiver;
-        frame.presentationTs = GETTIME();
-        frame.decodingTs = frame.presentationTs;
-      } else {
-        pRtcRtpTransceiver = value.second->pAudioRtcRtpTransceiver;
-        frame.presentationTs = ptsHundredsNanos;
-        frame.decodingTs = frame.presentationTs;
-      }
+  sendForceKeyUnit(pKvsWebrtcConfig->sendPipeline, "video-encoder");
+  for (auto& branch : pKvsWebrtcConfig->videoCodecBranches) {
+    requestVideoCodecBranchKeyFrame(branch);
+  }
+}
 
-      // フレームを送信
-      auto status = writeFrame(pRtcRtpTransceiver, &frame);
-      if (STATUS_FAILED(status) && status != STATUS_SRTP_NOT_READY_YET) {
-        DLOGV("writeFrame failed: 0x%08x", status);
-      }
+/**
+ * @brief 追加のコーデックのエンコーダーにキーフレームを要求する (実行中の場合のみ、ほかのコーデックの経路には要求しない)
+ */
+VOID requestVideoCodecBranchKeyFrame(VideoCodecBranch& branch)
+{
+  if (branch.codec == VIDEO_CODEC_TYPE_H264 || ATOMIC_LOAD(&branch.state) != VIDEO_CODEC_BRANCH_RUNNING || !branch.pKvsWebrtcConfig->sendPipeline) {
+    return;
+  }
+
+  sendForceKeyUnit(branch.pKvsWebrtcConfig->sendPipeline, (std::string("video-encoder-") + getVideoCodecName(branch.codec)).c_str());
+}
+
+/**
+ * @brief 名前で指定したエンコーダーに強制キーフレームのイベントを送る
+ *
+ * 下流からの強制キーフレームのイベント (GstForceKeyUnit) を送る。エンコーダーがない場合は何もしない。
+ */
+VOID sendForceKeyUnit(GstElement* pipeline, const CHAR* pName)
+{
+  GstElement* encoder;
+  GstEvent* event;
+
+  if (!(encoder = gst_bin_get_by_name(GST_BIN(pipeline), pName))) {
+    return;
+  }
+  event = gst_event_new_custom(GST_EVENT_CUSTOM_UPSTREAM,
+                               gst_structure_new("GstForceKeyUnit",
+                                                 "running-time",
+                                                 G_TYPE_UINT64,
+                                                 GST_CLOCK_TIME_NONE,
+                                                 "all-headers",
+                                                 G_TYPE_BOOLEAN,
+                                                 TRUE,
+                                                 "count",
+                                                 G_TYPE_UINT,
+                                                 0,
+                                                 nullptr));
+  gst_element_send_event(encoder, event);
+  gst_object_unref(encoder);
+}
+
+/**
+ * @brief チャネルのストリーミングスレッドのCPU時間の合計を取得する (ティック)
+ */
+UINT64 getGstThreadsCpuTicks(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  UINT64 cpuTicks, totalCpuTicks = 0;
+
+  if (!IS_VALID_MUTEX_VALUE(pKvsWebrtcConfig->gstThreadLock)) {
+    return 0;
+  }
+
+  MUTEX_LOCK(pKvsWebrtcConfig->gstThreadLock);
+  for (auto&& [threadId, threadStats] : pKvsWebrtcConfig->gstThreads) {
+    if (getThreadCpuTicks(threadId, cpuTicks)) {
+      totalCpuTicks += cpuTicks;
     }
   }
+  MUTEX_UNLOCK(pKvsWebrtcConfig->gstThreadLock);
 
-  // ロックを解除
-  MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+  return totalCpuTicks;
+}
 
-CleanUp:
+/**
+ * @brief 解像度とフレームレートの適応のメトリクスを出力する (設定オブジェクトのロックを保持して呼び出す)
+ *
+ * 切り替え以降の平均を出力するため、切り替え前のログと比較できる。
+ */
+VOID logVideoScalingStats(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  UINT32 width, height, framerate;
+  UINT64 cpuTicks;
+  DOUBLE elapsed;
 
-  // バッファのマップを解除
-  if (info.data) {
-    gst_buffer_unmap(buffer, &info);
+  if (!pKvsWebrtcConfig->videoScaleCaps) {
+    return;
   }
 
-  // サンプルの参照を解放
-  if (sample) {
-    gst_sample_unref(sample);
+  getVideoScalingSize(pKvsWebrtcConfig, pKvsWebrtcConfig->videoScaleLevel, width, height, framerate);
+  elapsed = static_cast<DOUBLE>(MAX(GETTIME() - pKvsWebrtcConfig->videoScaleChangeTime, 1ULL)) / HUNDREDS_OF_NANOS_IN_A_SECOND;
+  cpuTicks = getGstThreadsCpuTicks(pKvsWebrtcConfig);
+  DLOGP("video scaling: %ux%u@%u (level %u), since change: %.1f s, cpu: %.1f %%, bitrate: %.2f kbps, changes: %zu",
+        width,
+        height,
+        framerate,
+        pKvsWebrtcConfig->videoScaleLevel,
+        elapsed,
+        static_cast<DOUBLE>(cpuTicks > pKvsWebrtcConfig->videoScaleCpuTicks ? cpuTicks - pKvsWebrtcConfig->videoScaleCpuTicks : 0) /
+          sysconf(_SC_CLK_TCK) / elapsed * 100.0,
+        static_cast<DOUBLE>(ATOMIC_LOAD(&pKvsWebrtcConfig->videoScaleEncodedBytes)) * 8 / 1000 / elapsed,
+        ATOMIC_LOAD(&pKvsWebrtcConfig->videoScaleChanges));
+}
+
+// ============================================================================
+// キーフレーム間隔の適応
+// ============================================================================
+
+/**
+ * @brief キーフレーム間隔の制御を初期化する
+ *
+ * エンコードする場合のみ制御する。フレームバスに書き込む場合はワーカーのビューアーの参加が見えないため制御しない。
+ */
+STATUS initGopSettings(PKvsWebrtcConfig pKvsWebrtcConfig)
+{
+  auto retStatus = STATUS_SUCCESS;
+  UINT32 gopMin, gopMax;
+
+  // NULLチェック
+  CHK(pKvsWebrtcConfig, STATUS_NULL_ARG);
+
+  pKvsWebrtcConfig->gopAdaptive = getChannelEnvBool(pKvsWebrtcConfig, GOP_ADAPTIVE_ENV_VAR, TRUE) && pKvsWebrtcConfig->inputMode != INPUT_MODE_FILE &&
+                                  pKvsWebrtcConfig->inputMode != INPUT_MODE_BUS && !pKvsWebrtcConfig->pSendPipeline &&
+                                  !getChannelEnv(pKvsWebrtcConfig, FRAME_BUS_SOCKET_ENV_VAR);
+
+  // 最小値と最大値 (ミリ秒)
+  gopMin = getChannelEnvUint32(pKvsWebrtcConfig, GOP_MIN_ENV_VAR, DEFAULT_GOP_MIN_MS);
+  gopMax = getChannelEnvUint32(pKvsWebrtcConfig, GOP_MAX_ENV_VAR, DEFAULT_GOP_MAX_MS);
+  CHK_ERR(gopMin > 0 && gopMin <= gopMax, STATUS_INVALID_ARG, "環境変数「%s」と「%s」の値が不正です。", GOP_MIN_ENV_VAR, GOP_MAX_ENV_VAR);
+  pKvsWebrtcConfig->gopMinDuration = static_cast<UINT64>(gopMin) * HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+  pKvsWebrtcConfig->gopMaxDuration = static_cast<UINT64>(gopMax) * HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+
+  // 開始直後はビューアーが参加するため最小値から始める
+  pKvsWebrtcConfig->gopDuration = pKvsWebrtcConfig->gopMinDuration;
+  pKvsWebrtcConfig->lastGopAdaptTime = GETTIME();
+  pKvsWebrtcConfig->gopJoins = 0;
+  pKvsWebrtcConfig->gopJoinRate = 0;
+  pKvsWebrtcConfig->gopPliRate = 0;
+  pKvsWebrtcConfig->gopChanges = 0;
+
+  // コーデックごとのキーフレーム (H.264と追加のコーデックの経路はそれぞれのキーフレームから間隔を数える)
+  for (auto& branch : pKvsWebrtcConfig->videoCodecBranches) {
+    branch.lastKeyFrameTime = 0;
+    branch.lastKeyFrameRequestTime = 0;
+    branch.keyFrames = 0;
+    branch.keyFrameBytes = 0;
+    branch.deltaFrames = 0;
+    branch.deltaFrameBytes = 0;
+    branch.requestedKeyFrames = 0;
   }
 
-  // 終了フラグが立っていたらEOSを返す
-  if (ATOMIC_LOAD_BOOL(&pKvsWebrtcConfig->isTerminated)) {
-    ret = GST_FLOW_EOS;
+CleanUp:
+
+  return retStatus;
+}
+
+/**
+ * @brief 送信した映像のフレームをコーデックごとに記録し、キーフレーム間隔を過ぎた場合はそのコーデックのエンコーダーにキーフレームを要求する
+ *
+ * エンコーダー自身のキーフレーム間隔は最大値の2倍にしておき、キーフレームはこの関数の要求で挿入する
+ * (エンコーダーによってはストリーミング中にキーフレーム間隔のプロパティを変更できないため)。
+ * キーフレーム間隔は全コーデックで共有し、経過時間はコーデックごとの最後のキーフレームから数える。
+ * 設定オブジェクトのロックを保持して呼び出す。
+ */
+VOID onGopVideoFrame(PKvsWebrtcConfig pKvsWebrtcConfig, VideoCodecBranch& branch, const Frame& frame)
+{
+  auto now = GETTIME();
+
+  // キーフレームとデルタフレームのサイズ
+  if (frame.flags & FRAME_FLAG_KEY_FRAME) {
+    branch.keyFrames++;
+    branch.keyFrameBytes += frame.size;
+    branch.lastKeyFrameTime = now;
+  } else {
+    branch.deltaFrames++;
+    branch.deltaFrameBytes += frame.size;
   }
 
-  return ret;
+  if (!pKvsWebrtcConfig->gopAdaptive || !pKvsWebrtcConfig->sendPipeline) {
+    return;
+  }
+
+  // 最後のキーフレームと要求からキーフレーム間隔が過ぎた場合に要求 (要求が届くまでの間に重ねて要求しない)
+  if (now - branch.lastKeyFrameTime >= pKvsWebrtcConfig->gopDuration && now - branch.lastKeyFrameRequestTime >= pKvsWebrtcConfig->gopDuration) {
+    branch.lastKeyFrameRequestTime = now;
+    branch.requestedKeyFrames++;
+    if (branch.codec == VIDEO_CODEC_TYPE_H264) {
+      sendForceKeyUnit(pKvsWebrtcConfig->sendPipeline, "video-encoder");
+    } else {
+      requestVideoCodecBranchKeyFrame(branch);
+    }
+  }
 }
 
 /**
- * @brief Videoサンプルを受信した際のコールバック
+ * @brief 参加とPLIのレートからキーフレーム間隔を決める
+ *
+ * 新しいビューアーとPLIを送ったビューアーは次のキーフレームまで映像を表示できないため、
+ * 参加とPLIが多い間は短くし、ビューアーが安定している間は長くして帯域を節約する。
+ * キーフレーム間隔は参加とPLIの平均間隔の半分とし、短くする方向はすぐに、長くする方向は少しずつ変更する。
+ * PLIとFIRの累計はadaptToSessionStatsで取得したものを使用する。設定オブジェクトのロックを保持して呼び出すこと。
  */
-GstFlowReturn onNewSampleVideo(GstElement* sink, gpointer data)
+VOID adaptGop(PKvsWebrtcConfig pKvsWebrtcConfig, const std::vector<SessionLinkStats>& sessionStats)
 {
-  return onNewSample(sink, data, DEFAULT_VIDEO_TRACK_ID);
+  auto now = GETTIME();
+  auto elapsedMinutes = static_cast<DOUBLE>(MAX(now - pKvsWebrtcConfig->lastGopAdaptTime, 1ULL)) / (60 * HUNDREDS_OF_NANOS_IN_A_SECOND);
+  auto joins = ATOMIC_EXCHANGE(&pKvsWebrtcConfig->gopJoins, 0);
+  auto current = pKvsWebrtcConfig->gopDuration;
+  UINT64 plis = 0, target;
+  DOUBLE eventRate;
+
+  // 前回からビューアーが受信したPLIとFIRの数
+  for (auto&& stats : sessionStats) {
+    auto pStreamingSession = stats.pStreamingSession;
+    if (!stats.hasPliCount) {
+      continue;
+    }
+
+    if (stats.pliCount > pStreamingSession->lastPliCount) {
+      plis += stats.pliCount - pStreamingSession->lastPliCount;
+    }
+    pStreamingSession->lastPliCount = stats.pliCount;
+  }
+
+  // 平滑化したレート (1分あたり)
+  pKvsWebrtcConfig->gopJoinRate = GOP_RATE_SMOOTHING * joins / elapsedMinutes + (1.0 - GOP_RATE_SMOOTHING) * pKvsWebrtcConfig->gopJoinRate;
+  pKvsWebrtcConfig->gopPliRate = GOP_RATE_SMOOTHING * plis / elapsedMinutes + (1.0 - GOP_RATE_SMOOTHING) * pKvsWebrtcConfig->gopPliRate;
+  pKvsWebrtcConfig->lastGopAdaptTime = now;
+
+  // 参加とPLIの平均間隔に対する比 (1秒あたりのレートから求める)
+  eventRate = (pKvsWebrtcConfig->gopJoinRate + pKvsWebrtcConfig->gopPliRate) / 60.0;
+  target = eventRate > 0 && GOP_EVENT_INTERVAL_RATIO / eventRate * HUNDREDS_OF_NANOS_IN_A_SECOND < pKvsWebrtcConfig->gopMaxDuration
+    ? static_cast<UINT64>(GOP_EVENT_INTERVAL_RATIO / eventRate * HUNDREDS_OF_NANOS_IN_A_SECOND)
+    : pKvsWebrtcConfig->gopMaxDuration;
+
+  // 長くする方向は少しずつ変更し、100ミリ秒単位に丸めて範囲内に収める
+  if (target > current) {
+    target = MIN(target, static_cast<UINT64>(current * GOP_LENGTHEN_RATIO));
+  }
+  target = target / (100 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND) * (100 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND);
+  target = MIN(MAX(target, pKvsWebrtcConfig->gopMinDuration), pKvsWebrtcConfig->gopMaxDuration);
+
+  if (target == current) {
+    return;
+  }
+
+  DLOGI("GOP %.1f s -> %.1f s (joins: %.2f/min, plis: %.2f/min)",
+        static_cast<DOUBLE>(current) / HUNDREDS_OF_NANOS_IN_A_SECOND,
+        static_cast<DOUBLE>(target) / HUNDREDS_OF_NANOS_IN_A_SECOND,
+        pKvsWebrtcConfig->gopJoinRate,
+        pKvsWebrtcConfig->gopPliRate);
+  pKvsWebrtcConfig->gopDuration = target;
+  ATOMIC_INCREMENT(&pKvsWebrtcConfig->gopChanges);
 }
 
 /**
- * @brief Audioサンプルを受信した際のコールバック
+ * @brief キーフレーム間隔の適応のメトリクスを出力する (設定オブジェクトのロックを保持して呼び出す)
+ *
+ * 節約した帯域は、最小のキーフレーム間隔で固定した場合に増えるキーフレームの数と、
+ * キーフレームとデルタフレームの平均サイズの差から見積もる。
  */
-GstFlowReturn onNewSampleAudio(GstElement* sink, gpointer data)
+VOID logGopStats(PKvsWebrtcConfig pKvsWebrtcConfig)
 {
-  return onNewSample(sink, data, DEFAULT_AUDIO_TRACK_ID);
+  DOUBLE interval, keyFrameSize, deltaFrameSize, minGop, savedKeyFrames, savedBitrate;
+
+  if (!pKvsWebrtcConfig->gopAdaptive) {
+    return;
+  }
+
+  // 出力間隔 (秒) と最小のキーフレーム間隔
+  interval = static_cast<DOUBLE>(MAX(GETTIME() - pKvsWebrtcConfig->lastMetricsTime, 1ULL)) / HUNDREDS_OF_NANOS_IN_A_SECOND;
+  minGop = static_cast<DOUBLE>(pKvsWebrtcConfig->gopMinDuration) / HUNDREDS_OF_NANOS_IN_A_SECOND;
+
+  DLOGP("gop: %.1f s, joins: %.2f/min, plis: %.2f/min, changes: %zu",
+        static_cast<DOUBLE>(pKvsWebrtcConfig->gopDuration) / HUNDREDS_OF_NANOS_IN_A_SECOND,
+        pKvsWebrtcConfig->gopJoinRate,
+        pKvsWebrtcConfig->gopPliRate,
+        ATOMIC_EXCHANGE(&pKvsWebrtcConfig->gopChanges, 0));
+
+  // コーデックごとのキーフレーム (前回の出力以降にフレームを送信したコーデックのみ)
+  for (auto& branch : pKvsWebrtcConfig->videoCodecBranches) {
+    if (branch.keyFrames + branch.deltaFrames == 0) {
+      continue;
+    }
+
+    keyFrameSize = branch.keyFrames > 0 ? static_cast<DOUBLE>(branch.keyFrameBytes) / branch.keyFrames : 0.0;
+    deltaFrameSize = branch.deltaFrames > 0 ? static_cast<DOUBLE>(branch.deltaFrameBytes) / branch.deltaFrames : 0.0;
+
+    // 最小のキーフレーム間隔で固定した場合との差
+    savedBitrate = 0;
+    savedKeyFrames = interval / minGop - branch.keyFrames;
+    if (savedKeyFrames > 0 && keyFrameSize > deltaFrameSize) {
+      savedBitrate = savedKeyFrames * (keyFrameSize - deltaFrameSize) * 8 / 1000 / interval;
+    }
+
+    DLOGP("gop %s: keyframes: %zu (requested: %zu), avg keyframe: %.2f KB, avg delta: %.2f KB, keyframe share: %.1f%%, saved vs %.1f s gop: %.2f kbps",
+          getVideoCodecName(branch.codec),
+          branch.keyFrames,
+          branch.requestedKeyFrames,
+          keyFrameSize / 1024,
+          deltaFrameSize / 1024,
+          branch.keyFrameBytes + branch.deltaFrameBytes > 0
+            ? static_cast<DOUBLE>(branch.keyFrameBytes) / (branch.keyFrameBytes + branch.deltaFrameBytes) * 100.0
+            : 0.0,
+          minGop,
+          savedBitrate);
+
+    branch.keyFrames = 0;
+    branch.keyFrameBytes = 0;
+    branch.deltaFrames = 0;
+    branch.deltaFrameBytes = 0;
+    branch.requestedKeyFrames = 0;
+  }
 }
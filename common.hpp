@@ -3,10 +3,15 @@
 
 #include <gst/gst.h>
 #include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <opus.h>
 #include <com/amazonaws/kinesis/video/webrtcclient/Include.h>
+#include <deque>
 #include <unordered_map>
 #include <string>
 #include <memory>
+#include <vector>
+#include <sched.h>
 
 #define IOT_CORE_CREDENTIAL_ENDPOINT "AWS_IOT_CORE_CREDENTIAL_ENDPOINT"
 #define IOT_CORE_CERT                "AWS_IOT_CORE_CERT"
@@ -25,278 +30,2838 @@
 #define VIDEO_TRACK_ID "kvsWebrtcVideoTrack"
 #define AUDIO_TRACK_ID "kvsWebrtcAudioTrack"
 
+#define LATENCY_SEI_ENV_VAR      "KVS_WEBRTC_LATENCY_SEI"
+#define METRICS_INTERVAL_ENV_VAR "KVS_WEBRTC_METRICS_INTERVAL"
+#define INPUT_MODE_ENV_VAR       "KVS_WEBRTC_INPUT"
+#define VIDEO_FILE_ENV_VAR       "KVS_WEBRTC_VIDEO_FILE"
+#define AUDIO_FILE_ENV_VAR       "KVS_WEBRTC_AUDIO_FILE"
+#define TEST_PATTERN_ENV_VAR     "KVS_WEBRTC_TEST_PATTERN"
+#define VIDEO_BITRATE_ENV_VAR    "KVS_WEBRTC_VIDEO_BITRATE"
+#define AUDIO_BITRATE_ENV_VAR    "KVS_WEBRTC_AUDIO_BITRATE"
+#define CONFIG_FILE_ENV_VAR      "KVS_WEBRTC_CONFIG_FILE"
+#define PRESET_ENV_VAR           "KVS_WEBRTC_PRESET"
+#define SEND_PIPELINE_ENV_VAR    "KVS_WEBRTC_SEND_PIPELINE"
+#define VIDEO_DEVICE_ENV_VAR     "KVS_WEBRTC_VIDEO_DEVICE"
+#define AUDIO_DEVICE_ENV_VAR     "KVS_WEBRTC_AUDIO_DEVICE"
+#define VIDEO_WIDTH_ENV_VAR      "KVS_WEBRTC_VIDEO_WIDTH"
+#define VIDEO_HEIGHT_ENV_VAR     "KVS_WEBRTC_VIDEO_HEIGHT"
+#define VIDEO_FRAMERATE_ENV_VAR  "KVS_WEBRTC_VIDEO_FRAMERATE"
+#define VIDEO_ENCODER_ENV_VAR    "KVS_WEBRTC_VIDEO_ENCODER"
+#define V4L2_CONTROLS_ENV_VAR    "KVS_WEBRTC_V4L2_CONTROLS"
+#define V4L2_H265_CONTROLS_ENV_VAR "KVS_WEBRTC_V4L2_H265_CONTROLS"
+#define VIDEO_QUEUE_SIZE_ENV_VAR "KVS_WEBRTC_VIDEO_QUEUE_SIZE"
+#define AUDIO_QUEUE_SIZE_ENV_VAR "KVS_WEBRTC_AUDIO_QUEUE_SIZE"
+#define VIDEO_ENCODER_CACHE_FILE_ENV_VAR "KVS_WEBRTC_VIDEO_ENCODER_CACHE_FILE"
+#define CLOCK_OVERLAY_ENV_VAR    "KVS_WEBRTC_CLOCK_OVERLAY"
+#define PACING_RATE_ENV_VAR      "KVS_WEBRTC_PACING_RATE"
+#define PACING_BURST_ENV_VAR     "KVS_WEBRTC_PACING_BURST"
+#define PACING_MAX_DELAY_ENV_VAR "KVS_WEBRTC_PACING_MAX_DELAY"
+#define FRAME_BUS_SOCKET_ENV_VAR    "KVS_WEBRTC_FRAME_BUS_SOCKET"
+#define FRAME_BUS_SLOTS_ENV_VAR     "KVS_WEBRTC_FRAME_BUS_SLOTS"
+#define FRAME_BUS_SLOT_SIZE_ENV_VAR "KVS_WEBRTC_FRAME_BUS_SLOT_SIZE"
+#define CAPTURE_CPUS_ENV_VAR       "KVS_WEBRTC_CAPTURE_CPUS"
+#define CAPTURE_SCHED_ENV_VAR      "KVS_WEBRTC_CAPTURE_SCHED"
+#define ENCODE_CPUS_ENV_VAR        "KVS_WEBRTC_ENCODE_CPUS"
+#define ENCODE_SCHED_ENV_VAR       "KVS_WEBRTC_ENCODE_SCHED"
+#define FANOUT_CPUS_ENV_VAR        "KVS_WEBRTC_FANOUT_CPUS"
+#define FANOUT_SCHED_ENV_VAR       "KVS_WEBRTC_FANOUT_SCHED"
+#define SIGNALING_CPUS_ENV_VAR     "KVS_WEBRTC_SIGNALING_CPUS"
+#define SIGNALING_SCHED_ENV_VAR    "KVS_WEBRTC_SIGNALING_SCHED"
+#define RECORD_CPUS_ENV_VAR        "KVS_WEBRTC_RECORD_CPUS"
+#define RECORD_SCHED_ENV_VAR       "KVS_WEBRTC_RECORD_SCHED"
+#define ALLOCATION_STATS_ENV_VAR   "KVS_WEBRTC_ALLOCATION_STATS"
+#define MAX_SESSIONS_ENV_VAR         "KVS_WEBRTC_MAX_SESSIONS"
+#define MAX_CPU_ENV_VAR              "KVS_WEBRTC_MAX_CPU"
+#define MAX_EGRESS_BITRATE_ENV_VAR   "KVS_WEBRTC_MAX_EGRESS_BITRATE"
+#define MAX_RSS_ENV_VAR              "KVS_WEBRTC_MAX_RSS"
+#define ADMISSION_POLICY_ENV_VAR     "KVS_WEBRTC_ADMISSION_POLICY"
+#define SESSION_IDLE_TIMEOUT_ENV_VAR "KVS_WEBRTC_SESSION_IDLE_TIMEOUT"
+#define DISCONNECT_GRACE_ENV_VAR     "KVS_WEBRTC_DISCONNECT_GRACE"
+#define ASYNC_LOG_ENV_VAR            "KVS_WEBRTC_ASYNC_LOG"
+#define ASYNC_LOG_RING_SIZE_ENV_VAR  "KVS_WEBRTC_ASYNC_LOG_RING_SIZE"
+#define LOG_RATE_LIMIT_ENV_VAR       "KVS_WEBRTC_LOG_RATE_LIMIT"
+#define TALKBACK_ENV_VAR             "KVS_WEBRTC_TALKBACK"
+#define TALKBACK_SINK_ENV_VAR        "KVS_WEBRTC_TALKBACK_SINK"
+#define TALKBACK_MIN_DELAY_ENV_VAR   "KVS_WEBRTC_TALKBACK_MIN_DELAY"
+#define TALKBACK_MAX_DELAY_ENV_VAR   "KVS_WEBRTC_TALKBACK_MAX_DELAY"
+#define TALKBACK_MAX_SOURCES_ENV_VAR "KVS_WEBRTC_TALKBACK_MAX_SOURCES"
+#define TALKBACK_GAIN_ENV_VAR        "KVS_WEBRTC_TALKBACK_GAIN"
+#define DATA_CHANNEL_ENV_VAR                 "KVS_WEBRTC_DATA_CHANNEL"
+#define DATA_CHANNEL_LABEL_ENV_VAR           "KVS_WEBRTC_DATA_CHANNEL_LABEL"
+#define DATA_CHANNEL_MAX_RETRANSMITS_ENV_VAR "KVS_WEBRTC_DATA_CHANNEL_MAX_RETRANSMITS"
+#define DATA_CHANNEL_PING_INTERVAL_ENV_VAR   "KVS_WEBRTC_DATA_CHANNEL_PING_INTERVAL"
+#define RECORD_DIR_ENV_VAR                   "KVS_WEBRTC_RECORD_DIR"
+#define RECORD_FORMAT_ENV_VAR                "KVS_WEBRTC_RECORD_FORMAT"
+#define RECORD_SEGMENT_DURATION_ENV_VAR      "KVS_WEBRTC_RECORD_SEGMENT_DURATION"
+#define RECORD_MAX_SEGMENTS_ENV_VAR          "KVS_WEBRTC_RECORD_MAX_SEGMENTS"
+#define RECORD_MAX_SIZE_ENV_VAR              "KVS_WEBRTC_RECORD_MAX_SIZE"
+#define RECORD_QUEUE_SIZE_ENV_VAR            "KVS_WEBRTC_RECORD_QUEUE_SIZE"
+#define AUDIO_PROFILE_ENV_VAR                "KVS_WEBRTC_AUDIO_PROFILE"
+#define AUDIO_ADAPTIVE_ENV_VAR               "KVS_WEBRTC_AUDIO_ADAPTIVE"
+#define VIDEO_CODECS_ENV_VAR                 "KVS_WEBRTC_VIDEO_CODECS"
+#define VIDEO_SCALING_ENV_VAR                "KVS_WEBRTC_VIDEO_SCALING"
+#define GOP_ADAPTIVE_ENV_VAR                 "KVS_WEBRTC_GOP_ADAPTIVE"
+#define GOP_MIN_ENV_VAR                      "KVS_WEBRTC_GOP_MIN"
+#define GOP_MAX_ENV_VAR                      "KVS_WEBRTC_GOP_MAX"
+
+// テスト入力のデフォルト値
+#define DEFAULT_TEST_PATTERN       "smpte"
+#define DEFAULT_TEST_VIDEO_BITRATE 1000000
+#define DEFAULT_TEST_AUDIO_BITRATE 64000
+
+// VIDEO_CODEC (profile-level-id=42e01f) のレベル3.1 (キャップスとv4l2h264encのh264_levelの表記) と上限
+#define H264_LEVEL_CAPS         "3.1"
+#define H264_LEVEL_V4L2         "31"
+#define H264_LEVEL_3_1_MAX_FS   3600
+#define H264_LEVEL_3_1_MAX_MBPS 108000
+
+// 送信用パイプラインのデフォルト値
+#define DEFAULT_AUDIO_DEVICE     "plughw:CARD=WEBCAM,DEV=0"
+#define DEFAULT_VIDEO_WIDTH      640
+#define DEFAULT_VIDEO_HEIGHT     480
+#define DEFAULT_VIDEO_FRAMERATE  30
+#define DEFAULT_VIDEO_ENCODER    VIDEO_ENCODER_AUTO
+#define DEFAULT_V4L2_CONTROLS    "encode,h264_profile=0,h264_level=" H264_LEVEL_V4L2
+#define DEFAULT_V4L2_H265_CONTROLS "encode"
+#define DEFAULT_VIDEO_QUEUE_SIZE 240
+#define DEFAULT_AUDIO_QUEUE_SIZE 400
+
+// 低遅延の音声プロファイルのキューのサイズ、受信用パイプラインのジッタバッファの遅延 (ミリ秒)、キャプチャの周期とバッファ (マイクロ秒)
+#define LOW_LATENCY_AUDIO_QUEUE_SIZE         4
+#define LOW_LATENCY_RTPBIN_LATENCY_MS        20
+#define LOW_LATENCY_ALSA_LATENCY_TIME_US     5000
+#define LOW_LATENCY_ALSA_BUFFER_TIME_US      20000
+#define LOW_LATENCY_TEST_SAMPLES_PER_BUFFER  240
+
+// Opusのフレーム長 (ミリ秒、低遅延プロファイル、通常、損失やRTTが大きい場合)
+#define OPUS_FRAME_SIZE_LOW_LATENCY 10
+#define OPUS_FRAME_SIZE_DEFAULT     20
+#define OPUS_FRAME_SIZE_LOSSY       40
+
+// Opusの設定を見直す間隔と損失率・RTTの平滑化係数 (新しい値の重み)
+#define AUDIO_ADAPT_INTERVAL  (2 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+#define AUDIO_ADAPT_SMOOTHING 0.5
+
+// FECを有効にする損失率と無効に戻す損失率 (パーセント)
+#define AUDIO_FEC_ENABLE_LOSS  2.0
+#define AUDIO_FEC_DISABLE_LOSS 1.0
+
+// DTXを無効にしてフレーム長を延ばす損失率とRTT (ミリ秒)、元に戻す損失率とRTT
+#define AUDIO_HIGH_LOSS         10.0
+#define AUDIO_HIGH_LOSS_RECOVER 5.0
+#define AUDIO_HIGH_RTT          300.0
+#define AUDIO_HIGH_RTT_RECOVER  200.0
+
+// エンコーダーに設定する想定損失率の上限 (パーセント) とFECを有効にする場合のビットレートの下限 (bps)
+#define AUDIO_MAX_EXPECTED_LOSS 25
+#define AUDIO_FEC_MIN_BITRATE   24000
+
+// 音声のキャプチャ時刻を保持する数 (受信用パイプラインのキューに入る数より多くする)
+#define AUDIO_LATENCY_RECORDS 512
+
+// 映像コーデックの優先順位のデフォルト値 (H.264は送信用パイプラインで常にエンコードするためVP8より優先する)
+#define DEFAULT_VIDEO_CODECS "h265,h264,vp8"
+
+// H.265のビットレート (同じ画質のH.264に対する割合、パーセント)
+#define H265_BITRATE_PERCENT 60
+
+// 追加のコーデックのキーフレーム間隔 (秒、キーフレーム間隔を制御しない場合) とキューのサイズ (バッファ数)
+#define VIDEO_CODEC_BRANCH_KEYFRAME_INTERVAL 2
+#define VIDEO_CODEC_BRANCH_QUEUE_SIZE        2
+
+// 解像度とフレームレートを見直す間隔と、下げる方向に切り替える最小の間隔 (切り替えごとにキーフレームになるため)
+#define VIDEO_SCALING_INTERVAL          (2 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+#define VIDEO_SCALING_DOWN_MIN_INTERVAL (10 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+
+// ビューアーの段を下げる映像の損失率と、段を上げる損失率 (パーセント) とその継続時間
+#define VIDEO_SCALING_LOSS_DOWN 8.0
+#define VIDEO_SCALING_LOSS_UP   2.0
+#define VIDEO_SCALING_UP_HOLD   (10 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+
+// 画素レートの比に対するビットレートの比の指数 (解像度を下げた分ほどはビットレートを下げない)
+#define VIDEO_SCALING_BITRATE_EXPONENT 0.75
+
+// キーフレーム間隔の最小値と最大値のデフォルト値 (ミリ秒)
+#define DEFAULT_GOP_MIN_MS 1000
+#define DEFAULT_GOP_MAX_MS 10000
+
+// キーフレーム間隔を見直す間隔と、参加とPLIのレートの平滑化係数 (新しい値の重み)
+#define GOP_ADAPT_INTERVAL  (2 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+#define GOP_RATE_SMOOTHING  0.3
+
+// 参加とPLIの平均間隔に対するキーフレーム間隔の比と、1回の見直しで延ばす上限の倍率
+#define GOP_EVENT_INTERVAL_RATIO 0.5
+#define GOP_LENGTHEN_RATIO       1.5
+
+// H.264エンコーダーの自動選択
+#define VIDEO_ENCODER_AUTO                   "auto"
+#define DEFAULT_VIDEO_ENCODER_CACHE_FILE     "./.kvsWebrtcVideoEncoderCache"
+#define VIDEO_ENCODER_PROBE_FRAMES           60
+#define VIDEO_ENCODER_PROBE_TIMEOUT_SECONDS  20
+#define VIDEO_ENCODER_PROBE_BASELINE_DURATION (200 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND)
+
+
+// 送信用パイプラインから受信用パイプラインへのRTP/RTCPのポート (チャネルごとに4ポート)
+#define RTP_PORT_BASE         50000
+#define RTP_PORTS_PER_CHANNEL 4
+
+// シグナリングメッセージとSDPのバッファプールで保持する空きバッファの上限
+#define SIGNALING_MESSAGE_POOL_MAX_FREE   8
+#define SESSION_DESCRIPTION_POOL_MAX_FREE 4
+
+// チャネル間で共有するスレッドプールのスレッド数
+#define HOST_THREADPOOL_MIN_THREADS 1
+#define HOST_THREADPOOL_MAX_THREADS 4
+
+// メトリクスの出力間隔のデフォルト値 (秒)
+#define DEFAULT_METRICS_INTERVAL_SECONDS 60
+
+// レイテンシ統計で保持するサンプル数
+#define LATENCY_STATS_CAPACITY 1024
+
+// レイテンシ計測用SEIのタイムスタンプ長 (1バイト7ビット×10バイト)
+#define LATENCY_SEI_TIMESTAMP_LEN 10
+
+// レイテンシ計測用SEIに埋め込むタイムスタンプの種類
+enum LatencySeiTimestamp : UINT32 {
+  // キャプチャ時刻
+  LATENCY_SEI_TIMESTAMP_CAPTURE = 0,
+
+  // appsinkへの到着時刻
+  LATENCY_SEI_TIMESTAMP_APPSINK,
+
+  // writeFrameの呼び出し時刻
+  LATENCY_SEI_TIMESTAMP_WRITE,
+
+  // タイムスタンプの数
+  LATENCY_SEI_TIMESTAMP_COUNT,
+};
+
+// フレームペーサーのデフォルト値 (レートは0の場合は無効)
+#define DEFAULT_PACING_RATE         0
+#define DEFAULT_PACING_BURST        16000
+#define DEFAULT_PACING_MAX_DELAY_MS 50
+
+// フレームバス (エンコード済みフレームの共有メモリのリングバッファ)
+#define FRAME_BUS_MAGIC             0x5355424d5246534bULL
+#define FRAME_BUS_VERSION           1
+#define FRAME_BUS_ALIGNMENT         64
+#define FRAME_BUS_NO_SEQUENCE       MAX_UINT64
+#define FRAME_BUS_WAIT_TIMEOUT_MS   100
+#define FRAME_BUS_RECONNECT_INTERVAL (1 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+#define DEFAULT_FRAME_BUS_SLOTS     64
+#define DEFAULT_FRAME_BUS_SLOT_SIZE (256 * 1024)
+
+// スレッドの役割
+enum ThreadRole : UINT32 {
+  // キャプチャ (ソースからキューまでのストリーミングスレッド)
+  THREAD_ROLE_CAPTURE = 0,
+
+  // エンコード (キュー以降のストリーミングスレッド)
+  THREAD_ROLE_ENCODE,
+
+  // 配信 (受信用パイプライン、フレームペーサー、フレームバスの読み出し)
+  THREAD_ROLE_FANOUT,
+
+  // シグナリング (メインスレッドとSDKのシグナリング/ICEのスレッド)
+  THREAD_ROLE_SIGNALING,
+
+  // 録画 (録画用パイプラインのストリーミングスレッド)
+  THREAD_ROLE_RECORD,
+
+  // 役割の数
+  THREAD_ROLE_COUNT,
+};
+
+// アドミッション制御のデフォルト値 (0の場合は制限しない)
+#define DEFAULT_MAX_SESSIONS                 0
+#define DEFAULT_MAX_CPU_PERCENT              0
+#define DEFAULT_MAX_EGRESS_BITRATE           0
+#define DEFAULT_MAX_RSS_MB                   0
+#define DEFAULT_SESSION_IDLE_TIMEOUT_SECONDS 15
+
+// 拒否したオファーのICE候補を無視する期間
+#define ADMISSION_REJECTED_PEER_TTL (30 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+
+// 切断 (DISCONNECTED) から終了するまでの猶予期間のデフォルト値 (ミリ秒、0の場合は即座に終了)
+#define DEFAULT_DISCONNECT_GRACE_MS 5000
+
+// 終了したセッションのクライアントIDを再接続時間の計測のために保持する期間
+#define RECONNECT_TRACKING_TTL (60 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+
+// 再接続時間の統計のサンプル数
+#define RECONNECT_STATS_CAPACITY 256
+
+// 予算を超えた場合の動作
+enum AdmissionPolicy : UINT32 {
+  // オファーを拒否
+  ADMISSION_POLICY_REJECT = 0,
+
+  // アイドルのセッションがあれば切断して受け入れる
+  ADMISSION_POLICY_EVICT_IDLE,
+
+  // アイドルのセッション、なければ最も古いセッションを切断して受け入れる
+  ADMISSION_POLICY_EVICT_OLDEST,
+};
+
+// アドミッション制御の結果
+enum AdmissionResult : UINT32 {
+  // 受け入れ
+  ADMISSION_RESULT_ADMITTED = 0,
+
+  // セッションを切断して受け入れ
+  ADMISSION_RESULT_EVICTED,
+
+  // セッション数の上限で拒否
+  ADMISSION_RESULT_REJECTED_SESSIONS,
+
+  // CPU使用率の上限で拒否
+  ADMISSION_RESULT_REJECTED_CPU,
+
+  // 送信ビットレートの上限で拒否
+  ADMISSION_RESULT_REJECTED_EGRESS,
+
+  // メモリの上限で拒否
+  ADMISSION_RESULT_REJECTED_MEMORY,
+
+  // 結果の数
+  ADMISSION_RESULT_COUNT,
+};
+
+// 非同期ロガーのスレッドごとのリングバッファのサイズのデフォルト値 (KiB) と最小値 (バイト、2のべき乗)
+#define DEFAULT_ASYNC_LOG_RING_SIZE_KB 128
+#define ASYNC_LOG_MIN_RING_SIZE        (4 * 1024)
+
+// 非同期ロガーが文字列の引数から取り込む最大長 (超えた部分は切り捨てる)
+#define ASYNC_LOG_MAX_STRING_LEN (16 * 1024)
+
+// 非同期ロガーの終了時に書き込み中のスレッドを待つ間隔
+#define ASYNC_LOG_STOP_POLL_INTERVAL (1 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND)
+
+// 呼び出し箇所ごとに1秒間に出力するログの上限のデフォルト値 (0の場合は制限しない)
+#define DEFAULT_LOG_RATE_LIMIT 20
+
+// トークバック (受信した音声の再生) のデフォルト値
+#define DEFAULT_TALKBACK_SINK         "autoaudiosink"
+#define DEFAULT_TALKBACK_MIN_DELAY_MS 20
+#define DEFAULT_TALKBACK_MAX_DELAY_MS 200
+#define DEFAULT_TALKBACK_MAX_SOURCES  4
+#define DEFAULT_TALKBACK_GAIN_PERCENT 100
+
+// 同時に再生する話者数とゲインの上限 (ゲインはQ14の16ビットに収まる範囲)
+#define TALKBACK_MAX_SOURCES       16
+#define TALKBACK_MAX_GAIN_PERCENT  199
+
+// デコードとミキシングの形式 (48kHz、ステレオ、16ビット)
+#define TALKBACK_SAMPLE_RATE 48000
+#define TALKBACK_CHANNELS    2
+
+// ゲインの固定小数点 (Q14)
+#define TALKBACK_GAIN_SHIFT 14
+#define TALKBACK_GAIN_UNITY (1 << TALKBACK_GAIN_SHIFT)
+
+// ミキサーが1回に出力するサンプル数 (10ミリ秒) と再生時刻より先に出力する時間
+#define TALKBACK_MIX_FRAMES 480
+#define TALKBACK_MIX_LEAD   (10 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND)
+
+// 話者ごとのデコード済みサンプルのリングバッファのサンプル数 (2のべき乗、約680ミリ秒)
+#define TALKBACK_SOURCE_RING_FRAMES 32768
+
+// Opusの1パケットの最大サンプル数 (120ミリ秒)
+#define TALKBACK_MAX_DECODE_FRAMES 5760
+
+// パケットロスを補間するフレーム数の上限 (超えた場合は無音とする)
+#define TALKBACK_MAX_CONCEALED_FRAMES 3
+
+// 無音とみなすピーク振幅 (約-54dBFS) とDTXのパケットサイズ
+#define TALKBACK_SILENCE_PEAK   64
+#define TALKBACK_DTX_PACKET_MAX 2
+
+// トークバックのバッファの先頭に返却先のバッファプールを格納する領域 (16バイトでアラインメントを保つ)
+#define TALKBACK_BUFFER_HEADER_SIZE 16
+
+// ミキサーの出力を格納するバッファのサイズとバッファプールで保持する空きバッファの上限
+#define TALKBACK_MIX_BUFFER_SIZE (TALKBACK_BUFFER_HEADER_SIZE + TALKBACK_MIX_FRAMES * TALKBACK_CHANNELS * SIZEOF(INT16))
+#define TALKBACK_POOL_MAX_FREE   16
+
+// 受信がなくなった話者を解放するまでの時間と、新しい発話 (トークスパート) とみなすフレームの間隔
+#define TALKBACK_SOURCE_IDLE_TIMEOUT (5 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+#define TALKBACK_TALKSPURT_GAP       (200 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND)
+
+// ジッタに対する目標遅延の倍率と、フレーム長が不明な場合のフレーム長
+#define TALKBACK_JITTER_MULTIPLIER      3
+#define TALKBACK_DEFAULT_FRAME_DURATION (20 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND)
+
+// データチャネルのメッセージの形式のバージョン、ヘッダーのサイズ、最大サイズ (ヘッダーを含む)、バッファプールで保持する空きバッファの上限
+#define DATA_CHANNEL_MESSAGE_VERSION       1
+#define DATA_CHANNEL_HEADER_SIZE           16
+#define DATA_CHANNEL_MAX_MESSAGE_SIZE      16384
+#define DATA_CHANNEL_MESSAGE_POOL_MAX_FREE 8
+
+// データチャネルの疎通確認の間隔のデフォルト値 (ミリ秒、0の場合は送信しない)
+#define DEFAULT_DATA_CHANNEL_PING_INTERVAL_MS 1000
+
+// データチャネルのメッセージのフラグ (応答)
+#define DATA_CHANNEL_FLAG_RESPONSE 0x01
+
+// 録画のセグメントの長さ (秒)、保持するセグメント数 (0の場合は制限しない)、ディスク使用量の上限 (MB)、書き込み待ちの上限 (KB) のデフォルト値
+#define DEFAULT_RECORD_SEGMENT_DURATION_SECONDS 60
+#define DEFAULT_RECORD_MAX_SEGMENTS             0
+#define DEFAULT_RECORD_MAX_SIZE_MB              1024
+#define DEFAULT_RECORD_QUEUE_SIZE_KB            8192
+
+// フレームバスから読み出す場合の録画の音声のキャップス (appsinkのキャップスが得られないため送信用パイプラインのエンコード設定に合わせる)
+#define RECORD_FRAME_BUS_AUDIO_CAPS "audio/x-opus,rate=48000,channels=2,channel-mapping-family=0"
+
+// 録画の終了時に最後のセグメントの書き込みを待つ時間
+#define RECORD_EOS_TIMEOUT (5 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+
+// データチャネルのコマンド
+enum DataChannelCommand : UINT16 {
+  // 疎通確認 (応答でRTTを計測する)
+  DATA_CHANNEL_COMMAND_PING = 0x0001,
+
+  // 送信元のトークバックのゲインの設定 (ペイロードはパーセントのUINT16)
+  DATA_CHANNEL_COMMAND_TALKBACK_GAIN = 0x0002,
+
+  // 送信元が必要とする映像の最大の幅、高さ、フレームレート (ペイロードはUINT16×3、0は制限なし)
+  DATA_CHANNEL_COMMAND_VIDEO_CONSTRAINTS = 0x0003,
+
+  // アプリケーションのコマンドの開始値
+  DATA_CHANNEL_COMMAND_USER = 0x0100,
+};
+
+// アロケーション統計でセッションごとに集計するスロット数 (0はセッションなし)
+#define ALLOCATION_SESSION_SLOTS 64
+
+// アロケーションを集計するサブシステム
+enum AllocationTag : UINT16 {
+  // 呼び出し元が不明 (SDKの内部スレッドなど)
+  ALLOCATION_TAG_OTHER = 0,
+
+  // シグナリング
+  ALLOCATION_TAG_SIGNALING,
+
+  // ピア接続 (ネゴシエーションと送信)
+  ALLOCATION_TAG_PEER_CONNECTION,
+
+  // サブシステムの数
+  ALLOCATION_TAG_COUNT,
+};
+
+// メディアクロックのオフセットを追従する係数の逆数 (遅れる方向への追従)
+#define MEDIA_CLOCK_DRIFT_SMOOTHING 256
+
+// トラックごとのオフセットを平滑化する係数の逆数 (A/Vオフセット計測用)
+#define MEDIA_CLOCK_TRACK_SMOOTHING 16
+
+// メディアクロックを再同期するオフセットの変化量 (100ナノ秒単位)
+#define MEDIA_CLOCK_RESYNC_THRESHOLD (1 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+
+// メディアクロックのトラック
+enum MediaClockTrack : UINT32 {
+  // ビデオ
+  MEDIA_CLOCK_TRACK_VIDEO = 0,
+
+  // オーディオ
+  MEDIA_CLOCK_TRACK_AUDIO,
+
+  // トラックの数
+  MEDIA_CLOCK_TRACK_COUNT,
+};
+
+struct KvsWebrtcHost;
+using PKvsWebrtcHost = KvsWebrtcHost*;
+
 struct KvsWebrtcConfig;
 using PKvsWebrtcConfig = KvsWebrtcConfig*;
 
-struct KvsWebrtcStreamingSession;
-using PKvsWebrtcStreamingSession = KvsWebrtcStreamingSession*;
+struct KvsWebrtcStreamingSession;
+using PKvsWebrtcStreamingSession = KvsWebrtcStreamingSession*;
+
+struct KvsWebrtcDataChannel;
+using PKvsWebrtcDataChannel = KvsWebrtcDataChannel*;
+
+// 音声のプロファイル
+enum AudioProfile : UINT32 {
+  // 通常 (20ミリ秒のフレーム)
+  AUDIO_PROFILE_DEFAULT = 0,
+
+  // 低遅延 (10ミリ秒のフレーム、小さいキュー)
+  AUDIO_PROFILE_LOW_LATENCY,
+};
+
+// 映像コーデック
+enum VideoCodecType : UINT32 {
+  // H.264 (送信用パイプラインの既定の経路)
+  VIDEO_CODEC_TYPE_H264 = 0,
+
+  // H.265 (オファーに含まれる場合に経路を追加)
+  VIDEO_CODEC_TYPE_H265,
+
+  // VP8 (オファーに含まれる場合に経路を追加)
+  VIDEO_CODEC_TYPE_VP8,
+
+  // コーデックの数
+  VIDEO_CODEC_TYPE_COUNT,
+};
+
+// 追加のコーデックのエンコードの経路の状態
+enum VideoCodecBranchState : UINT32 {
+  // 停止
+  VIDEO_CODEC_BRANCH_STOPPED = 0,
+
+  // エンコード中
+  VIDEO_CODEC_BRANCH_RUNNING,
+
+  // 送信用パイプラインから削除中
+  VIDEO_CODEC_BRANCH_STOPPING,
+};
+
+// 入力モード
+enum InputMode : UINT32 {
+  // カメラとマイク
+  INPUT_MODE_DEVICE = 0,
+
+  // テストソース (videotestsrc/audiotestsrc)
+  INPUT_MODE_TEST,
+
+  // エンコード済みファイルのループ再生
+  INPUT_MODE_FILE,
+
+  // ほかのプロセスのフレームバス
+  INPUT_MODE_BUS,
+};
+
+struct VideoEncoderProbeResult;
+using PVideoEncoderProbeResult = VideoEncoderProbeResult*;
+
+struct VideoEncoderProbeContext;
+using PVideoEncoderProbeContext = VideoEncoderProbeContext*;
+
+struct VideoEncoderProbeResult {
+  // エンコーダー
+  std::string videoEncoder;
+
+  // 計測したフレーム数
+  UINT32 frames;
+
+  // フレームあたりの平均エンコード遅延 (100ナノ秒単位)
+  UINT64 meanLatency;
+
+  // フレームあたりのCPU時間 (100ナノ秒単位)
+  UINT64 cpuTimePerFrame;
+
+  // フレームあたりの経過時間 (100ナノ秒単位)
+  UINT64 wallTimePerFrame;
+};
+
+struct VideoEncoderProbeContext {
+  // 保護用ミューテックス
+  MUTEX lock;
+
+  // PTSごとのエンコーダーへの入力時刻
+  std::unordered_map<UINT64, UINT64> inputTimes;
+
+  // フレームごとのエンコード遅延
+  std::vector<UINT64> latencies;
+};
+
+struct GstThreadStats {
+  // スレッドを開始したエレメントのパス
+  std::string name;
+
+  // 前回出力時のCPU時間 (クロックティック)
+  UINT64 cpuTicks;
+
+  // 前回出力時の時刻
+  UINT64 time;
+};
+
+struct LatencyStats {
+  // 保護用ミューテックス
+  MUTEX lock;
+
+  // サンプル (100ナノ秒単位のリングバッファ)
+  std::vector<UINT64> samples;
+
+  // 前回の出力以降に追加されたサンプル数
+  UINT64 count;
+};
+
+struct MediaClock {
+  // 保護用ミューテックス
+  MUTEX lock;
+
+  // オフセットが初期化されたか
+  BOOL initialized;
+
+  // PTS (ランニングタイム) からセッションクロックへのオフセット (100ナノ秒単位)
+  INT64 offset;
+
+  // トラックごとの平滑化した到着時刻とPTSの差 (100ナノ秒単位)
+  INT64 trackOffsets[MEDIA_CLOCK_TRACK_COUNT];
+
+  // トラックごとの平滑化した差が初期化されたか
+  BOOL trackInitialized[MEDIA_CLOCK_TRACK_COUNT];
+
+  // トラックごとの前回のタイムスタンプ
+  UINT64 lastTimestamps[MEDIA_CLOCK_TRACK_COUNT];
+
+  // 到着時刻のジッタ (平滑化したクロックからの遅れ)
+  LatencyStats jitter;
+};
+
+struct PacedFrame {
+  // 送信先のクライアントID
+  std::string peerClientId;
+
+  // フレーム (frameDataは送信時に設定する)
+  Frame frame;
+
+  // フレームのデータ (全セッションで共有)
+  std::shared_ptr<std::vector<BYTE>> pData;
+
+  // キューに追加した時刻
+  UINT64 enqueueTime;
+};
+
+struct FramePacer {
+  // 保護用ミューテックス
+  MUTEX lock;
+
+  // 条件変数
+  CVAR cvar;
+
+  // 送信スレッド
+  TID threadId;
+
+  // 終了フラグ
+  volatile ATOMIC_BOOL isTerminated;
+
+  // 送信待ちのフレーム (全セッション共通のFIFO)
+  std::deque<PacedFrame> frames;
+
+  // トークンの補充レート (バイト/秒)
+  DOUBLE rate;
+
+  // バケットの容量 (バイト)
+  DOUBLE burst;
+
+  // トークン (バイト、負の場合は次のフレームを待たせる)
+  DOUBLE tokens;
+
+  // トークンを最後に補充した時刻
+  UINT64 lastRefillTime;
+
+  // 追加する遅延の上限 (100ナノ秒単位、超えた場合はトークンが不足していても送信する)
+  UINT64 maxDelay;
+
+  // 送信したフレーム数とバイト数
+  UINT64 frameCount;
+  UINT64 byteCount;
+
+  // 遅延の上限に達して送信したフレーム数
+  UINT64 forcedCount;
+
+  // 待機せずに続けて送信したバイト数とその最大値
+  UINT64 burstBytes;
+  UINT64 maxBurstBytes;
+
+  // ペーシングで追加した遅延
+  LatencyStats delay;
+};
+
+// フレームバスの共有メモリの先頭 (スロットが続く)
+struct FrameBusHeader {
+  // 識別子とバージョン
+  UINT64 magic;
+  UINT32 version;
+
+  // スロット数とスロットあたりのデータサイズ
+  UINT32 slotCount;
+  UINT32 slotSize;
+
+  // 書き込みごとに増加するfutexの待機対象
+  UINT32 futexWord;
+
+  // 次に書き込むシーケンス番号
+  UINT64 writeSequence;
+
+  // 最後に書き込んだビデオのキーフレームのシーケンス番号
+  UINT64 keyframeSequence;
+};
+
+// フレームバスのスロット (データが続く)
+struct FrameBusSlot {
+  // シーケンスロック (書き込み中は奇数、書き込み完了時はシーケンス番号×2+2)
+  UINT64 sequence;
+
+  // フレームの属性
+  UINT64 trackId;
+  UINT64 presentationTs;
+  UINT64 duration;
+  UINT32 flags;
+  UINT32 size;
+};
+
+struct FrameBus {
+  // 共有メモリ (memfd)
+  INT32 fd;
+  PBYTE pMemory;
+  SIZE_T memorySize;
+  FrameBusHeader* pHeader;
+
+  // スロットの間隔 (バイト)
+  SIZE_T slotStride;
+
+  // ファイルディスクリプタを受け渡すUNIXドメインソケット (読み出し側は書き込み側の終了を検出するため接続したまま保持)
+  std::string socketPath;
+  INT32 socketFd;
+
+  // 書き込み側かどうか (ソケットファイルの削除に使用)
+  BOOL isWriter;
+
+  // 受け渡し (書き込み側) または読み出し (読み出し側) スレッド
+  TID threadId;
+
+  // 終了フラグ
+  volatile ATOMIC_BOOL isTerminated;
+
+  // 書き込み側: 書き込んだフレーム数、大きすぎて破棄したフレーム数、接続中のワーカー数
+  volatile SIZE_T publishedCount;
+  volatile SIZE_T oversizedCount;
+  volatile SIZE_T readerCount;
+
+  // 読み出し側: 読み出したフレーム数、追い越されて読み飛ばした回数、読み出し中に上書きされたフレーム数、書き込み側に再接続した回数
+  volatile SIZE_T consumedCount;
+  volatile SIZE_T overrunCount;
+  volatile SIZE_T tornCount;
+  volatile SIZE_T reconnectCount;
+};
+
+// アロケーションごとに先頭に付加するヘッダー (16バイトでアラインメントを保つ)
+struct AllocationHeader {
+  // 要求されたサイズ
+  UINT64 size;
+
+  // サブシステム
+  UINT16 tag;
+
+  // セッションのスロットと確保時の世代 (解放済みのセッションと区別する)
+  UINT16 sessionSlot;
+  UINT32 generation;
+};
+
+struct AllocationCounter {
+  // 使用中のバイト数
+  volatile SIZE_T inUseBytes;
+
+  // 前回の出力以降に確保したバイト数と回数
+  volatile SIZE_T allocatedBytes;
+  volatile SIZE_T allocationCount;
+};
+
+struct AllocationSessionSlot {
+  // 使用中フラグ
+  volatile ATOMIC_BOOL isUsed;
+
+  // 世代と使用中のバイト数を保護するスピンロック (解放と再利用がアロケーションの集計と競合するため)
+  volatile ATOMIC_BOOL isLocked;
+
+  // 世代 (スロットを再利用するたびに増加)
+  volatile SIZE_T generation;
+
+  // 使用中のバイト数
+  volatile SIZE_T inUseBytes;
+};
+
+// スコープの間、呼び出し元のスレッドのアロケーションをサブシステムとセッションに割り当てる
+struct AllocationScope {
+  AllocationScope(AllocationTag, UINT32 = 0);
+  ~AllocationScope();
+
+  // スコープ開始前の割り当て
+  AllocationTag previousTag;
+  UINT32 previousSessionSlot;
+};
+
+struct BufferPool {
+  // 保護用ミューテックス
+  MUTEX lock;
+
+  // バッファのサイズ (バイト)
+  SIZE_T blockSize;
+
+  // 保持する空きバッファの上限 (超えた分は解放する)
+  UINT32 maxFreeBlocks;
+
+  // 空きバッファ
+  std::vector<PBYTE> freeBlocks;
+
+  // 確保中のバッファ数とその最大値
+  SIZE_T inUseCount;
+  SIZE_T peakInUseCount;
+
+  // 前回の出力以降に空きバッファを再利用した回数と新たに確保した回数
+  SIZE_T hitCount;
+  SIZE_T missCount;
+};
+
+struct TalkbackSource {
+  // Opusデコーダー
+  OpusDecoder* pDecoder;
+
+  // ゲイン (Q14)
+  INT32 gain;
+
+  // 発話の先頭で決めたフレームのタイムスタンプから再生時刻 (ランニングタイム) へのオフセット
+  BOOL anchored;
+  INT64 offset;
+
+  // 前のフレームの到着時刻とタイムスタンプ
+  UINT64 lastArrival;
+  UINT64 lastTimestamp;
+
+  // フレーム長 (タイムスタンプの間隔から推定)
+  UINT64 frameDuration;
+
+  // 到着間隔のジッタ (RFC 3550) と目標遅延
+  UINT64 jitter;
+  UINT64 targetDelay;
+
+  // デコード済みサンプルのリングバッファ (再生時刻のサンプル位置で参照) と書き込み済みの位置
+  std::vector<INT16> samples;
+  UINT64 writePosition;
+};
+
+struct Talkback {
+  // 保護用ミューテックス (話者とミキサーの状態)
+  MUTEX lock;
+
+  // 再生用パイプライン、appsrc、パイプラインのクロック
+  GstElement* pipeline;
+  GstElement* appsrc;
+  GstClock* clock;
+
+  // ミキサーの出力のバッファプール (GstBufferの解放時に返却する)
+  BufferPool mixPool;
+
+  // 目標遅延の範囲 (100ナノ秒単位)
+  UINT64 minDelay;
+  UINT64 maxDelay;
+
+  // 同時に再生する話者数の上限と新しい話者のゲイン (Q14)
+  UINT32 maxSources;
+  INT32 defaultGain;
+
+  // クライアントIDごとの話者
+  std::unordered_map<std::string, std::unique_ptr<TalkbackSource>> sources;
+
+  // デコード用の作業領域
+  std::vector<INT16> decodeBuffer;
+
+  // ミキサーが次に出力するサンプル位置 (0の場合は開始していない)
+  UINT64 mixPosition;
+
+  // 再生用パイプラインのレイテンシ (発話の先頭で問い合わせる)
+  UINT64 sinkLatency;
+
+  // ミキサースレッドと終了フラグ
+  TID mixerThreadId;
+  volatile ATOMIC_BOOL isTerminated;
+
+  // 再生したフレーム数、再生時刻に間に合わなかったフレーム数、発話数、破棄したフレーム数
+  volatile SIZE_T frameCount;
+  volatile SIZE_T underrunCount;
+  volatile SIZE_T talkspurtCount;
+  volatile SIZE_T droppedCount;
+
+  // 無音としてミキシングの対象から外したフレーム数とパケットロスを補間したフレーム数
+  volatile SIZE_T silentCount;
+  volatile SIZE_T concealedCount;
+
+  // ミキシングしたブロック数、ミキシングした話者数の合計、ミキシングにかかった時間の合計 (100ナノ秒単位)
+  volatile SIZE_T mixedBlocks;
+  volatile SIZE_T mixedSources;
+  volatile SIZE_T mixTime;
+
+  // 受信から再生までの遅延 (ジッタバッファとシンクのレイテンシ)
+  LatencyStats playoutDelay;
+};
+
+// 適応制御 (音声、解像度、キーフレーム間隔) に渡すセッションごとの統計 (設定オブジェクトのロックの外でまとめて取得する)
+struct SessionLinkStats {
+  // セッション (取得から適用までsessionStatsLockで解放を待たせる)
+  PKvsWebrtcStreamingSession pStreamingSession;
+
+  // 音声の損失率 (パーセント、ビューアーのReceiver Report)
+  BOOL hasAudioLoss;
+  DOUBLE audioLoss;
+
+  // RTT (ミリ秒、選択中の候補ペア)
+  BOOL hasRtt;
+  DOUBLE rtt;
+
+  // 映像の損失率 (パーセント、ビューアーのReceiver Report)
+  BOOL hasVideoLoss;
+  DOUBLE videoLoss;
+
+  // ビューアーから受信したPLIとFIRの累計
+  BOOL hasPliCount;
+  UINT64 pliCount;
+};
+
+struct AudioEncoderSettings {
+  // インバンドFEC
+  BOOL inbandFec;
+
+  // DTX (無音の間は送信しない)
+  BOOL dtx;
+
+  // 想定損失率 (パーセント)
+  UINT32 packetLossPercent;
+
+  // フレーム長 (ミリ秒)
+  UINT32 frameSize;
+
+  // ビットレート (bps、0の場合はエンコーダーのデフォルト値)
+  UINT32 bitrate;
+};
+
+struct AudioLatencyRecord {
+  // 受信用パイプラインでのRTPパケットのPTS
+  UINT64 pts;
+
+  // キャプチャ時刻
+  UINT64 captureTime;
+};
+
+struct VideoCodecBranch {
+  // KVS WebRTCの設定
+  PKvsWebrtcConfig pKvsWebrtcConfig;
+
+  // コーデック
+  VideoCodecType codec;
+
+  // エンコーダー (追加のコーデックで空の場合は使用できない)
+  std::string encoder;
+
+  // 状態 (VideoCodecBranchState)
+  volatile SIZE_T state;
+
+  // 送信用パイプラインに追加したビンとteeの要求パッド
+  GstElement* bin;
+  GstPad* teePad;
+
+  // PTSからセッションクロックへの写像 (H.264とは経路が異なるため個別に持つ)
+  MediaClock mediaClock;
+
+  // エンコードしたフレーム数とバイト数 (前回の出力以降)
+  volatile SIZE_T encodedFrames;
+  volatile SIZE_T encodedBytes;
+
+  // 最後にキーフレームを送信した時刻と要求した時刻 (キーフレーム間隔の制御、設定オブジェクトのロックで保護)
+  UINT64 lastKeyFrameTime;
+  UINT64 lastKeyFrameRequestTime;
+
+  // キーフレームとデルタフレームの数とバイト数、要求したキーフレームの数 (前回の出力以降、設定オブジェクトのロックで保護)
+  SIZE_T keyFrames;
+  UINT64 keyFrameBytes;
+  SIZE_T deltaFrames;
+  UINT64 deltaFrameBytes;
+  SIZE_T requestedKeyFrames;
+};
+
+struct Recorder {
+  // 保護用ミューテックス (入力の状態) と条件変数 (EOSの待機)
+  MUTEX lock;
+  CVAR cvar;
+
+  // 録画用パイプライン、映像と音声のappsrc
+  GstElement* pipeline;
+  GstElement* videoSrc;
+  GstElement* audioSrc;
+
+  // 出力先のディレクトリ、ファイル名の接頭辞 (チャネル名)、拡張子、マルチプレクサー
+  std::string directory;
+  std::string prefix;
+  std::string extension;
+  std::string muxer;
+
+  // セグメントの長さ (100ナノ秒単位)、保持するセグメント数、ディスク使用量の上限 (バイト)、書き込み待ちの上限 (バイト)
+  UINT64 segmentDuration;
+  UINT32 maxSegments;
+  UINT64 maxBytes;
+  UINT64 maxQueueBytes;
+
+  // 録画を開始したか、キーフレームを待っているか、録画を開始したフレームのタイムスタンプ
+  BOOL started;
+  BOOL waitingForKeyframe;
+  UINT64 baseTimestamp;
+
+  // 音声のappsrcにキャップスを設定したか (受信用パイプラインのappsinkでネゴシエートされたキャップスを使用する)
+  BOOL hasAudioCaps;
+
+  // パイプラインがEOSに達したか
+  BOOL isEos;
+
+  // 書き込みが完了したセグメントのパスとサイズ (古い順、録画用パイプラインのスレッドのみが参照する)
+  std::deque<std::pair<std::string, UINT64>> segments;
+
+  // ディスク上のセグメント数と合計サイズ
+  volatile SIZE_T segmentCount;
+  volatile SIZE_T diskBytes;
+
+  // 前回の出力以降に録画したフレーム数とバイト数、破棄したフレーム数、入力に失敗した回数
+  volatile SIZE_T recordedFrames;
+  volatile SIZE_T recordedBytes;
+  volatile SIZE_T droppedFrames;
+  volatile SIZE_T pushErrors;
+
+  // 前回の出力以降に書き込みが完了したセグメント数、削除したセグメント数、削除に失敗した回数
+  volatile SIZE_T closedSegments;
+  volatile SIZE_T deletedSegments;
+  volatile SIZE_T deleteErrors;
+};
+
+// データチャネルのメッセージのヘッダー (リトルエンディアン、16バイト)
+struct DataChannelMessageHeader {
+  // 形式のバージョン
+  UINT8 version;
+
+  // フラグ
+  UINT8 flags;
+
+  // コマンド
+  UINT16 command;
+
+  // シーケンス番号 (応答では要求の値を返す)
+  UINT32 sequence;
+
+  // 送信時刻 (送信側のクロック、100ナノ秒単位、応答では要求の値を返す)
+  UINT64 timestamp;
+};
+
+// 受信したデータチャネルのメッセージ (ペイロードはハンドラーの呼び出し中のみ有効)
+struct DataChannelMessage {
+  // 受信したデータチャネル (応答の送信に使用)
+  PKvsWebrtcDataChannel pDataChannel;
+
+  // ヘッダー
+  DataChannelMessageHeader header;
+
+  // ペイロード
+  PBYTE pPayload;
+  UINT32 payloadLen;
+};
+
+// データチャネルのコマンドのハンドラー
+using DataChannelHandler = STATUS (*)(UINT64, DataChannelMessage&);
+
+struct DataChannelHandlerEntry {
+  // ハンドラーと呼び出し時に渡す値
+  DataChannelHandler handler;
+  UINT64 customData;
+};
+
+struct KvsWebrtcDataChannel {
+  // ストリーミングセッション
+  PKvsWebrtcStreamingSession pStreamingSession;
+
+  // SDKのデータチャネル
+  PRtcDataChannel pRtcDataChannel;
+
+  // ラベル
+  std::string label;
+
+  // マスターが作成したか
+  BOOL isLocal;
+
+  // 送信できるか
+  volatile ATOMIC_BOOL isOpen;
+
+  // 送信したメッセージのシーケンス番号
+  volatile SIZE_T sequence;
+
+  // 前回の出力以降に受信と送信したメッセージ数とバイト数
+  volatile SIZE_T receivedMessages;
+  volatile SIZE_T receivedBytes;
+  volatile SIZE_T sentMessages;
+  volatile SIZE_T sentBytes;
+
+  // 前回の出力以降に破棄したメッセージ数 (形式が不正、ハンドラーがない) と送信に失敗した回数
+  volatile SIZE_T malformedMessages;
+  volatile SIZE_T unhandledMessages;
+  volatile SIZE_T sendErrors;
+
+  // 前回の出力以降の疎通確認のRTTの合計、回数、最大値 (100ナノ秒単位、セッションのdataChannelLockで保護)
+  UINT64 rttSum;
+  SIZE_T rttCount;
+  UINT64 rttMax;
+
+  // 前回の出力以降にハンドラーで処理したメッセージ数と処理時間の合計 (100ナノ秒単位、セッションのdataChannelLockで保護)
+  SIZE_T handledMessages;
+  UINT64 handlerTime;
+};
+
+struct ThreadPolicy {
+  // CPUアフィニティ (未設定の場合はプロセス開始時のアフィニティ)
+  BOOL hasCpus;
+  cpu_set_t cpus;
+
+  // スケジューリングポリシー (SCHED_OTHERまたはSCHED_FIFO)
+  INT32 schedPolicy;
+
+  // SCHED_FIFOの優先度
+  INT32 priority;
+
+  // SCHED_OTHERのnice値
+  INT32 niceValue;
+};
+
+struct ThreadRoleStats {
+  // スレッドの役割
+  ThreadRole role;
+
+  // 前回出力時の実行待ち時間 (ナノ秒) と実行回数
+  UINT64 waitTime;
+  UINT64 timeslices;
+};
+
+struct KvsWebrtcHost {
+  // 中断フラグ
+  volatile ATOMIC_BOOL isInterrupted;
+
+  // 保護用ミューテックス
+  MUTEX lock;
+
+  // 条件変数
+  CVAR cvar;
+
+  // メインループで処理する変化があるか (lockで保護し、待機前に確認する)
+  BOOL hasPendingWork;
+
+  // CA証明書のパス
+  PCHAR pCaCertPath;
+
+  // 認証情報プロバイダー (全チャネルで共有)
+  PAwsCredentialProvider pCredentialProvider;
+
+  // スレッドプール (シグナリングクライアントの再作成などに使用)
+  PThreadpool pThreadpool;
+
+  // チャネルごとのKVS WebRTCの設定
+  std::vector<std::unique_ptr<KvsWebrtcConfig>> channels;
+
+  // メトリクスの出力間隔 (100ナノ秒単位、0の場合は出力しない)
+  UINT64 metricsInterval;
+
+  // メトリクスを最後に出力した時刻とプロセスのCPU時間
+  UINT64 lastMetricsTime;
+  UINT64 lastCpuTime;
+
+  // シグナリングメッセージとSDPのバッファプール (全チャネルで共有)
+  BufferPool signalingMessagePool;
+  BufferPool sessionDescriptionPool;
+
+  // アドミッション制御の予算 (0の場合は制限しない)
+  UINT32 maxCpuPercent;
+  UINT64 maxEgressBitrate;
+  UINT64 maxResidentBytes;
+
+  // 直近の負荷 (メインループで更新し、lockで保護する)
+  DOUBLE cpuBusyPercent;
+  UINT64 egressBitrate;
+  UINT64 residentBytes;
+
+  // 負荷を最後に計測した時刻とシステム全体のCPU時間 (クロックティック)
+  UINT64 lastLoadTime;
+  UINT64 lastCpuTotalTicks;
+  UINT64 lastCpuIdleTicks;
+
+  // 役割ごとのスレッドの配置 (いずれかの役割が設定されている場合のみ適用)
+  BOOL threadPolicyEnabled;
+  ThreadPolicy threadPolicies[THREAD_ROLE_COUNT];
+  cpu_set_t defaultCpus;
+
+  // 役割を設定したスレッドと実行待ち時間の統計
+  MUTEX threadLock;
+  std::unordered_map<INT32, ThreadRoleStats> threads;
+
+  // 終了したセッションを解放するスレッドと解放待ちのセッション (reaperLockで保護する)
+  TID reaperThreadId;
+  MUTEX reaperLock;
+  CVAR reaperCvar;
+  BOOL reaperTerminated;
+  std::vector<std::unique_ptr<KvsWebrtcStreamingSession>> reaperQueue;
+
+  // 設定オブジェクトのロックの外でセッションを参照する間 (統計の取得、データチャネルの送信)、解放スレッドを待たせるミューテックス
+  MUTEX sessionStatsLock;
+
+  // 解放したセッション数
+  volatile SIZE_T reapedSessions;
+
+  // セッションの解放に要した時間
+  LatencyStats teardownLatency;
+
+  // 切断 (または終了) から解放が完了するまでの時間 (ソケットとスレッドが残っている時間)
+  LatencyStats lingerLatency;
+
+  // データチャネルのメッセージの送信用バッファプール (全チャネルで共有)
+  BufferPool dataChannelMessagePool;
+
+  // データチャネルの疎通確認の間隔 (100ナノ秒単位、0の場合は送信しない)
+  UINT64 dataChannelPingInterval;
+
+  // メインループの待機時間の上限 (疎通確認とOpusの設定の見直しの間隔に合わせる)
+  UINT64 serviceInterval;
+};
+
+struct KvsWebrtcConfig {
+  // チャネルを共有するホスト
+  PKvsWebrtcHost pKvsWebrtcHost;
+
+  // チャネル番号 (0から)
+  UINT32 channelIndex;
+
+  // 接続フラグ
+  volatile ATOMIC_BOOL isConnected;
+
+  // 中断フラグ
+  volatile ATOMIC_BOOL isInterrupted;
+
+  // 終了フラグ
+  volatile ATOMIC_BOOL isTerminated;
+
+  // 設定オブジェクト保護用ミューテックス
+  MUTEX kvsWebrtcConfigObjLock;
+
+  // シグナリングメッセージ送信用ミューテックス
+  MUTEX signalingSendMessageLock;
+
+  // 条件変数
+  CVAR cvar;
+
+  // シグナリングクライアント再作成フラグ
+  volatile ATOMIC_BOOL recreateSignalingClient;
+
+  // シグナリングクライアントを再作成中か
+  volatile ATOMIC_BOOL isRecreatingSignalingClient;
+
+  // ストリーミングセッションのマップ
+  std::unordered_map<std::string, std::unique_ptr<KvsWebrtcStreamingSession>> streamingSessions;
+
+  // CA証明書のパス (ホストと共有)
+  PCHAR pCaCertPath;
+
+  // 認証情報プロバイダー (ホストと共有)
+  PAwsCredentialProvider pCredentialProvider;
+
+  // クライアント情報
+  SignalingClientInfo clientInfo;
+
+  // チャネル情報
+  ChannelInfo channelInfo;
+
+  // コールバック
+  SignalingClientCallbacks callbacks;
+
+  // シグナリングクライアントに関するメトリクス
+  SignalingClientMetrics metrics;
+
+  // シグナリングクライアント
+  SIGNALING_CLIENT_HANDLE signalingHandle;
+
+  // 設定されたICEサーバーの数
+  UINT32 iceUriCount;
+
+  // 送信用パイプライン
+  GstElement* sendPipeline;
+
+  // 受信用パイプライン
+  GstElement* recvPipeline;
+
+  // 送信用パイプラインから受信用パイプラインへのRTP/RTCPの先頭ポート
+  UINT32 rtpPortBase;
+
+  // エンコード済みフレームを共有するフレームバス
+  FrameBus frameBus;
+
+  // 前回のメトリクス出力以降に送信したフレーム数とバイト数
+  volatile SIZE_T sentFrameCount;
+  volatile SIZE_T sentByteCount;
+
+  // 入力モード
+  InputMode inputMode;
+
+  // 入力ファイルのパス
+  PCHAR pVideoFile;
+  PCHAR pAudioFile;
+
+  // テストパターン
+  PCHAR pTestPattern;
+
+  // ビットレート (bps、0の場合はエンコーダーのデフォルト値)
+  UINT32 videoBitrate;
+  UINT32 audioBitrate;
+
+  // 送信用パイプラインの定義 (設定された場合は組み立てずにそのまま使用する)
+  PCHAR pSendPipeline;
+
+  // キャプチャデバイス
+  PCHAR pVideoDevice;
+  PCHAR pAudioDevice;
+
+  // 解像度とフレームレート
+  UINT32 videoWidth;
+  UINT32 videoHeight;
+  UINT32 videoFramerate;
+
+  // 要求されたH.264エンコーダー
+  PCHAR pRequestedVideoEncoder;
+
+  // 使用するH.264エンコーダー
+  std::string videoEncoder;
+
+  // ベンチマーク結果のキャッシュファイル
+  PCHAR pVideoEncoderCacheFile;
+
+  // v4l2h264encのextra-controls
+  PCHAR pV4l2Controls;
+
+  // v4l2h265encのextra-controls (ビットレートとキーフレーム間隔を除く)
+  PCHAR pV4l2H265Controls;
+
+  // 時刻を表示するか
+  BOOL clockOverlayEnabled;
+
+  // 変換なしでエンコーダーに入力するキャプチャのキャップス (空の場合は変換する)
+  std::string captureCaps;
+
+  // ストリーミングスレッド保護用ミューテックス
+  MUTEX gstThreadLock;
+
+  // スレッドIDごとのストリーミングスレッド
+  std::unordered_map<INT32, GstThreadStats> gstThreads;
+
+  // キューのサイズ (バッファ数)
+  UINT32 videoQueueSize;
+  UINT32 audioQueueSize;
+
+  // 音声のプロファイル
+  AudioProfile audioProfile;
+
+  // 損失率とRTTに応じてOpusの設定を変更するか
+  BOOL audioAdaptive;
+
+  // Opusエンコーダー (送信用パイプラインを組み立てた場合のみ) と現在の設定
+  GstElement* audioEncoder;
+  AudioEncoderSettings audioEncoderSettings;
+
+  // 全セッションの最大の損失率 (パーセント) とRTT (ミリ秒) を平滑化した値
+  DOUBLE audioLoss;
+  DOUBLE audioRtt;
+
+  // Opusの設定を最後に見直した時刻と前回の出力以降に設定を変更した回数
+  UINT64 lastAudioAdaptTime;
+  volatile SIZE_T audioAdaptations;
+
+  // 音声のキャプチャからwriteFrameまでのレイテンシを計測するか (送信用パイプラインを組み立てた場合のみ)
+  BOOL audioLatencyEnabled;
+
+  // 受信用パイプラインに届いた音声のキャプチャ時刻 (リングバッファ)
+  MUTEX audioLatencyLock;
+  std::vector<AudioLatencyRecord> audioLatencyRecords;
+  UINT64 audioLatencyHead;
+
+  // 音声のキャプチャからwriteFrameまでのレイテンシとその合計 (100ナノ秒単位) と回数 (前回の出力以降、audioLatencyLockで保護)
+  LatencyStats audioCaptureToWriteLatency;
+  UINT64 audioLatencySum;
+  UINT64 audioLatencyCount;
+
+  // レイテンシ計測用SEIを埋め込むか
+  BOOL latencySeiEnabled;
+
+  // キャプチャからappsinkまでのレイテンシ
+  LatencyStats captureToAppsinkLatency;
+
+  // appsinkからwriteFrameまでのレイテンシ
+  LatencyStats appsinkToWriteLatency;
+
+  // 受信したフレームのタイムスタンプを生成するクロック
+  MediaClock mediaClock;
+
+  // ビデオフレームをペーシングするか
+  BOOL pacingEnabled;
+
+  // フレームペーサー
+  FramePacer framePacer;
+
+  // メトリクスの出力間隔 (100ナノ秒単位、0の場合は出力しない)
+  UINT64 metricsInterval;
+
+  // メトリクスを最後に出力した時刻
+  UINT64 lastMetricsTime;
+
+  // セッション数の上限 (0の場合は制限しない)
+  UINT32 maxSessions;
+
+  // 予算を超えた場合の動作
+  AdmissionPolicy admissionPolicy;
+
+  // アイドルとみなすまでの時間 (100ナノ秒単位)
+  UINT64 sessionIdleTimeout;
+
+  // アドミッション制御の結果ごとの回数
+  volatile SIZE_T admissionCounts[ADMISSION_RESULT_COUNT];
+
+  // 拒否したオファーのクライアントIDと拒否した時刻 (ICE候補を無視する)
+  std::unordered_map<std::string, UINT64> rejectedPeers;
+
+  // 切断から終了するまでの猶予期間 (100ナノ秒単位、0の場合は即座に終了)
+  UINT64 disconnectGracePeriod;
+
+  // 切断後に終了したセッションのクライアントIDと切断した時刻 (再作成による再接続時間の計測に使用)
+  std::unordered_map<std::string, UINT64> disconnectedPeers;
+
+  // 既存のセッションで再接続するまでの時間 (再オファー、ICEリスタート)
+  LatencyStats reconnectLatency;
+
+  // セッションを作り直して再接続するまでの時間
+  LatencyStats recreateLatency;
+
+  // 既存のセッションで処理した再オファーとICEリスタートの回数
+  volatile SIZE_T reoffers;
+  volatile SIZE_T iceRestarts;
+  volatile SIZE_T replacedSessions;
+
+  // 受信した音声を再生するか
+  BOOL talkbackEnabled;
+
+  // トークバック
+  Talkback talkback;
+
+  // データチャネルを受け入れるか
+  BOOL dataChannelEnabled;
+
+  // マスターが作成するデータチャネルのラベル (空の場合は作成しない) と再送回数の上限 (負の場合は順序どおりに再送する)
+  std::string dataChannelLabel;
+  INT32 dataChannelMaxRetransmits;
+
+  // コマンドごとのハンドラー (シグナリングの開始前に登録する)
+  std::unordered_map<UINT16, DataChannelHandlerEntry> dataChannelHandlers;
+
+  // 疎通確認を最後に送信した時刻
+  UINT64 lastDataChannelPingTime;
+
+  // 全データチャネルの疎通確認のRTT
+  LatencyStats dataChannelRtt;
+
+  // 録画するか
+  BOOL recordingEnabled;
+
+  // 録画
+  Recorder recorder;
+
+  // 映像コーデックの優先順位 (オファーに含まれ、エンコーダーが使用できる最初のコーデックを選択)
+  std::vector<VideoCodecType> videoCodecs;
+
+  // コーデックごとのエンコードの経路 (H.264は送信用パイプラインの既定の経路)
+  VideoCodecBranch videoCodecBranches[VIDEO_CODEC_TYPE_COUNT];
+
+  // 送信用パイプラインから削除中の経路の数 (パイプラインの解放前に完了を待つ)
+  volatile SIZE_T stoppingVideoCodecBranches;
+
+  // 解像度とフレームレートを視聴中のビューアーに合わせるか
+  BOOL videoScalingEnabled;
+
+  // 解像度とフレームレートを変更するキャップスフィルター (変更できない場合はnullptr)
+  GstElement* videoScaleCaps;
+
+  // 現在の段 (0は設定どおり)、切り替えた時刻、最後に見直した時刻
+  UINT32 videoScaleLevel;
+  UINT64 videoScaleChangeTime;
+  UINT64 lastVideoScalingTime;
+
+  // 設定どおりの解像度でのエンコーダーのビットレート (bps、0の場合は変更しない)
+  UINT32 videoScaleBaseBitrate;
+
+  // 現在のH.264のビットレート (bps、0の場合はエンコーダーのデフォルト値、追加のコーデックのビットレートはここから求める)
+  UINT32 videoTargetBitrate;
+
+  // 切り替え以降にエンコードしたバイト数と、切り替え時のストリーミングスレッドのCPU時間 (ティック)
+  volatile SIZE_T videoScaleEncodedBytes;
+  UINT64 videoScaleCpuTicks;
+
+  // 切り替えた回数
+  volatile SIZE_T videoScaleChanges;
+
+  // キーフレーム間隔を参加とPLIのレートに合わせるか
+  BOOL gopAdaptive;
+
+  // キーフレーム間隔の最小値と最大値 (100ナノ秒単位)
+  UINT64 gopMinDuration;
+  UINT64 gopMaxDuration;
+
+  // 現在のキーフレーム間隔 (100ナノ秒単位、設定オブジェクトのロックで保護)
+  UINT64 gopDuration;
+
+  // 最後に見直した時刻
+  UINT64 lastGopAdaptTime;
+
+  // 前回の見直し以降に映像の受信を開始したビューアーの数 (新しいセッションとICEリスタート)
+  volatile SIZE_T gopJoins;
+
+  // 平滑化した参加とPLI (FIRを含む) のレート (1分あたり)
+  DOUBLE gopJoinRate;
+  DOUBLE gopPliRate;
+
+  // キーフレーム間隔を変更した回数 (前回の出力以降、キーフレームの数はコーデックの経路ごとに持つ)
+  volatile SIZE_T gopChanges;
+};
+
+struct KvsWebrtcStreamingSession {
+  // 終了フラグ
+  volatile ATOMIC_BOOL isTerminated;
+
+  // ICE候補収集完了フラグ
+  volatile ATOMIC_BOOL candidateGatheringDone;
+
+  // KVS WebRTCの設定
+  PKvsWebrtcConfig pKvsWebrtcConfig;
+
+  // クライアントID
+  CHAR peerClientId[MAX_SIGNALING_CLIENT_ID_LEN + 1];
+
+  // ピア接続
+  PRtcPeerConnection pPeerConnection;
+
+  // トランシーバー
+  PRtcRtpTransceiver pVideoRtcRtpTransceiver;
+  PRtcRtpTransceiver pAudioRtcRtpTransceiver;
+
+  // アロケーション統計のスロット (0の場合は集計しない)
+  UINT32 allocationSlot;
+
+  // ネゴシエーション中の状態の保護用ミューテックス
+  MUTEX negotiationLock;
+
+  // SDPアンサー (ネゴシエーション中のみバッファプールから確保し、接続後に解放する)
+  PRtcSessionDescriptionInit pAnswerSessionDescriptionInit;
+
+  // リモートがTrickle ICEをサポートしているか
+  BOOL remoteCanTrickleIce;
+
+  // フレームインデックス
+  UINT64 frameIndex;
+
+  // 映像コーデック (最初のオファーで選択する)
+  VideoCodecType videoCodec;
+
+  // 映像と音声を送信するか (オファーでリモートが受信する方向のメディアのみ、オファーを処理するまでは送信しない)
+  volatile ATOMIC_BOOL videoEnabled;
+  volatile ATOMIC_BOOL audioEnabled;
+
+  // writeFrameに送ったフレーム数とかかった時間 (100ナノ秒単位、前回の出力以降)
+  volatile SIZE_T writtenFrames;
+  volatile SIZE_T writeTime;
+
+  // ビューアーが必要とする映像の最大の幅、高さ、フレームレート (データチャネルで通知、0は制限なし)
+  volatile SIZE_T maxVideoWidth;
+  volatile SIZE_T maxVideoHeight;
+  volatile SIZE_T maxVideoFramerate;
+
+  // 映像の損失率に応じたビューアーの段と、損失率が低い状態が始まった時刻 (0は損失率が高い)
+  UINT32 videoScaleLevel;
+  UINT64 videoLowLossTime;
+
+  // 映像のトランシーバーが受信したPLIとFIRの数 (前回の見直し時点)
+  UINT64 lastPliCount;
+
+  // 接続フラグ
+  volatile ATOMIC_BOOL isConnected;
+
+  // 作成した時刻
+  UINT64 createTime;
+
+  // 送信したバイト数 (統計から取得) と直近の送信ビットレート
+  UINT64 lastBytesSent;
+  UINT64 egressBitrate;
+
+  // 切断と再接続の時刻の保護用ミューテックス (32ビット環境でも時刻を分断せずに読み書きする)
+  MUTEX reconnectLock;
+
+  // 切断 (DISCONNECTED) した時刻 (0の場合は切断していない)
+  UINT64 disconnectTime;
+
+  // 再接続の計測を開始した時刻 (0の場合は計測していない)
+  UINT64 reconnectStartTime;
+
+  // 終了したセッションを作り直したか (再接続時間をrecreateLatencyに記録する)
+  BOOL isRecreated;
+
+  // リモートのICEユーザー名フラグメント (ICEリスタートの検出に使用)
+  std::string remoteIceUfrag;
+
+  // リモートのDTLS証明書のフィンガープリントとSDPのセッションID (ピア接続を作り直したオファーの検出に使用)
+  std::string remoteFingerprint;
+  std::string remoteSdpSessionId;
+
+  // ファンアウトの対象から外した時刻
+  UINT64 unlinkTime;
+
+  // データチャネル保護用ミューテックスとデータチャネル (ピア接続の解放後に解放する)
+  MUTEX dataChannelLock;
+  std::vector<std::unique_ptr<KvsWebrtcDataChannel>> dataChannels;
+};
+
+// ============================================================================
+// ユーティリティ
+// ============================================================================
+
+/**
+ * @brief ログレベルを設定する
+ */
+UINT32 setLogLevel();
+
+/**
+ * @brief SIGINTハンドラを設定する
+ */
+VOID setSigintHandler(PKvsWebrtcConfig);
+
+/**
+ * @brief ホストの全チャネルを中断するSIGINTハンドラを設定する
+ */
+VOID setSigintHandler(PKvsWebrtcHost);
+
+/**
+ * @brief CA証明書のパスを取得する
+ */
+STATUS getCaCertPath(PCHAR&);
+
+/**
+ * @brief 設定ファイルとプリセットを読み込む
+ */
+STATUS loadSettings();
+
+/**
+ * @brief 設定ファイルを読み込む
+ */
+STATUS loadConfigFile(PCHAR);
+
+/**
+ * @brief プリセットを適用する
+ */
+STATUS applyPreset(PCHAR);
+
+/**
+ * @brief 環境変数から真偽値を取得する
+ */
+BOOL getEnvBool(const CHAR*, BOOL);
+
+/**
+ * @brief 環境変数から整数値を取得する
+ */
+UINT32 getEnvUint32(const CHAR*, UINT32);
+
+/**
+ * @brief チャネルの環境変数を取得する (「名前_チャネル番号」を優先する)
+ */
+PCHAR getChannelEnv(PKvsWebrtcConfig, const CHAR*);
+
+/**
+ * @brief チャネルの環境変数から真偽値を取得する
+ */
+BOOL getChannelEnvBool(PKvsWebrtcConfig, const CHAR*, BOOL);
+
+/**
+ * @brief チャネルの環境変数から整数値を取得する
+ */
+UINT32 getChannelEnvUint32(PKvsWebrtcConfig, const CHAR*, UINT32);
+
+// ============================================================================
+// レイテンシ計測
+// ============================================================================
+
+/**
+ * @brief レイテンシ統計を初期化する
+ */
+STATUS initLatencyStats(LatencyStats&, UINT32);
+
+/**
+ * @brief レイテンシ統計を解放する
+ */
+STATUS freeLatencyStats(LatencyStats&);
+
+/**
+ * @brief レイテンシのサンプルを追加する
+ */
+VOID addLatencySample(LatencyStats&, UINT64);
+
+/**
+ * @brief レイテンシの分布を出力してリセットする
+ */
+VOID logLatencyStats(const CHAR*, LatencyStats&);
+
+/**
+ * @brief メディアクロックを初期化する
+ */
+STATUS initMediaClock(MediaClock&);
+
+/**
+ * @brief メディアクロックを解放する
+ */
+STATUS freeMediaClock(MediaClock&);
+
+/**
+ * @brief PTSと到着時刻からセッションクロックのタイムスタンプを求める
+ */
+UINT64 getMediaClockTimestamp(MediaClock&, MediaClockTrack, UINT64, UINT64);
+
+/**
+ * @brief メディアクロックのA/Vオフセットとジッタを出力する
+ */
+VOID logMediaClockStats(MediaClock&);
+
+/**
+ * @brief フレームペーサーを初期化して送信スレッドを開始する
+ */
+STATUS initFramePacer(PKvsWebrtcConfig);
+
+/**
+ * @brief フレームペーサーの送信スレッドを停止して解放する
+ */
+STATUS freeFramePacer(PKvsWebrtcConfig);
+
+/**
+ * @brief フレームをペーシングのキューに追加する
+ */
+VOID enqueuePacedFrame(PKvsWebrtcConfig, PKvsWebrtcStreamingSession, Frame&, const std::shared_ptr<std::vector<BYTE>>&);
+
+/**
+ * @brief フレームペーサーの送信スレッド
+ */
+PVOID framePacerRoutine(PVOID);
+
+/**
+ * @brief ペーシングしたフレームを送信する
+ */
+VOID writePacedFrame(PKvsWebrtcConfig, PacedFrame&);
+
+/**
+ * @brief フレームペーサーのメトリクスを出力してリセットする
+ */
+VOID logFramePacerStats(FramePacer&);
+
+/**
+ * @brief レイテンシ計測用SEIを作成する
+ */
+VOID buildLatencySei(UINT64, std::vector<BYTE>&);
+
+/**
+ * @brief アクセスユニットからレイテンシ計測用SEIのタイムスタンプ領域を探す
+ */
+PBYTE findLatencySei(PBYTE, UINT32);
+
+/**
+ * @brief アクセスユニットから最初のVCL NALユニットの位置を探す
+ */
+UINT32 findH264VclOffset(PBYTE, UINT32);
+
+/**
+ * @brief レイテンシ計測用SEIのタイムスタンプを取得する
+ */
+UINT64 getLatencySeiTimestamp(PBYTE, LatencySeiTimestamp);
+
+/**
+ * @brief レイテンシ計測用SEIのタイムスタンプを設定する
+ */
+VOID setLatencySeiTimestamp(PBYTE, LatencySeiTimestamp, UINT64);
+
+// ============================================================================
+// KvsWebrtcHost 管理
+// ============================================================================
+
+/**
+ * @brief チャネル間で共有するリソースを作成する
+ */
+STATUS createKvsWebrtcHost(std::unique_ptr<KvsWebrtcHost>&);
+
+/**
+ * @brief チャネル間で共有するリソースとチャネルを解放する
+ */
+STATUS freeKvsWebrtcHost(std::unique_ptr<KvsWebrtcHost>&);
+
+/**
+ * @brief 全チャネルのメインループ
+ */
+STATUS loopKvsWebrtcHost(PKvsWebrtcHost);
+
+/**
+ * @brief ホストのメトリクスを出力する
+ */
+VOID reportKvsWebrtcHostMetrics(PKvsWebrtcHost);
+
+/**
+ * @brief ホストのメインループを起床する
+ */
+VOID wakeKvsWebrtcHost(PKvsWebrtcHost);
+
+/**
+ * @brief 終了したセッションを解放するスレッドを開始する
+ */
+STATUS startSessionReaper(PKvsWebrtcHost);
+
+/**
+ * @brief 終了したセッションを解放するスレッドを停止する (解放待ちのセッションはすべて解放する)
+ */
+VOID stopSessionReaper(PKvsWebrtcHost);
+
+/**
+ * @brief 終了したセッションを解放待ちのキューに追加する
+ */
+VOID reapStreamingSession(PKvsWebrtcHost, std::unique_ptr<KvsWebrtcStreamingSession>&&);
+
+/**
+ * @brief 終了したセッションを解放するスレッド
+ */
+PVOID sessionReaperRoutine(PVOID);
+
+/**
+ * @brief プロセスのCPU時間 (100ナノ秒単位) を取得する
+ */
+UINT64 getProcessCpuTime();
+
+/**
+ * @brief プロセスの常駐メモリ (バイト) を取得する
+ */
+UINT64 getProcessResidentBytes();
+
+// ============================================================================
+// アドミッション制御
+// ============================================================================
+
+/**
+ * @brief チャネルのアドミッション制御の設定を初期化する
+ */
+STATUS initAdmissionControl(PKvsWebrtcConfig);
+
+/**
+ * @brief ホストの負荷 (CPU使用率、送信ビットレート、常駐メモリ) を更新する
+ */
+VOID updateHostLoad(PKvsWebrtcHost);
+
+/**
+ * @brief システム全体のCPU時間とアイドル時間 (クロックティック) を取得する
+ */
+BOOL getSystemCpuTicks(UINT64&, UINT64&);
+
+/**
+ * @brief ストリーミングセッションが送信したバイト数を統計から取得する
+ */
+UINT64 getStreamingSessionBytesSent(PKvsWebrtcStreamingSession);
+
+/**
+ * @brief 新しいオファーを受け入れるか判定する
+ */
+AdmissionResult admitStreamingSession(PKvsWebrtcConfig, PCHAR);
+
+/**
+ * @brief 切断するセッションを選択する
+ */
+PKvsWebrtcStreamingSession selectEvictionCandidate(PKvsWebrtcConfig);
+
+/**
+ * @brief アドミッション制御のメトリクスを出力する
+ */
+VOID logAdmissionStats(PKvsWebrtcConfig);
+
+// ============================================================================
+// アロケーション統計
+// ============================================================================
+
+/**
+ * @brief アロケーション統計を開始する (SDKのメモリアロケーターを置き換える)
+ */
+STATUS initAllocationStats();
+
+/**
+ * @brief アロケーション統計を終了する
+ */
+VOID deinitAllocationStats();
+
+/**
+ * @brief メモリを確保する (アロケーション統計用)
+ */
+PVOID allocationStatsMemAlloc(SIZE_T);
+
+/**
+ * @brief アラインメントを指定してメモリを確保する (アロケーション統計用)
+ */
+PVOID allocationStatsMemAlignAlloc(SIZE_T, SIZE_T);
+
+/**
+ * @brief 0で初期化したメモリを確保する (アロケーション統計用)
+ */
+PVOID allocationStatsMemCalloc(SIZE_T, SIZE_T);
+
+/**
+ * @brief メモリを再確保する (アロケーション統計用)
+ */
+PVOID allocationStatsMemRealloc(PVOID, SIZE_T);
+
+/**
+ * @brief メモリを解放する (アロケーション統計用)
+ */
+VOID allocationStatsMemFree(PVOID);
+
+/**
+ * @brief セッションのスロットを取得する
+ */
+UINT32 acquireAllocationSessionSlot();
+
+/**
+ * @brief セッションのスロットを解放する
+ */
+VOID releaseAllocationSessionSlot(UINT32, const CHAR*);
+
+/**
+ * @brief セッションが使用中のバイト数を取得する
+ */
+SIZE_T getAllocationSessionBytes(UINT32);
+
+/**
+ * @brief mallocのヒープで使用中のバイト数を取得する
+ */
+SIZE_T getHeapInUseBytes();
+
+/**
+ * @brief アロケーション統計を出力する
+ */
+VOID logAllocationStats();
+
+// ============================================================================
+// 非同期ロガー
+// ============================================================================
+
+/**
+ * @brief 非同期ロガーを開始する (SDKのログ出力関数を置き換える)
+ */
+STATUS initAsyncLogger();
+
+/**
+ * @brief 非同期ロガーを終了する (書き込み済みのログはすべて出力する)
+ */
+VOID deinitAsyncLogger();
+
+/**
+ * @brief ログを呼び出し元のスレッドのリングバッファに書き込む (SDKのログ出力関数)
+ */
+VOID asyncLogPrint(UINT32, const PCHAR, const PCHAR, ...);
+
+/**
+ * @brief リングバッファのログを整形して出力するスレッド
+ */
+PVOID asyncLoggerRoutine(PVOID);
+
+/**
+ * @brief 非同期ロガーのメトリクスを出力する
+ */
+VOID logAsyncLoggerStats();
+
+// ============================================================================
+// バッファプール
+// ============================================================================
+
+/**
+ * @brief バッファプールを初期化する
+ */
+STATUS initBufferPool(BufferPool&, SIZE_T, UINT32);
+
+/**
+ * @brief バッファプールを解放する
+ */
+STATUS freeBufferPool(BufferPool&);
+
+/**
+ * @brief バッファプールからバッファを取得する
+ */
+PBYTE acquireBuffer(BufferPool&);
+
+/**
+ * @brief バッファをバッファプールに返却する
+ */
+VOID releaseBuffer(BufferPool&, PBYTE);
+
+/**
+ * @brief バッファプールのメトリクスを出力する
+ */
+VOID logBufferPoolStats(const CHAR*, BufferPool&);
+
+// ============================================================================
+// スレッド配置
+// ============================================================================
+
+/**
+ * @brief 役割ごとのスレッドの配置を環境変数から読み込む
+ */
+STATUS initThreadPolicies(PKvsWebrtcHost);
+
+/**
+ * @brief CPUリスト (例: 0-1,3) を解析する
+ */
+STATUS parseCpuList(PCHAR, cpu_set_t&);
+
+/**
+ * @brief スケジューリングの設定 (fifo:優先度、nice:nice値) を解析する
+ */
+STATUS parseThreadSched(PCHAR, ThreadPolicy&);
+
+/**
+ * @brief 呼び出し元のスレッドに役割を設定する
+ */
+VOID applyThreadPolicy(PKvsWebrtcHost, ThreadRole);
+
+/**
+ * @brief 呼び出し元のスレッドの役割を解除する
+ */
+VOID releaseThreadPolicy(PKvsWebrtcHost);
+
+/**
+ * @brief スレッドの実行待ち時間 (ナノ秒) と実行回数を取得する
+ */
+BOOL getThreadSchedStat(INT32, UINT64&, UINT64&);
+
+/**
+ * @brief 役割ごとの実行待ち時間を出力する
+ */
+VOID logThreadRoleStats(PKvsWebrtcHost);
+
+// ============================================================================
+// KvsWebrtcConfig 管理
+// ============================================================================
+
+/**
+ * @brief KVS WebRTCの設定を作成する
+ */
+STATUS createKvsWebrtcConfig(PKvsWebrtcHost, PCHAR, UINT32, UINT32, std::unique_ptr<KvsWebrtcConfig>&);
+
+/**
+ * @brief KVS WebRTCの設定を解放する
+ */
+STATUS freeKvsWebrtcConfig(std::unique_ptr<KvsWebrtcConfig>&);
+
+/**
+ * @brief 入力モードを初期化する
+ */
+STATUS initInputMode(PKvsWebrtcConfig);
+
+/**
+ * @brief 送信用パイプラインの設定を初期化する
+ */
+STATUS initPipelineSettings(PKvsWebrtcConfig);
+
+// ============================================================================
+// KvsWebrtcStreamingSession 管理
+// ============================================================================
+
+/**
+ * @brief ストリーミングセッションを作成する
+ */
+STATUS createKvsWebrtcStreamingSession(PKvsWebrtcConfig, PCHAR, std::unique_ptr<KvsWebrtcStreamingSession>&);
+
+/**
+ * @brief ストリーミングセッションを解放する
+ */
+STATUS freeKvsWebrtcStreamingSession(std::unique_ptr<KvsWebrtcStreamingSession>&);
+
+/**
+ * @brief ネゴシエーション中のみ使用するバッファを解放する
+ */
+VOID releaseNegotiationState(PKvsWebrtcStreamingSession);
+
+/**
+ * @brief ストリーミングセッションが保持するメモリ (バイト) を取得する
+ */
+SIZE_T getStreamingSessionMemory(PKvsWebrtcStreamingSession);
+
+/**
+ * @brief セッションが切断した時刻を取得する (0の場合は切断していない)
+ */
+UINT64 getDisconnectTime(PKvsWebrtcStreamingSession);
+
+/**
+ * @brief 猶予期間を過ぎた切断中のストリーミングセッションを終了する
+ */
+VOID expireDisconnectedSessions(PKvsWebrtcConfig);
+
+// ============================================================================
+// 初期化
+// ============================================================================
+
+/**
+ * @brief 認証情報プロバイダーを作成する
+ */
+STATUS createCredentialProvider(PCHAR, PAwsCredentialProvider&);
+
+/**
+ * @brief クライアント情報を初期化する
+ */
+STATUS initClientInfo(UINT32, SignalingClientInfo&);
+
+/**
+ * @brief チャネル情報を初期化する
+ */
+STATUS initChannelInfo(PCHAR, PCHAR, PCHAR, ChannelInfo&);
+
+/**
+ * @brief コールバックを初期化する
+ */
+STATUS initCallbacks(UINT64, SignalingClientCallbacks&);
+
+/**
+ * @brief メトリクスを初期化する
+ */
+STATUS initMetrics(SignalingClientMetrics&);
+
+/**
+ * @brief ピア接続を初期化する
+ */
+STATUS initPeerConnection(PKvsWebrtcConfig, PRtcPeerConnection&);
+
+// ============================================================================
+// シグナリング
+// ============================================================================
+
+/**
+ * @brief シグナリングクライアントを初期化する
+ */
+STATUS initSignaling(PKvsWebrtcConfig);
+
+/**
+ * @brief シグナリングクライアントを解放する
+ */
+STATUS deinitSignaling(PKvsWebrtcConfig);
+
+/**
+ * @brief 終了したセッションの解放とシグナリングクライアントの再作成を行う
+ */
+STATUS serviceSignaling(PKvsWebrtcConfig);
+
+/**
+ * @brief セッションの統計をまとめて取得し、音声、解像度、キーフレーム間隔の適応に渡す (設定オブジェクトのロックを保持せずに呼び出す)
+ */
+VOID adaptToSessionStats(PKvsWebrtcConfig);
+
+/**
+ * @brief セッションの統計を取得する (設定オブジェクトのロックを保持せずに呼び出す)
+ */
+VOID getSessionLinkStats(SessionLinkStats&, BOOL, BOOL, BOOL);
+
+/**
+ * @brief シグナリングクライアントを再作成する (スレッドプールで実行)
+ */
+PVOID recreateSignalingClientRoutine(PVOID);
+
+/**
+ * @brief チャネルのメトリクスを出力する
+ */
+VOID reportKvsWebrtcMetrics(PKvsWebrtcConfig);
+
+/**
+ * @brief ストリーミングセッションごとの送信メディア、送信ビットレート、送信処理時間を出力する
+ */
+VOID logStreamingSessionStats(PKvsWebrtcConfig);
+
+// ============================================================================
+// WebRTCセッション処理
+// ============================================================================
+
+/**
+ * @brief SDPオファーを処理する
+ */
+STATUS handleOffer(PKvsWebrtcConfig, PKvsWebrtcStreamingSession, SignalingMessage&);
+
+/**
+ * @brief SDPから指定した接頭辞で始まる最初の行の値を取得する
+ */
+std::string getSdpValue(const CHAR*, const std::string&);
+
+/**
+ * @brief SDPからICEユーザー名フラグメントを取得する
+ */
+std::string getIceUfrag(const CHAR*);
+
+/**
+ * @brief SDPからDTLS証明書のフィンガープリントを取得する
+ */
+std::string getSdpFingerprint(const CHAR*);
+
+/**
+ * @brief SDPのセッションID (o=行) を取得する
+ */
+std::string getSdpSessionId(const CHAR*);
+
+/**
+ * @brief オファーが既存のセッションと同じリモートのピア接続からのものか確認する
+ */
+BOOL isSameRemotePeerConnection(PKvsWebrtcConfig, PKvsWebrtcStreamingSession, SignalingMessage&);
+
+/**
+ * @brief SDPオファーからリモートが受信するメディア (映像、音声) を取得する
+ */
+VOID getOfferedMedia(const CHAR*, BOOL&, BOOL&);
+
+/**
+ * @brief SDPアンサーを送信する
+ */
+STATUS sendAnswer(PKvsWebrtcStreamingSession);
+
+/**
+ * @brief ICE候補を送信する
+ */
+STATUS sendIceCandidate(PKvsWebrtcStreamingSession, PCHAR);
+
+/**
+ * @brief リモートからのICE候補を処理する
+ */
+STATUS handleRemoteCandidate(PKvsWebrtcStreamingSession, SignalingMessage&);
+
+// ============================================================================
+// コールバック
+// ============================================================================
+
+/**
+ * @brief シグナリングクライアントの状態が変化した際のコールバック
+ */
+STATUS onSignalingClientStateChanged(UINT64, SIGNALING_CLIENT_STATE);
+
+/**
+ * @brief シグナリングメッセージを受信した際のコールバック
+ */
+STATUS onSignalingMessageReceived(UINT64, PReceivedSignalingMessage);
+
+/**
+ * @brief ICE Candidateを受信した際のコールバック
+ */
+VOID onIceCandidateHandler(UINT64, PCHAR);
+
+/**
+ * @brief ピア接続の状態が変化した際のコールバック
+ */
+VOID onConnectionStateChanged(UINT64, RTC_PEER_CONNECTION_STATE);
+
+/**
+ * @brief シグナリングクライアントでエラーが発生した際のコールバック
+ */
+STATUS onSignalingClientError(UINT64, STATUS, PCHAR, UINT32);
+
+// ============================================================================
+// GStreamer
+// ============================================================================
+
+/**
+ * @brief エレメントのパッドテンプレートのキャップスを取得する
+ */
+GstCaps* getPadTemplateCaps(const CHAR*, GstPadDirection);
+
+/**
+ * @brief H.264エンコーダーがVIDEO_CODECのプロファイルとレベルを満たすか検証する
+ */
+STATUS validateVideoEncoder(const CHAR*, UINT32, UINT32, UINT32);
+
+/**
+ * @brief 使用するH.264エンコーダーを選択する
+ */
+STATUS selectVideoEncoder(PKvsWebrtcConfig);
+
+/**
+ * @brief H.264エンコーダーのベンチマークを実行する
+ */
+STATUS probeVideoEncoder(PKvsWebrtcConfig, const std::string&, VideoEncoderProbeResult&);
+
+/**
+ * @brief ベンチマークでH.264エンコーダーを自動選択する
+ */
+STATUS autoSelectVideoEncoder(PKvsWebrtcConfig);
+
+/**
+ * @brief エンコードする映像のキャップスの定義を作成する
+ */
+std::string buildVideoCapsDescription(PKvsWebrtcConfig);
+
+/**
+ * @brief 変換なしでエンコーダーに入力できるキャプチャのキャップスをネゴシエーションする
+ */
+STATUS negotiateCaptureCaps(PKvsWebrtcConfig);
+
+/**
+ * @brief H.264エンコーダーの定義を作成する
+ */
+std::string buildVideoEncoderDescription(PKvsWebrtcConfig, const std::string&);
+
+/**
+ * @brief 送信用パイプラインの定義を作成する
+ */
+STATUS buildSendPipelineDescription(PKvsWebrtcConfig, std::string&);
+
+/**
+ * @brief ストリーミングスレッドを登録する
+ */
+VOID registerGstThread(PKvsWebrtcConfig, INT32, PCHAR);
+
+/**
+ * @brief ストリーミングスレッドの登録を解除する
+ */
+VOID unregisterGstThread(PKvsWebrtcConfig, INT32);
+
+/**
+ * @brief ストリーミングスレッドの役割を判定する
+ */
+ThreadRole getGstThreadRole(PKvsWebrtcConfig, const CHAR*);
+
+/**
+ * @brief スレッドのCPU時間 (クロックティック) を取得する
+ */
+BOOL getThreadCpuTicks(INT32, UINT64&);
+
+/**
+ * @brief ストリーミングスレッドごとのCPU使用率を出力する
+ */
+VOID logGstThreadStats(PKvsWebrtcConfig);
+
+/**
+ * @brief パイプラインのバスメッセージを処理する
+ */
+GstBusSyncReply onGstBusSyncMessage(GstBus*, GstMessage*, gpointer);
+
+/**
+ * @brief GStreamerパイプラインを作成する
+ */
+STATUS createGstPipelines(PKvsWebrtcConfig);
+
+/**
+ * @brief GStreamerパイプラインを解放する
+ */
+STATUS freeGstPipelines(PKvsWebrtcConfig);
+
+/**
+ * @brief エンコード済みフレームにレイテンシ計測用SEIを挿入するプローブ
+ */
+GstPadProbeReturn onLatencySeiProbe(GstPad*, GstPadProbeInfo*, gpointer);
+
+/**
+ * @brief 全セッションにフレームを送信する
+ */
+VOID writeFrameToSessions(PKvsWebrtcConfig, Frame&, VideoCodecType, PBYTE);
+
+/**
+ * @brief 新しいサンプルを受信した際の共通処理
+ */
+GstFlowReturn onNewSample(GstElement*, gpointer, UINT64);
+
+/**
+ * @brief Videoサンプルを受信した際のコールバック
+ */
+GstFlowReturn onNewSampleVideo(GstElement*, gpointer);
+
+/**
+ * @brief Audioサンプルを受信した際のコールバック
+ */
+GstFlowReturn onNewSampleAudio(GstElement*, gpointer);
+
+// ============================================================================
+// フレームバス
+// ============================================================================
+
+/**
+ * @brief メディア入力を開始する (GStreamerパイプラインまたはフレームバス)
+ */
+STATUS startMediaInput(PKvsWebrtcConfig);
+
+/**
+ * @brief フレームバスを作成してワーカーへの受け渡しを開始する
+ */
+STATUS createFrameBus(PKvsWebrtcConfig);
+
+/**
+ * @brief フレームバスの書き込み側に接続して共有メモリをマップする
+ */
+STATUS attachFrameBus(FrameBus&);
+
+/**
+ * @brief フレームバスの書き込み側から切断して共有メモリのマップを解除する
+ */
+VOID detachFrameBus(FrameBus&);
+
+/**
+ * @brief フレームバスに接続して読み出しを開始する
+ */
+STATUS connectFrameBus(PKvsWebrtcConfig);
+
+/**
+ * @brief フレームバスを解放する
+ */
+STATUS freeFrameBus(FrameBus&);
+
+/**
+ * @brief フレームバスのスロットを取得する
+ */
+FrameBusSlot* getFrameBusSlot(FrameBus&, UINT64);
+
+/**
+ * @brief フレームバスにフレームを書き込む
+ */
+VOID publishFrameBus(FrameBus&, Frame&);
+
+/**
+ * @brief ワーカーにフレームバスのファイルディスクリプタを受け渡すスレッド
+ */
+PVOID frameBusListenerRoutine(PVOID);
+
+/**
+ * @brief フレームバスからフレームを読み出して全セッションに送信するスレッド
+ */
+PVOID frameBusReaderRoutine(PVOID);
+
+/**
+ * @brief フレームバスのメトリクスを出力する
+ */
+VOID logFrameBusStats(PKvsWebrtcConfig);
+
+// ============================================================================
+// トークバック
+// ============================================================================
+
+/**
+ * @brief トークバックを初期化する
+ */
+STATUS initTalkback(PKvsWebrtcConfig);
+
+/**
+ * @brief トークバックの再生用パイプラインとミキサーを開始する
+ */
+STATUS startTalkback(PKvsWebrtcConfig);
 
-struct KvsWebrtcConfig {
-  // 接続フラグ
-  volatile ATOMIC_BOOL isConnected;
+/**
+ * @brief トークバックを解放する
+ */
+STATUS freeTalkback(Talkback&);
 
-  // 中断フラグ
-  volatile ATOMIC_BOOL isInterrupted;
+/**
+ * @brief トークバックのパイプラインのランニングタイムを取得する (100ナノ秒単位)
+ */
+BOOL getTalkbackRunningTime(Talkback&, UINT64&);
 
-  // 終了フラグ
-  volatile ATOMIC_BOOL isTerminated;
+/**
+ * @brief 受信した音声フレームをデコードして話者のリングバッファに書き込むコールバック
+ */
+VOID onTalkbackFrame(UINT64, PFrame);
 
-  // 設定オブジェクト保護用ミューテックス
-  MUTEX kvsWebrtcConfigObjLock;
+/**
+ * @brief 話者を取得する (存在しない場合は作成する)
+ */
+TalkbackSource* getTalkbackSource(Talkback&, const CHAR*);
 
-  // シグナリングメッセージ送信用ミューテックス
-  MUTEX signalingSendMessageLock;
+/**
+ * @brief 話者を解放する
+ */
+VOID freeTalkbackSource(std::unique_ptr<TalkbackSource>&);
 
-  // 条件変数
-  CVAR cvar;
+/**
+ * @brief 話者のゲインを設定する (パーセント)
+ */
+STATUS setTalkbackSourceGain(PKvsWebrtcConfig, const CHAR*, UINT32);
 
-  // シグナリングクライアント再作成フラグ
-  volatile ATOMIC_BOOL recreateSignalingClient;
+/**
+ * @brief デコード済みサンプルを話者のリングバッファに書き込む
+ */
+VOID writeTalkbackSamples(TalkbackSource&, UINT64, UINT64, const INT16*, UINT32);
 
-  // ストリーミングセッションのマップ
-  std::unordered_map<std::string, std::unique_ptr<KvsWebrtcStreamingSession>> streamingSessions;
+/**
+ * @brief 全話者のサンプルを1ブロック分ミキシングする
+ */
+UINT32 mixTalkbackBlock(Talkback&, UINT64, PINT16);
 
-  // CA証明書のパス
-  PCHAR pCaCertPath;
+/**
+ * @brief ゲインを掛けたサンプルを飽和加算する (SSE2/NEON)
+ */
+VOID mixTalkbackSamples(PINT16, const INT16*, UINT32, INT32);
 
-  // 認証情報プロバイダー
-  PAwsCredentialProvider pCredentialProvider;
+/**
+ * @brief ゲインを掛けたサンプルを飽和加算する (スカラー)
+ */
+VOID mixTalkbackSamplesScalar(PINT16, const INT16*, UINT32, INT32);
 
-  // クライアント情報
-  SignalingClientInfo clientInfo;
+/**
+ * @brief ミキシングした音声を再生用パイプラインに入力するスレッド
+ */
+PVOID talkbackMixerRoutine(PVOID);
 
-  // チャネル情報
-  ChannelInfo channelInfo;
+/**
+ * @brief トークバックのGstBufferの解放時にバッファをプールに返却する
+ */
+VOID releaseTalkbackBuffer(gpointer);
 
-  // コールバック
-  SignalingClientCallbacks callbacks;
+/**
+ * @brief トークバックのメトリクスを出力する (設定オブジェクトのロックを保持せずに呼び出す)
+ */
+VOID logTalkbackStats(PKvsWebrtcConfig);
 
-  // シグナリングクライアントに関するメトリクス
-  SignalingClientMetrics metrics;
 
-  // シグナリングクライアント
-  SIGNALING_CLIENT_HANDLE signalingHandle;
+// ============================================================================
+// データチャネル
+// ============================================================================
 
-  // 設定されたICEサーバーの数
-  UINT32 iceUriCount;
+/**
+ * @brief データチャネルの設定を初期化し、組み込みのコマンドのハンドラーを登録する
+ */
+STATUS initDataChannelSettings(PKvsWebrtcConfig);
 
-  // 送信用パイプライン
-  GstElement* sendPipeline;
+/**
+ * @brief データチャネルのコマンドのハンドラーを登録する (シグナリングの開始前に呼び出す)
+ */
+STATUS registerDataChannelHandler(PKvsWebrtcConfig, UINT16, DataChannelHandler, UINT64);
 
-  // 受信用パイプライン
-  GstElement* recvPipeline;
-};
+/**
+ * @brief ストリーミングセッションでデータチャネルを受け入れる (マスター側のデータチャネルも作成する)
+ */
+STATUS initStreamingSessionDataChannels(PKvsWebrtcStreamingSession);
 
-struct KvsWebrtcStreamingSession {
-  // 終了フラグ
-  volatile ATOMIC_BOOL isTerminated;
+/**
+ * @brief ビューアーが作成したデータチャネルを受け入れるコールバック
+ */
+VOID onDataChannel(UINT64, PRtcDataChannel);
 
-  // ICE候補収集完了フラグ
-  volatile ATOMIC_BOOL candidateGatheringDone;
+/**
+ * @brief データチャネルをストリーミングセッションに追加する
+ */
+STATUS addDataChannel(PKvsWebrtcStreamingSession, PRtcDataChannel, BOOL, BOOL, PKvsWebrtcDataChannel*);
 
-  // KVS WebRTCの設定
-  PKvsWebrtcConfig pKvsWebrtcConfig;
+/**
+ * @brief マスターが作成したデータチャネルが開いた際のコールバック
+ */
+VOID onDataChannelOpen(UINT64, PRtcDataChannel);
 
-  // クライアントID
-  CHAR peerClientId[MAX_SIGNALING_CLIENT_ID_LEN + 1];
+/**
+ * @brief データチャネルのメッセージを受信した際のコールバック
+ */
+VOID onDataChannelMessage(UINT64, PRtcDataChannel, BOOL, PBYTE, UINT32);
 
-  // ピア接続
-  PRtcPeerConnection pPeerConnection;
+/**
+ * @brief データチャネルのメッセージのヘッダーを書き込む
+ */
+VOID writeDataChannelHeader(PBYTE, const DataChannelMessageHeader&);
 
-  // トランシーバー
-  PRtcRtpTransceiver pVideoRtcRtpTransceiver;
-  PRtcRtpTransceiver pAudioRtcRtpTransceiver;
+/**
+ * @brief データチャネルのメッセージのヘッダーを読み出す
+ */
+VOID readDataChannelHeader(const BYTE*, DataChannelMessageHeader&);
 
-  // SDPアンサー
-  RtcSessionDescriptionInit answerSessionDescriptionInit;
+/**
+ * @brief データチャネルでメッセージを送信する
+ */
+STATUS sendDataChannelMessage(PKvsWebrtcDataChannel, const DataChannelMessageHeader&, const BYTE*, UINT32);
 
-  // リモートがTrickle ICEをサポートしているか
-  BOOL remoteCanTrickleIce;
+/**
+ * @brief データチャネルで新しいメッセージを送信する
+ */
+STATUS postDataChannelMessage(PKvsWebrtcDataChannel, UINT16, const BYTE*, UINT32);
 
-  // フレームインデックス
-  UINT64 frameIndex;
-};
+/**
+ * @brief 受信したメッセージに応答する
+ */
+STATUS replyDataChannelMessage(DataChannelMessage&, const BYTE*, UINT32);
 
-// ============================================================================
-// ユーティリティ
-// ============================================================================
+/**
+ * @brief 疎通確認のハンドラー
+ */
+STATUS onDataChannelPing(UINT64, DataChannelMessage&);
 
 /**
- * @brief ログレベルを設定する
+ * @brief トークバックのゲインの設定のハンドラー
  */
-UINT32 setLogLevel();
+STATUS onDataChannelTalkbackGain(UINT64, DataChannelMessage&);
 
 /**
- * @brief SIGINTハンドラを設定する
+ * @brief 映像の最大の解像度とフレームレートの通知のハンドラー
  */
-VOID setSigintHandler(PKvsWebrtcConfig);
+STATUS onDataChannelVideoConstraints(UINT64, DataChannelMessage&);
 
 /**
- * @brief CA証明書のパスを取得する
+ * @brief 開いている全データチャネルに疎通確認を送信する (設定オブジェクトのロックを保持せずに呼び出す)
  */
-STATUS getCaCertPath(PCHAR&);
+VOID pingDataChannels(PKvsWebrtcConfig);
+
+/**
+ * @brief データチャネルのメトリクスを出力する
+ */
+VOID logDataChannelStats(PKvsWebrtcConfig);
 
 // ============================================================================
-// KvsWebrtcConfig 管理
+// 録画
 // ============================================================================
 
 /**
- * @brief KVS WebRTCの設定を作成する
+ * @brief 録画の設定を初期化する
  */
-STATUS createKvsWebrtcConfig(PCHAR, UINT32, std::unique_ptr<KvsWebrtcConfig>&);
+STATUS initRecorder(PKvsWebrtcConfig);
 
 /**
- * @brief KVS WebRTCの設定を解放する
+ * @brief 録画用パイプラインを開始する
  */
-STATUS freeKvsWebrtcConfig(std::unique_ptr<KvsWebrtcConfig>&);
+STATUS startRecorder(PKvsWebrtcConfig);
 
-// ============================================================================
-// KvsWebrtcStreamingSession 管理
-// ============================================================================
+/**
+ * @brief 録画を終了する (最後のセグメントの書き込みを待つ)
+ */
+STATUS freeRecorder(Recorder&);
 
 /**
- * @brief ストリーミングセッションを作成する
+ * @brief エンコード済みフレームを録画用パイプラインに入力する
  */
-STATUS createKvsWebrtcStreamingSession(PKvsWebrtcConfig, PCHAR, std::unique_ptr<KvsWebrtcStreamingSession>&);
+VOID recordFrame(PKvsWebrtcConfig, Frame&, GstBuffer*, GstCaps*);
 
 /**
- * @brief ストリーミングセッションを解放する
+ * @brief 前回までに録画したセグメントを取得する
  */
-STATUS freeKvsWebrtcStreamingSession(std::unique_ptr<KvsWebrtcStreamingSession>&);
+STATUS scanRecordingSegments(Recorder&);
+
+/**
+ * @brief 書き込みが完了したセグメントを追加し、上限を超えた古いセグメントを削除する
+ */
+VOID addRecordingSegment(Recorder&, const std::string&);
+
+/**
+ * @brief セグメントのファイル名を作成するコールバック
+ */
+gchar* onRecorderFormatLocation(GstElement*, guint, gpointer);
+
+/**
+ * @brief 録画用パイプラインのバスメッセージを処理するコールバック
+ */
+GstBusSyncReply onRecorderBusSyncMessage(GstBus*, GstMessage*, gpointer);
+
+/**
+ * @brief 録画のメトリクスを出力する
+ */
+VOID logRecorderStats(PKvsWebrtcConfig);
 
 // ============================================================================
-// 初期化
+// 音声の適応制御
 // ============================================================================
 
 /**
- * @brief 認証情報プロバイダーを作成する
+ * @brief Opusエンコーダーの定義を作成する
  */
-STATUS createCredentialProvider(PCHAR, PAwsCredentialProvider&);
+std::string buildAudioEncoderDescription(PKvsWebrtcConfig);
 
 /**
- * @brief クライアント情報を初期化する
+ * @brief 損失率とRTTからOpusの設定を選択する
  */
-STATUS initClientInfo(UINT32, SignalingClientInfo&);
+VOID selectAudioEncoderSettings(PKvsWebrtcConfig, DOUBLE, DOUBLE, AudioEncoderSettings&);
 
 /**
- * @brief チャネル情報を初期化する
+ * @brief 全セッションの音声の損失率とRTTを集計してOpusの設定を変更する
  */
-STATUS initChannelInfo(PCHAR, PCHAR, PCHAR, ChannelInfo&);
+VOID adaptAudioEncoder(PKvsWebrtcConfig, const std::vector<SessionLinkStats>&);
 
 /**
- * @brief コールバックを初期化する
+ * @brief 受信用パイプラインに届いた音声のRTPパケットのキャプチャ時刻を記録するプローブ
  */
-STATUS initCallbacks(UINT64, SignalingClientCallbacks&);
+GstPadProbeReturn onAudioLatencyProbe(GstPad*, GstPadProbeInfo*, gpointer);
 
 /**
- * @brief メトリクスを初期化する
+ * @brief 送信した音声のキャプチャからのレイテンシを記録する
  */
-STATUS initMetrics(SignalingClientMetrics&);
+VOID addAudioLatencySample(PKvsWebrtcConfig, UINT64, UINT64);
 
 /**
- * @brief ピア接続を初期化する
+ * @brief 音声のメトリクスを出力する
  */
-STATUS initPeerConnection(PKvsWebrtcConfig, PRtcPeerConnection&);
+VOID logAudioStats(PKvsWebrtcConfig);
 
 // ============================================================================
-// シグナリング
+// 映像コーデック
 // ============================================================================
 
 /**
- * @brief シグナリングクライアントを初期化する
+ * @brief 映像コーデックの優先順位とエンコードの経路を初期化する
  */
-STATUS initSignaling(PKvsWebrtcConfig);
+STATUS initVideoCodecs(PKvsWebrtcConfig);
 
 /**
- * @brief シグナリングクライアントを解放する
+ * @brief 映像コーデックのエンコードの経路を解放する
  */
-STATUS deinitSignaling(PKvsWebrtcConfig);
+VOID freeVideoCodecs(PKvsWebrtcConfig);
 
 /**
- * @brief シグナリングのメインループ
+ * @brief 映像コーデックの名前を取得する
  */
-STATUS loopSignaling(PKvsWebrtcConfig);
+const CHAR* getVideoCodecName(VideoCodecType);
 
-// ============================================================================
-// WebRTCセッション処理
-// ============================================================================
+/**
+ * @brief 追加のコーデックのエンコーダーを選択する
+ */
+VOID selectVideoCodecEncoders(PKvsWebrtcConfig);
 
 /**
- * @brief SDPオファーを処理する
+ * @brief 映像コーデックを使用できるか
  */
-STATUS handleOffer(PKvsWebrtcConfig, PKvsWebrtcStreamingSession, SignalingMessage&);
+BOOL isVideoCodecAvailable(PKvsWebrtcConfig, VideoCodecType);
 
 /**
- * @brief SDPアンサーを送信する
+ * @brief SDPオファーの映像のメディアセクションに含まれるコーデックを取得する (VideoCodecTypeのビットマスク)
  */
-STATUS sendAnswer(PKvsWebrtcStreamingSession);
+UINT32 getOfferedVideoCodecs(const CHAR*);
 
 /**
- * @brief ICE候補を送信する
+ * @brief オファーに含まれるコーデックから使用するコーデックを選択する
  */
-STATUS sendIceCandidate(PKvsWebrtcStreamingSession, PCHAR);
+VideoCodecType selectVideoCodec(PKvsWebrtcConfig, UINT32);
 
 /**
- * @brief リモートからのICE候補を処理する
+ * @brief 選択したコーデックで映像のトランシーバーを追加する
  */
-STATUS handleRemoteCandidate(PKvsWebrtcStreamingSession, SignalingMessage&);
+STATUS addVideoTransceiver(PKvsWebrtcConfig, PKvsWebrtcStreamingSession, UINT32, BOOL);
 
-// ============================================================================
-// コールバック
-// ============================================================================
+/**
+ * @brief 追加のコーデックのエンコードの経路の定義を作成する
+ */
+std::string buildVideoCodecBranchDescription(PKvsWebrtcConfig, VideoCodecBranch&);
 
 /**
- * @brief シグナリングクライアントの状態が変化した際のコールバック
+ * @brief セッションが使用するコーデックの経路を開始し、使用されなくなった経路を停止する
  */
-STATUS onSignalingClientStateChanged(UINT64, SIGNALING_CLIENT_STATE);
+VOID updateVideoCodecBranches(PKvsWebrtcConfig);
 
 /**
- * @brief シグナリングメッセージを受信した際のコールバック
+ * @brief 追加のコーデックのエンコードの経路を送信用パイプラインに追加する
  */
-STATUS onSignalingMessageReceived(UINT64, PReceivedSignalingMessage);
+STATUS startVideoCodecBranch(VideoCodecBranch&);
 
 /**
- * @brief ICE Candidateを受信した際のコールバック
+ * @brief 追加のコーデックのエンコードの経路を送信用パイプラインから削除する
  */
-VOID onIceCandidateHandler(UINT64, PCHAR);
+VOID stopVideoCodecBranch(VideoCodecBranch&);
 
 /**
- * @brief ピア接続の状態が変化した際のコールバック
+ * @brief teeの要求パッドがアイドルになった際に経路を切り離すプローブ
  */
-VOID onConnectionStateChanged(UINT64, RTC_PEER_CONNECTION_STATE);
+GstPadProbeReturn onVideoCodecBranchIdle(GstPad*, GstPadProbeInfo*, gpointer);
 
 /**
- * @brief シグナリングクライアントでエラーが発生した際のコールバック
+ * @brief 切り離した経路を停止して送信用パイプラインから削除する (GStreamerのスレッドで実行)
  */
-STATUS onSignalingClientError(UINT64, STATUS, PCHAR, UINT32);
+VOID removeVideoCodecBranch(GstElement*, gpointer);
+
+/**
+ * @brief 追加のコーデックのサンプルを受信した際のコールバック
+ */
+GstFlowReturn onNewSampleVideoCodecBranch(GstElement*, gpointer);
+
+/**
+ * @brief 映像コーデックごとのメトリクスを出力する
+ */
+VOID logVideoCodecStats(PKvsWebrtcConfig);
 
 // ============================================================================
-// GStreamer
+// 解像度とフレームレートの適応
 // ============================================================================
 
 /**
- * @brief GStreamerパイプラインを作成する
+ * @brief 解像度とフレームレートの適応を初期化する (送信用パイプラインの作成後)
  */
-STATUS createGstPipelines(PKvsWebrtcConfig);
+VOID initVideoScaling(PKvsWebrtcConfig);
 
 /**
- * @brief GStreamerパイプラインを解放する
+ * @brief 段に対応する解像度とフレームレートを取得する
  */
-STATUS freeGstPipelines(PKvsWebrtcConfig);
+VOID getVideoScalingSize(PKvsWebrtcConfig, UINT32, UINT32&, UINT32&, UINT32&);
 
 /**
- * @brief 新しいサンプルを受信した際の共通処理
+ * @brief 段に対応するキャップスの定義を作成する
  */
-GstFlowReturn onNewSample(GstElement*, gpointer, UINT64);
+std::string buildVideoScaleCapsDescription(PKvsWebrtcConfig, UINT32);
 
 /**
- * @brief Videoサンプルを受信した際のコールバック
+ * @brief ビューアーが必要とする解像度とフレームレートを満たす最も低い段を取得する
  */
-GstFlowReturn onNewSampleVideo(GstElement*, gpointer);
+UINT32 getRequestedVideoScalingLevel(PKvsWebrtcConfig, PKvsWebrtcStreamingSession);
 
 /**
- * @brief Audioサンプルを受信した際のコールバック
+ * @brief 視聴中のビューアーが必要とし、受信できる段を求めて解像度とフレームレートを変更する
  */
-GstFlowReturn onNewSampleAudio(GstElement*, gpointer);
+VOID adaptVideoScaling(PKvsWebrtcConfig, const std::vector<SessionLinkStats>&);
+
+/**
+ * @brief 解像度とフレームレートを切り替える
+ */
+VOID applyVideoScalingLevel(PKvsWebrtcConfig, UINT32);
+
+/**
+ * @brief 映像のエンコーダーのビットレートを変更する
+ */
+VOID setVideoEncoderBitrate(PKvsWebrtcConfig, UINT32);
+
+/**
+ * @brief コーデックのビットレートを取得する (bps、0の場合はエンコーダーのデフォルト値)
+ */
+UINT32 getVideoCodecBitrate(PKvsWebrtcConfig, VideoCodecType);
+
+/**
+ * @brief 追加のコーデックのエンコーダーのビットレートを変更する
+ */
+VOID setVideoCodecBranchBitrate(VideoCodecBranch&);
+
+/**
+ * @brief 映像のエンコーダーにキーフレームを要求する
+ */
+VOID requestVideoKeyFrame(PKvsWebrtcConfig);
+
+/**
+ * @brief 追加のコーデックのエンコーダーにキーフレームを要求する
+ */
+VOID requestVideoCodecBranchKeyFrame(VideoCodecBranch&);
+
+/**
+ * @brief 名前で指定したエンコーダーに強制キーフレームのイベントを送る
+ */
+VOID sendForceKeyUnit(GstElement*, const CHAR*);
+
+/**
+ * @brief チャネルのストリーミングスレッドのCPU時間の合計を取得する (ティック)
+ */
+UINT64 getGstThreadsCpuTicks(PKvsWebrtcConfig);
+
+/**
+ * @brief 解像度とフレームレートの適応のメトリクスを出力する
+ */
+VOID logVideoScalingStats(PKvsWebrtcConfig);
+
+// ============================================================================
+// キーフレーム間隔の適応
+// ============================================================================
+
+/**
+ * @brief キーフレーム間隔の制御を初期化する
+ */
+STATUS initGopSettings(PKvsWebrtcConfig);
+
+/**
+ * @brief 送信した映像のフレームを記録し、キーフレーム間隔を過ぎた場合はキーフレームを要求する
+ */
+VOID onGopVideoFrame(PKvsWebrtcConfig, VideoCodecBranch&, const Frame&);
+
+/**
+ * @brief 参加とPLIのレートからキーフレーム間隔を決める
+ */
+VOID adaptGop(PKvsWebrtcConfig, const std::vector<SessionLinkStats>&);
+
+/**
+ * @brief キーフレーム間隔の適応のメトリクスを出力する
+ */
+VOID logGopStats(PKvsWebrtcConfig);
 
 #endif
@@ -3,38 +3,55 @@
 INT32 main(INT32 argc, CHAR* argv[])
 {
   auto retStatus = STATUS_SUCCESS;
+  std::unique_ptr<KvsWebrtcHost> pKvsWebrtcHost;
   std::unique_ptr<KvsWebrtcConfig> pKvsWebrtcConfig;
-  PCHAR pChannelName;
+  UINT32 logLevel;
+  INT32 i;
 
   SET_INSTRUMENTED_ALLOCATORS();
 
+  // 設定ファイルとプリセットを読み込む
+  CHK_STATUS(loadSettings());
+
   // ログレベル
-  auto logLevel = setLogLevel();
+  logLevel = setLogLevel();
+
+  // アロケーション統計 (SDKがメモリを確保する前に開始する)
+  CHK_STATUS(initAllocationStats());
 
-  // チャネル名
+  // 非同期ロガー (ログの整形と出力をロガースレッドで行う)
+  CHK_STATUS(initAsyncLogger());
+
+  // チャネル名 (複数指定した場合は1プロセスで全チャネルを配信する)
   CHK_ERR(argc > 1, STATUS_INVALID_OPERATION, "チャネル名は必須です。");
-  pChannelName = argv[1];
 
   // GStreamerを初期化
   gst_init(&argc, &argv);
 
-  // KVS WebRTCの設定を作成
-  CHK_STATUS(createKvsWebrtcConfig(pChannelName, logLevel, pKvsWebrtcConfig));
+  // チャネル間で共有するリソースを作成
+  CHK_STATUS(createKvsWebrtcHost(pKvsWebrtcHost));
 
   // SIGINTハンドラを設定
-  setSigintHandler(pKvsWebrtcConfig.get());
+  setSigintHandler(pKvsWebrtcHost.get());
 
   // KVS WebRTCを初期化
   CHK_STATUS(initKvsWebRtc());
 
-  // シグナリングクライアントを初期化
-  CHK_STATUS(initSignaling(pKvsWebrtcConfig.get()));
+  // チャネルごとの処理
+  for (i = 1; i < argc; i++) {
+    // KVS WebRTCの設定を作成
+    CHK_STATUS(createKvsWebrtcConfig(pKvsWebrtcHost.get(), argv[i], static_cast<UINT32>(i - 1), logLevel, pKvsWebrtcConfig));
+    pKvsWebrtcHost->channels.push_back(std::move(pKvsWebrtcConfig));
+
+    // シグナリングクライアントを初期化
+    CHK_STATUS(initSignaling(pKvsWebrtcHost->channels.back().get()));
 
-  // GStreamerパイプラインを作成
-  CHK_STATUS(createGstPipelines(pKvsWebrtcConfig.get()));
+    // メディア入力を開始 (GStreamerパイプラインまたはフレームバス)
+    CHK_STATUS(startMediaInput(pKvsWebrtcHost->channels.back().get()));
+  }
 
   // メインループ
-  CHK_STATUS(loopSignaling(pKvsWebrtcConfig.get()));
+  CHK_STATUS(loopKvsWebrtcHost(pKvsWebrtcHost.get()));
 
 CleanUp:
 
@@ -43,17 +60,27 @@ CleanUp:
   }
 
   // シグナリングクライアントを解放
-  deinitSignaling(pKvsWebrtcConfig.get());
+  if (pKvsWebrtcHost) {
+    for (auto&& pChannelConfig : pKvsWebrtcHost->channels) {
+      deinitSignaling(pChannelConfig.get());
+    }
+  }
 
   // KVS WebRTCを終了
   deinitKvsWebRtc();
 
-  // KVS WebRTCの設定を解放
-  freeKvsWebrtcConfig(pKvsWebrtcConfig);
+  // チャネルと共有リソースを解放
+  freeKvsWebrtcHost(pKvsWebrtcHost);
 
   // GStreamerを終了
   gst_deinit();
 
+  // アロケーション統計を終了
+  deinitAllocationStats();
+
+  // 非同期ロガーを終了 (残りのログを出力する)
+  deinitAsyncLogger();
+
   RESET_INSTRUMENTED_ALLOCATORS();
 
   if (STATUS_FAILED(retStatus)) {
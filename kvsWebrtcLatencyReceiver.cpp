@@ -0,0 +1,339 @@
+#include "common.hpp"
+
+#define LATENCY_RECEIVER_CLIENT_ID "kvsWebrtcLatencyReceiver"
+
+namespace {
+  // ストリーミングセッション
+  PKvsWebrtcStreamingSession pReceiverSession = nullptr;
+
+  // キャプチャからappsinkまでのレイテンシ
+  LatencyStats captureToAppsinkLatency;
+
+  // appsinkからwriteFrameまでのレイテンシ
+  LatencyStats appsinkToWriteLatency;
+
+  // writeFrameから受信までのレイテンシ
+  LatencyStats writeToReceiverLatency;
+
+  // キャプチャから受信までのレイテンシ
+  LatencyStats captureToReceiverLatency;
+
+  /**
+   * @brief Videoフレームを受信した際のコールバック
+   */
+  VOID onReceiverVideoFrame(UINT64 customData, PFrame pFrame)
+  {
+    UNUSED_PARAM(customData);
+    auto receiveTime = GETTIME();
+    PBYTE pLatencySei;
+    UINT64 captureTime, appsinkTime, writeTime;
+
+    // レイテンシ計測用SEIを探す
+    if (!pFrame || !(pLatencySei = findLatencySei(pFrame->frameData, pFrame->size))) {
+      return;
+    }
+
+    // タイムスタンプを取得
+    captureTime = getLatencySeiTimestamp(pLatencySei, LATENCY_SEI_TIMESTAMP_CAPTURE);
+    appsinkTime = getLatencySeiTimestamp(pLatencySei, LATENCY_SEI_TIMESTAMP_APPSINK);
+    writeTime = getLatencySeiTimestamp(pLatencySei, LATENCY_SEI_TIMESTAMP_WRITE);
+
+    // 時刻が逆転しているフレームは無視 (マスターと同一ホストで計測する前提)
+    if (captureTime == 0 || appsinkTime < captureTime || writeTime < appsinkTime || receiveTime < writeTime) {
+      return;
+    }
+
+    // レイテンシを記録
+    addLatencySample(captureToAppsinkLatency, appsinkTime - captureTime);
+    addLatencySample(appsinkToWriteLatency, writeTime - appsinkTime);
+    addLatencySample(writeToReceiverLatency, receiveTime - writeTime);
+    addLatencySample(captureToReceiverLatency, receiveTime - captureTime);
+  }
+
+  /**
+   * @brief SDPオファーを送信する
+   */
+  STATUS sendOffer(PKvsWebrtcStreamingSession pStreamingSession, RtcSessionDescriptionInit& offerSessionDescriptionInit)
+  {
+    auto retStatus = STATUS_SUCCESS;
+    auto pKvsWebrtcConfig = pStreamingSession->pKvsWebrtcConfig;
+    auto isLocked = FALSE;
+    UINT32 signalingMessageLen = MAX_SIGNALING_MESSAGE_LEN;
+    SignalingMessage signalingMessage;
+
+    // SDPオファーをシリアライズ
+    CHK_STATUS(serializeSessionDescriptionInit(&offerSessionDescriptionInit, signalingMessage.payload, &signalingMessageLen));
+
+    // シグナリングメッセージのバージョン
+    signalingMessage.version = SIGNALING_MESSAGE_CURRENT_VERSION;
+
+    // シグナリングメッセージのタイプ
+    signalingMessage.messageType = SIGNALING_MESSAGE_TYPE_OFFER;
+
+    // クライアントID
+    STRNCPY(signalingMessage.peerClientId, pStreamingSession->peerClientId, MAX_SIGNALING_CLIENT_ID_LEN);
+
+    // ペイロードの長さ
+    signalingMessage.payloadLen = STRLEN(signalingMessage.payload);
+
+    // 関連付けID
+    signalingMessage.correlationId[0] = '\0';
+
+    // ロックを開始
+    MUTEX_LOCK(pKvsWebrtcConfig->signalingSendMessageLock);
+    isLocked = TRUE;
+
+    // シグナリングメッセージを送信
+    CHK_STATUS(signalingClientSendMessageSync(pKvsWebrtcConfig->signalingHandle, &signalingMessage));
+
+  CleanUp:
+
+    // ロックを解除
+    if (isLocked) {
+      MUTEX_UNLOCK(pKvsWebrtcConfig->signalingSendMessageLock);
+    }
+
+    CHK_LOG_ERR(retStatus);
+
+    return retStatus;
+  }
+
+  /**
+   * @brief シグナリングメッセージを受信した際のコールバック
+   */
+  STATUS onReceiverSignalingMessageReceived(UINT64 customData, PReceivedSignalingMessage pReceivedSignalingMessage)
+  {
+    UNUSED_PARAM(customData);
+    auto retStatus = STATUS_SUCCESS;
+    RtcSessionDescriptionInit answerSessionDescriptionInit;
+
+    // ストリーミングセッションの存在チェック
+    CHK(pReceiverSession, STATUS_INVALID_OPERATION);
+
+    // メッセージタイプ別の処理
+    switch (pReceivedSignalingMessage->signalingMessage.messageType) {
+      case SIGNALING_MESSAGE_TYPE_ANSWER:
+        // SDPアンサーを設定
+        MEMSET(&answerSessionDescriptionInit, 0x00, SIZEOF(RtcSessionDescriptionInit));
+        CHK_STATUS(deserializeSessionDescriptionInit(pReceivedSignalingMessage->signalingMessage.payload,
+                                                     pReceivedSignalingMessage->signalingMessage.payloadLen,
+                                                     &answerSessionDescriptionInit));
+        CHK_STATUS(setRemoteDescription(pReceiverSession->pPeerConnection, &answerSessionDescriptionInit));
+        break;
+      case SIGNALING_MESSAGE_TYPE_ICE_CANDIDATE:
+        // リモートからのICE候補を処理
+        CHK_STATUS(handleRemoteCandidate(pReceiverSession, pReceivedSignalingMessage->signalingMessage));
+        break;
+      default:
+        break;
+    }
+
+  CleanUp:
+
+    CHK_LOG_ERR(retStatus);
+
+    return retStatus;
+  }
+
+  /**
+   * @brief 受信用のストリーミングセッションを作成する
+   */
+  STATUS createReceiverStreamingSession(PKvsWebrtcConfig pKvsWebrtcConfig, std::unique_ptr<KvsWebrtcStreamingSession>& pStreamingSession)
+  {
+    auto retStatus = STATUS_SUCCESS;
+    RtcMediaStreamTrack videoTrack;
+    RtcMediaStreamTrack audioTrack;
+    RtcRtpTransceiverInit videoRtpTransceiverInit;
+    RtcRtpTransceiverInit audioRtpTransceiverInit;
+
+    // 映像と音声のトラックとトランシーバーの設定を初期化
+    MEMSET(&videoTrack, 0x00, SIZEOF(RtcMediaStreamTrack));
+    MEMSET(&audioTrack, 0x00, SIZEOF(RtcMediaStreamTrack));
+    MEMSET(&videoRtpTransceiverInit, 0x00, SIZEOF(RtcRtpTransceiverInit));
+    MEMSET(&audioRtpTransceiverInit, 0x00, SIZEOF(RtcRtpTransceiverInit));
+
+    // ストリーミングセッションを初期化
+    pStreamingSession = std::make_unique<KvsWebrtcStreamingSession>();
+
+    // KVS WebRTCの設定
+    pStreamingSession->pKvsWebrtcConfig = pKvsWebrtcConfig;
+
+    // 送信先はマスター
+    STRCPY(pStreamingSession->peerClientId, CLIENT_ID);
+
+    // 終了フラグ
+    ATOMIC_STORE_BOOL(&pStreamingSession->isTerminated, FALSE);
+
+    // ICE候補収集完了フラグ
+    ATOMIC_STORE_BOOL(&pStreamingSession->candidateGatheringDone, FALSE);
+
+    // ICE候補はTrickle ICEで送信する
+    pStreamingSession->remoteCanTrickleIce = TRUE;
+
+    // ピア接続を初期化
+    CHK_STATUS(initPeerConnection(pKvsWebrtcConfig, pStreamingSession->pPeerConnection));
+
+    // ICE Candidateを受信した際のコールバックを設定
+    CHK_STATUS(peerConnectionOnIceCandidate(pStreamingSession->pPeerConnection,
+                                            reinterpret_cast<UINT64>(pStreamingSession.get()),
+                                            onIceCandidateHandler));
+
+    // ピア接続の状態が変化した際のコールバックを設定
+    CHK_STATUS(peerConnectionOnConnectionStateChange(pStreamingSession->pPeerConnection,
+                                                     reinterpret_cast<UINT64>(pStreamingSession.get()),
+                                                     onConnectionStateChanged));
+
+    // サポートされるコーデックを追加
+    CHK_STATUS(addSupportedCodec(pStreamingSession->pPeerConnection, VIDEO_CODEC));
+    CHK_STATUS(addSupportedCodec(pStreamingSession->pPeerConnection, AUDIO_CODEC));
+
+    // トラックの種類
+    videoTrack.kind = MEDIA_STREAM_TRACK_KIND_VIDEO;
+    audioTrack.kind = MEDIA_STREAM_TRACK_KIND_AUDIO;
+
+    // トラックのコーデック
+    videoTrack.codec = VIDEO_CODEC;
+    audioTrack.codec = AUDIO_CODEC;
+
+    // トランシーバーの方向
+    videoRtpTransceiverInit.direction = RTC_RTP_TRANSCEIVER_DIRECTION_RECVONLY;
+    audioRtpTransceiverInit.direction = RTC_RTP_TRANSCEIVER_DIRECTION_RECVONLY;
+
+    // トラックのストリームID
+    STRCPY(videoTrack.streamId, VIDEO_STREAM_ID);
+    STRCPY(audioTrack.streamId, AUDIO_STREAM_ID);
+
+    // トラックのID
+    STRCPY(videoTrack.trackId, VIDEO_TRACK_ID);
+    STRCPY(audioTrack.trackId, AUDIO_TRACK_ID);
+
+    // トランシーバーを追加
+    CHK_STATUS(addTransceiver(pStreamingSession->pPeerConnection, &videoTrack, &videoRtpTransceiverInit, &pStreamingSession->pVideoRtcRtpTransceiver));
+    CHK_STATUS(addTransceiver(pStreamingSession->pPeerConnection, &audioTrack, &audioRtpTransceiverInit, &pStreamingSession->pAudioRtcRtpTransceiver));
+
+    // Videoフレームを受信した際のコールバックを設定
+    CHK_STATUS(transceiverOnFrame(pStreamingSession->pVideoRtcRtpTransceiver,
+                                  reinterpret_cast<UINT64>(pStreamingSession.get()),
+                                  onReceiverVideoFrame));
+
+  CleanUp:
+
+    if (STATUS_FAILED(retStatus)) {
+      freeKvsWebrtcStreamingSession(pStreamingSession);
+    }
+
+    return retStatus;
+  }
+}
+
+INT32 main(INT32 argc, CHAR* argv[])
+{
+  auto retStatus = STATUS_SUCCESS;
+  std::unique_ptr<KvsWebrtcHost> pKvsWebrtcHost;
+  std::unique_ptr<KvsWebrtcConfig> pKvsWebrtcConfig;
+  std::unique_ptr<KvsWebrtcStreamingSession> pStreamingSession;
+  RtcSessionDescriptionInit offerSessionDescriptionInit;
+  PCHAR pChannelName;
+  UINT32 logLevel;
+
+  SET_INSTRUMENTED_ALLOCATORS();
+
+  // 設定ファイルとプリセットを読み込む
+  CHK_STATUS(loadSettings());
+
+  // ログレベル
+  logLevel = setLogLevel();
+
+  // チャネル名
+  CHK_ERR(argc > 1, STATUS_INVALID_OPERATION, "チャネル名は必須です。");
+  pChannelName = argv[1];
+
+  // レイテンシ統計を初期化
+  CHK_STATUS(initLatencyStats(captureToAppsinkLatency, LATENCY_STATS_CAPACITY));
+  CHK_STATUS(initLatencyStats(appsinkToWriteLatency, LATENCY_STATS_CAPACITY));
+  CHK_STATUS(initLatencyStats(writeToReceiverLatency, LATENCY_STATS_CAPACITY));
+  CHK_STATUS(initLatencyStats(captureToReceiverLatency, LATENCY_STATS_CAPACITY));
+
+  // 認証情報プロバイダーなどの共有リソースを作成
+  CHK_STATUS(createKvsWebrtcHost(pKvsWebrtcHost));
+
+  // KVS WebRTCの設定を作成
+  CHK_STATUS(createKvsWebrtcConfig(pKvsWebrtcHost.get(), pChannelName, 0, logLevel, pKvsWebrtcConfig));
+
+  // ビューワーとして接続
+  SNPRINTF(pKvsWebrtcConfig->clientInfo.clientId, MAX_SIGNALING_CLIENT_ID_LEN, "%s-%u", LATENCY_RECEIVER_CLIENT_ID, static_cast<UINT32>(getpid()));
+  pKvsWebrtcConfig->channelInfo.channelRoleType = SIGNALING_CHANNEL_ROLE_TYPE_VIEWER;
+  pKvsWebrtcConfig->callbacks.messageReceivedFn = onReceiverSignalingMessageReceived;
+
+  // SIGINTハンドラを設定
+  setSigintHandler(pKvsWebrtcConfig.get());
+
+  // KVS WebRTCを初期化
+  CHK_STATUS(initKvsWebRtc());
+
+  // シグナリングクライアントを初期化
+  CHK_STATUS(initSignaling(pKvsWebrtcConfig.get()));
+
+  // ストリーミングセッションを作成
+  CHK_STATUS(createReceiverStreamingSession(pKvsWebrtcConfig.get(), pStreamingSession));
+  pReceiverSession = pStreamingSession.get();
+
+  // SDPオファーを作成
+  MEMSET(&offerSessionDescriptionInit, 0x00, SIZEOF(RtcSessionDescriptionInit));
+  offerSessionDescriptionInit.useTrickleIce = TRUE;
+  CHK_STATUS(setLocalDescription(pStreamingSession->pPeerConnection, &offerSessionDescriptionInit));
+  CHK_STATUS(createOffer(pStreamingSession->pPeerConnection, &offerSessionDescriptionInit));
+
+  // SDPオファーを送信
+  CHK_STATUS(sendOffer(pStreamingSession.get(), offerSessionDescriptionInit));
+
+  // メインループ
+  while (!ATOMIC_LOAD_BOOL(&pKvsWebrtcConfig->isInterrupted) && !ATOMIC_LOAD_BOOL(&pStreamingSession->isTerminated)) {
+    // 5秒間スリープ
+    MUTEX_LOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+    CVAR_WAIT(pKvsWebrtcConfig->cvar, pKvsWebrtcConfig->kvsWebrtcConfigObjLock, (5 * HUNDREDS_OF_NANOS_IN_A_SECOND));
+    MUTEX_UNLOCK(pKvsWebrtcConfig->kvsWebrtcConfigObjLock);
+
+    // レイテンシの分布を出力
+    logLatencyStats("captureToAppsink", captureToAppsinkLatency);
+    logLatencyStats("appsinkToWriteFrame", appsinkToWriteLatency);
+    logLatencyStats("writeFrameToReceiver", writeToReceiverLatency);
+    logLatencyStats("captureToReceiver", captureToReceiverLatency);
+  }
+
+CleanUp:
+
+  if (STATUS_FAILED(retStatus)) {
+    DLOGE("ステータスコード「0x%08x」で終了しました。", retStatus);
+  }
+
+  // ストリーミングセッションを解放
+  pReceiverSession = nullptr;
+  freeKvsWebrtcStreamingSession(pStreamingSession);
+
+  // シグナリングクライアントを解放
+  deinitSignaling(pKvsWebrtcConfig.get());
+
+  // KVS WebRTCを終了
+  deinitKvsWebRtc();
+
+  // KVS WebRTCの設定を解放
+  freeKvsWebrtcConfig(pKvsWebrtcConfig);
+
+  // 共有リソースを解放
+  freeKvsWebrtcHost(pKvsWebrtcHost);
+
+  // レイテンシ統計を解放
+  freeLatencyStats(captureToAppsinkLatency);
+  freeLatencyStats(appsinkToWriteLatency);
+  freeLatencyStats(writeToReceiverLatency);
+  freeLatencyStats(captureToReceiverLatency);
+
+  RESET_INSTRUMENTED_ALLOCATORS();
+
+  if (STATUS_FAILED(retStatus)) {
+    return EXIT_FAILURE;
+  } else {
+    return EXIT_SUCCESS;
+  }
+}
@@ -0,0 +1,137 @@
+#include "common.hpp"
+#include <random>
+
+// 計測するブロック数のデフォルト値 (10ミリ秒×100000ブロック = 1000秒分の音声)
+#define MIX_BENCH_DEFAULT_BLOCKS 100000
+
+namespace {
+  /**
+   * @brief ベンチマーク用の話者を追加する
+   */
+  VOID addBenchSources(Talkback& talkback, UINT32 count, std::mt19937& random)
+  {
+    std::uniform_int_distribution<INT32> distribution(-12000, 12000);
+
+    for (UINT32 i = 0; i < count; i++) {
+      auto pSource = std::make_unique<TalkbackSource>();
+
+      // 半分の話者はゲインを80%にする (ゲインの乗算も計測する)
+      pSource->pDecoder = nullptr;
+      pSource->gain = i % 2 == 0 ? TALKBACK_GAIN_UNITY : TALKBACK_GAIN_UNITY * 80 / 100;
+
+      // リングバッファ全体にサンプルを書き込み済みにする
+      pSource->samples.resize(TALKBACK_SOURCE_RING_FRAMES * TALKBACK_CHANNELS);
+      for (auto& sample : pSource->samples) {
+        sample = static_cast<INT16>(distribution(random));
+      }
+      pSource->writePosition = MAX_UINT64;
+
+      talkback.sources["bench-" + std::to_string(i)] = std::move(pSource);
+    }
+  }
+
+  /**
+   * @brief 全話者をスカラーでミキシングする (比較用)
+   */
+  VOID mixBenchBlockScalar(Talkback& talkback, UINT64 position, PINT16 pOutput)
+  {
+    UINT64 index, count, first;
+
+    MEMSET(pOutput, 0x00, TALKBACK_MIX_FRAMES * TALKBACK_CHANNELS * SIZEOF(INT16));
+
+    for (auto&& value : talkback.sources) {
+      auto& source = *value.second;
+      if (source.writePosition <= position || source.gain == 0) {
+        continue;
+      }
+      index = position & (TALKBACK_SOURCE_RING_FRAMES - 1);
+      count = MIN(source.writePosition - position, static_cast<UINT64>(TALKBACK_MIX_FRAMES));
+      first = MIN(count, TALKBACK_SOURCE_RING_FRAMES - index);
+      mixTalkbackSamplesScalar(pOutput, &source.samples[index * TALKBACK_CHANNELS], static_cast<UINT32>(first * TALKBACK_CHANNELS), source.gain);
+      if (count > first) {
+        mixTalkbackSamplesScalar(pOutput + first * TALKBACK_CHANNELS, source.samples.data(), static_cast<UINT32>((count - first) * TALKBACK_CHANNELS), source.gain);
+      }
+    }
+  }
+
+  /**
+   * @brief ミキシングにかかる時間を計測する (1ブロックあたりのマイクロ秒)
+   */
+  DOUBLE measureMix(Talkback& talkback, UINT32 blocks, BOOL scalar, std::vector<INT16>& output)
+  {
+    UINT64 position = 0;
+    UINT64 startTime = GETTIME();
+
+    for (UINT32 i = 0; i < blocks; i++) {
+      if (scalar) {
+        mixBenchBlockScalar(talkback, position, output.data());
+      } else {
+        mixTalkbackBlock(talkback, position, output.data());
+      }
+      position += TALKBACK_MIX_FRAMES;
+    }
+
+    return static_cast<DOUBLE>(GETTIME() - startTime) / 10.0 / blocks;
+  }
+}
+
+INT32 main(INT32 argc, CHAR* argv[])
+{
+  auto retStatus = STATUS_SUCCESS;
+  std::mt19937 random(1);
+  std::vector<INT16> simdOutput(TALKBACK_MIX_FRAMES * TALKBACK_CHANNELS);
+  std::vector<INT16> scalarOutput(TALKBACK_MIX_FRAMES * TALKBACK_CHANNELS);
+  UINT32 blocks = MIX_BENCH_DEFAULT_BLOCKS;
+  DOUBLE simdTime, scalarTime, halfSilentTime;
+  UINT32 silentSources;
+
+  // ログレベル
+  setLogLevel();
+
+  // ブロック数
+  if (argc > 1) {
+    CHK_ERR(STATUS_SUCCEEDED(STRTOUI32(argv[1], NULL, 10, &blocks)) && blocks > 0, STATUS_INVALID_ARG, "ブロック数が不正です。");
+  }
+
+  // 話者数ごとに計測
+  for (UINT32 talkers : {1U, 2U, 4U, 8U, 12U, 16U}) {
+    Talkback talkback{};
+    addBenchSources(talkback, talkers, random);
+
+    // SIMDとスカラーの結果が一致するか確認
+    mixTalkbackBlock(talkback, 0, simdOutput.data());
+    mixBenchBlockScalar(talkback, 0, scalarOutput.data());
+    CHK_ERR(simdOutput == scalarOutput, STATUS_INTERNAL_ERROR, "SIMDとスカラーのミキシング結果が一致しません。");
+
+    // SIMDとスカラー
+    simdTime = measureMix(talkback, blocks, FALSE, simdOutput);
+    scalarTime = measureMix(talkback, blocks, TRUE, scalarOutput);
+
+    // 半分の話者が無音の場合 (書き込みのない話者は読み出さない)
+    silentSources = 0;
+    for (auto&& value : talkback.sources) {
+      if (silentSources++ < talkers / 2) {
+        value.second->writePosition = 0;
+      }
+    }
+    halfSilentTime = measureMix(talkback, blocks, FALSE, simdOutput);
+
+    // ログを出力 (CPU使用率は10ミリ秒のブロックに対する割合)
+    DLOGP("talkers: %2u, simd: %.3f us/block, scalar: %.3f us/block, speedup: %.2fx, half silent: %.3f us/block, cpu: %.3f%%",
+          talkers,
+          simdTime,
+          scalarTime,
+          simdTime > 0 ? scalarTime / simdTime : 0.0,
+          halfSilentTime,
+          simdTime / 100.0);
+  }
+
+CleanUp:
+
+  if (STATUS_FAILED(retStatus)) {
+    DLOGE("ステータスコード「0x%08x」で終了しました。", retStatus);
+    return EXIT_FAILURE;
+  } else {
+    return EXIT_SUCCESS;
+  }
+}